@@ -1,5 +1,6 @@
 ﻿#include <string>
 #include "aes_gcm.h"
+#include "aes_gcm_ni.h"
 #include <random>
 
 #define KEY_SIZE		AES_KEY_SIZE
@@ -189,7 +190,6 @@ namespace Crypto
 	/** function-pointer types, indicating functions that take fixed-size blocks: */
 	typedef void (*fdouble_t)(block_t);
 	typedef void (*fmix_t)(const block_t, block_t);
-	typedef void (*fmix_t2)(const block_t, block_t, uint8_t*);
 
 #define LAST                (BLOCK_SIZE - 1)      /*  last index in a block    */
 
@@ -259,17 +259,6 @@ namespace Crypto
 		memcpy(y, result, sizeof result);            /*  result is saved into y   */
 	}
 
-	static void mixThenXor(fmix_t2 mix, const block_t B, block_t f, uint8_t* w,
-		const uint8_t* X, uint8_t n, uint8_t* Y)
-	{
-		if (n == 0)  return;
-		mix(B, f, w);                                 /*  Y = f(B) ^ X             */
-		while (n--)
-		{
-			Y[n] = f[n] ^ X[n];
-		}
-	}
-
 	/** xor the result with input data and then apply the digest/mixing function.
 	 * repeat the process for each block of data until all blocks are digested... */
 	static void xMac(const void* data, const size_t dataSize,
@@ -293,43 +282,191 @@ namespace Crypto
 		}
 	}
 
-	static void CTR_Cipher(const block_t iCtr, const char big,
-		const void* input, const size_t dataSize, void* output, uint8_t* RoundKey)
+	/** calculate the GMAC of ciphertext and AAD using an authentication subkey H */
+	static void GHash(const block_t H, const void* aData, const void* crtxt,
+		const size_t aDataLen, const size_t crtxtLen, block_t gsh)
+	{
+		block_t len = { 0 };
+		xorBEint(len, aDataLen * 8, LAST / 2);
+		xorBEint(len, crtxtLen * 8, LAST);         /*  save bit-sizes into len  */
+
+		xMac(aData, aDataLen, H, &mulGF128, gsh);  /*  first digest AAD, then   */
+		xMac(crtxt, crtxtLen, H, &mulGF128, gsh);  /*  ..ciphertext, and then   */
+		xMac(len, sizeof len, H, &mulGF128, gsh);  /*  ..bit sizes into GHash   */
+	}
+
+	/** The byte-oriented cipher above costs a full state walk per byte of S-box,
+	 * ShiftRows and MixColumns. For bulk data the portable backend merges the three
+	 * into one 32-bit T-table (Te[x] = {2,1,1,3}*S[x], rotated for each row), so a
+	 * round is 16 lookups and xors. The table is built once from the S-box above.
+	 * Lookups are data dependent: this is the fast fallback, the AES-NI backend is
+	 * the one to rely on against cache-timing attackers sharing the core.
+	 */
+	static inline uint32_t rotr32(uint32_t x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	static inline uint32_t loadBE32(const uint8_t* p)
+	{
+		return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+	}
+
+	static inline void storeBE32(uint8_t* p, uint32_t x)
+	{
+		p[0] = (uint8_t)(x >> 24);  p[1] = (uint8_t)(x >> 16);
+		p[2] = (uint8_t)(x >> 8);   p[3] = (uint8_t)x;
+	}
+
+	static inline uint64_t loadBE64(const uint8_t* p)
+	{
+		return (uint64_t)loadBE32(p) << 32 | loadBE32(p + 4);
+	}
+
+	static inline void storeBE64(uint8_t* p, uint64_t x)
 	{
-		block_t c, enc;
-		count_t n = dataSize / BLOCK_SIZE;
-		uint8_t* y = reinterpret_cast<uint8_t*>(output);;
+		storeBE32(p, (uint32_t)(x >> 32));
+		storeBE32(p + 4, (uint32_t)x);
+	}
+
+	struct TTable
+	{
+		uint32_t te[4][256];
+		uint8_t s[256];
 
-		memcpy(output, input, dataSize);           /* do in-place en/decryption */
-		memcpy(c, iCtr, sizeof c);
-		if (big > 1)
+		TTable()
 		{
-			incBlock(c, big);                      /*  pre-increment in CCM/GCM */
+			for (int x = 0; x < 256; ++x)
+			{
+				uint8_t v = (uint8_t)SBoxValue(x), v2 = xtime(v), v3 = v2 ^ v;
+				s[x] = v;
+				te[0][x] = (uint32_t)v2 << 24 | (uint32_t)v << 16 | (uint32_t)v << 8 | v3;
+				te[1][x] = rotr32(te[0][x], 8);
+				te[2][x] = rotr32(te[0][x], 16);
+				te[3][x] = rotr32(te[0][x], 24);
+			}
 		}
-		else if (!big)
+	};
+
+	static const TTable& GetTTable()
+	{
+		static const TTable table;                   /*  thread-safe since C++11  */
+		return table;
+	}
+
+	/** Same result as rijndaelEncrypt, one round per 16 table lookups */
+	static void tableEncrypt(const block_t input, block_t output, const uint8_t* RoundKey)
+	{
+		const TTable& T = GetTTable();
+		uint32_t s0 = loadBE32(input) ^ loadBE32(RoundKey);
+		uint32_t s1 = loadBE32(input + 4) ^ loadBE32(RoundKey + 4);
+		uint32_t s2 = loadBE32(input + 8) ^ loadBE32(RoundKey + 8);
+		uint32_t s3 = loadBE32(input + 12) ^ loadBE32(RoundKey + 12);
+		uint32_t t0, t1, t2, t3;
+
+		for (int r = 1; r < ROUNDS; ++r)
 		{
-			c[LAST] |= 0x80;                       /*  set one bit in GCM-SIV   */
+			const uint8_t* rk = RoundKey + BLOCK_SIZE * r;
+			t0 = T.te[0][s0 >> 24] ^ T.te[1][(s1 >> 16) & 0xff] ^ T.te[2][(s2 >> 8) & 0xff] ^ T.te[3][s3 & 0xff] ^ loadBE32(rk);
+			t1 = T.te[0][s1 >> 24] ^ T.te[1][(s2 >> 16) & 0xff] ^ T.te[2][(s3 >> 8) & 0xff] ^ T.te[3][s0 & 0xff] ^ loadBE32(rk + 4);
+			t2 = T.te[0][s2 >> 24] ^ T.te[1][(s3 >> 16) & 0xff] ^ T.te[2][(s0 >> 8) & 0xff] ^ T.te[3][s1 & 0xff] ^ loadBE32(rk + 8);
+			t3 = T.te[0][s3 >> 24] ^ T.te[1][(s0 >> 16) & 0xff] ^ T.te[2][(s1 >> 8) & 0xff] ^ T.te[3][s2 & 0xff] ^ loadBE32(rk + 12);
+			s0 = t0;  s1 = t1;  s2 = t2;  s3 = t3;
 		}
-		for (; n--; y += BLOCK_SIZE)
+
+		const uint8_t* rk = RoundKey + BLOCK_SIZE * ROUNDS; /* no MixColumns     */
+		t0 = (uint32_t)T.s[s0 >> 24] << 24 | (uint32_t)T.s[(s1 >> 16) & 0xff] << 16 | (uint32_t)T.s[(s2 >> 8) & 0xff] << 8 | T.s[s3 & 0xff];
+		t1 = (uint32_t)T.s[s1 >> 24] << 24 | (uint32_t)T.s[(s2 >> 16) & 0xff] << 16 | (uint32_t)T.s[(s3 >> 8) & 0xff] << 8 | T.s[s0 & 0xff];
+		t2 = (uint32_t)T.s[s2 >> 24] << 24 | (uint32_t)T.s[(s3 >> 16) & 0xff] << 16 | (uint32_t)T.s[(s0 >> 8) & 0xff] << 8 | T.s[s1 & 0xff];
+		t3 = (uint32_t)T.s[s3 >> 24] << 24 | (uint32_t)T.s[(s0 >> 16) & 0xff] << 16 | (uint32_t)T.s[(s1 >> 8) & 0xff] << 8 | T.s[s2 & 0xff];
+		storeBE32(output, t0 ^ loadBE32(rk));
+		storeBE32(output + 4, t1 ^ loadBE32(rk + 4));
+		storeBE32(output + 8, t2 ^ loadBE32(rk + 8));
+		storeBE32(output + 12, t3 ^ loadBE32(rk + 12));
+	}
+
+	/** Portable CTR over whole blocks, same counter contract as AESNI_CTR */
+	static void tableCTR(const uint8_t* RoundKey, block_t counter, const uint8_t* input, size_t blocks, uint8_t* output)
+	{
+		block_t stream;
+		for (; blocks--; input += BLOCK_SIZE, output += BLOCK_SIZE)
 		{
-			rijndaelEncrypt(c, enc, RoundKey);     /*  both in en[de]cryption:  */
-			xorBlock(enc, y);                      /*  Y = Enc(Ctr) ^ X         */
-			incBlock(c, big);                      /*  Ctr_next = Ctr + 1       */
+			incBlock(counter, 1);
+			tableEncrypt(counter, stream, RoundKey);
+			for (uint8_t i = 0; i < BLOCK_SIZE; ++i)
+			{
+				output[i] = input[i] ^ stream[i];
+			}
 		}
-		mixThenXor(&rijndaelEncrypt, c, c, RoundKey, y, dataSize % BLOCK_SIZE, y);
+		memset(stream, 0, sizeof stream);
 	}
 
-	/** calculate the GMAC of ciphertext and AAD using an authentication subkey H */
-	static void GHash(const block_t H, const void* aData, const void* crtxt,
-		const size_t aDataLen, const size_t crtxtLen, block_t gsh)
+	/** GHASH needs no table at all to be fast: a 64x64 carry-less product can be
+	 * emulated with four integer multiplies by spreading the operands over every
+	 * fourth bit, so the carries of the integer multiply land in the holes and are
+	 * masked away. This runs in constant time, unlike Shoup's 4-bit tables whose
+	 * lookups are indexed by the secret-dependent state.
+	 */
+	static inline uint64_t bmul64(uint64_t x, uint64_t y)
 	{
-		block_t len = { 0 };
-		xorBEint(len, aDataLen * 8, LAST / 2);
-		xorBEint(len, crtxtLen * 8, LAST);         /*  save bit-sizes into len  */
+		const uint64_t m0 = 0x1111111111111111, m1 = m0 << 1, m2 = m0 << 2, m3 = m0 << 3;
+		uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+		uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+		uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+		uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+		uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+		uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+		return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+	}
 
-		xMac(aData, aDataLen, H, &mulGF128, gsh);  /*  first digest AAD, then   */
-		xMac(crtxt, crtxtLen, H, &mulGF128, gsh);  /*  ..ciphertext, and then   */
-		xMac(len, sizeof len, H, &mulGF128, gsh);  /*  ..bit sizes into GHash   */
+	static inline uint64_t rev64(uint64_t x)
+	{
+		x = ((x & 0x5555555555555555) << 1) | ((x >> 1) & 0x5555555555555555);
+		x = ((x & 0x3333333333333333) << 2) | ((x >> 2) & 0x3333333333333333);
+		x = ((x & 0x0F0F0F0F0F0F0F0F) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0F);
+		x = ((x & 0x00FF00FF00FF00FF) << 8) | ((x >> 8) & 0x00FF00FF00FF00FF);
+		x = ((x & 0x0000FFFF0000FFFF) << 16) | ((x >> 16) & 0x0000FFFF0000FFFF);
+		return (x << 32) | (x >> 32);
+	}
+
+	/** Digest whole blocks into the running GHASH, y = (y ^ block) * H per block */
+	static void tableGHash(const block_t H, block_t ghash, const uint8_t* data, size_t blocks)
+	{
+		uint64_t y1 = loadBE64(ghash), y0 = loadBE64(ghash + 8);
+		uint64_t h1 = loadBE64(H), h0 = loadBE64(H + 8);
+		uint64_t h0r = rev64(h0), h1r = rev64(h1), h2 = h0 ^ h1, h2r = h0r ^ h1r;
+
+		for (; blocks--; data += BLOCK_SIZE)
+		{
+			y1 ^= loadBE64(data);
+			y0 ^= loadBE64(data + 8);
+			uint64_t y0r = rev64(y0), y1r = rev64(y1), y2 = y0 ^ y1, y2r = y0r ^ y1r;
+
+			/* Karatsuba: three products for the low halves of the result and
+			 * three on bit-reversed operands for the high halves */
+			uint64_t z0 = bmul64(y0, h0), z1 = bmul64(y1, h1), z2 = bmul64(y2, h2);
+			uint64_t z0h = bmul64(y0r, h0r), z1h = bmul64(y1r, h1r), z2h = bmul64(y2r, h2r);
+			z2 ^= z0 ^ z1;
+			z2h ^= z0h ^ z1h;
+			z0h = rev64(z0h) >> 1;
+			z1h = rev64(z1h) >> 1;
+			z2h = rev64(z2h) >> 1;
+
+			uint64_t v0 = z0, v1 = z0h ^ z2, v2 = z1 ^ z2h, v3 = z1h;
+			v3 = (v3 << 1) | (v2 >> 63);             /*  GCM bit order: the 255-  */
+			v2 = (v2 << 1) | (v1 >> 63);             /*  ..bit product is shifted */
+			v1 = (v1 << 1) | (v0 >> 63);             /*  ..into 256 bits          */
+			v0 = (v0 << 1);
+
+			v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);   /* reduce modulo     */
+			v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);     /* x^128+x^7+x^2+x+1 */
+			v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+			v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+			y0 = v2;
+			y1 = v3;
+		}
+		storeBE64(ghash, y1);
+		storeBE64(ghash + 8, y0);
 	}
 
 	/** encrypt zeros to get authentication subkey H, and prepare the IV for GCM. */
@@ -349,20 +486,148 @@ namespace Crypto
 #endif
 	}
 
+	/** ghash = ghash * H, the block was already xored in */
+	static void GHashMultiply(GCM_CTX* ctx)
+	{
+		static const block_t zero = { 0 };
+		tableGHash(ctx->hash_key, ctx->ghash, zero, 1);
+	}
+
+	/** digest bytes into the running GHASH, a partial block waits for more data */
+	static void GHashBytes(GCM_CTX* ctx, const uint8_t* data, size_t length)
+	{
+		while (length--)
+		{
+			ctx->ghash[ctx->ghash_fill++] ^= *data++;
+			if (ctx->ghash_fill == BLOCK_SIZE)
+			{
+				GHashMultiply(ctx);
+				ctx->ghash_fill = 0;
+			}
+		}
+	}
+
+	static void GHashUpdate(GCM_CTX* ctx, const uint8_t* data, size_t length)
+	{
+		if (length >= BLOCK_SIZE)
+		{
+			size_t head = (BLOCK_SIZE - ctx->ghash_fill) % BLOCK_SIZE;   /* finish a pending block */
+			GHashBytes(ctx, data, head);
+			size_t blocks = (length - head) / BLOCK_SIZE;
+			if (ctx->accelerated)
+			{
+				PCLMUL_GHash(ctx->hash_powers, ctx->ghash, data + head, blocks);
+			}
+			else
+			{
+				tableGHash(ctx->hash_key, ctx->ghash, data + head, blocks);
+			}
+			data += head + blocks * BLOCK_SIZE;
+			length -= head + blocks * BLOCK_SIZE;
+		}
+		GHashBytes(ctx, data, length);
+	}
+
+	/** AAD and ciphertext are each zero-padded to a whole block */
+	static void GHashPad(GCM_CTX* ctx)
+	{
+		if (ctx->ghash_fill)
+		{
+			GHashMultiply(ctx);
+			ctx->ghash_fill = 0;
+		}
+	}
+
+	static void CryptBytes(GCM_CTX* ctx, const uint8_t* input, size_t length, uint8_t* output)
+	{
+		for (size_t i = 0; i < length; i++)
+		{
+			if (ctx->stream_used == BLOCK_SIZE)
+			{
+				incBlock(ctx->counter, 1);
+				tableEncrypt(ctx->counter, ctx->key_stream, ctx->round_key);
+				ctx->stream_used = 0;
+			}
+			output[i] = input[i] ^ ctx->key_stream[ctx->stream_used++];
+		}
+	}
+
+	static void GCM_Crypt(GCM_CTX* ctx, const uint8_t* input, size_t length, uint8_t* output)
+	{
+		ctx->text_len += length;
+		if (length >= BLOCK_SIZE)
+		{
+			size_t head = BLOCK_SIZE - ctx->stream_used;             /* rest of the key stream */
+			CryptBytes(ctx, input, head, output);
+			size_t blocks = (length - head) / BLOCK_SIZE;
+			if (ctx->accelerated)
+			{
+				AESNI_CTR(ctx->round_key, ROUNDS, ctx->counter, input + head, blocks, output + head);
+			}
+			else
+			{
+				tableCTR(ctx->round_key, ctx->counter, input + head, blocks, output + head);
+			}
+			input += head + blocks * BLOCK_SIZE;
+			output += head + blocks * BLOCK_SIZE;
+			length -= head + blocks * BLOCK_SIZE;
+		}
+		CryptBytes(ctx, input, length, output);
+	}
+
+	void GCM_Start(GCM_CTX* ctx, const uint8_t* key, const uint8_t* nonce, const uint8_t* aData, const size_t aDataLen)
+	{
+		memset(ctx, 0, sizeof(GCM_CTX));
+		GCM_Init(key, nonce, ctx->hash_key, ctx->first_counter, ctx->round_key);
+		memcpy(ctx->counter, ctx->first_counter, BLOCK_SIZE);
+		ctx->stream_used = BLOCK_SIZE;               /*  first use increments J0  */
+		ctx->accelerated = AESNI_Supported();
+		if (ctx->accelerated)
+		{
+			PCLMUL_Init(ctx->hash_key, ctx->hash_powers);
+		}
+		if (aData && aDataLen)
+		{
+			GHashUpdate(ctx, aData, aDataLen);
+			GHashPad(ctx);
+		}
+		ctx->aad_len = aDataLen;
+	}
+
+	void GCM_EncryptUpdate(GCM_CTX* ctx, const uint8_t* input, const size_t length, uint8_t* output)
+	{
+		GCM_Crypt(ctx, input, length, output);
+		GHashUpdate(ctx, output, length);            /*  digest the ciphertext    */
+	}
+
+	void GCM_DecryptUpdate(GCM_CTX* ctx, const uint8_t* input, const size_t length, uint8_t* output)
+	{
+		GHashUpdate(ctx, input, length);             /*  digest before in-place   */
+		GCM_Crypt(ctx, input, length, output);
+	}
+
+	void GCM_Finish(GCM_CTX* ctx, uint8_t tag[TAG_SIZE])
+	{
+		block_t len = { 0 };
+		xorBEint(len, (size_t)ctx->aad_len * 8, LAST / 2);
+		xorBEint(len, (size_t)ctx->text_len * 8, LAST);
+		GHashPad(ctx);
+		GHashUpdate(ctx, len, sizeof len);
+
+		tableEncrypt(ctx->first_counter, tag, ctx->round_key);
+		xorBlock(ctx->ghash, tag);                   /*  tag = Enc(J0) ^ GHASH    */
+		memset(ctx, 0, sizeof(GCM_CTX));
+	}
+
 	void AES_GCM_encrypt(const uint8_t* key, const uint8_t* nonce,
 		const uint8_t* pntxt, const size_t ptextLen,
 		const uint8_t* aData, const size_t aDataLen,
 		uint8_t* crtxt, uint8_t auTag[16])
 	{
-		block_t H = { 0 }, iv = { 0 }, gsh = { 0 };
-		uint8_t RoundKey[BLOCK_SIZE * ROUNDS + KEY_SIZE];
-		GCM_Init(key, nonce, H, iv, RoundKey);               /*  get IV & auth. subkey H  */
-
-		CTR_Cipher(iv, 2, pntxt, ptextLen, crtxt, RoundKey);
-		rijndaelEncrypt(iv, auTag, RoundKey);                /*  tag = Enc(iv) ^ GHASH    */
-		BURN(RoundKey);
-		GHash(H, aData, crtxt, aDataLen, ptextLen, gsh);
-		xorBlock(gsh, auTag);
+		GCM_CTX ctx;
+		GCM_Start(&ctx, key, nonce, aData, aDataLen);
+		GCM_EncryptUpdate(&ctx, pntxt, ptextLen, crtxt);
+		GCM_Finish(&ctx, auTag);
 	}
 
 	char AES_GCM_decrypt(const uint8_t* key, const uint8_t* nonce,
@@ -370,20 +635,16 @@ namespace Crypto
 		const uint8_t* aData, const size_t aDataLen,
 		const uint8_t* auTag, uint8_t* pntxt)
 	{
-		block_t H = { 0 }, iv = { 0 }, gsh = { 0 };
-		uint8_t RoundKey[BLOCK_SIZE * ROUNDS + KEY_SIZE];
-		GCM_Init(key, nonce, H, iv, RoundKey);
-		GHash(H, aData, crtxt, aDataLen, crtxtLen, gsh);
-
-		rijndaelEncrypt(iv, H, RoundKey);
-		xorBlock(H, gsh);                          /*  tag = Enc(iv) ^ GHASH    */
-		if (MISMATCH(gsh, auTag, 16))
-		{                                          /*  compare tags and         */
-			BURN(RoundKey);                        /*  ..proceed if they match  */
+		GCM_CTX ctx;
+		block_t tag;
+		GCM_Start(&ctx, key, nonce, aData, aDataLen);
+		GCM_DecryptUpdate(&ctx, crtxt, crtxtLen, pntxt);
+		GCM_Finish(&ctx, tag);
+		if (MISMATCH(tag, auTag, 16))
+		{                                          /*  compare tags and wipe    */
+			memset(pntxt, 0, crtxtLen);            /*  ..the output on failure  */
 			return AUTHENTICATION_FAILURE;
 		}
-		CTR_Cipher(iv, 2, crtxt, crtxtLen, pntxt, RoundKey);
-		BURN(RoundKey);
 		return NO_ERROR_RETURNED;
 	}
 
@@ -14,6 +14,9 @@
 #define AES_KEY_SIZE   16
 #endif
 
+#define GCM_BLOCK_SIZE      16
+#define GCM_ROUND_KEY_SIZE  (GCM_BLOCK_SIZE * ((AES_KEY_SIZE / 4) + 6) + AES_KEY_SIZE)
+
 namespace Crypto {
 
 	const uint8_t VERSION_1[] = { 'v', '1', '0' };
@@ -35,6 +38,52 @@ namespace Crypto {
 	/// <returns>Size of the data decrypted</returns>
 	size_t getCipherTextSize(const size_t pnTextLen);
 
+	/// <summary>
+	/// State of one GCM message processed in pieces, see GCM_Start / GCM_Update / GCM_Finish.
+	/// </summary>
+	typedef struct
+	{
+		uint8_t round_key[GCM_ROUND_KEY_SIZE];
+		uint8_t hash_key[GCM_BLOCK_SIZE];		/* H = Enc(0)                     */
+		uint8_t first_counter[GCM_BLOCK_SIZE];	/* J0, encrypted for the tag      */
+		uint8_t counter[GCM_BLOCK_SIZE];
+		uint8_t key_stream[GCM_BLOCK_SIZE];
+		uint8_t ghash[GCM_BLOCK_SIZE];
+		uint64_t aad_len;
+		uint64_t text_len;
+		size_t stream_used;						/* bytes of key_stream consumed   */
+		size_t ghash_fill;						/* bytes xored into partial block */
+		uint8_t hash_powers[4 * GCM_BLOCK_SIZE];	/* H^1..H^4 for the PCLMULQDQ path */
+		int accelerated;						/* AES-NI + PCLMULQDQ backend in use */
+	} GCM_CTX;
+
+	/// <summary>
+	/// This function is used to start a GCM message: expand the key, derive H and J0 and digest the AAD.
+	/// </summary>
+	/// <param name="1. [OUT] ctx">: Context of the message.</param>
+	/// <param name="2. [IN]  key">: AES key of AES_KEY_SIZE bytes.</param>
+	/// <param name="3. [IN]  nonce">: Nonce of GCM_NONCE_LEN bytes, never reused with the same key.</param>
+	/// <param name="4. [IN]  aData">: Additional authenticated data, may be NULL.</param>
+	/// <param name="5. [IN]  aDataLen">: Size of the additional authenticated data.</param>
+	void GCM_Start(GCM_CTX* ctx, const uint8_t* key, const uint8_t* nonce, const uint8_t* aData, const size_t aDataLen);
+
+	/// <summary>
+	/// This function is used to encrypt (or decrypt) the next piece of a message, pieces may have any size.
+	/// </summary>
+	/// <param name="1. [IN]  ctx">: Context started by GCM_Start.</param>
+	/// <param name="2. [IN]  input">: Plaintext when encrypting, ciphertext when decrypting.</param>
+	/// <param name="3. [IN]  length">: Size of the piece.</param>
+	/// <param name="4. [OUT] output">: Result of the same size, may be the input buffer.</param>
+	void GCM_EncryptUpdate(GCM_CTX* ctx, const uint8_t* input, const size_t length, uint8_t* output);
+	void GCM_DecryptUpdate(GCM_CTX* ctx, const uint8_t* input, const size_t length, uint8_t* output);
+
+	/// <summary>
+	/// This function is used to finish a message and compute its authentication tag, the context is wiped.
+	/// </summary>
+	/// <param name="1. [IN]  ctx">: Context started by GCM_Start.</param>
+	/// <param name="2. [OUT] tag">: Authentication tag of TAG_SIZE bytes.</param>
+	void GCM_Finish(GCM_CTX* ctx, uint8_t tag[TAG_SIZE]);
+
 	/// <summary>
 	/// This function is used to encrypt data using the AES-GCM algorithm.
 	/// </summary>
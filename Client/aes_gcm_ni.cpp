@@ -0,0 +1,191 @@
+#include "aes_gcm_ni.h"
+
+#if AES_GCM_NI_AVAILABLE
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AESNI
+#else
+#include <cpuid.h>
+#define TARGET_AESNI	__attribute__((target("aes,pclmul,ssse3")))
+#endif
+#endif
+
+namespace Crypto 
+{
+#if AES_GCM_NI_AVAILABLE
+	bool AESNI_Supported()
+	{
+		static const bool supported = []()
+		{
+			unsigned int ecx = 0;
+#ifdef _MSC_VER
+			int info[4] = { 0 };
+			__cpuid(info, 1);
+			ecx = (unsigned int)info[2];
+#else
+			unsigned int eax, ebx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			{
+				return false;
+			}
+#endif
+			const unsigned int PCLMULQDQ = 1u << 1, SSSE3 = 1u << 9, AESNI = 1u << 25;
+			return (ecx & (PCLMULQDQ | SSSE3 | AESNI)) == (PCLMULQDQ | SSSE3 | AESNI);
+		}();
+		return supported;
+	}
+
+	/** increment a big-endian 128-bit counter, same carry rule as the portable incBlock */
+	static inline void incCounter(uint8_t counter[16])
+	{
+		for (int i = 15; i >= 0 && !++counter[i]; --i);
+	}
+
+	TARGET_AESNI static inline __m128i encryptBlock(__m128i block, const __m128i* keys, int rounds)
+	{
+		block = _mm_xor_si128(block, keys[0]);
+		for (int r = 1; r < rounds; r++)
+		{
+			block = _mm_aesenc_si128(block, keys[r]);
+		}
+		return _mm_aesenclast_si128(block, keys[rounds]);
+	}
+
+	TARGET_AESNI void AESNI_CTR(const uint8_t* round_key, int rounds, uint8_t counter[16], const uint8_t* input, size_t blocks, uint8_t* output)
+	{
+		__m128i keys[15];
+		for (int r = 0; r <= rounds; r++)
+		{
+			keys[r] = _mm_loadu_si128((const __m128i*)(round_key + 16 * r));
+		}
+
+		/* four independent blocks keep the AES pipeline busy */
+		for (; blocks >= 4; blocks -= 4, input += 64, output += 64)
+		{
+			__m128i b0, b1, b2, b3;
+			incCounter(counter); b0 = _mm_loadu_si128((const __m128i*)counter);
+			incCounter(counter); b1 = _mm_loadu_si128((const __m128i*)counter);
+			incCounter(counter); b2 = _mm_loadu_si128((const __m128i*)counter);
+			incCounter(counter); b3 = _mm_loadu_si128((const __m128i*)counter);
+			b0 = _mm_xor_si128(b0, keys[0]);
+			b1 = _mm_xor_si128(b1, keys[0]);
+			b2 = _mm_xor_si128(b2, keys[0]);
+			b3 = _mm_xor_si128(b3, keys[0]);
+			for (int r = 1; r < rounds; r++)
+			{
+				b0 = _mm_aesenc_si128(b0, keys[r]);
+				b1 = _mm_aesenc_si128(b1, keys[r]);
+				b2 = _mm_aesenc_si128(b2, keys[r]);
+				b3 = _mm_aesenc_si128(b3, keys[r]);
+			}
+			b0 = _mm_aesenclast_si128(b0, keys[rounds]);
+			b1 = _mm_aesenclast_si128(b1, keys[rounds]);
+			b2 = _mm_aesenclast_si128(b2, keys[rounds]);
+			b3 = _mm_aesenclast_si128(b3, keys[rounds]);
+			_mm_storeu_si128((__m128i*)(output +  0), _mm_xor_si128(b0, _mm_loadu_si128((const __m128i*)(input +  0))));
+			_mm_storeu_si128((__m128i*)(output + 16), _mm_xor_si128(b1, _mm_loadu_si128((const __m128i*)(input + 16))));
+			_mm_storeu_si128((__m128i*)(output + 32), _mm_xor_si128(b2, _mm_loadu_si128((const __m128i*)(input + 32))));
+			_mm_storeu_si128((__m128i*)(output + 48), _mm_xor_si128(b3, _mm_loadu_si128((const __m128i*)(input + 48))));
+		}
+		for (; blocks--; input += 16, output += 16)
+		{
+			incCounter(counter);
+			__m128i b = encryptBlock(_mm_loadu_si128((const __m128i*)counter), keys, rounds);
+			_mm_storeu_si128((__m128i*)output, _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)input)));
+		}
+	}
+
+	/** 256-bit carry-less product of two reflected blocks, Karatsuba is not worth it for 4 multiplies */
+	TARGET_AESNI static inline void clmulWide(__m128i a, __m128i b, __m128i& lo, __m128i& hi)
+	{
+		__m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+		__m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+		__m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+		__m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+		t1 = _mm_xor_si128(t1, t2);
+		lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+		hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+	}
+
+	/** shift the product left by one (bit reflection) and reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	TARGET_AESNI static inline __m128i reduce(__m128i lo, __m128i hi)
+	{
+		__m128i t7 = _mm_srli_epi32(lo, 31);
+		__m128i t8 = _mm_srli_epi32(hi, 31);
+		lo = _mm_slli_epi32(lo, 1);
+		hi = _mm_slli_epi32(hi, 1);
+		__m128i t9 = _mm_srli_si128(t7, 12);
+		t8 = _mm_slli_si128(t8, 4);
+		t7 = _mm_slli_si128(t7, 4);
+		lo = _mm_or_si128(lo, t7);
+		hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+
+		t7 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+		t8 = _mm_srli_si128(t7, 4);
+		lo = _mm_xor_si128(lo, _mm_slli_si128(t7, 12));
+		__m128i t2 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+		lo = _mm_xor_si128(lo, _mm_xor_si128(t2, t8));
+		return _mm_xor_si128(hi, lo);
+	}
+
+	TARGET_AESNI static inline __m128i gfmul(__m128i a, __m128i b)
+	{
+		__m128i lo, hi;
+		clmulWide(a, b, lo, hi);
+		return reduce(lo, hi);
+	}
+
+	TARGET_AESNI void PCLMUL_Init(const uint8_t hash_key[16], uint8_t powers[GHASH_POWERS * 16])
+	{
+		const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		__m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)hash_key), reverse);
+		__m128i p = h;
+		for (int i = 0; i < GHASH_POWERS; i++)
+		{
+			_mm_storeu_si128((__m128i*)(powers + 16 * i), p);     /*  powers[i] = H^(i+1)      */
+			p = gfmul(p, h);
+		}
+	}
+
+	TARGET_AESNI void PCLMUL_GHash(const uint8_t* powers, uint8_t ghash[16], const uint8_t* data, size_t blocks)
+	{
+		const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m128i h1 = _mm_loadu_si128((const __m128i*)(powers + 0));
+		const __m128i h2 = _mm_loadu_si128((const __m128i*)(powers + 16));
+		const __m128i h3 = _mm_loadu_si128((const __m128i*)(powers + 32));
+		const __m128i h4 = _mm_loadu_si128((const __m128i*)(powers + 48));
+		__m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)ghash), reverse);
+
+		/* Y' = (Y ^ X1)*H^4 ^ X2*H^3 ^ X3*H^2 ^ X4*H, with a single reduction */
+		for (; blocks >= 4; blocks -= 4, data += 64)
+		{
+			__m128i x1 = _mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), reverse));
+			__m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), reverse);
+			__m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), reverse);
+			__m128i x4 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), reverse);
+			__m128i lo, hi, l, h;
+			clmulWide(x1, h4, lo, hi);
+			clmulWide(x2, h3, l, h); lo = _mm_xor_si128(lo, l); hi = _mm_xor_si128(hi, h);
+			clmulWide(x3, h2, l, h); lo = _mm_xor_si128(lo, l); hi = _mm_xor_si128(hi, h);
+			clmulWide(x4, h1, l, h); lo = _mm_xor_si128(lo, l); hi = _mm_xor_si128(hi, h);
+			y = reduce(lo, hi);
+		}
+		for (; blocks--; data += 16)
+		{
+			y = gfmul(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), reverse)), h1);
+		}
+		_mm_storeu_si128((__m128i*)ghash, _mm_shuffle_epi8(y, reverse));
+	}
+#else
+	bool AESNI_Supported()
+	{
+		return false;
+	}
+
+	void AESNI_CTR(const uint8_t*, int, uint8_t[16], const uint8_t*, size_t, uint8_t*) {}
+	void PCLMUL_Init(const uint8_t[16], uint8_t[GHASH_POWERS * 16]) {}
+	void PCLMUL_GHash(const uint8_t*, uint8_t[16], const uint8_t*, size_t) {}
+#endif
+}
\ No newline at end of file
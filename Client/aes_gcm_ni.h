@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_GCM_NI_AVAILABLE	1
+#else
+#define AES_GCM_NI_AVAILABLE	0
+#endif
+
+#define GHASH_POWERS		4		/* H^1..H^4, four blocks are digested per reduction */
+
+namespace Crypto 
+{
+	/// <summary>
+	/// This function is used to check once whether the CPU has AES-NI, PCLMULQDQ and SSSE3.
+	/// </summary>
+	/// <returns>True when the accelerated backend can be used</returns>
+	bool AESNI_Supported();
+
+	/// <summary>
+	/// This function is used to run AES-CTR over whole blocks with AES-NI.
+	/// </summary>
+	/// <param name="1. [IN]  round_key">: Expanded key, the standard FIPS-197 byte layout.</param>
+	/// <param name="2. [IN]  rounds">: Number of AES rounds (10, 12 or 14).</param>
+	/// <param name="3. [IN/OUT] counter">: Big-endian counter, incremented before each block, holds the last used value on return.</param>
+	/// <param name="4. [IN]  input">: Data to xor with the key stream.</param>
+	/// <param name="5. [IN]  blocks">: Number of 16-byte blocks.</param>
+	/// <param name="6. [OUT] output">: Result, may be the input buffer.</param>
+	void AESNI_CTR(const uint8_t* round_key, int rounds, uint8_t counter[16], const uint8_t* input, size_t blocks, uint8_t* output);
+
+	/// <summary>
+	/// This function is used to precompute the powers of the hash key for PCLMUL_GHash.
+	/// </summary>
+	/// <param name="1. [IN]  hash_key">: H = Enc(0).</param>
+	/// <param name="2. [OUT] powers">: GHASH_POWERS blocks in the byte-reflected form used by the multiplier.</param>
+	void PCLMUL_Init(const uint8_t hash_key[16], uint8_t powers[GHASH_POWERS * 16]);
+
+	/// <summary>
+	/// This function is used to digest whole blocks into a running GHASH with carry-less multiplication.
+	/// </summary>
+	/// <param name="1. [IN]  powers">: Table from PCLMUL_Init.</param>
+	/// <param name="2. [IN/OUT] ghash">: Running GHASH value, same byte order as the portable code.</param>
+	/// <param name="3. [IN]  data">: Data to digest.</param>
+	/// <param name="4. [IN]  blocks">: Number of 16-byte blocks.</param>
+	void PCLMUL_GHash(const uint8_t* powers, uint8_t ghash[16], const uint8_t* data, size_t blocks);
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <stdexcept>
 #include "base64.h"
+#include "base64_simd.h"
 
 namespace Crypto
 {
@@ -87,30 +88,32 @@ namespace Crypto
 		unsigned char trailing_char = url ? '.' : '=';
 		const char* base64_chars_ = base64_chars[url];
 
-		std::string ret;
-		ret.reserve(len_encoded);
+		// Sized once, the vector kernels take the bulk and the loop below the last few groups
+		std::string ret(len_encoded, '\0');
+		char* out = &ret[0];
+		size_t pos = Base64_EncodeSIMD(bytes_to_encode, in_len, out, url);
+		out += pos / 3 * 4;
 
-		unsigned int pos = 0;
 		while (pos < in_len) {
-			ret.push_back(base64_chars_[(bytes_to_encode[pos + 0] & 0xfc) >> 2]);
+			*out++ = base64_chars_[(bytes_to_encode[pos + 0] & 0xfc) >> 2];
 
 			if (pos + 1 < in_len) {
-				ret.push_back(base64_chars_[((bytes_to_encode[pos + 0] & 0x03) << 4) + ((bytes_to_encode[pos + 1] & 0xf0) >> 4)]);
+				*out++ = base64_chars_[((bytes_to_encode[pos + 0] & 0x03) << 4) + ((bytes_to_encode[pos + 1] & 0xf0) >> 4)];
 
 				if (pos + 2 < in_len) {
-					ret.push_back(base64_chars_[((bytes_to_encode[pos + 1] & 0x0f) << 2) + ((bytes_to_encode[pos + 2] & 0xc0) >> 6)]);
-					ret.push_back(base64_chars_[bytes_to_encode[pos + 2] & 0x3f]);
+					*out++ = base64_chars_[((bytes_to_encode[pos + 1] & 0x0f) << 2) + ((bytes_to_encode[pos + 2] & 0xc0) >> 6)];
+					*out++ = base64_chars_[bytes_to_encode[pos + 2] & 0x3f];
 				}
 				else {
-					ret.push_back(base64_chars_[(bytes_to_encode[pos + 1] & 0x0f) << 2]);
-					ret.push_back(trailing_char);
+					*out++ = base64_chars_[(bytes_to_encode[pos + 1] & 0x0f) << 2];
+					*out++ = trailing_char;
 				}
 			}
 			else {
 
-				ret.push_back(base64_chars_[(bytes_to_encode[pos + 0] & 0x03) << 4]);
-				ret.push_back(trailing_char);
-				ret.push_back(trailing_char);
+				*out++ = base64_chars_[(bytes_to_encode[pos + 0] & 0x03) << 4];
+				*out++ = trailing_char;
+				*out++ = trailing_char;
 			}
 			pos += 3;
 		}
@@ -139,17 +142,19 @@ namespace Crypto
 		}
 
 		size_t length_of_string = encoded_string.length();
-		size_t pos = 0;
 
 		//
-		// The approximate length (bytes) of the decoded string might be one or
-		// two bytes smaller, depending on the amount of trailing equal signs
-		// in the encoded string. This approximation is needed to reserve
-		// enough space in the string to be returned.
+		// The decoded string is sized for the worst case, an unpadded last
+		// chunk included, and trimmed at the end. It might be one or two
+		// bytes smaller, depending on the amount of trailing equal signs.
+		// The vector kernels decode everything up to the first chunk that
+		// holds padding or an unexpected character, the loop below the rest.
 		//
-		size_t approx_length_of_decoded_string = length_of_string / 4 * 3;
-		std::string ret;
-		ret.reserve(approx_length_of_decoded_string);
+		size_t max_length_of_decoded_string = (length_of_string + 3) / 4 * 3;
+		std::string ret(max_length_of_decoded_string, '\0');
+		unsigned char* out = reinterpret_cast<unsigned char*>(&ret[0]);
+		size_t pos = Base64_DecodeSIMD(encoded_string.data(), length_of_string, out, max_length_of_decoded_string);
+		out += pos / 4 * 3;
 
 		while (pos < length_of_string) {
 			//
@@ -170,7 +175,7 @@ namespace Crypto
 			//
 			// Emit the first output byte that is produced in each chunk:
 			//
-			ret.push_back(static_cast<std::string::value_type>(((pos_of_char(encoded_string.at(pos + 0))) << 2) + ((pos_of_char_1 & 0x30) >> 4)));
+			*out++ = static_cast<unsigned char>(((pos_of_char(encoded_string.at(pos + 0))) << 2) + ((pos_of_char_1 & 0x30) >> 4));
 
 			if ((pos + 2 < length_of_string) &&  // Check for data that is not padded with equal signs (which is allowed by RFC 2045)
 				encoded_string.at(pos + 2) != '=' &&
@@ -181,7 +186,7 @@ namespace Crypto
 				// Emit a chunk's second byte (which might not be produced in the last chunk).
 				//
 				unsigned int pos_of_char_2 = pos_of_char(encoded_string.at(pos + 2));
-				ret.push_back(static_cast<std::string::value_type>(((pos_of_char_1 & 0x0f) << 4) + ((pos_of_char_2 & 0x3c) >> 2)));
+				*out++ = static_cast<unsigned char>(((pos_of_char_1 & 0x0f) << 4) + ((pos_of_char_2 & 0x3c) >> 2));
 
 				if ((pos + 3 < length_of_string) &&
 					encoded_string.at(pos + 3) != '=' &&
@@ -191,11 +196,12 @@ namespace Crypto
 					//
 					// Emit a chunk's third byte (which might not be produced in the last chunk).
 					//
-					ret.push_back(static_cast<std::string::value_type>(((pos_of_char_2 & 0x03) << 6) + pos_of_char(encoded_string.at(pos + 3))));
+					*out++ = static_cast<unsigned char>(((pos_of_char_2 & 0x03) << 6) + pos_of_char(encoded_string.at(pos + 3)));
 				}
 			}
 			pos += 4;
 		}
+		ret.resize(out - reinterpret_cast<unsigned char*>(&ret[0]));
 		return ret;
 	}
 
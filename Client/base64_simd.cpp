@@ -0,0 +1,256 @@
+#include "base64_simd.h"
+
+#if BASE64_SIMD_AVAILABLE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_SSSE3	__attribute__((target("ssse3")))
+#define TARGET_AVX2		__attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Crypto
+{
+#if BASE64_SIMD_AVAILABLE
+	int Base64_SimdLevel()
+	{
+		static const int level = []()
+		{
+			unsigned int ecx1 = 0, ebx7 = 0;
+			unsigned long long xcr0 = 0;
+#ifdef _MSC_VER
+			int info[4] = { 0 };
+			__cpuid(info, 1);
+			ecx1 = (unsigned int)info[2];
+			__cpuidex(info, 7, 0);
+			ebx7 = (unsigned int)info[1];
+			if (ecx1 & (1u << 27))
+			{
+				xcr0 = _xgetbv(0);
+			}
+#else
+			unsigned int eax, ebx, edx, ecx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+			{
+				return BASE64_SIMD_NONE;
+			}
+			if (__get_cpuid_count(7, 0, &eax, &ebx7, &ecx, &edx) == 0)
+			{
+				ebx7 = 0;
+			}
+			if (ecx1 & (1u << 27))
+			{
+				unsigned int lo, hi;
+				__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+				xcr0 = ((unsigned long long)hi << 32) | lo;
+			}
+#endif
+			/* AVX2 also needs the OS to save the YMM registers (OSXSAVE, XCR0 bits 1 and 2) */
+			const unsigned int SSSE3 = 1u << 9, AVX2 = 1u << 5;
+			if ((ebx7 & AVX2) && (xcr0 & 6) == 6)
+			{
+				return BASE64_SIMD_AVX2;
+			}
+			return (ecx1 & SSSE3) ? BASE64_SIMD_SSSE3 : BASE64_SIMD_NONE;
+		}();
+		return level;
+	}
+
+	/** Encoding follows Mula and Lemire: a shuffle spreads each 3 bytes over 4 lanes, two multiplies
+	 * move the 6-bit fields into place, and a 16-entry shuffle table turns each index into the offset
+	 * to add for its character range (A-Z, a-z, 0-9, then the two alphabet specific characters). */
+	TARGET_SSSE3 static inline __m128i encodeIndices(__m128i in)
+	{
+		in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+		__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		return _mm_or_si128(t0, t1);
+	}
+
+	TARGET_SSSE3 static inline __m128i encodeChars(__m128i indices, __m128i shift_lut)
+	{
+		__m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+		reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+		return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, reduced), indices);
+	}
+
+	TARGET_AVX2 static inline __m256i encodeIndices(__m256i in)
+	{
+		in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+			1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+		__m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		return _mm256_or_si256(t0, t1);
+	}
+
+	TARGET_AVX2 static inline __m256i encodeChars(__m256i indices, __m256i shift_lut)
+	{
+		__m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		return _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, reduced), indices);
+	}
+
+	TARGET_SSSE3 static size_t encodeSSSE3(const uint8_t* input, size_t length, char* output, bool url)
+	{
+		const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, (char)((url ? '-' : '+') - 62), (char)((url ? '_' : '/') - 63), 'A', 0, 0);
+		size_t i = 0;
+		for (; length - i >= 16; i += 12, output += 16)
+		{
+			__m128i in = _mm_loadu_si128((const __m128i*)(input + i));
+			_mm_storeu_si128((__m128i*)output, encodeChars(encodeIndices(in), shift_lut));
+		}
+		return i;
+	}
+
+	TARGET_AVX2 static size_t encodeAVX2(const uint8_t* input, size_t length, char* output, bool url)
+	{
+		const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, (char)((url ? '-' : '+') - 62), (char)((url ? '_' : '/') - 63), 'A', 0, 0,
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, (char)((url ? '-' : '+') - 62), (char)((url ? '_' : '/') - 63), 'A', 0, 0);
+		size_t i = 0;
+		/* each 128-bit lane takes 12 of the 24 bytes, the second load ends at byte 28 */
+		for (; length - i >= 28; i += 24, output += 32)
+		{
+			__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(input + i))),
+				_mm_loadu_si128((const __m128i*)(input + i + 12)), 1);
+			_mm256_storeu_si256((__m256i*)output, encodeChars(encodeIndices(in), shift_lut));
+		}
+		return i + encodeSSSE3(input + i, length - i, output, url);
+	}
+
+	/** Decoding classifies each character by range with unsigned compares, so '+'/'-' and '/'/'_' are
+	 * both accepted like the scalar decoder does. One maddubs and one madd pack four 6-bit values into
+	 * 24 bits, a shuffle drops the gaps. Any character outside the alphabet ends the vector loop. */
+	TARGET_SSSE3 static inline __m128i inRange(__m128i c, char low, char high)
+	{
+		__m128i t = _mm_sub_epi8(c, _mm_set1_epi8(low));
+		return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8((char)(high - low))), t);
+	}
+
+	TARGET_AVX2 static inline __m256i inRange(__m256i c, char low, char high)
+	{
+		__m256i t = _mm256_sub_epi8(c, _mm256_set1_epi8(low));
+		return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8((char)(high - low))), t);
+	}
+
+	TARGET_SSSE3 static inline bool decodeValues(__m128i c, __m128i& values)
+	{
+		__m128i upper = inRange(c, 'A', 'Z'), lower = inRange(c, 'a', 'z'), digit = inRange(c, '0', '9');
+		__m128i plus = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('+')), _mm_cmpeq_epi8(c, _mm_set1_epi8('-')));
+		__m128i slash = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('/')), _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+		__m128i ranges = _mm_or_si128(_mm_or_si128(upper, lower), digit);
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(ranges, plus), slash)) != 0xFFFF)
+		{
+			return false;
+		}
+		__m128i shift = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+			_mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))), _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+		values = _mm_or_si128(_mm_and_si128(_mm_add_epi8(c, shift), ranges),
+			_mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62)), _mm_and_si128(slash, _mm_set1_epi8(63))));
+		return true;
+	}
+
+	TARGET_AVX2 static inline bool decodeValues(__m256i c, __m256i& values)
+	{
+		__m256i upper = inRange(c, 'A', 'Z'), lower = inRange(c, 'a', 'z'), digit = inRange(c, '0', '9');
+		__m256i plus = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-')));
+		__m256i slash = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('/')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+		__m256i ranges = _mm256_or_si256(_mm256_or_si256(upper, lower), digit);
+		if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(ranges, plus), slash)) != -1)
+		{
+			return false;
+		}
+		__m256i shift = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+			_mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))), _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+		values = _mm256_or_si256(_mm256_and_si256(_mm256_add_epi8(c, shift), ranges),
+			_mm256_or_si256(_mm256_and_si256(plus, _mm256_set1_epi8(62)), _mm256_and_si256(slash, _mm256_set1_epi8(63))));
+		return true;
+	}
+
+	TARGET_SSSE3 static size_t decodeSSSE3(const char* input, size_t length, uint8_t* output, size_t capacity)
+	{
+		const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		size_t i = 0, o = 0;
+		for (; length - i >= 16 && capacity - o >= 16; i += 16, o += 12)
+		{
+			__m128i values;
+			if (!decodeValues(_mm_loadu_si128((const __m128i*)(input + i)), values))
+			{
+				break;
+			}
+			__m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+			_mm_storeu_si128((__m128i*)(output + o), _mm_shuffle_epi8(merged, pack));
+		}
+		return i;
+	}
+
+	TARGET_AVX2 static size_t decodeAVX2(const char* input, size_t length, uint8_t* output, size_t capacity)
+	{
+		const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);   /* 12 bytes of each lane side by side */
+		size_t i = 0, o = 0;
+		for (; length - i >= 32 && capacity - o >= 32; i += 32, o += 24)
+		{
+			__m256i values;
+			if (!decodeValues(_mm256_loadu_si256((const __m256i*)(input + i)), values))
+			{
+				break;
+			}
+			__m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+			_mm256_storeu_si256((__m256i*)(output + o), _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), gather));
+		}
+		return i + decodeSSSE3(input + i, length - i, output + o, capacity - o);
+	}
+
+	size_t Base64_EncodeSIMD(const uint8_t* input, size_t length, char* output, bool url)
+	{
+		switch (Base64_SimdLevel())
+		{
+		case BASE64_SIMD_AVX2:
+			if (length >= 28)
+			{
+				return encodeAVX2(input, length, output, url);
+			}
+			/* too short for one 256-bit step */
+		case BASE64_SIMD_SSSE3:
+			return encodeSSSE3(input, length, output, url);
+		default:
+			return 0;
+		}
+	}
+
+	size_t Base64_DecodeSIMD(const char* input, size_t length, uint8_t* output, size_t capacity)
+	{
+		switch (Base64_SimdLevel())
+		{
+		case BASE64_SIMD_AVX2:
+			if (length >= 32)
+			{
+				return decodeAVX2(input, length, output, capacity);
+			}
+			/* too short for one 256-bit step */
+		case BASE64_SIMD_SSSE3:
+			return decodeSSSE3(input, length, output, capacity);
+		default:
+			return 0;
+		}
+	}
+#else
+	int Base64_SimdLevel()
+	{
+		return BASE64_SIMD_NONE;
+	}
+
+	size_t Base64_EncodeSIMD(const uint8_t*, size_t, char*, bool) { return 0; }
+	size_t Base64_DecodeSIMD(const char*, size_t, uint8_t*, size_t) { return 0; }
+#endif
+}
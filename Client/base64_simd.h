@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BASE64_SIMD_AVAILABLE	1
+#else
+#define BASE64_SIMD_AVAILABLE	0
+#endif
+
+#define BASE64_SIMD_NONE	0
+#define BASE64_SIMD_SSSE3	1
+#define BASE64_SIMD_AVX2	2
+
+namespace Crypto
+{
+	/// <summary>
+	/// This function is used to check once which vector kernels the CPU (and OS, for AVX2) supports.
+	/// </summary>
+	/// <returns>BASE64_SIMD_NONE, BASE64_SIMD_SSSE3 or BASE64_SIMD_AVX2</returns>
+	int Base64_SimdLevel();
+
+	/// <summary>
+	/// This function is used to encode the bulk of the input, 12 (SSSE3) or 24 (AVX2) bytes per step.
+	/// </summary>
+	/// <param name="1. [IN]  input">: Data to encode.</param>
+	/// <param name="2. [IN]  length">: Size of the data, a step only runs while 16 (28) bytes are readable.</param>
+	/// <param name="3. [OUT] output">: Receives consumed / 3 * 4 characters.</param>
+	/// <param name="4. [IN]  url">: Use the URL-safe alphabet ('-' and '_').</param>
+	/// <returns>Number of input bytes consumed, a multiple of 3, the caller encodes the rest</returns>
+	size_t Base64_EncodeSIMD(const uint8_t* input, size_t length, char* output, bool url);
+
+	/// <summary>
+	/// This function is used to decode the bulk of the input, 16 (SSSE3) or 32 (AVX2) characters per step.
+	/// Both alphabets are accepted. It stops before the first step holding padding, a line break or any
+	/// other character, so the caller can handle (and report) it.
+	/// </summary>
+	/// <param name="1. [IN]  input">: Characters to decode.</param>
+	/// <param name="2. [IN]  length">: Number of characters.</param>
+	/// <param name="3. [OUT] output">: Receives consumed / 4 * 3 bytes.</param>
+	/// <param name="4. [IN]  capacity">: Size of output, a step stores 16 (32) bytes and keeps 12 (24).</param>
+	/// <returns>Number of characters consumed, a multiple of 4</returns>
+	size_t Base64_DecodeSIMD(const char* input, size_t length, uint8_t* output, size_t capacity);
+}
@@ -1,24 +1,1282 @@
+#include <cmath>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cwctype>
+#include <algorithm>
 #include "data_transform.h"
+#include "logger.h"
 
 namespace NetworkOperations 
 {
+	DataCompress::DataCompress(int level, int window_bits)
+		: level_(level), window_bits_(window_bits), deflate_level_(level), deflate_ready_(FALSE), inflate_ready_(FALSE), threads_(1),
+		chunk_started_(FALSE), parallel_(FALSE), filling_(NULL), draining_(NULL), staged_offset_(0), parallel_in_(0), parallel_check_(0), trailer_staged_(FALSE)
+	{
+		ZeroMemory(&deflate_stream_, sizeof(deflate_stream_));
+		ZeroMemory(&inflate_stream_, sizeof(inflate_stream_));
+	}
+
+	DataCompress::~DataCompress()
+	{
+		// Workers may still hold blocks of an abandoned chunk
+		WaitBlocks();
+		for (ParallelBlock* block : free_blocks_)
+		{
+			delete block;
+		}
+		for (z_stream* stream : idle_streams_)
+		{
+			deflateEnd(stream);
+			delete stream;
+		}
+		if (deflate_ready_)
+		{
+			deflateEnd(&deflate_stream_);
+		}
+		if (inflate_ready_)
+		{
+			inflateEnd(&inflate_stream_);
+		}
+	}
+
 	BOOL DataCompress::TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
 	{
+		return Deflate(data_in, length_in, data_out, length_out, level_);
+	}
+
+	BOOL DataCompress::Deflate(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out, int level)
+	{
+		data_out = NULL;
+		length_out = 0;
+		// A large buffer is one span of the parallel stream, with room for the whole result
+		if (length_in >= PARALLEL_MIN_SIZE && UseParallel(level))
+		{
+			StartParallel(level);
+			size_t bound = Bound(length_in);
+			size_t consumed = 0, produced = 0;
+			BOOL done = FALSE;
+			data_out = new BYTE[bound];
+			if (!ParallelSpan(data_in, length_in, consumed, data_out, bound, produced, TRUE, done) || !done)
+			{
+				delete[] data_out;
+				data_out = NULL;
+				return FALSE;
+			}
+			length_out = (DWORD)produced;
+			return TRUE;
+		}
+		if (!StartDeflate(level))
+		{
+			return FALSE;
+		}
+
+		// The bound is the worst case, the whole chunk is compressed in one call
+		uLong bound = deflateBound(&deflate_stream_, length_in);
+		data_out = new BYTE[bound];
+		deflate_stream_.next_in = (Bytef*)data_in;
+		deflate_stream_.avail_in = length_in;
+		deflate_stream_.next_out = data_out;
+		deflate_stream_.avail_out = bound;
+		int ret = deflate(&deflate_stream_, Z_FINISH);
+		if (ret != Z_STREAM_END)
+		{
+			LOG_ERROR_W(L"[Compress] Failed to deflate data: %d", ret);
+			delete[] data_out;
+			data_out = NULL;
+			return FALSE;
+		}
+		length_out = (DWORD)deflate_stream_.total_out;
+		return TRUE;
+	}
+
+	BOOL DataCompress::StartDeflate(int level)
+	{
+		// Initialize the deflate state once, later chunks only reset it
+		int ret = deflate_ready_ ? deflateReset(&deflate_stream_)
+			: deflateInit2(&deflate_stream_, deflate_level_, Z_DEFLATED, window_bits_, COMPRESS_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+		if (ret != Z_OK)
+		{
+			LOG_ERROR_W(L"[Compress] Failed to initialize deflate stream: %d", ret);
+			return FALSE;
+		}
+		deflate_ready_ = TRUE;
+		if (level != deflate_level_)
+		{
+			// Right after a reset no data is pending, changing the level does not emit a block
+			if (deflateParams(&deflate_stream_, level, Z_DEFAULT_STRATEGY) != Z_OK)
+			{
+				LOG_ERROR_W(L"[Compress] Failed to set compression level %d", level);
+				return FALSE;
+			}
+			deflate_level_ = level;
+		}
+		return TRUE;
+	}
+
+	BOOL DataCompress::StartChunk(int level)
+	{
+		chunk_started_ = TRUE;
+		parallel_ = UseParallel(level);
+		if (parallel_)
+		{
+			StartParallel(level);
+			return TRUE;
+		}
+		return StartDeflate(level);
+	}
+
+	BOOL DataCompress::DeflateSpan(const BYTE* data_in, size_t length_in, size_t& consumed,
+		BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done)
+	{
+		// zlib counts in uInt, larger spans are taken in several calls
+		uInt avail_in = (uInt)min(length_in, (size_t)UINT_MAX);
+		uInt avail_out = (uInt)min(length_out, (size_t)UINT_MAX);
+		deflate_stream_.next_in = (Bytef*)data_in;
+		deflate_stream_.avail_in = avail_in;
+		deflate_stream_.next_out = data_out;
+		deflate_stream_.avail_out = avail_out;
+		// Z_FINISH only once the caller has handed over all input
+		int ret = deflate(&deflate_stream_, final && avail_in == length_in ? Z_FINISH : Z_NO_FLUSH);
+		consumed = avail_in - deflate_stream_.avail_in;
+		produced = avail_out - deflate_stream_.avail_out;
+		done = (ret == Z_STREAM_END);
+		if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+		{
+			LOG_ERROR_W(L"[Compress] Failed to deflate data: %d", ret);
+			return FALSE;
+		}
 		return TRUE;
 	}
 
+	size_t DataCompress::Bound(size_t length_in) const
+	{
+		// compressBound() in size_t: stored blocks and the zlib wrapper, plus 18 for a gzip header and trailer.
+		// It only holds for the full window, with a smaller one deflateBound() falls back to the larger of its
+		// bounds for fixed blocks of 9-bit literals and for the stored blocks of level 0
+		size_t bound = (window_bits_ == MAX_WBITS || window_bits_ == -MAX_WBITS || window_bits_ == 16 + MAX_WBITS)
+			? length_in + (length_in >> 12) + (length_in >> 14) + (length_in >> 25) + 13 + 18
+			: length_in + (length_in >> 3) + (length_in >> 8) + (length_in >> 9) + 7 + 18;
+		if (threads_ > 1)
+		{
+			// Every parallel block may end in a short stored block and a sync marker, the stream in an empty final block
+			bound += (length_in / PARALLEL_BLOCK_SIZE + 1) * 16;
+		}
+		return bound;
+	}
+
+	BOOL DataCompress::BeginChunk(ULONGLONG index, BOOL last)
+	{
+		chunk_started_ = FALSE;
+		return TRUE;
+	}
+
+	BOOL DataCompress::Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+		BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done)
+	{
+		if (!chunk_started_ && !StartChunk(level_))
+		{
+			return FALSE;
+		}
+		return parallel_ ? ParallelSpan(data_in, length_in, consumed, data_out, length_out, produced, final, done)
+			: DeflateSpan(data_in, length_in, consumed, data_out, length_out, produced, final, done);
+	}
+
+	BOOL DataCompress::UseParallel(int level) const
+	{
+		// Parallel blocks are primed with a 32 KB dictionary, which needs the full window
+		return threads_ > 1 && level != Z_NO_COMPRESSION &&
+			(window_bits_ == MAX_WBITS || window_bits_ == -MAX_WBITS || window_bits_ == 16 + MAX_WBITS);
+	}
+
+	void DataCompress::StartParallel(int level)
+	{
+		WaitBlocks();
+		parallel_in_ = 0;
+		parallel_check_ = window_bits_ > MAX_WBITS ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+		trailer_staged_ = FALSE;
+		blocks_.reserve((size_t)threads_ * 2 + 1);
+		filling_ = AcquireBlock(level);
+
+		// The stream header goes out first, the blocks are raw deflate data
+		staged_.clear();
+		staged_offset_ = 0;
+		if (window_bits_ > MAX_WBITS)
+		{
+			const BYTE header[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, (BYTE)(level == 9 ? 2 : level == 1 ? 4 : 0), 0xff };
+			staged_.assign(header, header + sizeof(header));
+		}
+		else if (window_bits_ > 0)
+		{
+			// zlib header: 32 KB window, level hint, checked so that the 16-bit value is a multiple of 31
+			int hint = (level == 1) ? 0 : (level > 1 && level < 6) ? 1 : (level == 6 || level == Z_DEFAULT_COMPRESSION) ? 2 : 3;
+			DWORD header = (((MAX_WBITS - 8) << 4 | Z_DEFLATED) << 8) | (hint << 6);
+			header += 31 - header % 31;
+			staged_.push_back((BYTE)(header >> 8));
+			staged_.push_back((BYTE)header);
+		}
+	}
+
+	BOOL DataCompress::ParallelSpan(const BYTE* data_in, size_t length_in, size_t& consumed,
+		BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done)
+	{
+		BOOL gzip = window_bits_ > MAX_WBITS;
+		consumed = 0;
+		produced = 0;
+		done = FALSE;
+		// After the final call the last block is queued and no block takes input any more
+		if (!filling_ && length_in > 0)
+		{
+			LOG_ERROR_W(L"[Compress] Input after the end of the chunk");
+			return FALSE;
+		}
+		auto filled = [&]() { return filling_->input.size() - filling_->dictionary == (size_t)PARALLEL_BLOCK_SIZE; };
+		for (;;)
+		{
+			// Step 1: Hand out what is ready, the header, finished blocks in stream order and the trailer
+			const BYTE* ready = draining_ ? draining_->output.data() : staged_.data();
+			size_t ready_size = draining_ ? draining_->output_size : staged_.size();
+			if (staged_offset_ < ready_size)
+			{
+				size_t piece = min(ready_size - staged_offset_, length_out - produced);
+				memcpy(data_out + produced, ready + staged_offset_, piece);
+				staged_offset_ += piece;
+				produced += piece;
+				if (staged_offset_ < ready_size)
+				{
+					return TRUE;
+				}
+			}
+			if (draining_)
+			{
+				free_blocks_.push_back(draining_);
+				draining_ = NULL;
+			}
+
+			// Step 2: The oldest block is next once it is deflated
+			if (!blocks_.empty())
+			{
+				ParallelBlock& block = *blocks_.front();
+				BOOL block_done;
+				{
+					std::lock_guard<std::mutex> lock(parallel_mutex_);
+					block_done = block.done;
+				}
+				// Needed now when no more blocks may be queued or the rest of the stream is already queued
+				BOOL at_limit = consumed < length_in && filled() && blocks_.size() >= (size_t)threads_ * 2;
+				if (!block_done && (at_limit || (final && consumed == length_in && !filling_)))
+				{
+					WaitBlock(block);
+					block_done = TRUE;
+				}
+				if (block_done)
+				{
+					if (!block.success)
+					{
+						LOG_ERROR_W(L"[Compress] Failed to deflate parallel block");
+						return FALSE;
+					}
+					size_t input_size = block.input.size() - block.dictionary;
+					parallel_check_ = gzip ? crc32_combine(parallel_check_, block.check, (z_off_t)input_size)
+						: adler32_combine(parallel_check_, block.check, (z_off_t)input_size);
+					// The header is out, the staging buffer stays empty until the trailer
+					staged_.clear();
+					draining_ = &block;
+					staged_offset_ = 0;
+					blocks_.erase(blocks_.begin());
+					continue;
+				}
+			}
+
+			// Step 3: Input fills the current block, a full one is deflated when more input follows
+			if (consumed < length_in)
+			{
+				if (filled())
+				{
+					SubmitBlock(FALSE);
+					continue;
+				}
+				size_t piece = min(length_in - consumed, PARALLEL_BLOCK_SIZE - (filling_->input.size() - filling_->dictionary));
+				filling_->input.insert(filling_->input.end(), data_in + consumed, data_in + consumed + piece);
+				consumed += piece;
+				parallel_in_ += piece;
+				continue;
+			}
+			if (!final)
+			{
+				return TRUE;
+			}
+
+			// Step 4: The block holding the end of the input closes the deflate stream, the trailer follows the last block
+			if (filling_)
+			{
+				SubmitBlock(TRUE);
+				continue;
+			}
+			if (!trailer_staged_)
+			{
+				staged_.clear();
+				staged_offset_ = 0;
+				if (gzip)
+				{
+					for (int i = 0; i < 4; i++) staged_.push_back((BYTE)(parallel_check_ >> (8 * i)));
+					for (int i = 0; i < 4; i++) staged_.push_back((BYTE)(parallel_in_ >> (8 * i)));
+				}
+				else if (window_bits_ > 0)
+				{
+					for (int i = 3; i >= 0; i--) staged_.push_back((BYTE)(parallel_check_ >> (8 * i)));
+				}
+				trailer_staged_ = TRUE;
+				continue;
+			}
+			done = TRUE;
+			return TRUE;
+		}
+	}
+
+	DataCompress::ParallelBlock* DataCompress::AcquireBlock(int level)
+	{
+		ParallelBlock* block;
+		if (free_blocks_.empty())
+		{
+			block = new ParallelBlock;
+			block->owner = this;
+			block->input.reserve(PARALLEL_DICT_SIZE + PARALLEL_BLOCK_SIZE);
+		}
+		else
+		{
+			block = free_blocks_.back();
+			free_blocks_.pop_back();
+			block->input.clear();
+		}
+		block->dictionary = 0;
+		block->level = level;
+		block->last = FALSE;
+		block->queued = FALSE;
+		block->done = FALSE;
+		block->success = FALSE;
+		block->output_size = 0;
+		return block;
+	}
+
+	void DataCompress::SubmitBlock(BOOL last)
+	{
+		ParallelBlock* block = filling_;
+		block->last = last;
+		blocks_.push_back(block);
+		filling_ = NULL;
+		if (!last)
+		{
+			// The tail of this block is the dictionary of the next one
+			filling_ = AcquireBlock(block->level);
+			filling_->input.assign(block->input.end() - PARALLEL_DICT_SIZE, block->input.end());
+			filling_->dictionary = PARALLEL_DICT_SIZE;
+		}
+		// Without workers the caller deflates every block when it needs the output
+		if (WorkerPool::Instance().GetThreadCount() > 0)
+		{
+			block->queued = TRUE;
+			WorkerPool::Instance().Submit(*block);
+		}
+	}
+
+	void DataCompress::DeflateBlock(ParallelBlock& block)
+	{
+		// Idle streams are reused, only the level is set again
+		z_stream* stream = NULL;
+		{
+			std::lock_guard<std::mutex> lock(parallel_mutex_);
+			if (!idle_streams_.empty())
+			{
+				stream = idle_streams_.back();
+				idle_streams_.pop_back();
+			}
+		}
+		int ret = Z_OK;
+		if (!stream)
+		{
+			stream = new z_stream;
+			ZeroMemory(stream, sizeof(z_stream));
+			ret = deflateInit2(stream, block.level, Z_DEFLATED, -MAX_WBITS, COMPRESS_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+			if (ret != Z_OK)
+			{
+				delete stream;
+				stream = NULL;
+			}
+		}
+		else
+		{
+			ret = deflateReset(stream);
+			if (ret == Z_OK)
+			{
+				ret = deflateParams(stream, block.level, Z_DEFAULT_STRATEGY);
+			}
+		}
+
+		// Raw deflate data ending on a byte boundary, the last block closes the stream
+		BOOL success = FALSE;
+		if (ret == Z_OK && block.dictionary)
+		{
+			ret = deflateSetDictionary(stream, block.input.data(), (uInt)block.dictionary);
+		}
+		if (ret == Z_OK)
+		{
+			const BYTE* input = block.input.data() + block.dictionary;
+			uInt input_size = (uInt)(block.input.size() - block.dictionary);
+			block.check = window_bits_ > MAX_WBITS ? crc32(0L, input, input_size) : adler32(1L, input, input_size);
+			// A sync flush adds an empty stored block on top of the bound. The buffer only grows, once per block
+			size_t bound = deflateBound(stream, input_size) + 16;
+			if (block.output.size() < bound)
+			{
+				block.output.resize(bound);
+			}
+			stream->next_in = (Bytef*)input;
+			stream->avail_in = input_size;
+			stream->next_out = block.output.data();
+			stream->avail_out = (uInt)block.output.size();
+			ret = deflate(stream, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+			success = block.last ? ret == Z_STREAM_END : (ret == Z_OK && stream->avail_in == 0);
+			block.output_size = block.output.size() - stream->avail_out;
+		}
+
+		std::lock_guard<std::mutex> lock(parallel_mutex_);
+		if (stream)
+		{
+			idle_streams_.push_back(stream);
+		}
+		block.success = success;
+		block.done = TRUE;
+		parallel_done_.notify_all();
+	}
+
+	void DataCompress::WaitBlock(ParallelBlock& block)
+	{
+		// A block no worker has started yet is taken back and deflated here instead of waiting for one
+		if (!block.queued || WorkerPool::Instance().Cancel(block))
+		{
+			block.queued = FALSE;
+			DeflateBlock(block);
+			return;
+		}
+		std::unique_lock<std::mutex> lock(parallel_mutex_);
+		parallel_done_.wait(lock, [&]() { return block.done; });
+	}
+
+	void DataCompress::WaitBlocks()
+	{
+		// Blocks of an abandoned chunk: queued ones are taken back, running ones are waited for
+		for (ParallelBlock* block : blocks_)
+		{
+			if (block->queued && !WorkerPool::Instance().Cancel(*block))
+			{
+				std::unique_lock<std::mutex> lock(parallel_mutex_);
+				parallel_done_.wait(lock, [&]() { return block->done; });
+			}
+			free_blocks_.push_back(block);
+		}
+		blocks_.clear();
+		for (ParallelBlock** block : { &filling_, &draining_ })
+		{
+			if (*block)
+			{
+				free_blocks_.push_back(*block);
+				*block = NULL;
+			}
+		}
+	}
+
 	BOOL DataCompress::ReverseTransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
 	{
+		data_out = NULL;
+		length_out = 0;
+		int ret = inflate_ready_ ? inflateReset(&inflate_stream_) : inflateInit2(&inflate_stream_, window_bits_);
+		if (ret != Z_OK)
+		{
+			LOG_ERROR_W(L"[Compress] Failed to initialize inflate stream: %d", ret);
+			return FALSE;
+		}
+		inflate_ready_ = TRUE;
+
+		// The original size is unknown, grow the output until the stream ends. length_out is a DWORD,
+		// so the capacity stops at MAXDWORD instead of wrapping around
+		DWORD capacity = length_in > MAXDWORD / 4 ? MAXDWORD : max(length_in * 4, (DWORD)(64 * 1024));
+		data_out = new BYTE[capacity];
+		inflate_stream_.next_in = (Bytef*)data_in;
+		inflate_stream_.avail_in = length_in;
+		do
+		{
+			if (inflate_stream_.total_out == capacity)
+			{
+				if (capacity == MAXDWORD)
+				{
+					LOG_ERROR_W(L"[Compress] Inflated data does not fit in %lu bytes", capacity);
+					ret = Z_BUF_ERROR;
+					break;
+				}
+				DWORD grown = capacity > MAXDWORD / 2 ? MAXDWORD : capacity * 2;
+				BYTE* grow = new BYTE[grown];
+				memcpy(grow, data_out, capacity);
+				delete[] data_out;
+				data_out = grow;
+				capacity = grown;
+			}
+			inflate_stream_.next_out = data_out + inflate_stream_.total_out;
+			inflate_stream_.avail_out = capacity - (DWORD)inflate_stream_.total_out;
+			ret = inflate(&inflate_stream_, Z_NO_FLUSH);
+		} while (ret == Z_OK);
+
+		if (ret != Z_STREAM_END)
+		{
+			LOG_ERROR_W(L"[Compress] Failed to inflate data: %d", ret);
+			delete[] data_out;
+			data_out = NULL;
+			return FALSE;
+		}
+		length_out = (DWORD)inflate_stream_.total_out;
 		return TRUE;
 	}
 
-	BOOL DataCryptor::TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
+	std::mutex AdaptiveCompress::stats_mutex_;
+	std::map<std::wstring, AdaptiveCompress::ExtensionStats> AdaptiveCompress::stats_;
+
+	void AdaptiveCompress::SetFileExtension(const std::wstring& extension)
 	{
+		extension_ = extension;
+		std::transform(extension_.begin(), extension_.end(), extension_.begin(), ::towlower);
+	}
+
+	BOOL AdaptiveCompress::TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
+	{
+		// Step 1: Media and archives seen before are stored without looking at the data
+		if (IsKnownIncompressible())
+		{
+			return Deflate(data_in, length_in, data_out, length_out, Z_NO_COMPRESSION);
+		}
+		// Step 2: A byte histogram of the chunk prefix catches already compressed or encrypted data
+		if (EstimateEntropy(data_in, min(length_in, (DWORD)ADAPTIVE_SAMPLE_SIZE)) > ADAPTIVE_MAX_ENTROPY)
+		{
+			UpdateStats(TRUE);
+			return Deflate(data_in, length_in, data_out, length_out, Z_NO_COMPRESSION);
+		}
+		// Step 3: Compress and remember how well this kind of file shrinks
+		if (!Deflate(data_in, length_in, data_out, length_out, level_))
+		{
+			return FALSE;
+		}
+		UpdateStats(length_out > length_in * (1.0 - ADAPTIVE_MIN_SAVING));
 		return TRUE;
 	}
 
+	BOOL AdaptiveCompress::BeginChunk(ULONGLONG index, BOOL last)
+	{
+		measure_chunk_ = FALSE;
+		chunk_in_ = 0;
+		chunk_out_ = 0;
+		return DataCompress::BeginChunk(index, last);
+	}
+
+	BOOL AdaptiveCompress::Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+		BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done)
+	{
+		// Same decision as TransformData, taken on the first piece instead of the whole chunk
+		if (!chunk_started_)
+		{
+			int level = level_;
+			if (IsKnownIncompressible())
+			{
+				level = Z_NO_COMPRESSION;
+			}
+			else if (EstimateEntropy(data_in, (DWORD)min(length_in, (size_t)ADAPTIVE_SAMPLE_SIZE)) > ADAPTIVE_MAX_ENTROPY)
+			{
+				UpdateStats(TRUE);
+				level = Z_NO_COMPRESSION;
+			}
+			else
+			{
+				measure_chunk_ = TRUE;
+			}
+			if (!StartChunk(level))
+			{
+				return FALSE;
+			}
+		}
+		if (!DataCompress::Process(data_in, length_in, consumed, data_out, length_out, produced, final, done))
+		{
+			return FALSE;
+		}
+		chunk_in_ += consumed;
+		chunk_out_ += produced;
+		if (done && measure_chunk_)
+		{
+			UpdateStats(chunk_out_ > chunk_in_ * (1.0 - ADAPTIVE_MIN_SAVING));
+		}
+		return TRUE;
+	}
+
+	BOOL AdaptiveCompress::IsKnownIncompressible()
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		auto it = stats_.find(extension_);
+		if (it == stats_.end() || it->second.chunks < ADAPTIVE_MIN_SAMPLES)
+		{
+			return FALSE;
+		}
+		if (it->second.incompressible * 10 < it->second.chunks * 9)
+		{
+			return FALSE;
+		}
+		// Keep probing now and then, so one odd file does not pin the extension forever
+		return ++it->second.skipped % 64 != 0;
+	}
+
+	void AdaptiveCompress::UpdateStats(BOOL incompressible)
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		ExtensionStats& stats = stats_[extension_];
+		stats.chunks++;
+		if (incompressible)
+		{
+			stats.incompressible++;
+		}
+	}
+
+	double AdaptiveCompress::EstimateEntropy(const BYTE* data, DWORD length)
+	{
+		if (length == 0)
+		{
+			return 0.0;
+		}
+		DWORD histogram[256] = { 0 };
+		for (DWORD i = 0; i < length; i++)
+		{
+			histogram[data[i]]++;
+		}
+		double entropy = 0.0;
+		for (DWORD count : histogram)
+		{
+			if (count)
+			{
+				double p = (double)count / length;
+				entropy -= p * std::log2(p);
+			}
+		}
+		return entropy;
+	}
+
+	BOOL DataCryptor::PrepareChunk(ULONGLONG index, BOOL last, BYTE nonce[GCM_NONCE_LEN], BYTE aad[9])
+	{
+		if (key_.size() != AES_KEY_SIZE || iv_.size() != GCM_NONCE_LEN)
+		{
+			LOG_ERROR_W(L"[Crypto] Key must be %d bytes and nonce %d bytes", AES_KEY_SIZE, GCM_NONCE_LEN);
+			return FALSE;
+		}
+		memcpy(nonce, iv_.data(), GCM_NONCE_LEN);
+		for (int i = 0; i < 8; i++)
+		{
+			nonce[GCM_NONCE_LEN - 1 - i] ^= (BYTE)(index >> (8 * i));
+			aad[7 - i] = (BYTE)(index >> (8 * i));
+		}
+		aad[8] = last ? 1 : 0;
+		return TRUE;
+	}
+
+	BOOL DataCryptor::TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
+	{
+		BOOL last = last_chunk_;
+		last_chunk_ = FALSE;
+		if (encrypt_ended_)
+		{
+			LOG_ERROR_W(L"[Crypto] Chunk %llu comes after the last chunk", encrypt_index_);
+			data_out = NULL;
+			length_out = 0;
+			return FALSE;
+		}
+		encrypt_ended_ = last;
+		return TransformChunk(encrypt_index_++, last, data_in, length_in, data_out, length_out);
+	}
+
 	BOOL DataCryptor::ReverseTransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
 	{
+		// The last flag is in the AAD, a stream cut after any other chunk fails on the one the caller marks as last
+		BOOL last = last_chunk_;
+		last_chunk_ = FALSE;
+		if (decrypt_ended_)
+		{
+			LOG_ERROR_W(L"[Crypto] Chunk %llu comes after the last chunk", decrypt_index_);
+			data_out = NULL;
+			length_out = 0;
+			return FALSE;
+		}
+		decrypt_ended_ = last;
+		return ReverseTransformChunk(decrypt_index_++, last, data_in, length_in, data_out, length_out);
+	}
+
+	BOOL DataCryptor::TransformChunk(ULONGLONG index, BOOL last, const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
+	{
+		BYTE nonce[GCM_NONCE_LEN], aad[9];
+		data_out = NULL;
+		length_out = 0;
+		if (!PrepareChunk(index, last, nonce, aad))
+		{
+			return FALSE;
+		}
+		Crypto::GCM_CTX ctx;
+		data_out = new BYTE[(size_t)length_in + TAG_SIZE];
+		Crypto::GCM_Start(&ctx, (const uint8_t*)key_.data(), nonce, aad, sizeof(aad));
+		Crypto::GCM_EncryptUpdate(&ctx, data_in, length_in, data_out);
+		Crypto::GCM_Finish(&ctx, data_out + length_in);
+		length_out = length_in + TAG_SIZE;
+		return TRUE;
+	}
+
+	BOOL DataCryptor::ReverseTransformChunk(ULONGLONG index, BOOL last, const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out)
+	{
+		BYTE nonce[GCM_NONCE_LEN], aad[9], tag[TAG_SIZE];
+		data_out = NULL;
+		length_out = 0;
+		if (length_in < TAG_SIZE || !PrepareChunk(index, last, nonce, aad))
+		{
+			return FALSE;
+		}
+		Crypto::GCM_CTX ctx;
+		DWORD text_size = length_in - TAG_SIZE;
+		data_out = new BYTE[text_size ? text_size : 1];
+		Crypto::GCM_Start(&ctx, (const uint8_t*)key_.data(), nonce, aad, sizeof(aad));
+		Crypto::GCM_DecryptUpdate(&ctx, data_in, text_size, data_out);
+		Crypto::GCM_Finish(&ctx, tag);
+
+		// Constant-time compare, the plaintext is only released with a valid tag
+		BYTE diff = 0;
+		for (int i = 0; i < TAG_SIZE; i++)
+		{
+			diff |= tag[i] ^ data_in[text_size + i];
+		}
+		if (diff)
+		{
+			LOG_ERROR_W(L"[Crypto] Authentication failed for chunk %llu", index);
+			SecureZeroMemory(data_out, text_size);
+			delete[] data_out;
+			data_out = NULL;
+			return FALSE;
+		}
+		length_out = text_size;
+		return TRUE;
+	}
+
+	BOOL DataCryptor::BeginChunk(ULONGLONG index, BOOL last)
+	{
+		BYTE nonce[GCM_NONCE_LEN], aad[9];
+		if (!PrepareChunk(index, last, nonce, aad))
+		{
+			return FALSE;
+		}
+		Crypto::GCM_Start(&stream_ctx_, (const uint8_t*)key_.data(), nonce, aad, sizeof(aad));
+		return TRUE;
+	}
+
+	BOOL DataCryptor::Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+		BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done)
+	{
+		consumed = min(length_in, length_out);
+		Crypto::GCM_EncryptUpdate(&stream_ctx_, data_in, consumed, data_out);
+		produced = consumed;
+		done = FALSE;
+		// The tag goes out once all input is in and there is room for it, otherwise on the next call
+		if (final && consumed == length_in && length_out - produced >= TAG_SIZE)
+		{
+			Crypto::GCM_Finish(&stream_ctx_, data_out + produced);
+			produced += TAG_SIZE;
+			done = TRUE;
+		}
 		return TRUE;
 	}
+
+	WorkerPool::WorkerPool(DWORD threads) : first_task_(NULL), last_task_(NULL), stopping_(FALSE)
+	{
+		for (DWORD i = 0; i < threads; i++)
+		{
+			threads_.emplace_back(&WorkerPool::WorkLoop, this);
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = TRUE;
+		}
+		wake_.notify_all();
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	WorkerPool& WorkerPool::Instance()
+	{
+		static WorkerPool pool(max(std::thread::hardware_concurrency(), 1u) - 1);
+		return pool;
+	}
+
+	void WorkerPool::Submit(WorkerTask& task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			task.next_task_ = NULL;
+			if (last_task_)
+			{
+				last_task_->next_task_ = &task;
+			}
+			else
+			{
+				first_task_ = &task;
+			}
+			last_task_ = &task;
+		}
+		wake_.notify_one();
+	}
+
+	BOOL WorkerPool::Cancel(WorkerTask& task)
+	{
+		// The queue holds a few tasks per running transform, a walk is cheaper than a second link
+		std::lock_guard<std::mutex> lock(mutex_);
+		WorkerTask* previous = NULL;
+		for (WorkerTask* queued = first_task_; queued; previous = queued, queued = queued->next_task_)
+		{
+			if (queued == &task)
+			{
+				(previous ? previous->next_task_ : first_task_) = task.next_task_;
+				if (last_task_ == &task)
+				{
+					last_task_ = previous;
+				}
+				task.next_task_ = NULL;
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+
+	void WorkerPool::WorkLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			wake_.wait(lock, [this]() { return stopping_ || first_task_ != NULL; });
+			if (!first_task_)
+			{
+				break;
+			}
+			WorkerTask* task = first_task_;
+			first_task_ = task->next_task_;
+			if (!first_task_)
+			{
+				last_task_ = NULL;
+			}
+			lock.unlock();
+			// The task may be reused by its owner as soon as it reports its result, it is not touched after Run
+			task->Run();
+			lock.lock();
+		}
+	}
+
+	BufferPool::~BufferPool()
+	{
+		for (auto& buffers : free_)
+		{
+			for (BYTE* buffer : buffers)
+			{
+				delete[] buffer;
+			}
+		}
+	}
+
+	BufferPool& BufferPool::Instance()
+	{
+		static BufferPool pool;
+		return pool;
+	}
+
+	DWORD BufferPool::SizeClass(size_t size)
+	{
+		DWORD bits = POOL_MIN_CLASS_BITS;
+		while (bits <= POOL_MAX_CLASS_BITS && ((size_t)1 << bits) < size)
+		{
+			bits++;
+		}
+		return bits;
+	}
+
+	BYTE* BufferPool::Acquire(size_t size)
+	{
+		DWORD bits = SizeClass(size);
+		if (bits > POOL_MAX_CLASS_BITS)
+		{
+			return new BYTE[size];
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!free_[bits].empty())
+			{
+				BYTE* buffer = free_[bits].back();
+				free_[bits].pop_back();
+				free_bytes_ -= (size_t)1 << bits;
+				return buffer;
+			}
+		}
+		return new BYTE[(size_t)1 << bits];
+	}
+
+	void BufferPool::Release(BYTE* buffer, size_t size)
+	{
+		DWORD bits = SizeClass(size);
+		if (bits <= POOL_MAX_CLASS_BITS)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (free_[bits].size() < POOL_MAX_FREE_PER_CLASS && free_bytes_ + ((size_t)1 << bits) <= POOL_MAX_FREE_BYTES)
+			{
+				free_[bits].push_back(buffer);
+				free_bytes_ += (size_t)1 << bits;
+				return;
+			}
+		}
+		delete[] buffer;
+	}
+
+	ChunkPipeline::ChunkPipeline(size_t tile_size) : tile_size_(max(tile_size, (size_t)TAG_SIZE))
+	{
+		Crypto::SHA256_Init(&digest_);
+	}
+
+	void ChunkPipeline::AddStage(IDataTransform* stage)
+	{
+		stages_.push_back(stage);
+		streaming_.push_back(FALSE);
+		scratch_.emplace_back(new PooledBuffer(tile_size_));
+		pending_.emplace_back();
+		pending_size_.push_back(0);
+	}
+
+	size_t ChunkPipeline::Bound(size_t length_in) const
+	{
+		for (IDataTransform* stage : stages_)
+		{
+			length_in = stage->Bound(length_in);
+		}
+		return length_in;
+	}
+
+	BOOL ChunkPipeline::ProcessChunk(ULONGLONG index, BOOL last, const BYTE* data_in, size_t length_in, BYTE* data_out, size_t capacity, size_t& length_out)
+	{
+		length_out = 0;
+		size_t stage_input = length_in;
+		for (size_t i = 0; i < stages_.size(); i++)
+		{
+			streaming_[i] = stages_[i]->BeginChunk(index, last);
+			pending_size_[i] = 0;
+			// A whole-chunk stage after the first collects its input in a pooled buffer kept between chunks
+			if (!streaming_[i] && i > 0 && (!pending_[i] || pending_[i]->size() < stage_input))
+			{
+				pending_[i].reset(new PooledBuffer(stage_input));
+			}
+			stage_input = stages_[i]->Bound(stage_input);
+		}
+		// A first stage that wants the whole chunk reads it in place
+		if (!stages_.empty() && !streaming_[0])
+		{
+			return Feed(0, data_in, length_in, TRUE, data_out, capacity, length_out);
+		}
+		size_t offset = 0;
+		do
+		{
+			size_t piece = min(tile_size_, length_in - offset);
+			if (!Feed(0, data_in + offset, piece, offset + piece == length_in, data_out, capacity, length_out))
+			{
+				return FALSE;
+			}
+			offset += piece;
+		} while (offset < length_in);
+		return TRUE;
+	}
+
+	BOOL ChunkPipeline::Feed(size_t stage, const BYTE* data, size_t length, BOOL final, BYTE* data_out, size_t capacity, size_t& length_out)
+	{
+		if (stage == stages_.size())
+		{
+			if (length > capacity - length_out)
+			{
+				LOG_ERROR_W(L"[Pipeline] Output buffer is too small");
+				return FALSE;
+			}
+			memcpy(data_out + length_out, data, length);
+			Crypto::SHA256_Update(&digest_, data_out + length_out, (uint32_t)length);
+			length_out += length;
+			return TRUE;
+		}
+		IDataTransform* transform = stages_[stage];
+		BOOL last_stage = (stage + 1 == stages_.size());
+		if (streaming_[stage])
+		{
+			// The last stage writes the result directly, the others a pooled tile passed on after every call
+			BOOL done = FALSE;
+			while (length > 0 || (final && !done))
+			{
+				BYTE* target = last_stage ? data_out + length_out : scratch_[stage]->data();
+				size_t room = last_stage ? capacity - length_out : tile_size_;
+				size_t consumed = 0, produced = 0;
+				if (!transform->Process(data, length, consumed, target, room, produced, final, done))
+				{
+					return FALSE;
+				}
+				if (consumed == 0 && produced == 0 && !done)
+				{
+					LOG_ERROR_W(L"[Pipeline] Stage %u made no progress, output buffer is too small", (unsigned)stage);
+					return FALSE;
+				}
+				data += consumed;
+				length -= consumed;
+				if (last_stage)
+				{
+					// Hashed while the bytes just written are still in cache
+					Crypto::SHA256_Update(&digest_, target, (uint32_t)produced);
+					length_out += produced;
+				}
+				else if (!Feed(stage + 1, target, produced, final && done, data_out, capacity, length_out))
+				{
+					return FALSE;
+				}
+			}
+			return TRUE;
+		}
+
+		// Whole-chunk stage: collect the tiles (unless the chunk arrives in one piece) and run it once
+		if (!final || pending_size_[stage] > 0)
+		{
+			PooledBuffer& collected = *pending_[stage];
+			if (length > collected.size() - pending_size_[stage])
+			{
+				LOG_ERROR_W(L"[Pipeline] Stage %u input exceeds its bound", (unsigned)stage);
+				return FALSE;
+			}
+			memcpy(collected.data() + pending_size_[stage], data, length);
+			pending_size_[stage] += length;
+			if (!final)
+			{
+				return TRUE;
+			}
+			data = collected.data();
+			length = pending_size_[stage];
+		}
+		BYTE* result = NULL;
+		DWORD result_size = 0;
+		if (length > MAXDWORD || !transform->TransformData(data, (DWORD)length, result, result_size))
+		{
+			return FALSE;
+		}
+		pending_size_[stage] = 0;
+		BOOL success = TRUE;
+		size_t offset = 0;
+		do
+		{
+			size_t piece = min(tile_size_, (size_t)result_size - offset);
+			success = Feed(stage + 1, result + offset, piece, offset + piece == result_size, data_out, capacity, length_out);
+			offset += piece;
+		} while (success && offset < result_size);
+		delete[] result;
+		return success;
+	}
+
+	void ChunkPipeline::AddToDigest(const BYTE* data, size_t length)
+	{
+		Crypto::SHA256_Update(&digest_, (uint8_t*)data, (uint32_t)length);
+	}
+
+	std::string ChunkPipeline::GetDigest()
+	{
+		BYTE digest[SHA256_DIGEST_LENGTH];
+		Crypto::SHA256_Final(&digest_, digest);
+		return Helper::StringHelper::convertBytesHexString(digest, SHA256_DIGEST_LENGTH);
+	}
+
+	size_t StoredLayout::Bound(const ChunkPipeline& pipeline, size_t length)
+	{
+		return STORED_HEADER_SIZE + pipeline.Bound(length) + STORED_TRAILER_SIZE;
+	}
+
+	BOOL StoredLayout::WritePart(ChunkPipeline& pipeline, const std::string& nonce, ULONGLONG index, BOOL last,
+		const BYTE* data, size_t length, BYTE* part, size_t capacity, size_t& part_size)
+	{
+		part_size = 0;
+		size_t header = 0;
+		if (!nonce.empty() && index == 0)
+		{
+			// The file nonce is read back from the header when the file is downloaded
+			memcpy(part, Crypto::PREFIX_NAME, sizeof(Crypto::PREFIX_NAME));
+			memcpy(part + sizeof(Crypto::PREFIX_NAME), nonce.data(), GCM_NONCE_LEN);
+			pipeline.AddToDigest(part, STORED_HEADER_SIZE);
+			header = STORED_HEADER_SIZE;
+		}
+		size_t produced = 0;
+		size_t trailer = nonce.empty() ? 0 : STORED_TRAILER_SIZE;
+		if (capacity < header + trailer
+			|| !pipeline.ProcessChunk(index, last, data, length, part + header, capacity - header - trailer, produced))
+		{
+			return FALSE;
+		}
+		if (trailer)
+		{
+			for (int i = 0; i < STORED_TRAILER_SIZE; i++)
+			{
+				part[header + produced + i] = (BYTE)(produced >> (8 * i));
+			}
+			pipeline.AddToDigest(part + header + produced, STORED_TRAILER_SIZE);
+		}
+		part_size = header + produced + trailer;
+		return TRUE;
+	}
+
+	BOOL StoredLayout::ReadAt(HANDLE hFile, ULONGLONG offset, BYTE* data, DWORD length)
+	{
+		LARGE_INTEGER position;
+		position.QuadPart = (LONGLONG)offset;
+		DWORD bytesRead = 0;
+		return SetFilePointerEx(hFile, position, NULL, FILE_BEGIN)
+			&& ReadFile(hFile, data, length, &bytesRead, NULL) && bytesRead == length;
+	}
+
+	// Inflates data into hFile. A stream that ends starts the next one, total_in is 0 again at its end
+	BOOL StoredLayout::Inflate(z_stream& stream, const BYTE* data, size_t length, BYTE* output, size_t output_size, HANDLE hFile)
+	{
+		BOOL success = TRUE;
+		DWORD bytesWrite = 0;
+		stream.next_in = (Bytef*)data;
+		stream.avail_in = (uInt)length;
+		do
+		{
+			stream.next_out = output;
+			stream.avail_out = (uInt)output_size;
+			int ret = inflate(&stream, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+			{
+				// The next part starts right behind this one
+				ret = inflateReset(&stream);
+			}
+			DWORD produced = (DWORD)(output_size - stream.avail_out);
+			success = (ret == Z_OK || (ret == Z_BUF_ERROR && stream.avail_in == 0))
+				&& WriteFile(hFile, output, produced, &bytesWrite, NULL) && bytesWrite == produced;
+		} while (success && (stream.avail_in > 0 || stream.avail_out == 0));
+		return success;
+	}
+
+	BOOL StoredLayout::RestorePlain(HANDLE hStored, HANDLE hFile)
+	{
+		// The parts are inflated one after the other and their Adler-32 trailers check the content
+		PooledBuffer input(STORED_BUFFER_SIZE), output(STORED_BUFFER_SIZE);
+		z_stream stream;
+		ZeroMemory(&stream, sizeof(stream));
+		if (inflateInit2(&stream, COMPRESS_WINDOW_BITS) != Z_OK)
+		{
+			return FALSE;
+		}
+		LARGE_INTEGER start;
+		start.QuadPart = 0;
+		BOOL success = SetFilePointerEx(hStored, start, NULL, FILE_BEGIN);
+		DWORD bytesRead = 0;
+		while (success)
+		{
+			success = ReadFile(hStored, input.data(), STORED_BUFFER_SIZE, &bytesRead, NULL);
+			if (!success || bytesRead == 0)
+			{
+				break;
+			}
+			success = Inflate(stream, input.data(), bytesRead, output.data(), STORED_BUFFER_SIZE, hFile);
+		}
+		// A part cut short leaves the stream started
+		success = success && stream.total_in == 0;
+		inflateEnd(&stream);
+		return success;
+	}
+
+	BOOL StoredLayout::RestoreEncrypted(HANDLE hStored, HANDLE hFile, const std::string& key, const std::string& nonce)
+	{
+		struct Part
+		{
+			ULONGLONG offset;
+			DWORD size;
+		};
+		// The trailers are walked back from the end of the file down to the header
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(hStored, &file_size))
+		{
+			return FALSE;
+		}
+		std::vector<Part> parts;
+		ULONGLONG end = (ULONGLONG)file_size.QuadPart;
+		while (end > STORED_HEADER_SIZE)
+		{
+			BYTE trailer[STORED_TRAILER_SIZE];
+			if (end < STORED_HEADER_SIZE + STORED_TRAILER_SIZE || !ReadAt(hStored, end - STORED_TRAILER_SIZE, trailer, STORED_TRAILER_SIZE))
+			{
+				return FALSE;
+			}
+			DWORD size = 0;
+			for (int i = 0; i < STORED_TRAILER_SIZE; i++)
+			{
+				size |= (DWORD)trailer[i] << (8 * i);
+			}
+			end -= STORED_TRAILER_SIZE;
+			if (size < TAG_SIZE || size > STORED_MAX_PART_SIZE || end - STORED_HEADER_SIZE < size)
+			{
+				return FALSE;
+			}
+			end -= size;
+			parts.push_back({ end, size });
+		}
+		if (parts.empty())
+		{
+			return FALSE;
+		}
+		std::reverse(parts.begin(), parts.end());
+
+		// Every part is checked by its tag before it is inflated, and has to be exactly one zlib stream
+		DataCryptor cryptor(key, nonce);
+		PooledBuffer output(STORED_BUFFER_SIZE);
+		z_stream stream;
+		ZeroMemory(&stream, sizeof(stream));
+		if (inflateInit2(&stream, COMPRESS_WINDOW_BITS) != Z_OK)
+		{
+			return FALSE;
+		}
+		BOOL success = TRUE;
+		for (size_t i = 0; success && i < parts.size(); i++)
+		{
+			PooledBuffer input(parts[i].size);
+			BYTE* plain = NULL;
+			DWORD plain_size = 0;
+			success = ReadAt(hStored, parts[i].offset, input.data(), parts[i].size)
+				&& cryptor.ReverseTransformChunk(i, i + 1 == parts.size(), input.data(), parts[i].size, plain, plain_size)
+				&& Inflate(stream, plain, plain_size, output.data(), STORED_BUFFER_SIZE, hFile)
+				&& stream.total_in == 0;
+			delete[] plain;
+		}
+		inflateEnd(&stream);
+		return success;
+	}
+
+	BOOL StoredLayout::Restore(HANDLE hStored, HANDLE hFile, const std::string& key)
+	{
+		// A zlib stream cannot start with PREFIX_NAME, its first byte names deflate in the low 4 bits
+		BYTE header[STORED_HEADER_SIZE];
+		if (!ReadAt(hStored, 0, header, STORED_HEADER_SIZE) || memcmp(header, Crypto::PREFIX_NAME, sizeof(Crypto::PREFIX_NAME)) != 0)
+		{
+			return RestorePlain(hStored, hFile);
+		}
+		if (key.size() != AES_KEY_SIZE)
+		{
+			LOG_ERROR_W(L"[Crypto] The file is encrypted, a %d byte key is needed to restore it", AES_KEY_SIZE);
+			return FALSE;
+		}
+		return RestoreEncrypted(hStored, hFile, key, std::string((const char*)header + sizeof(Crypto::PREFIX_NAME), GCM_NONCE_LEN));
+	}
 }
\ No newline at end of file
@@ -1,37 +1,317 @@
 #pragma once
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
 #include "utils.h"
 #include "aes_gcm.h"
+#include "sha256.h"
+#include "zlib/zlib.h"
 #include "zlib/zip.h"
 #include "zlib/unzip.h"
 
+#define COMPRESS_LEVEL          Z_DEFAULT_COMPRESSION   // 0 (store) .. 9 (best)
+#define COMPRESS_WINDOW_BITS    MAX_WBITS               // 8..15 zlib, -8..-15 raw deflate, 16 + (8..15) gzip
+#define COMPRESS_MEMORY_LEVEL   8
+#define PARALLEL_BLOCK_SIZE     (128 * 1024)    // Input per block of the parallel deflate
+#define PARALLEL_MIN_SIZE       (1024 * 1024)   // Smaller chunks are deflated on the calling thread
+#define PARALLEL_DICT_SIZE      (32 * 1024)     // Tail of the previous block used as dictionary
+
+#define ADAPTIVE_SAMPLE_SIZE    (4 * 1024)  // Prefix of a chunk used for the entropy estimate
+#define ADAPTIVE_MAX_ENTROPY    7.5         // Bits per byte above which a chunk is sent stored
+#define ADAPTIVE_MIN_SAVING     0.05        // Chunks saving less than 5% count as incompressible
+#define ADAPTIVE_MIN_SAMPLES    4           // Chunks seen before the extension statistics are trusted
+
+#define PIPELINE_TILE_SIZE      (64 * 1024) // Piece of a chunk carried through every stage while it is in L2
+
+#define POOL_MIN_CLASS_BITS     12                  // Smallest pooled size class, 4 KB
+#define POOL_MAX_CLASS_BITS     28                  // Larger buffers are allocated and freed directly (256 MB)
+#define POOL_MAX_FREE_PER_CLASS 4                   // Idle buffers kept per size class
+#define POOL_MAX_FREE_BYTES     (128 * 1024 * 1024) // Idle memory kept by the whole pool
+
+#define STORED_HEADER_SIZE      (sizeof(Crypto::PREFIX_NAME) + GCM_NONCE_LEN) // PREFIX_NAME and the file nonce of an encrypted file
+#define STORED_TRAILER_SIZE     4                   // Size of an encrypted part, written behind it
+#define STORED_MAX_PART_SIZE    (64 * 1024 * 1024)  // A larger part size is a damaged trailer, uploads send 10 MB parts
+#define STORED_BUFFER_SIZE      (1024 * 1024)       // Read and inflate buffers of a restore
+
 namespace NetworkOperations 
 {
 	class IDataTransform 
 	{
 	public:
 		virtual ~IDataTransform() = default;
+		// Whole-buffer use: data_out is allocated with new[] by the transform, the caller releases it with delete[]
 		virtual BOOL TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) = 0;
 		virtual BOOL ReverseTransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) = 0;
+		// Largest output TransformData or a whole streamed chunk can produce from length_in bytes
+		virtual size_t Bound(size_t length_in) const = 0;
+		// Streaming use, zlib style: BeginChunk, then Process with caller-provided buffers. Each call reads up to
+		// length_in bytes and writes up to length_out bytes, reporting consumed and produced. With final set the
+		// chunk is flushed, calls continue until done. BeginChunk returns FALSE when only whole chunks are supported
+		virtual BOOL BeginChunk(ULONGLONG index, BOOL last) { return FALSE; }
+		virtual BOOL Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done) { return FALSE; }
+	};
+
+	// Work item queued by the WorkerPool without an allocation. It is linked into the queue itself,
+	// so the submitter keeps it alive until it has run or was cancelled, and submits it once at a time
+	class WorkerTask {
+		friend class WorkerPool;
+	private:
+		WorkerTask* next_task_ = NULL;
+	protected:
+		~WorkerTask() {}
+	public:
+		virtual void Run() = 0;
 	};
 
-	class DataCompress : IDataTransform {
+	// Threads kept for the whole process, so parallel work does not start threads of its own
+	class WorkerPool {
 	private:
-		std::string password_;
+		std::mutex mutex_;
+		std::condition_variable wake_;
+		WorkerTask* first_task_;
+		WorkerTask* last_task_;
+		std::vector<std::thread> threads_;
+		BOOL stopping_;
+		void WorkLoop();
 	public:
-		DataCompress() {}
-		~DataCompress() {}
+		explicit WorkerPool(DWORD threads);
+		~WorkerPool();
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+		// One worker for every core but the one of the calling thread
+		static WorkerPool& Instance();
+		DWORD GetThreadCount() const { return (DWORD)threads_.size(); }
+		void Submit(WorkerTask& task);
+		// Takes a task back from the queue, FALSE when a worker has already started it
+		BOOL Cancel(WorkerTask& task);
+	};
+
+	// Every call produces one complete deflate stream, the z_stream state is kept and reset between chunks
+	class DataCompress : public IDataTransform {
+	protected:
+		// Block of the parallel deflate, its input follows the dictionary. Deflated by a worker, or by the
+		// thread that needs its output when it takes the block back from the queue first. Blocks are
+		// reused for the whole life of the object, their buffers keep their capacity
+		struct ParallelBlock : public WorkerTask
+		{
+			DataCompress* owner = NULL;
+			std::vector<BYTE> input;
+			size_t dictionary = 0;
+			int level = 0;
+			BOOL last = FALSE;
+			BOOL queued = FALSE;    // Submitted to the WorkerPool, only used by the owner's thread
+			BOOL done = FALSE;      // Guarded by parallel_mutex_
+			BOOL success = FALSE;
+			uLong check = 0;
+			std::vector<BYTE> output;
+			size_t output_size = 0;
+			void Run() override { owner->DeflateBlock(*this); }
+		};
+		int level_;
+		int window_bits_;
+		int deflate_level_;
+		z_stream deflate_stream_;
+		z_stream inflate_stream_;
+		BOOL deflate_ready_;
+		BOOL inflate_ready_;
+		DWORD threads_;
+		BOOL chunk_started_;
+		BOOL parallel_;
+		std::mutex parallel_mutex_;
+		std::condition_variable parallel_done_;
+		std::vector<z_stream*> idle_streams_;
+		std::vector<ParallelBlock*> blocks_;        // Queued in stream order
+		ParallelBlock* filling_;
+		ParallelBlock* draining_;                  // Its output is being handed out
+		std::vector<ParallelBlock*> free_blocks_;
+		std::vector<BYTE> staged_;
+		size_t staged_offset_;
+		ULONGLONG parallel_in_;
+		uLong parallel_check_;
+		BOOL trailer_staged_;
+		BOOL StartDeflate(int level);
+		BOOL StartChunk(int level);
+		BOOL Deflate(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out, int level);
+		BOOL DeflateSpan(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done);
+		BOOL UseParallel(int level) const;
+		void StartParallel(int level);
+		BOOL ParallelSpan(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done);
+		ParallelBlock* AcquireBlock(int level);
+		void SubmitBlock(BOOL last);
+		void DeflateBlock(ParallelBlock& block);
+		void WaitBlock(ParallelBlock& block);
+		void WaitBlocks();
+	public:
+		DataCompress(int level = COMPRESS_LEVEL, int window_bits = COMPRESS_WINDOW_BITS);
+		~DataCompress();
+		// The z_stream states point into themselves and are ended once, a copy would end them twice
+		DataCompress(const DataCompress&) = delete;
+		DataCompress& operator=(const DataCompress&) = delete;
+		// More than one thread splits chunks into PARALLEL_BLOCK_SIZE blocks deflated in parallel (pigz style)
+		// by the WorkerPool. Whole buffers are only split from PARALLEL_MIN_SIZE on
+		void SetThreadCount(DWORD threads) { threads_ = max(threads, (DWORD)1); }
 		BOOL TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) override;
 		BOOL ReverseTransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) override;
+		size_t Bound(size_t length_in) const override;
+		// Streams with any thread count. The deflate state is set up by the first Process call of a chunk,
+		// which reports its errors
+		BOOL BeginChunk(ULONGLONG index, BOOL last) override;
+		BOOL Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done) override;
+	};
+
+	// Sends chunks that will not shrink as stored deflate blocks, the output stays readable by DataCompress
+	class AdaptiveCompress : public DataCompress {
+	private:
+		struct ExtensionStats
+		{
+			DWORD chunks = 0;
+			DWORD incompressible = 0;
+			DWORD skipped = 0;
+		};
+		std::wstring extension_;
+		BOOL measure_chunk_;
+		size_t chunk_in_;
+		size_t chunk_out_;
+		static std::mutex stats_mutex_;
+		static std::map<std::wstring, ExtensionStats> stats_;
+
+		BOOL IsKnownIncompressible();
+		void UpdateStats(BOOL incompressible);
+		static double EstimateEntropy(const BYTE* data, DWORD length);
+	public:
+		AdaptiveCompress(int level = COMPRESS_LEVEL, int window_bits = COMPRESS_WINDOW_BITS)
+			: DataCompress(level, window_bits), measure_chunk_(FALSE), chunk_in_(0), chunk_out_(0) {}
+		void SetFileExtension(const std::wstring& extension);
+		BOOL TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) override;
+		// The level is chosen on the first call, its input prefix is the entropy sample
+		BOOL BeginChunk(ULONGLONG index, BOOL last) override;
+		BOOL Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done) override;
 	};
 
-	class DataCryptor : IDataTransform {
+	// AES-GCM per chunk: ciphertext followed by a TAG_SIZE tag. The nonce of chunk i is the file nonce (iv)
+	// with i xored into its last 8 bytes, the AAD binds the chunk index and the last-chunk flag,
+	// so chunks can be encrypted in parallel and a reordered, dropped or truncated chunk fails to decrypt
+	class DataCryptor : public IDataTransform {
 	private:
 		std::string key_;
 		std::string iv_;
+		ULONGLONG encrypt_index_;
+		ULONGLONG decrypt_index_;
+		BOOL last_chunk_;
+		BOOL encrypt_ended_;
+		BOOL decrypt_ended_;
+		Crypto::GCM_CTX stream_ctx_;
+		BOOL PrepareChunk(ULONGLONG index, BOOL last, BYTE nonce[GCM_NONCE_LEN], BYTE aad[9]);
 	public:
-		DataCryptor(std::string key, std::string iv) : key_(key), iv_(iv) {}
-		~DataCryptor() {}
+		DataCryptor(std::string key, std::string iv)
+			: key_(key), iv_(iv), encrypt_index_(0), decrypt_index_(0), last_chunk_(FALSE), encrypt_ended_(FALSE), decrypt_ended_(FALSE) {}
+		~DataCryptor() { SecureZeroMemory(&stream_ctx_, sizeof(stream_ctx_)); }
+		// Sequential use, chunk indexes are counted by the transform. The next call handles the final chunk,
+		// a decryption then fails unless that chunk was encrypted as the final one, and later calls fail
+		void SetLastChunk() { last_chunk_ = TRUE; }
 		BOOL TransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) override;
 		BOOL ReverseTransformData(const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out) override;
+		// Random access, safe to call from several threads
+		BOOL TransformChunk(ULONGLONG index, BOOL last, const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out);
+		BOOL ReverseTransformChunk(ULONGLONG index, BOOL last, const BYTE* data_in, DWORD length_in, BYTE*& data_out, DWORD& length_out);
+		size_t Bound(size_t length_in) const override { return length_in + TAG_SIZE; }
+		// Encrypts the pieces of chunk index in order, the tag follows the final piece
+		BOOL BeginChunk(ULONGLONG index, BOOL last) override;
+		BOOL Process(const BYTE* data_in, size_t length_in, size_t& consumed,
+			BYTE* data_out, size_t length_out, size_t& produced, BOOL final, BOOL& done) override;
+	};
+
+	// Keeps released buffers for reuse, so a steady stream of chunks does not touch the heap. Idle buffers
+	// are limited per size class and in total, the rest goes back to the heap
+	class BufferPool {
+	private:
+		std::mutex mutex_;
+		std::vector<BYTE*> free_[POOL_MAX_CLASS_BITS + 1];
+		size_t free_bytes_;
+		static DWORD SizeClass(size_t size);
+	public:
+		BufferPool() : free_bytes_(0) {}
+		~BufferPool();
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+		static BufferPool& Instance();
+		// Buffers come in power of two size classes, so a reused buffer is less than twice the size asked for
+		BYTE* Acquire(size_t size);
+		// size is the one passed to Acquire. Kept for reuse while the pool is under its limits, freed otherwise
+		void Release(BYTE* buffer, size_t size);
+	};
+
+	// Buffer borrowed from a BufferPool for the lifetime of the object
+	class PooledBuffer {
+	private:
+		BufferPool* pool_;
+		BYTE* data_;
+		size_t size_;
+	public:
+		PooledBuffer(size_t size, BufferPool& pool = BufferPool::Instance()) : pool_(&pool), data_(pool.Acquire(size)), size_(size) {}
+		~PooledBuffer() { pool_->Release(data_, size_); }
+		PooledBuffer(const PooledBuffer&) = delete;
+		PooledBuffer& operator=(const PooledBuffer&) = delete;
+		BYTE* data() const { return data_; }
+		size_t size() const { return size_; }
+	};
+
+	// Runs each chunk through a chain of transforms (compress, encrypt, ...) one tile at a time, so every stage
+	// and the SHA-256 of the output touch a tile while it is still in cache. Stages write into pooled tile
+	// buffers and the last one into the caller's buffer, a stage that cannot stream gets its whole input
+	// collected and passes its result on in tiles
+	class ChunkPipeline {
+	private:
+		std::vector<IDataTransform*> stages_;
+		std::vector<BOOL> streaming_;
+		std::vector<std::unique_ptr<PooledBuffer>> scratch_;
+		std::vector<std::unique_ptr<PooledBuffer>> pending_;
+		std::vector<size_t> pending_size_;
+		Crypto::SHA256_CTX digest_;
+		size_t tile_size_;
+		BOOL Feed(size_t stage, const BYTE* data, size_t length, BOOL final, BYTE* data_out, size_t capacity, size_t& length_out);
+	public:
+		ChunkPipeline(size_t tile_size = PIPELINE_TILE_SIZE);
+		// Stages are not owned and run in the order they are added
+		void AddStage(IDataTransform* stage);
+		// Output size of the whole chain for a chunk of length_in bytes
+		size_t Bound(size_t length_in) const;
+		// capacity should be Bound(length_in), length_out receives the size of the result
+		BOOL ProcessChunk(ULONGLONG index, BOOL last, const BYTE* data_in, size_t length_in, BYTE* data_out, size_t capacity, size_t& length_out);
+		// Bytes stored between the chunks, a header or a trailer, go into the digest in their place
+		void AddToDigest(const BYTE* data, size_t length);
+		// SHA-256 of every output byte since construction, the bytes the server stores, call once after the last chunk
+		std::string GetDigest();
+	};
+
+	// The layout of a file on the server. A plain file is its parts one after the other, one zlib stream each.
+	// An encrypted file starts with PREFIX_NAME and its nonce, then holds every part as DataCryptor encrypted
+	// it followed by its size in STORED_TRAILER_SIZE little-endian bytes. The sizes trail the parts, so the
+	// layout is written and hashed in upload order, a download walks them back from the end of the file
+	class StoredLayout {
+	private:
+		static BOOL ReadAt(HANDLE hFile, ULONGLONG offset, BYTE* data, DWORD length);
+		static BOOL Inflate(z_stream& stream, const BYTE* data, size_t length, BYTE* output, size_t output_size, HANDLE hFile);
+		static BOOL RestorePlain(HANDLE hStored, HANDLE hFile);
+		static BOOL RestoreEncrypted(HANDLE hStored, HANDLE hFile, const std::string& key, const std::string& nonce);
+	public:
+		// Room WritePart needs for a part of length bytes
+		static size_t Bound(const ChunkPipeline& pipeline, size_t length);
+		// Part index of an upload through the pipeline into part. With a nonce the pipeline encrypts with it, the
+		// first part then starts with the header and every part ends with its trailer, all in the pipeline digest
+		static BOOL WritePart(ChunkPipeline& pipeline, const std::string& nonce, ULONGLONG index, BOOL last,
+			const BYTE* data, size_t length, BYTE* part, size_t capacity, size_t& part_size);
+		// Writes the original of the whole stored file to hFile. key opens an encrypted file, FALSE if the
+		// stored file is damaged or the key does not open it
+		static BOOL Restore(HANDLE hStored, HANDLE hFile, const std::string& key);
 	};
 }
\ No newline at end of file
@@ -1,118 +1,907 @@
 #include <fstream>
+#include <string.h>
+#include <stdexcept>
+#include "logger.h"
 #include "file_cache.h"
 
-namespace UserOperations 
+namespace
 {
+	// Snapshot layout, offsets from the start of the file: the header, the records, the path index,
+	// the id index and the paths. An index has bucket_count slots holding a record number + 1, 0 when
+	// empty, probed linearly from the hash of the key. Paths are UTF-16 without terminator.
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t count;
+		uint32_t bucket_count;			// Power of two above count
+		uint64_t records_offset;
+		uint64_t path_index_offset;
+		uint64_t id_index_offset;
+		uint64_t paths_offset;
+		uint64_t paths_length;			// In characters
+		uint64_t file_size;
+	};
+
+	struct CacheRecord
+	{
+		DWORD id;
+		uint32_t path_hash;
+		uint32_t path_offset;			// In characters from paths_offset
+		uint32_t path_length;
+	};
+
+	// Live record of the cache while a snapshot is written
+	struct CacheEntry
+	{
+		const wchar_t* path;
+		uint32_t length;
+		DWORD id;
+	};
+
+	// FNV-1a over the UTF-16 units
+	inline uint32_t HashPath(const wchar_t* path, size_t length)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < length; i++)
+		{
+			hash = (hash ^ (uint32_t)path[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	inline uint32_t HashID(DWORD id)
+	{
+		uint32_t hash = id;
+		hash ^= hash >> 16;
+		hash *= 0x85EBCA6Bu;
+		hash ^= hash >> 13;
+		hash *= 0xC2B2AE35u;
+		hash ^= hash >> 16;
+		return hash;
+	}
+
+	inline const CacheHeader* GetHeader(const BYTE* view)
+	{
+		return (const CacheHeader*)view;
+	}
+
+	inline const CacheRecord* GetRecords(const BYTE* view)
+	{
+		return (const CacheRecord*)(view + GetHeader(view)->records_offset);
+	}
+
+	inline const uint32_t* GetPathIndex(const BYTE* view)
+	{
+		return (const uint32_t*)(view + GetHeader(view)->path_index_offset);
+	}
+
+	inline const uint32_t* GetIDIndex(const BYTE* view)
+	{
+		return (const uint32_t*)(view + GetHeader(view)->id_index_offset);
+	}
+
+	// Path of a record, NULL if it points outside the paths
+	inline const wchar_t* GetRecordPath(const BYTE* view, const CacheRecord& record)
+	{
+		const CacheHeader* header = GetHeader(view);
+		if ((uint64_t)record.path_offset + record.path_length > header->paths_length)
+		{
+			return NULL;
+		}
+		return (const wchar_t*)(view + header->paths_offset) + record.path_offset;
+	}
+
+	// A region of 'count' items of 'size' bytes inside the file, aligned for its items
+	inline bool IsRegionValid(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size)
+	{
+		return offset % size == 0 && offset <= file_size && count <= (file_size - offset) / size;
+	}
+
+	BOOL WriteSnapshotFile(const std::wstring& path, const BYTE* data, size_t size)
+	{
+		HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			return FALSE;
+		}
+		while (size > 0)
+		{
+			DWORD bytesWrite = 0;
+			DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+			if (!WriteFile(hFile, data, chunk, &bytesWrite, NULL) || bytesWrite != chunk)
+			{
+				CloseHandle(hFile);
+				return FALSE;
+			}
+			data += chunk;
+			size -= chunk;
+		}
+		// The snapshot must be on disk before it replaces the old one
+		BOOL flushed = FlushFileBuffers(hFile);
+		CloseHandle(hFile);
+		return flushed;
+	}
+
+	class SharedLock
+	{
+	public:
+		explicit SharedLock(SRWLOCK& lock) : lock(lock) { AcquireSRWLockShared(&lock); }
+		~SharedLock() { ReleaseSRWLockShared(&lock); }
+	private:
+		SRWLOCK& lock;
+	};
+
+	class ExclusiveLock
+	{
+	public:
+		explicit ExclusiveLock(SRWLOCK& lock) : lock(lock) { AcquireSRWLockExclusive(&lock); }
+		~ExclusiveLock() { ReleaseSRWLockExclusive(&lock); }
+	private:
+		SRWLOCK& lock;
+	};
+}
+
+namespace UserOperations
+{
+	FileCache::FileCache(const std::wstring& path)
+		: store_path(path), map_file(INVALID_HANDLE_VALUE), map_handle(NULL), view(NULL), base_count(0), snapshot_size(0),
+		dirty(false), live_valid(false), compact_pending(false), stopping(false)
+	{
+		for (Shard& shard : shards)
+		{
+			InitializeSRWLock(&shard.lock);
+		}
+		compactor = std::thread(&FileCache::compactLoop, this);
+	}
+
+	FileCache::~FileCache()
+	{
+		{
+			std::lock_guard<std::mutex> lock(compact_mutex);
+			stopping = true;
+		}
+		compact_requested.notify_one();
+		compactor.join();
+		log.Close();
+		unmapSnapshot();
+	}
+
+	FileCache::ShardsLock::ShardsLock(FileCache& cache, bool exclusive) : cache(cache), exclusive(exclusive)
+	{
+		for (Shard& shard : cache.shards)
+		{
+			if (exclusive)
+			{
+				AcquireSRWLockExclusive(&shard.lock);
+			}
+			else
+			{
+				AcquireSRWLockShared(&shard.lock);
+			}
+		}
+	}
+
+	FileCache::ShardsLock::~ShardsLock()
+	{
+		for (size_t i = sizeof(cache.shards) / sizeof(cache.shards[0]); i-- > 0; )
+		{
+			if (exclusive)
+			{
+				ReleaseSRWLockExclusive(&cache.shards[i].lock);
+			}
+			else
+			{
+				ReleaseSRWLockShared(&cache.shards[i].lock);
+			}
+		}
+	}
+
+	size_t FileCache::getCount()
+	{
+		ShardsLock lock(*this, false);
+		return countFiles();
+	}
+
 	bool FileCache::isEmptyCache()
 	{
-		return file_cache.empty();
+		ShardsLock lock(*this, false);
+		return countFiles() == 0;
 	}
 
 	bool FileCache::isFileExist(const std::wstring& path)
 	{
-		return file_cache.find(path) != file_cache.end();
+		uint32_t hash = HashPath(path.data(), path.size());
+		Shard& shard = shards[getShardIndex(hash)];
+		SharedLock lock(shard.lock);
+		return shard.added_paths.find(path) != shard.added_paths.end() || findBasePath(shard, path, hash) >= 0;
 	}
 
 	void FileCache::insertFile(const std::wstring& path, DWORD id)
 	{
-		if (!file_cache.empty() && (file_cache.find(path) != file_cache.end()))
+		uint32_t hash = HashPath(path.data(), path.size());
+		Shard& shard = shards[getShardIndex(hash)];
+		ExclusiveLock lock(shard.lock);
+		if (applyInsert(shard, path, hash, id))
 		{
-			file_cache[path] = id;
+			// Appended under the shard lock, so the log has the changes of a path in the order they were made
+			log.Append(FileCacheLog::LOG_INSERT, path, id);
+			requestCompaction(false);
 		}
-		else
+	}
+
+	void FileCache::removeFile(int index)
+	{
+		ShardsLock lock(*this, true);
+		uint32_t record;
+		const Entry* entry = getEntry(index, record);
+		std::wstring path = entry != NULL ? entry->path : getBasePath(record);
+		uint32_t hash = HashPath(path.data(), path.size());
+		if (applyRemove(shards[getShardIndex(hash)], path, hash))
 		{
-			file_cache.insert({ path, id });
+			log.Append(FileCacheLog::LOG_REMOVE, path, 0);
+			requestCompaction(false);
 		}
 	}
 
-	void FileCache::removeFile(int index) 
+	void FileCache::removeFile(const std::wstring& path)
 	{
-		if (index < 0 || index >= file_cache.size())
+		uint32_t hash = HashPath(path.data(), path.size());
+		Shard& shard = shards[getShardIndex(hash)];
+		ExclusiveLock lock(shard.lock);
+		if (applyRemove(shard, path, hash))
 		{
-			throw std::out_of_range("Index out of range");
+			log.Append(FileCacheLog::LOG_REMOVE, path, 0);
+			requestCompaction(false);
 		}
-		auto it = file_cache.begin();
-		std::advance(it, index);
-		file_cache.erase(it);
 	}
 
-	void FileCache::removeFile(const std::wstring& path) 
+	// Changes the records in memory, false if 'path' already had 'id'. The caller holds 'shard', the one of 'hash'.
+	bool FileCache::applyInsert(Shard& shard, const std::wstring& path, uint32_t hash, DWORD id)
 	{
-		file_cache.erase(path);
+		auto it = shard.added_paths.find(path);
+		if (it != shard.added_paths.end())
+		{
+			Entry& entry = shard.added[it->second];
+			if (entry.id != id)
+			{
+				auto owner = shard.added_ids.find(entry.id);
+				if (owner != shard.added_ids.end() && owner->second == it->second)
+				{
+					shard.added_ids.erase(owner);
+				}
+				entry.id = id;
+				shard.added_ids[id] = it->second;
+				dirty = true;
+				return true;
+			}
+			return false;
+		}
+		int64_t record = findBasePath(shard, path, hash);
+		if (record >= 0)
+		{
+			if (GetRecords(view)[record].id == id)
+			{
+				return false;
+			}
+			// The new id goes with the added records, the snapshot one is shadowed
+			removeBase(shard, (uint32_t)record);
+		}
+		uint32_t index = (uint32_t)shard.added.size();
+		shard.added.push_back({ path, id });
+		shard.added_paths[path] = index;
+		shard.added_ids[id] = index;
+		dirty = true;
+		return true;
 	}
 
-	DWORD FileCache::getFileID(int index)
+	bool FileCache::applyRemove(Shard& shard, const std::wstring& path, uint32_t hash)
 	{
-		if (index < 0 || index >= file_cache.size())
+		auto it = shard.added_paths.find(path);
+		if (it != shard.added_paths.end())
 		{
-			throw std::out_of_range("Index out of range");
+			removeAdded(shard, it->second);
+			return true;
 		}
-		auto it = file_cache.begin();
-		std::advance(it, index);
-		return it->second;
+		int64_t record = findBasePath(shard, path, hash);
+		if (record >= 0)
+		{
+			removeBase(shard, (uint32_t)record);
+			return true;
+		}
+		return false;
+	}
+
+	DWORD FileCache::getFileID(int index)
+	{
+		ShardsLock lock(*this, false);
+		uint32_t record;
+		const Entry* entry = getEntry(index, record);
+		return entry != NULL ? entry->id : GetRecords(view)[record].id;
 	}
 
 	DWORD FileCache::getFileID(const std::wstring& path)
 	{
-		auto it = file_cache.find(path);
-		if (it != file_cache.end())
+		uint32_t hash = HashPath(path.data(), path.size());
+		Shard& shard = shards[getShardIndex(hash)];
+		SharedLock lock(shard.lock);
+		auto it = shard.added_paths.find(path);
+		if (it != shard.added_paths.end())
 		{
-			return it->second;
+			return shard.added[it->second].id;
+		}
+		int64_t record = findBasePath(shard, path, hash);
+		if (record >= 0)
+		{
+			return GetRecords(view)[record].id;
 		}
 		throw std::runtime_error("File not found");
 	}
 
-	std::wstring FileCache::getFilePath(int index) 
+	std::wstring FileCache::getFilePath(int index)
 	{
-		if (index < 0 || index >= file_cache.size())
-		{
-			throw std::out_of_range("Index out of range");
-		}
-		auto it = file_cache.begin();
-		std::advance(it, index);
-		return it->first;
+		ShardsLock lock(*this, false);
+		uint32_t record;
+		const Entry* entry = getEntry(index, record);
+		return entry != NULL ? entry->path : getBasePath(record);
 	}
 
 	std::wstring FileCache::getFilePath(DWORD id)
 	{
-		for (const auto& pair : file_cache)
+		// Shards go by path, so any of them may hold the id
+		ShardsLock lock(*this, false);
+		for (const Shard& shard : shards)
 		{
-			if (pair.second == id)
+			auto it = shard.added_ids.find(id);
+			if (it != shard.added_ids.end())
 			{
-				return pair.first;
+				return shard.added[it->second].path;
 			}
 		}
+		int64_t record = findBaseID(id);
+		if (record >= 0)
+		{
+			return getBasePath((uint32_t)record);
+		}
 		throw std::runtime_error("File ID not found");
 	}
 
+	/**
+	 * Makes every change so far durable: waits for the log to write them, sharing one flush with the
+	 * changes of other threads. Without a loaded store the records are written as its snapshot.
+	 *
+	 * @access public
+	 */
 	void FileCache::saveFileCache()
 	{
-		std::wofstream ofs(store_path);
-		if (!ofs)
+		bool logged;
 		{
+			// Any shard keeps the log from being opened or closed
+			SharedLock lock(shards[0].lock);
+			logged = log.IsOpen();
+		}
+		if (!logged)
+		{
+			ShardsLock lock(*this, true);
+			compactFileCache();
+			return;
+		}
+		if (!log.Sync())
+		{
+			throw std::runtime_error("Could not write the cache log");
+		}
+	}
+
+	/**
+	 * Writes the records into a new snapshot, puts it in place of the old one and empties the log.
+	 * The snapshot is flushed before the move, so after a crash the store is the old snapshot or the
+	 * new one, whole; a crash before the log is emptied replays changes the snapshot already has,
+	 * which leaves the same records. The caller holds every shard exclusively.
+	 *
+	 * @access private
+	 */
+	void FileCache::compactFileCache()
+	{
+		if (!dirty)
+		{
+			if (log.IsOpen())
+			{
+				log.Reset();
+			}
+			return;
+		}
+		std::vector<CacheEntry> entries;
+		entries.reserve(countFiles());
+		uint64_t paths_length = 0;
+		if (view != NULL)
+		{
+			const CacheRecord* records = GetRecords(view);
+			for (uint32_t r = 0; r < base_count; r++)
+			{
+				const wchar_t* path = GetRecordPath(view, records[r]);
+				if (!isBaseRemoved(r) && path != NULL)
+				{
+					entries.push_back({ path, records[r].path_length, records[r].id });
+					paths_length += records[r].path_length;
+				}
+			}
+		}
+		for (const Shard& shard : shards)
+		{
+			for (const Entry& entry : shard.added)
+			{
+				entries.push_back({ entry.path.data(), (uint32_t)entry.path.size(), entry.id });
+				paths_length += entry.path.size();
+			}
+		}
+		if (entries.size() >= 0x40000000 || paths_length > 0xFFFFFFFF)
+		{
+			throw std::runtime_error("File cache too large");
+		}
+
+		uint32_t count = (uint32_t)entries.size();
+		uint32_t bucket_count = 16;
+		while (bucket_count < count * 2)
+		{
+			bucket_count <<= 1;
+		}
+		CacheHeader header;
+		memcpy(header.magic, FILE_CACHE_MAGIC, sizeof(header.magic));
+		header.version = FILE_CACHE_VERSION;
+		header.count = count;
+		header.bucket_count = bucket_count;
+		header.records_offset = sizeof(CacheHeader);
+		header.path_index_offset = header.records_offset + (uint64_t)count * sizeof(CacheRecord);
+		header.id_index_offset = header.path_index_offset + (uint64_t)bucket_count * sizeof(uint32_t);
+		header.paths_offset = header.id_index_offset + (uint64_t)bucket_count * sizeof(uint32_t);
+		header.paths_length = paths_length;
+		header.file_size = header.paths_offset + paths_length * sizeof(wchar_t);
+
+		std::vector<BYTE> buffer((size_t)header.file_size);
+		BYTE* data = buffer.data();
+		memcpy(data, &header, sizeof(header));
+		CacheRecord* records = (CacheRecord*)(data + header.records_offset);
+		uint32_t* path_index = (uint32_t*)(data + header.path_index_offset);
+		uint32_t* id_index = (uint32_t*)(data + header.id_index_offset);
+		wchar_t* paths = (wchar_t*)(data + header.paths_offset);
+		uint32_t mask = bucket_count - 1;
+		uint32_t offset = 0;
+		for (uint32_t r = 0; r < count; r++)
+		{
+			const CacheEntry& entry = entries[r];
+			CacheRecord& record = records[r];
+			record.id = entry.id;
+			record.path_hash = HashPath(entry.path, entry.length);
+			record.path_offset = offset;
+			record.path_length = entry.length;
+			memcpy(paths + offset, entry.path, entry.length * sizeof(wchar_t));
+			offset += entry.length;
+
+			uint32_t i = record.path_hash & mask;
+			while (path_index[i] != 0)
+			{
+				i = (i + 1) & mask;
+			}
+			path_index[i] = r + 1;
+			i = HashID(record.id) & mask;
+			while (id_index[i] != 0)
+			{
+				i = (i + 1) & mask;
+			}
+			id_index[i] = r + 1;
+		}
+
+		std::wstring temp_path = store_path + L".tmp";
+		if (!WriteSnapshotFile(temp_path, data, buffer.size()))
+		{
+			DeleteFileW(temp_path.c_str());
 			throw std::runtime_error("Could not open file for writing");
 		}
-		for (const auto& pair : file_cache)
+		// A mapped file can not be replaced
+		unmapSnapshot();
+		if (!MoveFileExW(temp_path.c_str(), store_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			DeleteFileW(temp_path.c_str());
+			// The changes still apply to the old snapshot
+			mapSnapshot();
+			throw std::runtime_error("Could not replace the cache file");
+		}
+		resetChanges();
+		if (!mapSnapshot())
 		{
-			ofs << pair.first << L" " << pair.second << L"\n";
+			throw std::runtime_error("Could not open file for reading");
+		}
+		if (log.IsOpen() && !log.Reset())
+		{
+			throw std::runtime_error("Could not empty the cache log");
 		}
-		ofs.close();
 	}
 
+	/**
+	 * Maps the snapshot and replays the log on top of it. A missing store is an empty cache, and a
+	 * store in the former text format is read once and rewritten as a snapshot in the background.
+	 *
+	 * @access public
+	 */
 	void FileCache::loadFileCache()
 	{
-		DWORD id;
-		std::wstring path;
+		ShardsLock lock(*this, true);
+		log.Close();
+		unmapSnapshot();
+		resetChanges();
+		bool legacy = false;
+		if (GetFileAttributesW(store_path.c_str()) == INVALID_FILE_ATTRIBUTES)
+		{
+			DWORD error = GetLastError();
+			if (error != ERROR_FILE_NOT_FOUND && error != ERROR_PATH_NOT_FOUND)
+			{
+				throw std::runtime_error("Could not open file for reading");
+			}
+		}
+		else if (!mapSnapshot())
+		{
+			legacy = loadLegacyCache();
+			if (!legacy)
+			{
+				resetChanges();
+				throw std::runtime_error("Invalid file cache");
+			}
+		}
+		bool opened = log.Open(store_path + L".wal", [this](FileCacheLog::Operation operation, const std::wstring& path, DWORD id)
+		{
+			uint32_t hash = HashPath(path.data(), path.size());
+			Shard& shard = shards[getShardIndex(hash)];
+			if (operation == FileCacheLog::LOG_INSERT)
+			{
+				applyInsert(shard, path, hash, id);
+			}
+			else
+			{
+				applyRemove(shard, path, hash);
+			}
+		});
+		if (!opened)
+		{
+			throw std::runtime_error("Could not open the cache log");
+		}
+		requestCompaction(legacy);
+	}
+
+	void FileCache::deleteFileCache()
+	{
+		ShardsLock lock(*this, true);
+		log.Close();
+		unmapSnapshot();
+		resetChanges();
+		DeleteFileW(store_path.c_str());
+		DeleteFileW((store_path + L".wal").c_str());
+	}
+
+	// Wakes the compactor once the log has grown past the snapshot. The caller holds a shard, which
+	// keeps the log and the snapshot in place.
+	void FileCache::requestCompaction(bool force)
+	{
+		if (compact_pending || !log.IsOpen())
+		{
+			return;
+		}
+		uint64_t limit = snapshot_size > FILE_CACHE_COMPACT_SIZE ? snapshot_size : FILE_CACHE_COMPACT_SIZE;
+		if (force || log.GetSize() > limit)
+		{
+			{
+				std::lock_guard<std::mutex> lock(compact_mutex);
+				compact_pending = true;
+			}
+			compact_requested.notify_one();
+		}
+	}
+
+	void FileCache::compactLoop()
+	{
+		std::unique_lock<std::mutex> lock(compact_mutex);
+		while (true)
+		{
+			compact_requested.wait(lock, [this]() { return stopping || compact_pending; });
+			if (stopping)
+			{
+				break;
+			}
+			compact_pending = false;
+			// A writer asks for compaction while it holds its shard, so the shards are not taken under compact_mutex
+			lock.unlock();
+			try
+			{
+				ShardsLock shards_lock(*this, true);
+				compactFileCache();
+			}
+			catch (const std::exception& ex)
+			{
+				// The log still holds the changes, the next request tries again
+				LOG_WARNING_W(L"[Cache] Failed to compact the file cache: %S", ex.what());
+			}
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Maps the store read-only and checks that the header describes regions inside the file. Records
+	 * and index slots are checked when they are read.
+	 *
+	 * @access private
+	 *
+	 * @return bool Returns false if the store can not be opened or is not a snapshot
+	 */
+	bool FileCache::mapSnapshot()
+	{
+		map_file = CreateFileW(store_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (map_file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(map_file, &size) || size.QuadPart < (LONGLONG)sizeof(CacheHeader))
+		{
+			unmapSnapshot();
+			return false;
+		}
+		map_handle = CreateFileMappingW(map_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map_handle == NULL)
+		{
+			unmapSnapshot();
+			return false;
+		}
+		view = (const BYTE*)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+		if (view == NULL)
+		{
+			unmapSnapshot();
+			return false;
+		}
+
+		const CacheHeader* header = GetHeader(view);
+		uint64_t file_size = (uint64_t)size.QuadPart;
+		if (memcmp(header->magic, FILE_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != FILE_CACHE_VERSION || header->file_size != file_size ||
+			header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+			header->bucket_count <= header->count ||
+			!IsRegionValid(header->records_offset, header->count, sizeof(CacheRecord), file_size) ||
+			!IsRegionValid(header->path_index_offset, header->bucket_count, sizeof(uint32_t), file_size) ||
+			!IsRegionValid(header->id_index_offset, header->bucket_count, sizeof(uint32_t), file_size) ||
+			!IsRegionValid(header->paths_offset, header->paths_length, sizeof(wchar_t), file_size))
+		{
+			unmapSnapshot();
+			return false;
+		}
+		base_count = header->count;
+		snapshot_size = file_size;
+		return true;
+	}
+
+	void FileCache::unmapSnapshot()
+	{
+		if (view != NULL)
+		{
+			UnmapViewOfFile(view);
+			view = NULL;
+		}
+		if (map_handle != NULL)
+		{
+			CloseHandle(map_handle);
+			map_handle = NULL;
+		}
+		if (map_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(map_file);
+			map_file = INVALID_HANDLE_VALUE;
+		}
+		base_count = 0;
+		snapshot_size = 0;
+	}
+
+	// The former store, one "path id" line per file, where the path may hold spaces
+	bool FileCache::loadLegacyCache()
+	{
 		std::wifstream ifs(store_path);
 		if (!ifs)
 		{
-			throw std::runtime_error("Could not open file for reading");
+			return false;
+		}
+		std::wstring line;
+		while (std::getline(ifs, line))
+		{
+			if (line.empty())
+			{
+				continue;
+			}
+			size_t space = line.rfind(L' ');
+			if (space == std::wstring::npos || space == 0 || space + 1 == line.size() ||
+				line.find_first_not_of(L"0123456789", space + 1) != std::wstring::npos)
+			{
+				return false;
+			}
+			std::wstring path = line.substr(0, space);
+			uint32_t hash = HashPath(path.data(), path.size());
+			applyInsert(shards[getShardIndex(hash)], path, hash, wcstoul(line.c_str() + space + 1, NULL, 10));
+		}
+		live_valid = false;
+		// A read error stops getline as well
+		return ifs.eof();
+	}
+
+	int64_t FileCache::findBasePath(const Shard& shard, const std::wstring& path, uint32_t hash) const
+	{
+		if (view == NULL)
+		{
+			return -1;
+		}
+		const CacheHeader* header = GetHeader(view);
+		const CacheRecord* records = GetRecords(view);
+		const uint32_t* index = GetPathIndex(view);
+		uint32_t mask = header->bucket_count - 1;
+		for (uint32_t i = hash & mask, probe = 0; probe < header->bucket_count; i = (i + 1) & mask, probe++)
+		{
+			uint32_t slot = index[i];
+			if (slot == 0 || slot > base_count)
+			{
+				return -1;
+			}
+			const CacheRecord& record = records[slot - 1];
+			if (record.path_hash != hash || record.path_length != path.size())
+			{
+				continue;
+			}
+			const wchar_t* text = GetRecordPath(view, record);
+			if (text != NULL && memcmp(text, path.data(), path.size() * sizeof(wchar_t)) == 0)
+			{
+				return (shard.removed.empty() || shard.removed.count(slot - 1) == 0) ? (int64_t)(slot - 1) : -1;
+			}
+		}
+		return -1;
+	}
+
+	int64_t FileCache::findBaseID(DWORD id) const
+	{
+		if (view == NULL)
+		{
+			return -1;
+		}
+		const CacheHeader* header = GetHeader(view);
+		const CacheRecord* records = GetRecords(view);
+		const uint32_t* index = GetIDIndex(view);
+		uint32_t mask = header->bucket_count - 1;
+		for (uint32_t i = HashID(id) & mask, probe = 0; probe < header->bucket_count; i = (i + 1) & mask, probe++)
+		{
+			uint32_t slot = index[i];
+			if (slot == 0 || slot > base_count)
+			{
+				return -1;
+			}
+			// A removed record may share its id with one still live
+			if (records[slot - 1].id == id && !isBaseRemoved(slot - 1))
+			{
+				return slot - 1;
+			}
+		}
+		return -1;
+	}
+
+	std::wstring FileCache::getBasePath(uint32_t record) const
+	{
+		const CacheRecord& entry = GetRecords(view)[record];
+		const wchar_t* text = GetRecordPath(view, entry);
+		return text != NULL ? std::wstring(text, entry.path_length) : std::wstring();
+	}
+
+	// A snapshot record is in the shard of its stored hash, the one findBasePath matches it with
+	bool FileCache::isBaseRemoved(uint32_t record) const
+	{
+		const Shard& shard = shards[getShardIndex(GetRecords(view)[record].path_hash)];
+		return !shard.removed.empty() && shard.removed.count(record) != 0;
+	}
+
+	size_t FileCache::countFiles() const
+	{
+		size_t count = base_count;
+		for (const Shard& shard : shards)
+		{
+			count += shard.added.size();
+			count -= shard.removed.size();
+		}
+		return count;
+	}
+
+	void FileCache::resetChanges()
+	{
+		for (Shard& shard : shards)
+		{
+			shard.added.clear();
+			shard.added_paths.clear();
+			shard.added_ids.clear();
+			shard.removed.clear();
+		}
+		live_slots.clear();
+		live_valid = false;
+		dirty = false;
+	}
+
+	void FileCache::removeAdded(Shard& shard, uint32_t index)
+	{
+		Entry& entry = shard.added[index];
+		shard.added_paths.erase(entry.path);
+		auto owner = shard.added_ids.find(entry.id);
+		if (owner != shard.added_ids.end() && owner->second == index)
+		{
+			shard.added_ids.erase(owner);
+		}
+		// The last record takes the freed place
+		uint32_t last = (uint32_t)shard.added.size() - 1;
+		if (index != last)
+		{
+			entry = std::move(shard.added[last]);
+			shard.added_paths[entry.path] = index;
+			owner = shard.added_ids.find(entry.id);
+			if (owner != shard.added_ids.end() && owner->second == last)
+			{
+				owner->second = index;
+			}
+		}
+		shard.added.pop_back();
+		dirty = true;
+	}
+
+	void FileCache::removeBase(Shard& shard, uint32_t record)
+	{
+		if (shard.removed.insert(record).second)
+		{
+			live_valid = false;
+			dirty = true;
+		}
+	}
+
+	/**
+	 * Record at 'index': the snapshot records still live in their order, then the added records shard
+	 * by shard. The caller holds every shard.
+	 *
+	 * @access private
+	 *
+	 * @return Entry Returns the added record, or NULL with 'record' set to the snapshot record
+	 */
+	const FileCache::Entry* FileCache::getEntry(int index, uint32_t& record)
+	{
+		if (index < 0 || (size_t)index >= countFiles())
+		{
+			throw std::out_of_range("Index out of range");
+		}
+		// Readers holding the shards shared may get here together
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		if (!live_valid)
+		{
+			live_slots.clear();
+			live_slots.reserve(base_count);
+			for (uint32_t r = 0; r < base_count; r++)
+			{
+				if (!isBaseRemoved(r))
+				{
+					live_slots.push_back(r);
+				}
+			}
+			live_valid = true;
 		}
-		file_cache.clear();
-		while (ifs >> path >> id)
+		size_t position = (size_t)index;
+		if (position < live_slots.size())
 		{
-			file_cache[path] = id;
+			record = live_slots[position];
+			return NULL;
+		}
+		position -= live_slots.size();
+		for (const Shard& shard : shards)
+		{
+			if (position < shard.added.size())
+			{
+				return &shard.added[position];
+			}
+			position -= shard.added.size();
 		}
-		ifs.close();
+		throw std::out_of_range("Index out of range");
 	}
-}
\ No newline at end of file
+}
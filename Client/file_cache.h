@@ -1,17 +1,114 @@
 #pragma once
-#include <map>
+#include <mutex>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
 #include <Windows.h>
+#include "file_cache_log.h"
 
-namespace UserOperations 
+#define FILE_CACHE_MAGIC		"FCAC"
+#define FILE_CACHE_VERSION		1
+#define FILE_CACHE_COMPACT_SIZE	(4 * 1024 * 1024)	// Log bytes before it is folded into a new snapshot, at least the snapshot size
+#define FILE_CACHE_SHARD_BITS	6					// 64 shards, taken from the top bits of the path hash
+
+namespace UserOperations
 {
-	class FileCache 
+	// Local path of every uploaded file and the id the server gave it. The store is a binary snapshot
+	// holding the records, their paths and an open-addressing index for each direction; it is mapped
+	// as is, so loading does not depend on its size and lookups probe the mapped indexes. Changes made
+	// since the snapshot are kept in memory on top of it and appended to a log next to the store, which
+	// a background thread folds into a new snapshot once it outgrows it.
+	//
+	// The methods are thread-safe. The changes are split in shards by path hash, each behind its own
+	// reader/writer lock, so the calls that take a path only hold the shard of that path and readers
+	// never wait for each other. The calls that take an index or an id, and the ones that replace the
+	// snapshot, hold every shard in order.
+	class FileCache
 	{
 	private:
+		struct Entry
+		{
+			std::wstring path;
+			DWORD id;
+		};
+
+		// Changes to the paths whose hash falls in the shard
+		struct Shard
+		{
+			SRWLOCK lock;
+			std::vector<Entry> added;						// Records added since the snapshot
+			std::unordered_map<std::wstring, uint32_t> added_paths;
+			std::unordered_map<DWORD, uint32_t> added_ids;
+			std::unordered_set<uint32_t> removed;			// Snapshot records removed or replaced since it was mapped
+		};
+
+		// Holds every shard, in order, for the calls that see the cache as a whole
+		class ShardsLock
+		{
+		public:
+			ShardsLock(FileCache& cache, bool exclusive);
+			~ShardsLock();
+		private:
+			ShardsLock(const ShardsLock&) = delete;
+			ShardsLock& operator=(const ShardsLock&) = delete;
+			FileCache& cache;
+			bool exclusive;
+		};
+
 		std::wstring store_path;
-		std::map<std::wstring /*file_path*/, DWORD /*file_id*/> file_cache;
+
+		// Mapped snapshot, only replaced while every shard is held
+		HANDLE map_file;
+		HANDLE map_handle;
+		const BYTE* view;
+		uint32_t base_count;
+		uint64_t snapshot_size;
+
+		Shard shards[1 << FILE_CACHE_SHARD_BITS];
+		std::atomic<bool> dirty;
+
+		// Live snapshot records in order, the first indexes; the added records of each shard follow them
+		std::mutex slots_mutex;
+		std::vector<uint32_t> live_slots;
+		std::atomic<bool> live_valid;		// Cleared when a snapshot record is removed
+
+		FileCacheLog log;
+		std::mutex compact_mutex;
+		std::thread compactor;
+		std::condition_variable compact_requested;
+		std::atomic<bool> compact_pending;
+		bool stopping;
+
+		FileCache(const FileCache&) = delete;
+		FileCache& operator=(const FileCache&) = delete;
+
+		static uint32_t getShardIndex(uint32_t hash) { return hash >> (32 - FILE_CACHE_SHARD_BITS); }
+		bool mapSnapshot();
+		void unmapSnapshot();
+		bool loadLegacyCache();
+		int64_t findBasePath(const Shard& shard, const std::wstring& path, uint32_t hash) const;
+		int64_t findBaseID(DWORD id) const;
+		std::wstring getBasePath(uint32_t record) const;
+		bool isBaseRemoved(uint32_t record) const;
+		void resetChanges();
+		bool applyInsert(Shard& shard, const std::wstring& path, uint32_t hash, DWORD id);
+		bool applyRemove(Shard& shard, const std::wstring& path, uint32_t hash);
+		void removeAdded(Shard& shard, uint32_t index);
+		void removeBase(Shard& shard, uint32_t record);
+		const Entry* getEntry(int index, uint32_t& record);
+		size_t countFiles() const;
+		void compactFileCache();
+		void requestCompaction(bool force);
+		void compactLoop();
 	public:
-		FileCache(const std::wstring& path) : store_path(path) {}
+		FileCache(const std::wstring& path);
+		~FileCache();
+		size_t getCount();
 		bool isEmptyCache();
 		bool isFileExist(const std::wstring& path);
 		void insertFile(const std::wstring& path, DWORD id);
@@ -26,4 +123,4 @@ namespace UserOperations
 		void deleteFileCache();
 	};
 
-}
\ No newline at end of file
+}
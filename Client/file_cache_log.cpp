@@ -0,0 +1,323 @@
+#include <string.h>
+#include "file_cache_log.h"
+#include "zlib/crc32_simd.h"
+
+namespace
+{
+	const DWORD kHeaderSize = 8;			// Magic and version
+	const DWORD kRecordHeaderSize = 8;		// CRC-32C and body length
+	const DWORD kBodyHeaderSize = 5;		// Operation and id
+
+	inline void PutU32(BYTE* out, uint32_t value)
+	{
+		memcpy(out, &value, sizeof(value));
+	}
+
+	inline uint32_t GetU32(const BYTE* in)
+	{
+		uint32_t value;
+		memcpy(&value, in, sizeof(value));
+		return value;
+	}
+
+	BOOL WriteAll(HANDLE file, const BYTE* data, size_t size)
+	{
+		while (size > 0)
+		{
+			DWORD bytesWrite = 0;
+			DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+			if (!WriteFile(file, data, chunk, &bytesWrite, NULL) || bytesWrite != chunk)
+			{
+				return FALSE;
+			}
+			data += chunk;
+			size -= chunk;
+		}
+		return TRUE;
+	}
+
+	BOOL SeekTo(HANDLE file, uint64_t offset)
+	{
+		LARGE_INTEGER position;
+		position.QuadPart = (LONGLONG)offset;
+		return SetFilePointerEx(file, position, NULL, FILE_BEGIN);
+	}
+}
+
+namespace UserOperations
+{
+	FileCacheLog::FileCacheLog()
+		: file(INVALID_HANDLE_VALUE), appended(0), durable(0), size(0), waiters(0), writing(false), failed(false),
+		stopping(false)
+	{
+	}
+
+	FileCacheLog::~FileCacheLog()
+	{
+		Close();
+	}
+
+	/**
+	 * Opens the log, creating it if needed, and replays it
+	 *
+	 * @access public
+	 *
+	 * @param ReplayHandler handler Receives every intact record in the order they were appended
+	 *
+	 * @return bool Returns false if the log can not be opened or is not a FileCache log
+	 */
+	bool FileCacheLog::Open(const std::wstring& path, const ReplayHandler& handler)
+	{
+		Close();
+		file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		pending.clear();
+		appended = 0;
+		durable = 0;
+		waiters = 0;
+		writing = false;
+		failed = false;
+		stopping = false;
+		if (!Replay(handler))
+		{
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+			return false;
+		}
+		flusher = std::thread(&FileCacheLog::FlushLoop, this);
+		return true;
+	}
+
+	void FileCacheLog::Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return;
+			}
+			stopping = true;
+		}
+		pending_changed.notify_all();
+		if (flusher.joinable())
+		{
+			flusher.join();
+		}
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+
+	/**
+	 * Queues a record for the flusher. It reaches the disk within FILE_CACHE_LOG_INTERVAL, or as soon
+	 * as the write in flight ends when Sync waits for it.
+	 *
+	 * @access public
+	 *
+	 * @return uint64_t Returns the sequence of the record for Sync, 0 when the log is closed
+	 */
+	uint64_t FileCacheLog::Append(Operation operation, const std::wstring& path, DWORD id)
+	{
+		DWORD body_size = kBodyHeaderSize + (DWORD)(path.size() * sizeof(wchar_t));
+		uint64_t sequence;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return 0;
+			}
+			size_t offset = pending.size();
+			pending.resize(offset + kRecordHeaderSize + body_size);
+			BYTE* record = pending.data() + offset;
+			PutU32(record + 4, body_size);
+			record[8] = operation;
+			PutU32(record + 9, id);
+			memcpy(record + 8 + kBodyHeaderSize, path.data(), path.size() * sizeof(wchar_t));
+			PutU32(record, (uint32_t)crc32c(0, record + 4, 4 + body_size));
+			size += kRecordHeaderSize + body_size;
+			sequence = ++appended;
+		}
+		pending_changed.notify_one();
+		return sequence;
+	}
+
+	bool FileCacheLog::Sync(uint64_t sequence)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		// A waiter makes the flusher write at once instead of waiting for more records
+		waiters++;
+		pending_changed.notify_one();
+		durable_changed.wait(lock, [&]() { return durable >= sequence || failed; });
+		waiters--;
+		return durable >= sequence;
+	}
+
+	bool FileCacheLog::Sync()
+	{
+		uint64_t sequence;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sequence = appended;
+		}
+		return Sync(sequence);
+	}
+
+	/**
+	 * Cuts the log back to its header. The caller has written a snapshot holding every record and
+	 * keeps Append from running until this returns.
+	 *
+	 * @access public
+	 *
+	 * @return bool Returns false if the log could not be truncated
+	 */
+	bool FileCacheLog::Reset()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		// The write in flight has to end before the file shrinks under it
+		durable_changed.wait(lock, [&]() { return !writing; });
+		pending.clear();
+		bool truncated = SeekTo(file, kHeaderSize) && SetEndOfFile(file) && FlushFileBuffers(file);
+		if (truncated)
+		{
+			// What the log held is in the snapshot now, a failed write no longer matters
+			durable = appended;
+			size = kHeaderSize;
+			failed = false;
+		}
+		durable_changed.notify_all();
+		return truncated;
+	}
+
+	uint64_t FileCacheLog::GetSize()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return size;
+	}
+
+	/**
+	 * Reads the records back and cuts the log after the last intact one, which drops a record torn by
+	 * a crash. A new or empty log gets its header.
+	 *
+	 * @access private
+	 */
+	bool FileCacheLog::Replay(const ReplayHandler& handler)
+	{
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(file, &length) || length.QuadPart > 0x7FFFFFFF)
+		{
+			return false;
+		}
+		std::vector<BYTE> data((size_t)length.QuadPart);
+		DWORD bytesRead = 0;
+		if (!data.empty() && (!ReadFile(file, data.data(), (DWORD)data.size(), &bytesRead, NULL) || bytesRead != data.size()))
+		{
+			return false;
+		}
+		if (data.size() < kHeaderSize)
+		{
+			// Not created yet, or the header itself was torn
+			BYTE header[kHeaderSize];
+			memcpy(header, FILE_CACHE_LOG_MAGIC, 4);
+			PutU32(header + 4, FILE_CACHE_LOG_VERSION);
+			if (!SeekTo(file, 0) || !WriteAll(file, header, kHeaderSize) || !SetEndOfFile(file) || !FlushFileBuffers(file))
+			{
+				return false;
+			}
+			size = kHeaderSize;
+			return true;
+		}
+		if (memcmp(data.data(), FILE_CACHE_LOG_MAGIC, 4) != 0 || GetU32(data.data() + 4) != FILE_CACHE_LOG_VERSION)
+		{
+			return false;
+		}
+
+		size_t position = kHeaderSize;
+		while (data.size() - position >= kRecordHeaderSize)
+		{
+			const BYTE* record = data.data() + position;
+			uint32_t body_size = GetU32(record + 4);
+			if (body_size < kBodyHeaderSize || body_size > data.size() - position - kRecordHeaderSize ||
+				(body_size - kBodyHeaderSize) % sizeof(wchar_t) != 0 ||
+				GetU32(record) != (uint32_t)crc32c(0, record + 4, 4 + body_size))
+			{
+				break;
+			}
+			Operation operation = (Operation)record[8];
+			if (operation != LOG_INSERT && operation != LOG_REMOVE)
+			{
+				break;
+			}
+			std::wstring path((const wchar_t*)(record + 8 + kBodyHeaderSize), (body_size - kBodyHeaderSize) / sizeof(wchar_t));
+			handler(operation, path, GetU32(record + 9));
+			position += kRecordHeaderSize + body_size;
+		}
+		if (position < data.size())
+		{
+			if (!SeekTo(file, position) || !SetEndOfFile(file) || !FlushFileBuffers(file))
+			{
+				return false;
+			}
+		}
+		size = position;
+		return SeekTo(file, position) != FALSE;
+	}
+
+	/**
+	 * Writes the pending records in batches. Without a waiter a batch collects records for
+	 * FILE_CACHE_LOG_INTERVAL; records appended during a write form the next batch either way.
+	 *
+	 * @access private
+	 */
+	void FileCacheLog::FlushLoop()
+	{
+		std::vector<BYTE> batch;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			pending_changed.wait(lock, [&]() { return stopping || !pending.empty(); });
+			if (pending.empty())
+			{
+				break;
+			}
+			if (waiters == 0 && !stopping)
+			{
+				pending_changed.wait_for(lock, std::chrono::milliseconds(FILE_CACHE_LOG_INTERVAL),
+					[&]() { return stopping || waiters > 0; });
+				if (pending.empty())
+				{
+					continue;	// Reset dropped them
+				}
+			}
+			batch.swap(pending);
+			uint64_t batch_end = appended;
+			bool ok = !failed;
+			writing = true;
+			lock.unlock();
+			ok = ok && WriteAll(file, batch.data(), batch.size()) && FlushFileBuffers(file);
+			lock.lock();
+			writing = false;
+			if (ok)
+			{
+				durable = batch_end;
+			}
+			else
+			{
+				// Later records would follow a hole, they wait for the next Reset
+				failed = true;
+			}
+			batch.clear();
+			durable_changed.notify_all();
+		}
+	}
+}
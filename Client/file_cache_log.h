@@ -0,0 +1,71 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <functional>
+#include <condition_variable>
+#include <Windows.h>
+
+#define FILE_CACHE_LOG_MAGIC		"FCWL"
+#define FILE_CACHE_LOG_VERSION		1
+#define FILE_CACHE_LOG_INTERVAL		10			// Milliseconds a commit waits for more records to join it
+
+namespace UserOperations
+{
+	// Append-only log of the FileCache changes made since its snapshot. Every record is checksummed
+	// with CRC-32C, and a torn or damaged tail is cut off when the log is replayed. Records are
+	// written by one flusher thread: all the records appended while a write is in flight go out in
+	// the next write, with one FlushFileBuffers for all of them (group commit).
+	//
+	//   "FCWL" version:u32
+	//   per record: crc32c:u32 of the rest, body length:u32, operation:u8, id:u32, UTF-16 path
+	class FileCacheLog
+	{
+	public:
+		enum Operation : BYTE
+		{
+			LOG_INSERT = 1,
+			LOG_REMOVE = 2,
+		};
+		typedef std::function<void(Operation operation, const std::wstring& path, DWORD id)> ReplayHandler;
+
+		FileCacheLog();
+		~FileCacheLog();
+
+		// Passes every intact record to 'handler' in order, then starts the flusher
+		bool Open(const std::wstring& path, const ReplayHandler& handler);
+		// Writes what is pending and stops the flusher
+		void Close();
+		bool IsOpen() const { return file != INVALID_HANDLE_VALUE; }
+
+		uint64_t Append(Operation operation, const std::wstring& path, DWORD id);
+		// Waits until the record 'sequence' and all before it are on disk, false if the log failed
+		bool Sync(uint64_t sequence);
+		bool Sync();
+		// Drops every record once a snapshot holds them. No record may be appended meanwhile.
+		bool Reset();
+		uint64_t GetSize();
+	private:
+		FileCacheLog(const FileCacheLog&) = delete;
+		FileCacheLog& operator=(const FileCacheLog&) = delete;
+
+		bool Replay(const ReplayHandler& handler);
+		void FlushLoop();
+
+		HANDLE file;
+		std::thread flusher;
+		std::mutex mutex;
+		std::condition_variable pending_changed;	// Records appended, a waiter in Sync, or stopping
+		std::condition_variable durable_changed;
+		std::vector<BYTE> pending;					// Records not handed to the flusher yet
+		uint64_t appended;							// Sequence of the last record appended
+		uint64_t durable;							// Sequence of the last record on disk
+		uint64_t size;								// Log bytes, pending ones included
+		size_t waiters;
+		bool writing;
+		bool failed;
+		bool stopping;
+	};
+}
@@ -18,7 +18,7 @@ namespace ResourceOperations
 		return ErrorMessageFile[last_error];
 	}
 
-	BOOL FileHandle::GetFileInfo(const std::wstring& path, FileInfo& info)
+	BOOL FileHandle::GetFileInfo(const std::wstring& path, FileInfo& info, IDigestSource* digests)
 	{
 		WIN32_FILE_ATTRIBUTE_DATA attr_data;
 		if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attr_data))
@@ -30,29 +30,35 @@ namespace ResourceOperations
 		file_size.HighPart = attr_data.nFileSizeHigh;
 		file_size.LowPart = attr_data.nFileSizeLow;
 
-		//TODO: Update hash file	
-		BYTE digest[SHA256_DIGEST_LENGTH];
-		DWORD buffer_size = 0;
-		BYTE* buffer = NULL;
-		if (!ReadFileData(path, buffer, buffer_size))
-		{
-			last_error = ERROR_READ_FILE;
-			return FALSE;
-		}
-		//LOG_INFO_W(L"Hashing file %s", path.c_str());
-		if (!Crypto::SHA256_Hash(buffer, buffer_size, digest))
-		{
-			last_error = ERROR_HASH_FILE_DATA;
-			return FALSE;
-		}
-		//LOG_INFO_W(L"Hashing done!");
-		if (buffer)
-		{
-			delete[] buffer;
+		// A file that kept its size and last write time keeps the digest it was hashed with
+		std::string hash;
+		if (!digests || !digests->FindDigest(path, (DWORD)file_size.QuadPart, attr_data.ftLastWriteTime, hash))
+		{
+			BYTE digest[SHA256_DIGEST_LENGTH];
+			DWORD buffer_size = 0;
+			BYTE* buffer = NULL;
+			if (!ReadFileData(path, buffer, buffer_size))
+			{
+				last_error = ERROR_READ_FILE;
+				return FALSE;
+			}
+			//LOG_INFO_W(L"Hashing file %s", path.c_str());
+			if (!Crypto::SHA256_Hash(buffer, buffer_size, digest))
+			{
+				delete[] buffer;
+				last_error = ERROR_HASH_FILE_DATA;
+				return FALSE;
+			}
+			//LOG_INFO_W(L"Hashing done!");
+			if (buffer)
+			{
+				delete[] buffer;
+			}
+			hash.assign(reinterpret_cast<char*>(digest), sizeof(digest));
 		}
 		info = FileInfo(path, 
 						(DWORD)file_size.QuadPart, 
-						std::string(reinterpret_cast<char*>(digest), sizeof(digest)),
+						hash,
 						attr_data.dwFileAttributes, attr_data.ftCreationTime, attr_data.ftLastWriteTime, attr_data.ftLastAccessTime);
 		return TRUE;
 
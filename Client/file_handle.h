@@ -44,6 +44,15 @@ namespace ResourceOperations
 		"Failed to hash file data!",
 	};
 
+	// Digests already computed, so a scan hashes only the files that changed
+	class IDigestSource
+	{
+	public:
+		virtual ~IDigestSource() = default;
+		// The SHA-256 of 'path' if it was hashed with this size and last write time
+		virtual BOOL FindDigest(const std::wstring& path, DWORD size, const FILETIME& last_write_time, std::string& digest) = 0;
+	};
+
 	class FileHandle 
 	{
 	private:
@@ -51,7 +60,7 @@ namespace ResourceOperations
 	public:
 		static DWORD GetLastError();
 		static std::string GetLastErrorString();
-		static BOOL GetFileInfo(const std::wstring& path, FileInfo& info);
+		static BOOL GetFileInfo(const std::wstring& path, FileInfo& info, IDigestSource* digests = NULL);
 		static BOOL SetFileInfo(const std::wstring& path, const FileInfo& info);
 		static BOOL RenameFile(const std::wstring& path, const std::wstring& rename);
 		static BOOL ReadFileData(const std::wstring& path, BYTE*& pData, DWORD& szData);
@@ -128,11 +128,11 @@ namespace ResourceOperations {
 
         /*=====================[ Getter Methods ]========================*/
         std::wstring GetFilePath() const { return file_path_; }
-        std::wstring GetFileName() const { return file_name_; }
+        const std::wstring& GetFileName() const { return file_name_; }
         DWORD GetFileSize() const { return file_size_; }
         std::wstring GetFileExtension() const { return extension_; }
         DWORD GetFileAttribute() const { return file_attribute_; }
-        std::string GetHashFile() const { return hash_file_; }
+        const std::string& GetHashFile() const { return hash_file_; }
         FILETIME GetCreateTime() const { return create_time_; }
         FILETIME GetLastWriteTime() const { return last_write_time_; }
         FILETIME GetLastAccessTime() const { return last_access_time_; }
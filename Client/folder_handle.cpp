@@ -135,7 +135,7 @@ namespace ResourceOperations
 		return TRUE;
 	}
 
-	BOOL FolderHandle::GetFolderFilter(const std::wstring& path, const std::wstring& filter, FolderInfo& folder)
+	BOOL FolderHandle::GetFolderFilter(const std::wstring& path, const std::wstring& filter, FolderInfo& folder, IDigestSource* digests)
 	{
 		if (path.length() > MAX_PATH)
 		{
@@ -182,7 +182,7 @@ namespace ResourceOperations
 				children.SetChangeTime(attr_data.ftLastWriteTime);
 				children.SetAccessTime(attr_data.ftLastAccessTime);
 	
-				if (GetFolderFilter(folder_path, filter, children))
+				if (GetFolderFilter(folder_path, filter, children, digests))
 				{
 					folder.AddChildren(children);
 					totalSize += children.GetFolderSize();
@@ -192,7 +192,7 @@ namespace ResourceOperations
 			{
 				FileInfo file;
 				std::wstring file_path = path + L"\\" + ffd.cFileName;
-				if (!FileHandle::GetFileInfo(file_path, file))
+				if (!FileHandle::GetFileInfo(file_path, file, digests))
 				{
 					FindClose(hFind);
 					last_error = ERROR_GET_FILE_INFO;
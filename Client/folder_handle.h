@@ -39,6 +39,6 @@ namespace ResourceOperations
         static BOOL RenameFolder(const std::wstring& path, const std::wstring& rename);
         static BOOL DeleteFolder(const std::wstring& path);
         static BOOL GetFolderInfo(const std::wstring& path, FolderInfo& folder);
-        static BOOL GetFolderFilter(const std::wstring& path, const std::wstring& filter, FolderInfo& folder);
+        static BOOL GetFolderFilter(const std::wstring& path, const std::wstring& filter, FolderInfo& folder, IDigestSource* digests = NULL);
     };
 }
\ No newline at end of file
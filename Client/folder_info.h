@@ -42,7 +42,7 @@ namespace ResourceOperations {
             for (auto& child : children_)
             {
                 child.SetParentFolder(this);
-                for (auto& file : child.GetFiles())
+                for (auto& file : child.files_)
                 {
                     file.SetParentFolder(&child);
                 }
@@ -69,7 +69,7 @@ namespace ResourceOperations {
                 for (auto& child : children_)
                 {
                     child.SetParentFolder(this);
-                    for (auto& file : child.GetFiles())
+                    for (auto& file : child.files_)
                     {
                         file.SetParentFolder(&child);
                     }
@@ -145,7 +145,7 @@ namespace ResourceOperations {
         /*=====================[ Getter Methods ]========================*/
         BOOL GetRoot() const { return is_root_; }
         std::wstring GetFolderPath() const { return folder_path_; }
-        std::wstring GetFolderName() const { return folder_name_; }
+        const std::wstring& GetFolderName() const { return folder_name_; }
         ULONGLONG GetFolderSize() const { return folder_size_; }
         DWORD GetUserId() const { return user_id_; }
         DWORD GetGroupId() const { return group_id_; }
@@ -302,8 +302,8 @@ namespace ResourceOperations {
         FileInfo GetFile(int index) const { return files_[index]; }
         FolderInfo GetChildren(int index) const { return children_[index]; }
 
-        LIST_FILE GetFiles() const { return files_; }
-        LIST_FOLDER GetChildrens() const { return children_; }
+        const LIST_FILE& GetFiles() const { return files_; }
+        const LIST_FOLDER& GetChildrens() const { return children_; }
 
         LIST_FILE GetFilesRecursive() const
         {
@@ -1,8 +1,11 @@
+#include <atomic>
+#include <thread>
 #include "utils.h"
 #include "logger.h"
+#include "sha256.h"
 #include "http_client.h"
 #include "file_handle.h"
-#include "json/json_parser.h"
+#include "json/json_document.h"
 
 namespace NetworkOperations 
 {
@@ -138,6 +141,46 @@ namespace NetworkOperations
 #endif
 	}
 
+	BOOL HttpClient::OptionMaxConnections(DWORD connections)
+	{
+		// Persistent connections to one server are pooled by the session handle
+#ifdef WININET
+		return InternetSetOptionW(hSession, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &connections, sizeof(connections))
+			&& InternetSetOptionW(hSession, INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER, &connections, sizeof(connections));
+#else 
+		return WinHttpSetOption(hSession, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &connections, sizeof(connections))
+			&& WinHttpSetOption(hSession, WINHTTP_OPTION_MAX_CONNS_PER_1_0_SERVER, &connections, sizeof(connections));
+#endif
+	}
+
+	BOOL HttpClient::RaiseMaxConnections(DWORD connections, DWORD& previous)
+	{
+		// Only ever raised, and the caller restores previous once its requests are done. FALSE when the
+		// limit was left as it is
+		previous = 0;
+		DWORD size = sizeof(previous);
+#ifdef WININET
+		if (!InternetQueryOptionW(hSession, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &previous, &size))
+#else 
+		if (!WinHttpQueryOption(hSession, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &previous, &size))
+#endif
+		{
+			LOG_WARNING_W(L"Failed to query the connection limit, it is left as it is. Error code = %d", GetLastError());
+			return FALSE;
+		}
+		if (previous >= connections)
+		{
+			return FALSE;
+		}
+		if (!OptionMaxConnections(connections))
+		{
+			LOG_WARNING_W(L"Failed to raise the connection limit to %lu. Error code = %d", connections, GetLastError());
+			OptionMaxConnections(previous);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
 	BOOL HttpClient::Disconnect()
 	{
 		BOOL result = TRUE;
@@ -292,6 +335,109 @@ resend:
 		return FALSE;
 	}
 
+	LPVOID HttpClient::OpenChunkedRequest(const std::wstring & verb, const std::wstring & path, const HttpHeaders & headers)
+	{
+		HttpHeaders chunked_headers = headers;
+		chunked_headers.SetHeader("Transfer-Encoding", "chunked");
+		HINTERNET hRequest = OpenRequest(verb, path, chunked_headers.GetFormatWstring());
+		if (!hRequest)
+		{
+			return NULL;
+		}
+resend:
+		// Send the headers only, the body follows with WriteRequestChunk
+#ifdef WININET
+		if (!HttpSendRequestExW(hRequest, NULL, NULL, HSR_INITIATE, 0))
+		{
+			DWORD dwError = GetLastError();
+			if (dwError == ERROR_INTERNET_CLIENT_AUTH_CERT_NEEDED)
+			{
+				LOG_WARNING_W(L"The server is requesting client authentication.");
+				if (!InternetSetOptionW(hRequest,
+					INTERNET_OPTION_CLIENT_CERT_CONTEXT,
+					(LPVOID)pCertContext, sizeof(CERT_CONTEXT)))
+				{
+#else
+		if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH, 0))
+		{
+			DWORD dwError = GetLastError();
+			if (dwError == ERROR_WINHTTP_CLIENT_AUTH_CERT_NEEDED)
+			{
+				LOG_WARNING_W(L"The server is requesting client authentication.");
+				if (!WinHttpSetOption(hRequest,
+					WINHTTP_OPTION_CLIENT_CERT_CONTEXT,
+					(LPVOID)pCertContext, sizeof(CERT_CONTEXT)))
+				{
+#endif
+					LOG_ERROR_W(L"Failed to set client certificate context: Error code = %d", dwError);
+					CloseRequest(hRequest);
+					return NULL;
+				}
+				goto resend;
+			}
+			LOG_ERROR_W(L"Failed to send request. Error code = %d", dwError);
+			CloseRequest(hRequest);
+			return NULL;
+		}
+		return hRequest;
+	}
+
+	BOOL HttpClient::WriteRequestChunk(LPVOID hRequest, const void* data, size_t length)
+	{
+		if (length == 0)
+		{
+			return TRUE;	// An empty chunk would end the body
+		}
+		char header[24];
+		int header_length = sprintf_s(header, sizeof(header), "%zx\r\n", length);
+		return WriteRequestData(hRequest, header, header_length) &&
+			WriteRequestData(hRequest, data, length) &&
+			WriteRequestData(hRequest, "\r\n", 2);
+	}
+
+	HttpResponse HttpClient::EndChunkedRequest(LPVOID hRequest, IResponseReader* reader)
+	{
+		// Last chunk and an empty trailer
+		if (!WriteRequestData(hRequest, "0\r\n\r\n", 5))
+		{
+			CloseRequest(hRequest);
+			return HttpResponse();
+		}
+#ifdef WININET
+		if (!HttpEndRequestW(hRequest, NULL, 0, 0))
+#else
+		if (!WinHttpReceiveResponse(hRequest, NULL))
+#endif
+		{
+			LOG_ERROR_W(L"Failed to end the request. Error code = %d", GetLastError());
+			CloseRequest(hRequest);
+			return HttpResponse();
+		}
+		return HttpResponse(hRequest, reader);
+	}
+
+	BOOL HttpClient::WriteRequestData(LPVOID hRequest, const void* data, size_t length)
+	{
+		const BYTE* p = (const BYTE*)data;
+		while (length > 0)
+		{
+			DWORD bytesWrite = 0;
+			DWORD size = (DWORD)min(length, (size_t)MAXDWORD);
+#ifdef WININET
+			if (!InternetWriteFile(hRequest, p, size, &bytesWrite) || bytesWrite == 0)
+#else
+			if (!WinHttpWriteData(hRequest, p, size, &bytesWrite) || bytesWrite == 0)
+#endif
+			{
+				LOG_ERROR_W(L"Failed to write the request body. Error code = %lu", GetLastError());
+				return FALSE;
+			}
+			p += bytesWrite;
+			length -= bytesWrite;
+		}
+		return TRUE;
+	}
+
 	HttpResponse HttpClient::Head(const std::wstring & path, const HttpHeaders & headers)
 	{
 		HINTERNET hRequest = OpenRequest(L"HEAD", path, headers.GetFormatWstring());
@@ -349,8 +495,30 @@ resend:
 	{
 		BYTE* buffer = NULL;
 		DWORD buffer_size = 0;
-		transform->TransformData((BYTE*)data, (DWORD)length, buffer, buffer_size);
-		return Post(path, headers, buffer, buffer_size);
+		if (!transform || !transform->TransformData((const BYTE*)data, (DWORD)length, buffer, buffer_size))
+		{
+			LOG_ERROR_W(L"Failed to transform the request data!");
+			return HttpResponse();
+		}
+		HttpResponse response = Post(path, headers, buffer, buffer_size);
+		delete[] buffer;
+		return response;
+	}
+
+	HttpResponse HttpClient::Post(const std::wstring & path, const HttpHeaders & headers, const std::string & data, IResponseReader * reader)
+	{
+		HINTERNET hRequest = OpenRequest(L"POST", path, headers.GetFormatWstring());
+		if (!hRequest)
+		{
+			LOG_ERROR_W(L"Failed to initialize an request!");
+			return HttpResponse();
+		}
+		if (!SendRequest(hRequest, data.c_str(), data.length()))
+		{
+			return HttpResponse();
+		}
+		// The status code and headers, the body goes to the reader as it arrives
+		return HttpResponse(hRequest, reader);
 	}
 
 
@@ -379,8 +547,14 @@ resend:
 	{
 		BYTE* buffer = NULL;
 		DWORD buffer_size = 0;
-		transform->TransformData((BYTE*)data, (DWORD)length, buffer, buffer_size);
-		return Put(path, headers, buffer, buffer_size);
+		if (!transform || !transform->TransformData((const BYTE*)data, (DWORD)length, buffer, buffer_size))
+		{
+			LOG_ERROR_W(L"Failed to transform the request data!");
+			return HttpResponse();
+		}
+		HttpResponse response = Put(path, headers, buffer, buffer_size);
+		delete[] buffer;
+		return response;
 	}
 
 
@@ -614,6 +788,221 @@ resend:
 
 #endif
 
+	HttpResponse HttpClient::DownloadFileRanged(const std::wstring& path, const std::wstring& local_path, const HttpHeaders& headers,
+		const std::string& sha256, DWORD connections)
+	{
+		struct RangeTask
+		{
+			ULONGLONG offset;
+			ULONGLONG length;
+			BOOL done;
+		};
+
+		// Step 1: Learn the file size and whether the server accepts byte ranges
+		HttpResponse head = Head(path, headers);
+		if (head.GetStatusCode() != 200)
+		{
+			LOG_ERROR_W(L"[Download] HEAD %s failed with status %ld", path.c_str(), head.GetStatusCode());
+			return head;
+		}
+		std::string content_length = head.GetResponseHeader(std::string("Content-Length"));
+		if (content_length.empty())
+		{
+			LOG_ERROR_W(L"[Download] Server did not report the size of %s", path.c_str());
+			return HttpResponse();
+		}
+		ULONGLONG file_size = _strtoui64(content_length.c_str(), NULL, 10);
+		BOOL accept_ranges = head.GetResponseHeader(std::string("Accept-Ranges")).find("bytes") != std::string::npos;
+
+		// Step 2: Split the file into ranges, one request for small files or servers without range support
+		std::vector<RangeTask> tasks;
+		if (!accept_ranges || file_size < RANGE_MIN_SIZE || connections <= 1)
+		{
+			tasks.push_back({ 0, file_size, FALSE });
+		}
+		else
+		{
+			ULONGLONG range_size = (file_size + connections - 1) / connections;
+			for (ULONGLONG offset = 0; offset < file_size; offset += range_size)
+			{
+				tasks.push_back({ offset, min(range_size, file_size - offset), FALSE });
+			}
+		}
+
+		// Step 3: Preallocate the output file so every range can be written at its own position
+		HANDLE hOutputFile = CreateFileW(local_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hOutputFile == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR_W(L"[Download] Failed to create file %s. Error code = %d", local_path.c_str(), GetLastError());
+			return HttpResponse();
+		}
+		LARGE_INTEGER end_of_file;
+		end_of_file.QuadPart = (LONGLONG)file_size;
+		if (!SetFilePointerEx(hOutputFile, end_of_file, NULL, FILE_BEGIN) || !SetEndOfFile(hOutputFile))
+		{
+			LOG_ERROR_W(L"[Download] Failed to preallocate %llu bytes. Error code = %d", file_size, GetLastError());
+			CloseHandle(hOutputFile);
+			return HttpResponse();
+		}
+
+		// Step 4: Fetch the ranges in parallel, the session pools the connections between workers and allows
+		// one per range until they are done
+		std::wstring header_string = headers.GetFormatWstring();
+		std::atomic<size_t> next_task(0);
+		BOOL whole = (tasks.size() == 1);
+		auto worker = [&]()
+		{
+			for (size_t i = next_task++; i < tasks.size(); i = next_task++)
+			{
+				RangeTask& task = tasks[i];
+				for (DWORD attempt = 0; attempt < RANGE_MAX_RETRY && !task.done; attempt++)
+				{
+					task.done = DownloadRange(path, header_string, hOutputFile, task.offset, task.length, whole);
+					if (!task.done)
+					{
+						LOG_WARNING_W(L"[Download] Range %llu-%llu failed (attempt %d/%d)",
+							task.offset, task.offset + task.length - 1, attempt + 1, RANGE_MAX_RETRY);
+					}
+				}
+			}
+		};
+		DWORD previous_connections = 0;
+		BOOL raised = RaiseMaxConnections((DWORD)tasks.size(), previous_connections);
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < tasks.size(); i++)
+		{
+			workers.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : workers)
+		{
+			thread.join();
+		}
+		if (raised && !OptionMaxConnections(previous_connections))
+		{
+			LOG_WARNING_W(L"[Download] Failed to restore the connection limit to %lu. Error code = %d", previous_connections, GetLastError());
+		}
+
+		for (const auto& task : tasks)
+		{
+			if (!task.done)
+			{
+				LOG_ERROR_W(L"[Download] Range %llu-%llu could not be downloaded", task.offset, task.offset + task.length - 1);
+				CloseHandle(hOutputFile);
+				DeleteFileW(local_path.c_str());
+				return HttpResponse();
+			}
+		}
+
+		// Step 5: Check the assembled file against the expected digest
+		if (!sha256.empty() && !VerifyFileDigest(hOutputFile, sha256))
+		{
+			LOG_ERROR_W(L"[Download] SHA-256 of %s does not match the expected digest", local_path.c_str());
+			CloseHandle(hOutputFile);
+			DeleteFileW(local_path.c_str());
+			return HttpResponse();
+		}
+		CloseHandle(hOutputFile);
+		return HttpResponse(200, "", head.GetHeaderString());
+	}
+
+	BOOL HttpClient::DownloadRange(const std::wstring& path, const std::wstring& headers, HANDLE hFile, ULONGLONG offset, ULONGLONG length, BOOL whole)
+	{
+		if (length == 0)
+		{
+			return TRUE;
+		}
+		std::wstring range = L"Range:bytes=" + std::to_wstring(offset) + L"-" + std::to_wstring(offset + length - 1) + L"\r\n";
+		HINTERNET hRequest = OpenRequest(L"GET", path, headers + range);
+		if (!hRequest)
+		{
+			return FALSE;
+		}
+		if (!SendRequest(hRequest, NULL, 0))
+		{
+			return FALSE;
+		}
+
+		// A server may ignore the Range header and answer 200, which is only usable for a whole-file range
+		DWORD statusCode = 0;
+		DWORD size = sizeof(statusCode);
+#ifdef WININET
+		HttpQueryInfoW(hRequest, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &statusCode, &size, NULL);
+#else
+		WinHttpReceiveResponse(hRequest, NULL);
+		WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, NULL, &statusCode, &size, NULL);
+#endif
+		if (statusCode != 206 && !(statusCode == 200 && whole))
+		{
+			LOG_ERROR_W(L"[Download] Unexpected status %ld for range request", statusCode);
+			CloseRequest(hRequest);
+			return FALSE;
+		}
+
+		std::vector<BYTE> buffer(RANGE_BUFFER_SIZE);
+		ULONGLONG received = 0;
+		DWORD bytesRead = 0, bytesWrite = 0;
+		while (received < length)
+		{
+#ifdef WININET
+			if (!InternetReadFile(hRequest, buffer.data(), (DWORD)buffer.size(), &bytesRead))
+#else
+			if (!WinHttpReadData(hRequest, buffer.data(), (DWORD)buffer.size(), &bytesRead))
+#endif
+			{
+				LOG_ERROR_W(L"[Download] Failed to read range data. Error code = %d", GetLastError());
+				break;
+			}
+			if (bytesRead == 0)
+			{
+				break;	// EOF.
+			}
+			bytesRead = (DWORD)min((ULONGLONG)bytesRead, length - received);
+
+			// Positional write, workers share the file handle without moving its pointer
+			OVERLAPPED position = { 0 };
+			ULARGE_INTEGER file_offset;
+			file_offset.QuadPart = offset + received;
+			position.Offset = file_offset.LowPart;
+			position.OffsetHigh = file_offset.HighPart;
+			if (!WriteFile(hFile, buffer.data(), bytesRead, &bytesWrite, &position) || bytesWrite != bytesRead)
+			{
+				LOG_ERROR_W(L"[Download] Error writing data: %lu", GetLastError());
+				break;
+			}
+			received += bytesRead;
+		}
+		CloseRequest(hRequest);
+		return received == length;
+	}
+
+	BOOL HttpClient::VerifyFileDigest(HANDLE hFile, const std::string& sha256)
+	{
+		Crypto::SHA256_CTX ctx;
+		BYTE digest[SHA256_DIGEST_LENGTH];
+		std::vector<BYTE> buffer(MB);
+		DWORD bytesRead = 0;
+		LARGE_INTEGER begin = { 0 };
+
+		if (!SetFilePointerEx(hFile, begin, NULL, FILE_BEGIN))
+		{
+			return FALSE;
+		}
+		Crypto::SHA256_Init(&ctx);
+		while (ReadFile(hFile, buffer.data(), (DWORD)buffer.size(), &bytesRead, NULL) && bytesRead > 0)
+		{
+			Crypto::SHA256_Update(&ctx, buffer.data(), bytesRead);
+		}
+		Crypto::SHA256_Final(&ctx, digest);
+
+		// The digest is given raw like FileInfo::GetHashFile(), or as a hex string
+		if (sha256.size() == SHA256_DIGEST_LENGTH)
+		{
+			return memcmp(sha256.data(), digest, SHA256_DIGEST_LENGTH) == 0;
+		}
+		return _stricmp(sha256.c_str(), Helper::StringHelper::convertBytesHexString(digest, SHA256_DIGEST_LENGTH).c_str()) == 0;
+	}
+
 #pragma region HttpResponse
 
 	BOOL HttpResponse::CheckContentIsJson()
@@ -625,7 +1014,8 @@ resend:
 			{
 				result = TRUE;
 			}
-			result = (JsonParser::Parse(contentString.c_str())->CountChildren() > 0) ? TRUE : FALSE;
+			JsonDocument document;
+			result = (document.Parse(contentString) && document.Root().CountChildren() > 0) ? TRUE : FALSE;
 		}
 		return result;
 	}
@@ -744,6 +1134,62 @@ resend:
 		return content;
 		}
 
+	HttpResponse::HttpResponse(HINTERNET hRequest, IResponseReader* reader)
+		: statusCode(0)
+	{
+		if (!hRequest)
+		{
+			return;
+		}
+		statusCode = GetStatusCode(hRequest);
+		headerString = ReadResponseHeader(hRequest);
+		if (!headerString.empty())
+		{
+			headerPairs = ParseResponseHeaders(headerString);
+		}
+		// Only a successful body is streamed, an error body stays the content so callers can log it
+		if (reader && statusCode >= 200 && statusCode < 300)
+		{
+			ReadResponseContent(hRequest, reader);
+		}
+		else
+		{
+			contentString = ReadResponseContent(hRequest);
+		}
+#ifdef WININET
+		InternetCloseHandle(hRequest);
+#else
+		WinHttpCloseHandle(hRequest);
+#endif
+	}
+
+	BOOL HttpResponse::ReadResponseContent(HINTERNET hRequest, IResponseReader* reader)
+	{
+		std::vector<BYTE> buffer(STREAM_BUFFER_SIZE);
+		DWORD bytesRead = 0;
+		while (TRUE)
+		{
+#ifdef WININET
+			if (!InternetReadFile(hRequest, buffer.data(), (DWORD)buffer.size(), &bytesRead))
+			{
+#else
+			if (!WinHttpReadData(hRequest, buffer.data(), (DWORD)buffer.size(), &bytesRead))
+			{
+#endif
+				LOG_ERROR_W(L"Failed to read the HTTP response. Error code = %d", GetLastError());
+				return FALSE;
+			}
+			if (bytesRead == 0)
+			{
+				return TRUE;	// EOF.
+			}
+			if (!reader->ReadResponseData(buffer.data(), bytesRead))
+			{
+				return FALSE;	// The reader has what it needs or gave up
+			}
+		}
+	}
+
 	std::map<std::string, std::string> HttpResponse::ParseResponseHeaders(const std::string& headerStr)
 	{
 		std::string line;
@@ -22,11 +22,27 @@
 #define BUFFER_SIZE		10 * KB
 #define USER_AGENT      L"File storage client"
 
+#define RANGE_BUFFER_SIZE   (64 * KB)   // Receive buffer of one range worker
+#define RANGE_MIN_SIZE      (4 * MB)    // Smaller files are fetched with a single request
+#define RANGE_CONNECTIONS   4           // Default number of parallel range requests
+#define RANGE_MAX_RETRY     3           // Attempts per range before the download fails
+
+#define STREAM_BUFFER_SIZE  (64 * KB)   // Receive buffer of a response body handed to an IResponseReader
+
 namespace NetworkOperations 
 {
     class HttpHeaders;
     class HttpResponse;
 
+    // Takes a response body piece by piece while it downloads, instead of the whole body as one string
+    class IResponseReader
+    {
+    public:
+        virtual ~IResponseReader() = default;
+        // Return FALSE to stop reading, the rest of the body is discarded
+        virtual BOOL ReadResponseData(const BYTE* data, DWORD length) = 0;
+    };
+
     class HttpClient 
     {
     public:
@@ -40,16 +56,22 @@ namespace NetworkOperations
         void OptionRecvTimeOut(DWORD milliseconds);
         void OptionSendTimeOut(DWORD milliseconds);
         void OptionConnectTimeOut(DWORD milliseconds);
+        BOOL OptionMaxConnections(DWORD connections);
         BOOL Disconnect();
         LPVOID OpenRequest(const std::wstring& verb, const std::wstring& path, const std::wstring& headers);
         BOOL SendRequest(LPVOID hRequest, const void* data, const size_t& length);
         BOOL CloseRequest(LPVOID hRequest);
+        //Requests whose body is still being produced while it is sent, with chunked transfer encoding
+        LPVOID OpenChunkedRequest(const std::wstring& verb, const std::wstring& path, const HttpHeaders& headers);
+        BOOL WriteRequestChunk(LPVOID hRequest, const void* data, size_t length);
+        HttpResponse EndChunkedRequest(LPVOID hRequest, IResponseReader* reader = NULL);
         //Basic HTTP/HTTPS verb methods
         HttpResponse Head(const std::wstring& path, const HttpHeaders& headers);
         HttpResponse Get(const std::wstring& path, const HttpHeaders& headers);
         HttpResponse Post(const std::wstring& path, const HttpHeaders& headers, const std::string& data);
         HttpResponse Post(const std::wstring& path, const HttpHeaders& headers, const void* data, size_t length);
         HttpResponse Post(const std::wstring& path, const HttpHeaders& headers, IDataTransform* transform, const void* data, size_t length);
+        HttpResponse Post(const std::wstring& path, const HttpHeaders& headers, const std::string& data, IResponseReader* reader);
         HttpResponse Put(const std::wstring& path, const HttpHeaders& headers, const std::string& data);
         HttpResponse Put(const std::wstring& path, const HttpHeaders& headers, const void* data, size_t length);
         HttpResponse Put(const std::wstring& path, const HttpHeaders& headers, IDataTransform* transform, const void* data, size_t length);
@@ -60,9 +82,16 @@ namespace NetworkOperations
         HttpResponse Trace(const std::wstring& path, const HttpHeaders& headers);
         //Advance HTTP/HTTPS methods
         HttpResponse DownloadFile(const std::wstring& path);
+        HttpResponse DownloadFileRanged(const std::wstring& path, const std::wstring& local_path, const HttpHeaders& headers,
+            const std::string& sha256 = "", DWORD connections = RANGE_CONNECTIONS);
         HttpResponse UploadFile(const std::wstring& path);
 
     private:
+        BOOL RaiseMaxConnections(DWORD connections, DWORD& previous);
+        BOOL DownloadRange(const std::wstring& path, const std::wstring& headers, HANDLE hFile, ULONGLONG offset, ULONGLONG length, BOOL whole);
+        BOOL VerifyFileDigest(HANDLE hFile, const std::string& sha256);
+        BOOL WriteRequestData(LPVOID hRequest, const void* data, size_t length);
+
         DWORD state = 0;
         WCHAR scheme[0x20];
         WCHAR hostName[0x100] = L"localhost";
@@ -126,6 +155,37 @@ namespace NetworkOperations
         std::map<std::string, std::string> pairs;
     };
 
+    // A multipart/form-data body built in memory, for requests whose parts are all at hand
+    class MultipartBody
+    {
+    public:
+        MultipartBody() : boundary(Helper::createUUIDString()) {}
+        void AddField(const std::string& name, const std::string& value) {
+            body += "--" + boundary + "\r\n";
+            body += "Content-Disposition: form-data; name=\"" + name + "\"\r\n";
+            body += "Content-Type: text/plain\r\n\r\n";
+            body += value + "\r\n";
+        }
+        void AddFile(const std::string& name, const std::string& file_name, const void* data, size_t length) {
+            body += "--" + boundary + "\r\n";
+            body += "Content-Disposition: form-data; name=\"" + name + "\"; filename=\"" + file_name + "\"\r\n";
+            body += "Content-Type: application/octet-stream\r\n\r\n";
+            body.append((const char*)data, length);
+            body += "\r\n";
+        }
+        std::string GetContentType() const {
+            return "multipart/form-data; boundary=" + boundary;
+        }
+        // The body with its closing boundary, nothing can be added after it
+        std::string Finish() {
+            body += "--" + boundary + "--\r\n";
+            return body;
+        }
+    private:
+        std::string boundary;
+        std::string body;
+    };
+
     class HttpResponse 
     {
     public:
@@ -154,6 +214,7 @@ namespace NetworkOperations
                 }
             }
         }
+        HttpResponse(HINTERNET hRequest, IResponseReader* reader);
         DWORD GetStatusCode() { return statusCode; }
         std::string GetHeaderString() { return headerString; }
         std::wstring GetHeaderWString() { return Helper::StringHelper::convertStringToWideString(headerString); }
@@ -173,6 +234,7 @@ namespace NetworkOperations
         DWORD GetStatusCode(HINTERNET hRequest);
         std::string ReadResponseHeader(HINTERNET hRequest);
         std::string ReadResponseContent(HINTERNET hRequest);
+        BOOL ReadResponseContent(HINTERNET hRequest, IResponseReader* reader);
         std::map<std::string, std::string> ParseResponseHeaders(const std::string& headerStr);
     };
 
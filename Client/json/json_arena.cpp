@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "json_arena.h"
+
+JsonArena::JsonArena(size_t block_size)
+	: head(NULL), cursor(NULL), limit(NULL), block_size(block_size), used(0), reserved(0)
+{
+}
+
+JsonArena::~JsonArena()
+{
+	while (head)
+	{
+		Block* previous = head->previous;
+		free(head);
+		head = previous;
+	}
+}
+
+/**
+ * Bumps the cursor of the current block, or starts a new block when the request does not fit
+ *
+ * @access public
+ *
+ * @param size_t size Number of bytes
+ * @param size_t alignment Power of two the address must be a multiple of
+ *
+ * @return void* Returns the memory, valid until Reset or destruction, or NULL if out of memory
+ */
+void* JsonArena::Allocate(size_t size, size_t alignment)
+{
+	uintptr_t aligned = ((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	if (head == NULL || aligned < (uintptr_t)cursor || aligned > (uintptr_t)limit || size > (uintptr_t)limit - aligned)
+	{
+		size_t request = size + alignment;
+		if (request < size)
+		{
+			return NULL;
+		}
+		size_t capacity = request > block_size ? request : block_size;
+		Block* block = (Block*)malloc(sizeof(Block) + capacity);
+		if (block == NULL)
+		{
+			return NULL;
+		}
+		block->previous = head;
+		block->size = capacity;
+		head = block;
+		cursor = Begin(block);
+		limit = cursor + capacity;
+		reserved += capacity;
+		aligned = ((uintptr_t)cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	}
+	used += (aligned - (uintptr_t)cursor) + size;
+	cursor = (char*)(aligned + size);
+	return (void*)aligned;
+}
+
+/**
+ * Releases every allocation at once. If the last document needed several blocks they are merged
+ * into one of their total size, so parsing a document of a similar size again does not touch the heap.
+ *
+ * @access public
+ */
+void JsonArena::Reset()
+{
+	used = 0;
+	if (head == NULL)
+	{
+		return;
+	}
+	if (head->previous != NULL)
+	{
+		size_t total = 0;
+		while (head)
+		{
+			Block* previous = head->previous;
+			total += head->size;
+			free(head);
+			head = previous;
+		}
+		reserved = 0;
+		head = (Block*)malloc(sizeof(Block) + total);
+		if (head == NULL)
+		{
+			cursor = limit = NULL;
+			return;
+		}
+		head->previous = NULL;
+		head->size = total;
+		reserved = total;
+	}
+	cursor = Begin(head);
+	limit = cursor + head->size;
+}
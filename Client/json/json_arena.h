@@ -0,0 +1,46 @@
+#pragma once
+#include <stddef.h>
+
+#define JSON_ARENA_BLOCK_SIZE	(64 * 1024)	// Default size of a block, larger requests get a block of their own
+
+// Bump allocator for the nodes and strings of a JsonDocument. Allocations are never freed one by one:
+// Reset drops them all at once and keeps the memory for the next document, the destructor
+// returns every block.
+class JsonArena
+{
+public:
+	explicit JsonArena(size_t block_size = JSON_ARENA_BLOCK_SIZE);
+	~JsonArena();
+
+	void* Allocate(size_t size, size_t alignment = sizeof(void*));
+	template <typename T>
+	T* AllocateArray(size_t count)
+	{
+		if (count > (size_t)-1 / sizeof(T))
+		{
+			return NULL;
+		}
+		return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+	}
+	void Reset();
+
+	size_t GetUsed() const { return used; }
+	size_t GetReserved() const { return reserved; }
+private:
+	JsonArena(const JsonArena&) = delete;
+	JsonArena& operator=(const JsonArena&) = delete;
+
+	struct Block
+	{
+		Block* previous;
+		size_t size;	// Usable bytes after the header
+	};
+	static char* Begin(Block* block) { return reinterpret_cast<char*>(block + 1); }
+
+	Block* head;
+	char* cursor;
+	char* limit;
+	size_t block_size;
+	size_t used;
+	size_t reserved;
+};
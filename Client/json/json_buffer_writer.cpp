@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <math.h>
+
+#include "json_buffer_writer.h"
+
+namespace
+{
+	const char kHexDigits[] = "0123456789abcdef";
+
+	const char kDigitPairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	// Short escapes of the control characters, 0 where only \u00XX exists
+	const char kShortEscapes[0x20] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 'b', 't', 'n', 0, 'f', 'r', 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+	};
+
+	// Bytes of a string that need no escape: everything from space up except quote and backslash
+	inline bool IsPlain(uint32_t c)
+	{
+		return c >= 0x20 && c != '"' && c != '\\';
+	}
+
+	char* WriteEscape(char* out, uint32_t c)
+	{
+		*out++ = '\\';
+		if (c == '"' || c == '\\')
+		{
+			*out++ = (char)c;
+		}
+		else if (kShortEscapes[c])
+		{
+			*out++ = kShortEscapes[c];
+		}
+		else
+		{
+			*out++ = 'u';
+			*out++ = '0';
+			*out++ = '0';
+			*out++ = kHexDigits[c >> 4];
+			*out++ = kHexDigits[c & 0xF];
+		}
+		return out;
+	}
+
+	char* WriteUtf8(char* out, uint32_t code_point)
+	{
+		if (code_point < 0x800)
+		{
+			*out++ = (char)(0xC0 | (code_point >> 6));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			*out++ = (char)(0xE0 | (code_point >> 12));
+			*out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			*out++ = (char)(0xF0 | (code_point >> 18));
+			*out++ = (char)(0x80 | ((code_point >> 12) & 0x3F));
+			*out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		return out;
+	}
+
+	// Decimal digits two at a time, written backwards from the end of a 20 byte scratch buffer
+	char* WriteDecimal(char* out, uint64_t value)
+	{
+		char scratch[20];
+		char* p = scratch + sizeof(scratch);
+		while (value >= 100)
+		{
+			const char* pair = kDigitPairs + (value % 100) * 2;
+			value /= 100;
+			*--p = pair[1];
+			*--p = pair[0];
+		}
+		if (value >= 10)
+		{
+			const char* pair = kDigitPairs + value * 2;
+			*--p = pair[1];
+			*--p = pair[0];
+		}
+		else
+		{
+			*--p = (char)('0' + value);
+		}
+		size_t count = scratch + sizeof(scratch) - p;
+		memcpy(out, p, count);
+		return out + count;
+	}
+
+	inline char* WritePair(char* out, uint32_t value)
+	{
+		*out++ = kDigitPairs[value * 2];
+		*out++ = kDigitPairs[value * 2 + 1];
+		return out;
+	}
+}
+
+JsonBufferWriter::JsonBufferWriter(size_t capacity)
+	: data(NULL), size(0), capacity(capacity), sink(NULL), failed(false), after_key(false), depth(0)
+{
+	data = (char*)malloc(capacity);
+	if (data == NULL)
+	{
+		this->capacity = 0;
+		failed = true;
+	}
+}
+
+JsonBufferWriter::~JsonBufferWriter()
+{
+	free(data);
+}
+
+/**
+ * Makes room for 'count' more bytes at the end of the output. A full buffer is passed to the sink
+ * if there is one, otherwise it doubles.
+ *
+ * @access private
+ *
+ * @return char* Returns where to write, or NULL once the writer has failed
+ */
+char* JsonBufferWriter::Reserve(size_t count)
+{
+	if (failed)
+	{
+		return NULL;
+	}
+	if (capacity - size >= count)
+	{
+		return data + size;
+	}
+	if (sink != NULL && !Flush())
+	{
+		return NULL;
+	}
+	if (capacity - size < count)
+	{
+		size_t grown = capacity * 2 > size + count ? capacity * 2 : size + count;
+		char* buffer = (char*)realloc(data, grown);
+		if (buffer == NULL)
+		{
+			failed = true;
+			return NULL;
+		}
+		data = buffer;
+		capacity = grown;
+	}
+	return data + size;
+}
+
+/**
+ * Reserves room for a value of up to 'count' bytes and writes the comma that separates it from
+ * the previous member of its container
+ *
+ * @access private
+ */
+char* JsonBufferWriter::Separate(size_t count)
+{
+	char* out = Reserve(count + 1);
+	if (out == NULL)
+	{
+		return NULL;
+	}
+	if (depth > 0)
+	{
+		if (!empty[depth - 1] && !after_key)
+		{
+			*out++ = ',';
+		}
+		empty[depth - 1] = 0;
+	}
+	after_key = false;
+	return out;
+}
+
+void JsonBufferWriter::Open(char c)
+{
+	char* out = Separate(1);
+	if (out == NULL)
+	{
+		return;
+	}
+	if (depth == JSON_MAX_DEPTH)
+	{
+		failed = true;
+		return;
+	}
+	*out++ = c;
+	size = out - data;
+	empty[depth++] = 1;
+}
+
+void JsonBufferWriter::Close(char c)
+{
+	char* out = Reserve(1);
+	if (out == NULL || depth == 0)
+	{
+		return;
+	}
+	*out = c;
+	size++;
+	depth--;
+	after_key = false;
+}
+
+/**
+ * Writes an object key, escaped like any string
+ *
+ * @access public
+ *
+ * @param char* key Null-terminated UTF-8 name
+ */
+void JsonBufferWriter::Key(const char* key)
+{
+	String(key, strlen(key));
+	char* out = Reserve(1);
+	if (out == NULL)
+	{
+		return;
+	}
+	*out = ':';
+	size++;
+	after_key = true;
+}
+
+/**
+ * Writes a UTF-8 string value. Runs of bytes that need no escape are copied at once.
+ *
+ * @access public
+ *
+ * @param char* data The UTF-8 bytes, not necessarily null terminated
+ * @param size_t length Number of bytes
+ */
+void JsonBufferWriter::String(const char* data, size_t length)
+{
+	// An escape is at most 6 bytes (\u00XX), plus the quotes
+	char* out = Separate(length * 6 + 2);
+	if (out == NULL)
+	{
+		return;
+	}
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* end = p + length;
+	*out++ = '"';
+	while (p < end)
+	{
+		const uint8_t* run = p;
+		while (p < end && IsPlain(*p))
+		{
+			p++;
+		}
+		memcpy(out, run, p - run);
+		out += p - run;
+		if (p < end)
+		{
+			out = WriteEscape(out, *p++);
+		}
+	}
+	*out++ = '"';
+	size = out - this->data;
+}
+
+/**
+ * Writes a UTF-16 string value (UTF-32 where wchar_t is 4 bytes) converted to UTF-8 on the way.
+ * Unpaired surrogates become U+FFFD, as with WideCharToMultiByte.
+ *
+ * @access public
+ *
+ * @param wchar_t* data The characters, not necessarily null terminated
+ * @param size_t length Number of wchar_t units
+ */
+void JsonBufferWriter::String(const wchar_t* data, size_t length)
+{
+	// No unit takes more than 6 bytes: an escape, or 3 bytes of UTF-8 (a surrogate pair is 4 for 2 units)
+	char* out = Separate(length * 6 + 2);
+	if (out == NULL)
+	{
+		return;
+	}
+	const wchar_t* p = data;
+	const wchar_t* end = data + length;
+	*out++ = '"';
+	while (p < end)
+	{
+		uint32_t c = (uint32_t)*p++;
+		if (c < 0x80)
+		{
+			if (IsPlain(c))
+			{
+				*out++ = (char)c;
+			}
+			else
+			{
+				out = WriteEscape(out, c);
+			}
+			continue;
+		}
+		if (c >= 0xD800 && c <= 0xDFFF)
+		{
+			if (c <= 0xDBFF && p < end && (uint32_t)*p >= 0xDC00 && (uint32_t)*p <= 0xDFFF)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)*p++ - 0xDC00);
+			}
+			else
+			{
+				c = 0xFFFD;
+			}
+		}
+		else if (c > 0x10FFFF)
+		{
+			c = 0xFFFD;
+		}
+		out = WriteUtf8(out, c);
+	}
+	*out++ = '"';
+	size = out - this->data;
+}
+
+void JsonBufferWriter::Integer(int64_t value)
+{
+	char* out = Separate(20);
+	if (out == NULL)
+	{
+		return;
+	}
+	uint64_t magnitude = (uint64_t)value;
+	if (value < 0)
+	{
+		*out++ = '-';
+		magnitude = 0 - magnitude;
+	}
+	out = WriteDecimal(out, magnitude);
+	size = out - data;
+}
+
+void JsonBufferWriter::Unsigned(uint64_t value)
+{
+	char* out = Separate(20);
+	if (out == NULL)
+	{
+		return;
+	}
+	out = WriteDecimal(out, value);
+	size = out - data;
+}
+
+/**
+ * Writes a number. Whole values are written as integers, others with 17 significant digits so they
+ * read back exactly; NaN and infinity have no JSON form and are written as null.
+ *
+ * @access public
+ */
+void JsonBufferWriter::Number(double value)
+{
+	if (value != value || value - value != 0)
+	{
+		Null();
+		return;
+	}
+	if (value == floor(value) && fabs(value) < 9007199254740992.0)
+	{
+		Integer((int64_t)value);
+		return;
+	}
+	char* out = Separate(32);
+	if (out == NULL)
+	{
+		return;
+	}
+#ifdef _MSC_VER
+	static _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+	int count = _snprintf_s_l(out, 32, _TRUNCATE, "%.17g", c_locale, value);
+#else
+	int count = snprintf(out, 32, "%.17g", value);
+#endif
+	size = (out - data) + (count > 0 ? count : 0);
+}
+
+void JsonBufferWriter::Bool(bool value)
+{
+	char* out = Separate(5);
+	if (out == NULL)
+	{
+		return;
+	}
+	memcpy(out, value ? "true" : "false", value ? 4 : 5);
+	size = (out - data) + (value ? 4 : 5);
+}
+
+void JsonBufferWriter::Null()
+{
+	char* out = Separate(4);
+	if (out == NULL)
+	{
+		return;
+	}
+	memcpy(out, "null", 4);
+	size = (out - data) + 4;
+}
+
+/**
+ * Writes a FILETIME as a "YYYY-MM-DD hh:mm:ss" string, the format of TimeHelper::convertFileTimeToString.
+ * The civil date comes from the day count directly (H. Hinnant's days-to-civil), without FileTimeToSystemTime.
+ *
+ * @access public
+ *
+ * @param uint64_t file_time 100 ns intervals since 1601-01-01 UTC
+ */
+void JsonBufferWriter::Timestamp(uint64_t file_time)
+{
+	char* out = Separate(21);
+	if (out == NULL)
+	{
+		return;
+	}
+	uint64_t seconds = file_time / 10000000;
+	uint32_t second_of_day = (uint32_t)(seconds % 86400);
+	// Days since 0000-03-01, the start of a 400 year era with leap days at the end of each year
+	int64_t days = (int64_t)(seconds / 86400) + 584694;
+	int64_t era = days / 146097;
+	uint32_t day_of_era = (uint32_t)(days - era * 146097);
+	uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	uint32_t shifted_month = (5 * day_of_year + 2) / 153;
+	uint32_t day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+	uint32_t month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+	uint32_t year = (uint32_t)(era * 400) + year_of_era + (month <= 2 ? 1 : 0);
+
+	*out++ = '"';
+	out = WritePair(out, (year / 100) % 100);
+	out = WritePair(out, year % 100);
+	*out++ = '-';
+	out = WritePair(out, month);
+	*out++ = '-';
+	out = WritePair(out, day);
+	*out++ = ' ';
+	out = WritePair(out, second_of_day / 3600);
+	*out++ = ':';
+	out = WritePair(out, second_of_day / 60 % 60);
+	*out++ = ':';
+	out = WritePair(out, second_of_day % 60);
+	*out++ = '"';
+	size = out - data;
+}
+
+/**
+ * Passes the buffered output to the sink. Call it once after the document is complete; without a
+ * sink the output simply stays in the buffer.
+ *
+ * @access public
+ *
+ * @return bool Returns false if the sink refused data or memory ran out, the output is incomplete then
+ */
+bool JsonBufferWriter::Flush()
+{
+	if (failed)
+	{
+		return false;
+	}
+	if (sink != NULL && size > 0)
+	{
+		if (!sink->WriteOutput(data, size))
+		{
+			failed = true;
+		}
+		size = 0;
+	}
+	return !failed;
+}
+
+/**
+ * Drops the output so far and starts a new document, keeping the buffer
+ *
+ * @access public
+ */
+void JsonBufferWriter::Clear()
+{
+	size = 0;
+	depth = 0;
+	after_key = false;
+	failed = data == NULL;
+}
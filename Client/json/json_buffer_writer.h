@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "json_document.h"
+
+#define JSON_WRITER_BUFFER_SIZE	(64 * 1024)	// Initial capacity, and the size at which output goes to the sink
+
+// Receives the output of a JsonBufferWriter each time its buffer fills up
+class JsonWriterSink
+{
+public:
+	virtual ~JsonWriterSink() {}
+	// Return false to make the writer drop the rest of the document
+	virtual bool WriteOutput(const char* data, size_t length) = 0;
+};
+
+// Compact JSON appended to one contiguous buffer, with numbers, timestamps and UTF-16 strings
+// formatted in place instead of through streams or temporary strings. Without a sink the buffer
+// grows to hold the whole document; with one, every JSON_WRITER_BUFFER_SIZE bytes are passed on
+// so a large document can be sent while it is still being written.
+class JsonBufferWriter
+{
+public:
+	explicit JsonBufferWriter(size_t capacity = JSON_WRITER_BUFFER_SIZE);
+	~JsonBufferWriter();
+	void SetSink(JsonWriterSink* sink) { this->sink = sink; }
+
+	void StartObject() { Open('{'); }
+	void EndObject() { Close('}'); }
+	void StartArray() { Open('['); }
+	void EndArray() { Close(']'); }
+
+	void Key(const char* key);
+	void String(const char* data, size_t length);
+	void String(const std::string& value) { String(value.data(), value.size()); }
+	void String(const wchar_t* data, size_t length);
+	void String(const std::wstring& value) { String(value.data(), value.size()); }
+	void Integer(int64_t value);
+	void Unsigned(uint64_t value);
+	void Number(double value);
+	void Bool(bool value);
+	void Null();
+	void Timestamp(uint64_t file_time);		// FILETIME ticks as "YYYY-MM-DD hh:mm:ss" UTC
+
+	bool Flush();
+	void Clear();
+	bool IsFailed() const { return failed; }
+
+	const char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+	std::string ToString() const { return std::string(data, size); }
+private:
+	JsonBufferWriter(const JsonBufferWriter&) = delete;
+	JsonBufferWriter& operator=(const JsonBufferWriter&) = delete;
+
+	char* Reserve(size_t count);
+	char* Separate(size_t count);
+	void Open(char c);
+	void Close(char c);
+
+	char* data;
+	size_t size;
+	size_t capacity;
+	JsonWriterSink* sink;
+	bool failed;
+	bool after_key;					// The next value completes a pair, no comma in front of it
+	uint8_t empty[JSON_MAX_DEPTH];	// 1 while the container at that depth has no member yet
+	size_t depth;
+};
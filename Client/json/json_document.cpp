@@ -0,0 +1,754 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_document.h"
+#include "json_scalar.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_SCAN_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	// Bit masks of one JSON_BLOCK_SIZE block, bit i is byte i
+	struct BlockMasks
+	{
+		uint32_t backslash;
+		uint32_t quote;
+		uint32_t op;			// { } [ ] : ,
+		uint32_t whitespace;	// Space, tab, \r, \n
+		uint32_t control;		// Below 0x20 except tab, not allowed in strings
+		uint32_t high;			// Non-ASCII
+	};
+
+	inline uint32_t TrailingZeros(uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+		return bit;
+#else
+		return (uint32_t)__builtin_ctz(mask);
+#endif
+	}
+
+	// Bit i of the result is the xor of bits 0..i, so it is set from an opening quote up to its closing one
+	inline uint32_t PrefixXor(uint32_t mask)
+	{
+		mask ^= mask << 1;
+		mask ^= mask << 2;
+		mask ^= mask << 4;
+		mask ^= mask << 8;
+		mask ^= mask << 16;
+		return mask;
+	}
+
+#ifdef JSON_SCAN_SSE2
+	inline uint32_t Match(__m128i lo, __m128i hi, char c)
+	{
+		const __m128i v = _mm_set1_epi8(c);
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, v)) | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, v)) << 16);
+	}
+
+	inline void Classify(const uint8_t* block, BlockMasks& masks)
+	{
+		const __m128i lo = _mm_loadu_si128((const __m128i*)block);
+		const __m128i hi = _mm_loadu_si128((const __m128i*)(block + 16));
+		// '[' and ']' are '{' and '}' without bit 5
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		const __m128i lo_folded = _mm_or_si128(lo, case_bit);
+		const __m128i hi_folded = _mm_or_si128(hi, case_bit);
+		const __m128i below_space = _mm_set1_epi8(0x20);
+
+		uint32_t tab = Match(lo, hi, '\t');
+		masks.backslash = Match(lo, hi, '\\');
+		masks.quote = Match(lo, hi, '"');
+		masks.op = Match(lo_folded, hi_folded, '{') | Match(lo_folded, hi_folded, '}') | Match(lo, hi, ':') | Match(lo, hi, ',');
+		masks.whitespace = Match(lo, hi, ' ') | tab | Match(lo, hi, '\n') | Match(lo, hi, '\r');
+		masks.high = (uint32_t)_mm_movemask_epi8(lo) | ((uint32_t)_mm_movemask_epi8(hi) << 16);
+		// Signed compare, so non-ASCII bytes are "below" too and are taken out again
+		masks.control = (((uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(lo, below_space)) |
+			((uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(hi, below_space)) << 16)) & ~masks.high) & ~tab;
+	}
+#else
+	inline void Classify(const uint8_t* block, BlockMasks& masks)
+	{
+		memset(&masks, 0, sizeof(masks));
+		for (uint32_t i = 0; i < JSON_BLOCK_SIZE; i++)
+		{
+			uint8_t c = block[i];
+			uint32_t bit = 1u << i;
+			switch (c)
+			{
+			case '\\': masks.backslash |= bit; break;
+			case '"': masks.quote |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': masks.op |= bit; break;
+			case ' ': case '\t': case '\n': case '\r': masks.whitespace |= bit; break;
+			}
+			if (c < 0x20 && c != '\t') masks.control |= bit;
+			if (c >= 0x80) masks.high |= bit;
+		}
+	}
+#endif
+}
+
+#pragma region JsonDocument
+
+JsonDocument::JsonDocument()
+	: input(NULL), length(0), tape(NULL), tape_size(0), strings(NULL), strings_size(0), error(NULL), error_offset(0)
+{
+}
+
+/**
+ * Parses a complete UTF-8 JSON text. The input is not copied and must stay alive and unchanged
+ * while the document or any of its elements are used.
+ *
+ * @access public
+ *
+ * @param char* data The JSON text, it does not need to be null terminated
+ * @param size_t length Number of bytes of the text
+ *
+ * @return bool Returns true on success, false on error (see GetError and GetErrorOffset)
+ */
+bool JsonDocument::Parse(const char* data, size_t length)
+{
+	Clear();
+	if (data == NULL || length >= UINT32_MAX)
+	{
+		return Fail("Invalid input", 0);
+	}
+	// Editors on Windows like to start UTF-8 files with a byte order mark
+	if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+	{
+		data += 3;
+		length -= 3;
+	}
+	this->input = data;
+	this->length = length;
+	if (!FindStructurals() || !BuildTape())
+	{
+		tape_size = 0;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Drops the parsed values in one step by resetting the arena, keeping its largest block and the
+ * index buffer for the next Parse
+ *
+ * @access public
+ */
+void JsonDocument::Clear()
+{
+	input = NULL;
+	length = 0;
+	indexes.clear();
+	arena.Reset();
+	tape = NULL;
+	tape_size = 0;
+	strings = NULL;
+	strings_size = 0;
+	error = NULL;
+	error_offset = 0;
+}
+
+/**
+ * Gets the top-level value
+ *
+ * @access public
+ *
+ * @return JsonElement Returns the root, or an invalid element if nothing was parsed
+ */
+JsonElement JsonDocument::Root() const
+{
+	if (tape_size == 0)
+	{
+		return JsonElement();
+	}
+	return JsonElement(this, 0, tape_size);
+}
+
+bool JsonDocument::Fail(const char* message, size_t offset)
+{
+	error = message;
+	error_offset = offset;
+	return false;
+}
+
+/**
+ * Stage 1: classifies the input JSON_BLOCK_SIZE bytes at a time into bit masks and records the offset
+ * of every structural character, quote and scalar start outside of strings. Escaped quotes are found
+ * from the backslash runs, string interiors by a prefix xor of the remaining quotes.
+ *
+ * @access private
+ *
+ * @return bool Returns false for unterminated strings, control characters in strings or bad UTF-8
+ */
+bool JsonDocument::FindStructurals()
+{
+	const uint8_t* data = (const uint8_t*)input;
+	uint32_t prev_in_string = 0;	// All ones if the previous block ended inside a string
+	uint32_t prev_escaped = 0;		// 1 if the previous block ended with an unescaped backslash
+	uint32_t prev_scalar = 0;		// 1 if the previous block ended with a non-quote scalar byte
+	uint32_t bad_control = 0;
+	uint32_t high = 0;
+
+	indexes.reserve(length / 8 + 16);
+	for (size_t base = 0; base < length; base += JSON_BLOCK_SIZE)
+	{
+		uint8_t padded[JSON_BLOCK_SIZE];
+		const uint8_t* block = data + base;
+		if (length - base < JSON_BLOCK_SIZE)
+		{
+			memset(padded, ' ', JSON_BLOCK_SIZE);
+			memcpy(padded, block, length - base);
+			block = padded;
+		}
+
+		BlockMasks masks;
+		Classify(block, masks);
+
+		// Characters following an odd run of backslashes are escaped; runs are rare enough to walk
+		uint32_t escaped = prev_escaped;
+		uint32_t backslash = masks.backslash & ~prev_escaped;
+		prev_escaped = 0;
+		while (backslash)
+		{
+			uint32_t bit = TrailingZeros(backslash);
+			if (bit == JSON_BLOCK_SIZE - 1)
+			{
+				prev_escaped = 1;
+				break;
+			}
+			escaped |= 1u << (bit + 1);
+			backslash &= ~(3u << bit);
+		}
+
+		uint32_t quote = masks.quote & ~escaped;
+		uint32_t in_string = PrefixXor(quote) ^ prev_in_string;
+		prev_in_string = (uint32_t)((int32_t)in_string >> 31);
+		uint32_t string_tail = in_string ^ quote;	// Interior and closing quote
+
+		uint32_t scalar = ~(masks.op | masks.whitespace);
+		uint32_t nonquote_scalar = scalar & ~quote;
+		uint32_t follows_scalar = (nonquote_scalar << 1) | prev_scalar;
+		prev_scalar = nonquote_scalar >> 31;
+
+		// Closing quotes are kept too, so a string's end is the next index after its start
+		uint32_t structural = ((masks.op | (scalar & ~follows_scalar)) & ~string_tail) | quote;
+
+		bad_control |= masks.control & in_string;
+		high |= masks.high;
+
+		while (structural)
+		{
+			indexes.push_back((uint32_t)base + TrailingZeros(structural));
+			structural &= structural - 1;
+		}
+	}
+
+	if (prev_in_string)
+	{
+		return Fail("Unterminated string", length);
+	}
+	if (bad_control)
+	{
+		return Fail("Control character in string", 0);
+	}
+	if (high && !JsonValidateUtf8(data, length))
+	{
+		return Fail("Invalid UTF-8", 0);
+	}
+	return true;
+}
+
+/**
+ * Stage 2: walks the structural offsets and appends every value to the tape, validating the grammar
+ * with an explicit stack of the open containers instead of recursion.
+ *
+ * @access private
+ *
+ * @return bool Returns true on success, false on a syntax error
+ */
+bool JsonDocument::BuildTape()
+{
+	size_t count = indexes.size();
+	size_t i = 0;
+	size_t depth = 0;
+
+	if (count == 0)
+	{
+		return Fail("Empty document", 0);
+	}
+	// Every node starts at a distinct index, so the tape never needs to grow
+	tape = arena.AllocateArray<JsonNode>(count);
+	uint32_t* open = arena.AllocateArray<uint32_t>(JSON_MAX_DEPTH);
+	if (tape == NULL || open == NULL)
+	{
+		return Fail("Out of memory", 0);
+	}
+
+	for (;;)
+	{
+		// A value starts at indexes[i]
+		if (i >= count)
+		{
+			return Fail("Expected a value", length);
+		}
+		uint32_t at = indexes[i++];
+		char c = input[at];
+		JsonNode node;
+		memset(&node, 0, sizeof(node));
+		node.member = (depth > 0 && tape[open[depth - 1]].type == JSONElement_Object) ? 1 : 0;
+		if (depth > 0)
+		{
+			tape[open[depth - 1]].length++;
+		}
+
+		if (c == '{' || c == '[')
+		{
+			node.type = (uint8_t)(c == '{' ? JSONElement_Object : JSONElement_Array);
+			if (depth == JSON_MAX_DEPTH)
+			{
+				return Fail("Too deeply nested", at);
+			}
+			open[depth++] = tape_size;
+			tape[tape_size++] = node;
+			if (i < count && input[indexes[i]] == (c == '{' ? '}' : ']'))
+			{
+				// Empty container
+				i++;
+				tape[open[--depth]].next = tape_size;
+			}
+			else
+			{
+				if (c == '{')
+				{
+					// First key
+					JsonNode key;
+					memset(&key, 0, sizeof(key));
+					if (i >= count || input[indexes[i]] != '"' || !ParseString(i, key))
+					{
+						return Fail("Expected a key", i < count ? indexes[i] : length);
+					}
+					i += 2;
+					tape[tape_size++] = key;
+					if (i >= count || input[indexes[i]] != ':')
+					{
+						return Fail("Expected ':'", i < count ? indexes[i] : length);
+					}
+					i++;
+				}
+				continue;
+			}
+		}
+		else
+		{
+			bool ok;
+			if (c == '"')
+			{
+				ok = ParseString(i - 1, node);
+				i++;	// Closing quote
+			}
+			else if (c == '-' || (c >= '0' && c <= '9'))
+			{
+				ok = ParseNumber(at, node);
+			}
+			else
+			{
+				ok = ParseLiteral(at, node);
+			}
+			if (!ok)
+			{
+				return false;
+			}
+			node.next = tape_size + 1;
+			tape[tape_size++] = node;
+		}
+
+		// After a value: close containers or move on to the next element
+		for (;;)
+		{
+			if (depth == 0)
+			{
+				if (i != count)
+				{
+					return Fail("Unexpected data after the root value", indexes[i]);
+				}
+				return true;
+			}
+			if (i >= count)
+			{
+				return Fail("Unterminated array or object", length);
+			}
+			JsonNode& container = tape[open[depth - 1]];
+			bool object = container.type == JSONElement_Object;
+			at = indexes[i++];
+			if (input[at] == (object ? '}' : ']'))
+			{
+				container.next = tape_size;
+				depth--;
+				continue;
+			}
+			if (input[at] != ',')
+			{
+				return Fail(object ? "Expected ',' or '}'" : "Expected ',' or ']'", at);
+			}
+			if (object)
+			{
+				JsonNode key;
+				memset(&key, 0, sizeof(key));
+				if (i >= count || input[indexes[i]] != '"' || !ParseString(i, key))
+				{
+					return Fail("Expected a key", i < count ? indexes[i] : length);
+				}
+				i += 2;
+				tape[tape_size++] = key;
+				if (i >= count || input[indexes[i]] != ':')
+				{
+					return Fail("Expected ':'", i < count ? indexes[i] : length);
+				}
+				i++;
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * Fills a string node from the quote at indexes[position]. Stage 1 put the closing quote at the next index;
+ * strings with escapes are decoded into the document's string buffer, others point into the input.
+ *
+ * @access private
+ */
+bool JsonDocument::ParseString(size_t position, JsonNode& node)
+{
+	// FindStructurals checked that every string is terminated
+	uint32_t at = indexes[position];
+	uint32_t close = indexes[position + 1];
+	const char* begin = input + at + 1;
+	size_t size = close - at - 1;
+
+	node.type = JSONElement_String;
+	node.next = tape_size + 1;
+	if (memchr(begin, '\\', size) == NULL)
+	{
+		node.offset = at + 1;
+		node.length = (uint32_t)size;
+		return true;
+	}
+
+	if (strings == NULL)
+	{
+		// Unescaping never grows a string, so the input length bounds all of them together
+		strings = arena.AllocateArray<char>(length);
+		if (strings == NULL)
+		{
+			return Fail("Out of memory", at);
+		}
+	}
+	size_t error_offset;
+	char* out = JsonUnescape(begin, size, strings + strings_size, error_offset);
+	if (out == NULL)
+	{
+		return Fail("Invalid escape", at + 1 + error_offset);
+	}
+	node.escaped = 1;
+	node.offset = (uint32_t)strings_size;
+	node.length = (uint32_t)(out - strings - strings_size);
+	strings_size = out - strings;
+	return true;
+}
+
+/**
+ * Fills a number node from the text at 'at', which must be followed by a delimiter
+ *
+ * @access private
+ */
+bool JsonDocument::ParseNumber(uint32_t at, JsonNode& node)
+{
+	const char* stop;
+	if (!JsonParseNumber(input + at, input + length, stop, node) || !IsDelimiter(stop - input))
+	{
+		return Fail("Invalid number", at);
+	}
+	return true;
+}
+
+/**
+ * Fills a node from true, false or null at 'at'
+ *
+ * @access private
+ */
+bool JsonDocument::ParseLiteral(uint32_t at, JsonNode& node)
+{
+	const char* p = input + at;
+	size_t left = length - at;
+	if (left >= 4 && memcmp(p, "true", 4) == 0 && IsDelimiter(at + 4))
+	{
+		node.type = JSONElement_Bool;
+		node.bool_value = true;
+		return true;
+	}
+	if (left >= 5 && memcmp(p, "false", 5) == 0 && IsDelimiter(at + 5))
+	{
+		node.type = JSONElement_Bool;
+		node.bool_value = false;
+		return true;
+	}
+	if (left >= 4 && memcmp(p, "null", 4) == 0 && IsDelimiter(at + 4))
+	{
+		node.type = JSONElement_Null;
+		return true;
+	}
+	return Fail("Unexpected character", at);
+}
+
+// A scalar must be followed by the end, whitespace or a structural character
+bool JsonDocument::IsDelimiter(size_t at) const
+{
+	if (at >= length)
+	{
+		return true;
+	}
+	switch (input[at])
+	{
+	case ' ': case '\t': case '\r': case '\n':
+	case ',': case ':': case ']': case '}': case '[': case '{':
+		return true;
+	default:
+		return false;
+	}
+}
+
+#pragma endregion
+
+#pragma region JsonElement
+
+const JsonNode& JsonElement::Node() const
+{
+	return document->tape[index];
+}
+
+JsonElementType JsonElement::GetType() const
+{
+	return document ? (JsonElementType)Node().type : JSONElement_Null;
+}
+
+bool JsonElement::IsNull() const
+{
+	return GetType() == JSONElement_Null;
+}
+
+bool JsonElement::IsString() const
+{
+	return GetType() == JSONElement_String;
+}
+
+bool JsonElement::IsBool() const
+{
+	return GetType() == JSONElement_Bool;
+}
+
+bool JsonElement::IsNumber() const
+{
+	return GetType() == JSONElement_Number;
+}
+
+bool JsonElement::IsArray() const
+{
+	return GetType() == JSONElement_Array;
+}
+
+bool JsonElement::IsObject() const
+{
+	return GetType() == JSONElement_Object;
+}
+
+/**
+ * Gets the UTF-8 bytes of a string value, not null terminated
+ *
+ * @access public
+ *
+ * @return char* Returns the first byte, or NULL if this is not a string
+ */
+const char* JsonElement::GetStringData() const
+{
+	if (!IsString())
+	{
+		return NULL;
+	}
+	const JsonNode& node = Node();
+	return node.escaped ? document->strings + node.offset : document->input + node.offset;
+}
+
+size_t JsonElement::GetStringLength() const
+{
+	return IsString() ? Node().length : 0;
+}
+
+std::string JsonElement::AsString() const
+{
+	const char* data = GetStringData();
+	return data ? std::string(data, Node().length) : std::string();
+}
+
+/**
+ * Gets a string value converted from UTF-8 to UTF-16 (UTF-32 where wchar_t is 4 bytes)
+ *
+ * @access public
+ *
+ * @return std::wstring Returns the string, empty if this is not a string
+ */
+std::wstring JsonElement::AsWString() const
+{
+	const char* data = GetStringData();
+	return data ? JsonDecodeWString(data, Node().length) : std::wstring();
+}
+
+bool JsonElement::AsBool() const
+{
+	return IsBool() ? Node().bool_value : false;
+}
+
+double JsonElement::AsNumber() const
+{
+	if (!IsNumber())
+	{
+		return 0;
+	}
+	const JsonNode& node = Node();
+	return node.integer ? (double)node.integer_value : node.number;
+}
+
+int64_t JsonElement::AsInteger() const
+{
+	if (!IsNumber())
+	{
+		return 0;
+	}
+	const JsonNode& node = Node();
+	return node.integer ? node.integer_value : (int64_t)node.number;
+}
+
+/**
+ * Counts the values of an array or the pairs of an object
+ *
+ * @access public
+ *
+ * @return size_t Returns the number of children, 0 for scalars
+ */
+std::size_t JsonElement::CountChildren() const
+{
+	return (IsArray() || IsObject()) ? Node().length : 0;
+}
+
+/**
+ * Gets the value at 'index' of an array or object, by walking the siblings
+ *
+ * @access public
+ *
+ * @return JsonElement Returns the value, or an invalid element if out of range
+ */
+JsonElement JsonElement::Child(std::size_t index) const
+{
+	JsonElement child = FirstChild();
+	while (index-- > 0 && child.IsValid())
+	{
+		child = child.NextSibling();
+	}
+	return child;
+}
+
+/**
+ * Gets the value of the first pair of an object whose key is 'name'
+ *
+ * @access public
+ *
+ * @return JsonElement Returns the value, or an invalid element if there is no such key
+ */
+JsonElement JsonElement::Child(const char* name) const
+{
+	if (!IsObject() || name == NULL)
+	{
+		return JsonElement();
+	}
+	size_t size = strlen(name);
+	for (JsonElement child = FirstChild(); child.IsValid(); child = child.NextSibling())
+	{
+		JsonElement key(document, child.index - 1, child.index);
+		if (key.GetStringLength() == size && memcmp(key.GetStringData(), name, size) == 0)
+		{
+			return child;
+		}
+	}
+	return JsonElement();
+}
+
+bool JsonElement::HasChild(const char* name) const
+{
+	return Child(name).IsValid();
+}
+
+/**
+ * Gets the first value of an array or object
+ *
+ * @access public
+ *
+ * @return JsonElement Returns the value, or an invalid element if there are no children
+ */
+JsonElement JsonElement::FirstChild() const
+{
+	if (CountChildren() == 0)
+	{
+		return JsonElement();
+	}
+	const JsonNode& node = Node();
+	uint32_t first = index + (node.type == JSONElement_Object ? 2 : 1);
+	return JsonElement(document, first, node.next);
+}
+
+/**
+ * Gets the next value of the same array or object, skipping over this value's children
+ *
+ * @access public
+ *
+ * @return JsonElement Returns the value, or an invalid element after the last one
+ */
+JsonElement JsonElement::NextSibling() const
+{
+	if (!document)
+	{
+		return JsonElement();
+	}
+	const JsonNode& node = Node();
+	uint32_t next = node.next + (node.member ? 1 : 0);
+	if (next >= end)
+	{
+		return JsonElement();
+	}
+	return JsonElement(document, next, end);
+}
+
+/**
+ * Gets the key of an object pair, when this element is its value
+ *
+ * @access public
+ *
+ * @return std::string Returns the key, empty for array values and the root
+ */
+std::string JsonElement::Key() const
+{
+	if (!document || !Node().member)
+	{
+		return std::string();
+	}
+	return JsonElement(document, index - 1, index).AsString();
+}
+
+#pragma endregion
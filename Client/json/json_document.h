@@ -0,0 +1,121 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "json_arena.h"
+
+#define JSON_MAX_DEPTH		1024	// Deepest nesting of arrays and objects a document accepts
+#define JSON_BLOCK_SIZE		32		// Bytes classified per step of the structural scan
+
+enum JsonElementType
+{
+	JSONElement_Null,
+	JSONElement_String,
+	JSONElement_Bool,
+	JSONElement_Number,
+	JSONElement_Array,
+	JSONElement_Object
+};
+
+// One value on the tape, in document order. A container is followed by its children (an object
+// by key / value pairs) and 'next' is the index just past the whole value, so siblings are one hop apart.
+struct JsonNode
+{
+	uint8_t type;
+	uint8_t escaped;		// String was unescaped into the document, offset is into its string buffer
+	uint8_t integer;		// Number had no fraction or exponent and fits in int64_t
+	uint8_t member;			// Value of an object pair, the node before it is the key
+	uint32_t next;
+	uint32_t length;		// Bytes of a string, values of an array, pairs of an object
+	union
+	{
+		uint32_t offset;	// String start, in the input or the string buffer
+		double number;
+		int64_t integer_value;
+		bool bool_value;
+	};
+};
+
+class JsonDocument;
+
+// Lightweight handle to a value of a JsonDocument, valid as long as the document (and its input).
+// Accessors on a missing or mismatched element return empty values instead of failing.
+class JsonElement
+{
+	friend class JsonDocument;
+public:
+	JsonElement() : document(NULL), index(0), end(0) {}
+
+	bool IsValid() const { return document != NULL; }
+	JsonElementType GetType() const;
+	bool IsNull() const;
+	bool IsString() const;
+	bool IsBool() const;
+	bool IsNumber() const;
+	bool IsArray() const;
+	bool IsObject() const;
+
+	const char* GetStringData() const;
+	size_t GetStringLength() const;
+	std::string AsString() const;
+	std::wstring AsWString() const;
+	bool AsBool() const;
+	double AsNumber() const;
+	int64_t AsInteger() const;
+
+	std::size_t CountChildren() const;
+	JsonElement Child(std::size_t index) const;
+	JsonElement Child(const char* name) const;
+	bool HasChild(const char* name) const;
+	JsonElement FirstChild() const;
+	JsonElement NextSibling() const;
+	std::string Key() const;
+private:
+	JsonElement(const JsonDocument* document, uint32_t index, uint32_t end) : document(document), index(index), end(end) {}
+	const JsonNode& Node() const;
+
+	const JsonDocument* document;
+	uint32_t index;
+	uint32_t end;			// End of the parent's children, for NextSibling
+};
+
+// UTF-8 JSON parsed in place: a vectorized pass finds the structural characters, a second pass
+// builds the tape from them. Strings without escapes point into the input, which must outlive
+// the document; escaped ones are decoded into a buffer the document owns. The tape and that buffer
+// come from the document's arena, so the whole tree is released at once by Clear or destruction.
+class JsonDocument
+{
+	friend class JsonElement;
+public:
+	JsonDocument();
+	bool Parse(const char* data, size_t length);
+	bool Parse(const std::string& data) { return Parse(data.data(), data.size()); }
+	void Clear();
+
+	JsonElement Root() const;
+	const char* GetError() const { return error; }
+	size_t GetErrorOffset() const { return error_offset; }
+private:
+	JsonDocument(const JsonDocument&) = delete;
+	JsonDocument& operator=(const JsonDocument&) = delete;
+
+	bool FindStructurals();
+	bool BuildTape();
+	bool ParseString(size_t position, JsonNode& node);
+	bool ParseNumber(uint32_t at, JsonNode& node);
+	bool ParseLiteral(uint32_t at, JsonNode& node);
+	bool IsDelimiter(size_t at) const;
+	bool Fail(const char* message, size_t offset);
+
+	const char* input;
+	size_t length;
+	std::vector<uint32_t> indexes;	// Offsets of structural characters, quotes and scalar starts
+	JsonArena arena;
+	JsonNode* tape;
+	uint32_t tape_size;
+	char* strings;					// Unescaped strings, allocated on the first escape
+	size_t strings_size;
+	const char* error;
+	size_t error_offset;
+};
@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#include "json_scalar.h"
+#include "json_document.h"
+
+namespace
+{
+	char* AppendUtf8(char* out, uint32_t code_point)
+	{
+		if (code_point < 0x80)
+		{
+			*out++ = (char)code_point;
+		}
+		else if (code_point < 0x800)
+		{
+			*out++ = (char)(0xC0 | (code_point >> 6));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			*out++ = (char)(0xE0 | (code_point >> 12));
+			*out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		else
+		{
+			*out++ = (char)(0xF0 | (code_point >> 18));
+			*out++ = (char)(0x80 | ((code_point >> 12) & 0x3F));
+			*out++ = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code_point & 0x3F));
+		}
+		return out;
+	}
+
+	bool ParseHex4(const char* p, uint32_t& value)
+	{
+		value = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			char c = p[i];
+			value <<= 4;
+			if (c >= '0' && c <= '9') value |= (uint32_t)(c - '0');
+			else if (c >= 'A' && c <= 'F') value |= (uint32_t)(10 + c - 'A');
+			else if (c >= 'a' && c <= 'f') value |= (uint32_t)(10 + c - 'a');
+			else return false;
+		}
+		return true;
+	}
+
+	// Locale-independent strtod for the numbers the fast path cannot convert exactly
+	double StringToDouble(const char* text)
+	{
+#ifdef _MSC_VER
+		static _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+		return _strtod_l(text, NULL, c_locale);
+#else
+		return strtod(text, NULL);
+#endif
+	}
+
+	const double kPowersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+}
+
+/**
+ * Validates UTF-8 text
+ *
+ * @param uint8_t* data The bytes to check
+ * @param size_t length Number of bytes
+ *
+ * @return bool Returns false on a truncated or invalid sequence
+ */
+bool JsonValidateUtf8(const uint8_t* data, size_t length)
+{
+	size_t i = 0;
+	while (i < length)
+	{
+		uint8_t c = data[i];
+		if (c < 0x80)
+		{
+			i++;
+			continue;
+		}
+		size_t extra;
+		uint32_t code_point;
+		if ((c & 0xE0) == 0xC0) { extra = 1; code_point = c & 0x1F; }
+		else if ((c & 0xF0) == 0xE0) { extra = 2; code_point = c & 0x0F; }
+		else if ((c & 0xF8) == 0xF0) { extra = 3; code_point = c & 0x07; }
+		else return false;
+		if (length - i <= extra)
+		{
+			return false;
+		}
+		for (size_t k = 1; k <= extra; k++)
+		{
+			if ((data[i + k] & 0xC0) != 0x80)
+			{
+				return false;
+			}
+			code_point = (code_point << 6) | (data[i + k] & 0x3F);
+		}
+		// Overlong forms, surrogates and values past U+10FFFF
+		static const uint32_t minimum[4] = { 0, 0x80, 0x800, 0x10000 };
+		if (code_point < minimum[extra] || (code_point >= 0xD800 && code_point <= 0xDFFF) || code_point > 0x10FFFF)
+		{
+			return false;
+		}
+		i += extra + 1;
+	}
+	return true;
+}
+
+/**
+ * Decodes the escapes of a string body. Unpaired surrogates become U+FFFD.
+ *
+ * @param char* begin The first byte after the opening quote
+ * @param size_t size Number of bytes up to the closing quote
+ * @param char* out Output buffer of at least 'size' bytes, may be 'begin'
+ * @param size_t& error_offset Offset of an invalid escape from 'begin'
+ *
+ * @return char* Returns the end of the decoded text, or NULL on an invalid escape
+ */
+char* JsonUnescape(const char* begin, size_t size, char* out, size_t& error_offset)
+{
+	const char* p = begin;
+	const char* end = begin + size;
+	while (p < end)
+	{
+		const char* slash = (const char*)memchr(p, '\\', end - p);
+		if (slash == NULL)
+		{
+			memmove(out, p, end - p);
+			out += end - p;
+			break;
+		}
+		memmove(out, p, slash - p);
+		out += slash - p;
+		p = slash + 1;
+		if (p == end)
+		{
+			error_offset = slash - begin;
+			return NULL;
+		}
+		switch (*p++)
+		{
+		case '"': *out++ = '"'; break;
+		case '\\': *out++ = '\\'; break;
+		case '/': *out++ = '/'; break;
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u':
+		{
+			uint32_t code_point;
+			if (end - p < 4 || !ParseHex4(p, code_point))
+			{
+				error_offset = p - begin;
+				return NULL;
+			}
+			p += 4;
+			if (code_point >= 0xD800 && code_point <= 0xDBFF)
+			{
+				uint32_t low;
+				if (end - p >= 6 && p[0] == '\\' && p[1] == 'u' && ParseHex4(p + 2, low) && low >= 0xDC00 && low <= 0xDFFF)
+				{
+					code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+					p += 6;
+				}
+				else
+				{
+					code_point = 0xFFFD;	// Unpaired high surrogate
+				}
+			}
+			else if (code_point >= 0xDC00 && code_point <= 0xDFFF)
+			{
+				code_point = 0xFFFD;		// Unpaired low surrogate
+			}
+			out = AppendUtf8(out, code_point);
+			break;
+		}
+		default:
+			error_offset = p - 1 - begin;
+			return NULL;
+		}
+	}
+	return out;
+}
+
+/**
+ * Parses a number. Up to 19 significant digits with a small exponent are converted exactly with
+ * one multiplication or division, anything else goes through strtod.
+ *
+ * @param char* begin The '-' or first digit
+ * @param char* end End of the available text
+ * @param char*& stop Receives the end of the number
+ * @param JsonNode& node Receives the value, as an int64_t when there is no fraction or exponent
+ *
+ * @return bool Returns false if the text is not a valid JSON number
+ */
+bool JsonParseNumber(const char* begin, const char* end, const char*& stop, JsonNode& node)
+{
+	const char* p = begin;
+	bool negative = false;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool integer = true;
+
+	if (*p == '-')
+	{
+		negative = true;
+		p++;
+	}
+	if (p == end || *p < '0' || *p > '9')
+	{
+		return false;
+	}
+	if (*p == '0')
+	{
+		p++;
+	}
+	else
+	{
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+				digits++;
+			}
+			else
+			{
+				exponent++;
+			}
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		integer = false;
+		p++;
+		if (p == end || *p < '0' || *p > '9')
+		{
+			return false;
+		}
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+				digits += (mantissa != 0) ? 1 : 0;	// Leading zeros of the fraction are not significant
+				exponent--;
+			}
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		integer = false;
+		p++;
+		bool negative_exponent = false;
+		if (p < end && (*p == '+' || *p == '-'))
+		{
+			negative_exponent = *p == '-';
+			p++;
+		}
+		if (p == end || *p < '0' || *p > '9')
+		{
+			return false;
+		}
+		int value = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (value < 100000)
+			{
+				value = value * 10 + (*p - '0');
+			}
+		}
+		exponent += negative_exponent ? -value : value;
+	}
+	stop = p;
+	node.type = JSONElement_Number;
+	if (integer && exponent == 0 && mantissa <= (uint64_t)INT64_MAX)
+	{
+		node.integer = 1;
+		node.integer_value = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+		return true;
+	}
+	if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double value = (double)mantissa;
+		value = exponent < 0 ? value / kPowersOf10[-exponent] : value * kPowersOf10[exponent];
+		node.number = negative ? -value : value;
+		return true;
+	}
+	char buffer[64];
+	size_t size = p - begin;
+	if (size < sizeof(buffer))
+	{
+		memcpy(buffer, begin, size);
+		buffer[size] = 0;
+		node.number = StringToDouble(buffer);
+	}
+	else
+	{
+		node.number = StringToDouble(std::string(begin, size).c_str());
+	}
+	return true;
+}
+
+/**
+ * Converts UTF-8 text that was already validated
+ *
+ * @param char* data The UTF-8 bytes
+ * @param size_t length Number of bytes
+ *
+ * @return std::wstring Returns the UTF-16 string (UTF-32 where wchar_t is 4 bytes)
+ */
+std::wstring JsonDecodeWString(const char* data, size_t length)
+{
+	std::wstring result;
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* end = p + length;
+	result.reserve(end - p);
+	while (p < end)
+	{
+		uint32_t code_point = *p++;
+		// The caller validated the encoding, so only the lead byte decides the length
+		if (code_point >= 0xF0)
+		{
+			code_point = ((code_point & 0x07) << 18) | ((p[0] & 0x3Fu) << 12) | ((p[1] & 0x3Fu) << 6) | (p[2] & 0x3Fu);
+			p += 3;
+		}
+		else if (code_point >= 0xE0)
+		{
+			code_point = ((code_point & 0x0F) << 12) | ((p[0] & 0x3Fu) << 6) | (p[1] & 0x3Fu);
+			p += 2;
+		}
+		else if (code_point >= 0xC0)
+		{
+			code_point = ((code_point & 0x1F) << 6) | (p[0] & 0x3Fu);
+			p += 1;
+		}
+		if (code_point >= 0x10000 && sizeof(wchar_t) == 2)
+		{
+			code_point -= 0x10000;
+			result += (wchar_t)(0xD800 + (code_point >> 10));
+			result += (wchar_t)(0xDC00 + (code_point & 0x3FF));
+		}
+		else
+		{
+			result += (wchar_t)code_point;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct JsonNode;
+
+// Scalar decoding shared by JsonDocument and JsonStreamReader. None of these look at the
+// surrounding text: the callers find where a string or number ends and check what follows it.
+
+// Checks for well-formed UTF-8 without overlong forms, surrogates or values past U+10FFFF
+bool JsonValidateUtf8(const uint8_t* data, size_t length);
+
+// Decodes the escapes of a string body (without its quotes) into 'out', which needs 'size' bytes
+// and may be 'begin' itself since unescaping never grows. Returns the end of the output, or NULL
+// with 'error_offset' set to the bad escape relative to 'begin'.
+char* JsonUnescape(const char* begin, size_t size, char* out, size_t& error_offset);
+
+// Parses the number at 'begin' into the type, integer and value fields of 'node'. 'stop' receives
+// the first byte after the number text.
+bool JsonParseNumber(const char* begin, const char* end, const char*& stop, JsonNode& node);
+
+// Converts validated UTF-8 to UTF-16 (UTF-32 where wchar_t is 4 bytes)
+std::wstring JsonDecodeWString(const char* data, size_t length);
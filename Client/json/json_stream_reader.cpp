@@ -0,0 +1,432 @@
+#include <string.h>
+
+#include "json_stream_reader.h"
+#include "json_scalar.h"
+
+namespace
+{
+	const uint8_t kByteOrderMark[3] = { 0xEF, 0xBB, 0xBF };
+
+	// Bytes a string scan has to stop at: 1 for quote and backslash, 2 for control characters
+	// (tab is allowed, as in JsonDocument), 3 for non-ASCII
+	struct StringClasses
+	{
+		uint8_t table[256];
+		StringClasses()
+		{
+			for (int c = 0; c < 256; c++)
+			{
+				table[c] = (c < 0x20 && c != '\t') ? 2 : (c >= 0x80 ? 3 : 0);
+			}
+			table['"'] = 1;
+			table['\\'] = 1;
+		}
+	};
+	const StringClasses kStringClasses;
+
+	// A number or literal ends at whitespace or a structural character
+	inline bool IsDelimiter(char c)
+	{
+		switch (c)
+		{
+		case ' ': case '\t': case '\r': case '\n':
+		case ',': case ':': case ']': case '}': case '[': case '{':
+			return true;
+		default:
+			return false;
+		}
+	}
+}
+
+JsonStreamReader::JsonStreamReader(JsonStreamHandler* handler)
+	: handler(handler)
+{
+	Reset();
+}
+
+/**
+ * Forgets the current document so the reader can take a new one
+ *
+ * @access public
+ */
+void JsonStreamReader::Reset()
+{
+	state = State_Value;
+	token = Token_None;
+	key = false;
+	escape = false;
+	escaped = false;
+	high = false;
+	token_offset = 0;
+	partial.clear();
+	depth = 0;
+	position = 0;
+	base = NULL;
+	bom = 0;
+	error = NULL;
+	error_offset = 0;
+}
+
+/**
+ * Parses the next piece of the document and reports every value completed in it. A token cut at the
+ * end of the piece is kept and finished by the next Feed, so the pieces can be split anywhere.
+ *
+ * @access public
+ *
+ * @param char* data The next bytes of the document, only used during the call
+ * @param size_t length Number of bytes
+ *
+ * @return bool Returns false on a syntax error or when the handler stopped the reader (see GetError)
+ */
+bool JsonStreamReader::Feed(const char* data, size_t length)
+{
+	if (error != NULL)
+	{
+		return false;
+	}
+	base = data;
+	const char* p = data;
+	const char* end = data + length;
+	if (token == Token_String)
+	{
+		p = ScanString(p, end);
+	}
+	else if (token != Token_None)
+	{
+		p = ScanScalar(p, end);
+	}
+
+	while (p != NULL && p < end)
+	{
+		char c = *p;
+		uint64_t at = position + (p - data);
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+		{
+			p++;
+			continue;
+		}
+		if (at < 3 && bom == at && (uint8_t)c == kByteOrderMark[at])
+		{
+			bom++;
+			p++;
+			continue;
+		}
+		if (bom == 1 || bom == 2)
+		{
+			return Fail("Unexpected character", 0);
+		}
+
+		switch (state)
+		{
+		case State_Value:
+		case State_ValueOrEnd:
+			if (c == ']' && state == State_ValueOrEnd)
+			{
+				p = Close(c, at) ? p + 1 : NULL;
+			}
+			else if (c == '{' || c == '[')
+			{
+				p = Open(c, at) ? p + 1 : NULL;
+			}
+			else if (c == '"')
+			{
+				token = Token_String;
+				token_offset = at;
+				key = escape = escaped = high = false;
+				p = ScanString(p + 1, end);
+			}
+			else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')
+			{
+				token = (c == '-' || (c >= '0' && c <= '9')) ? Token_Number : Token_Literal;
+				token_offset = at;
+				p = ScanScalar(p, end);
+			}
+			else
+			{
+				return Fail("Unexpected character", at);
+			}
+			break;
+		case State_Key:
+		case State_KeyOrEnd:
+			if (c == '}' && state == State_KeyOrEnd)
+			{
+				p = Close(c, at) ? p + 1 : NULL;
+				break;
+			}
+			if (c != '"')
+			{
+				return Fail("Expected a key", at);
+			}
+			token = Token_String;
+			token_offset = at;
+			key = true;
+			escape = escaped = high = false;
+			p = ScanString(p + 1, end);
+			break;
+		case State_Colon:
+			if (c != ':')
+			{
+				return Fail("Expected ':'", at);
+			}
+			state = State_Value;
+			p++;
+			break;
+		case State_CommaOrEnd:
+		{
+			bool object = open[depth - 1] == '{';
+			if (c == ',')
+			{
+				state = object ? State_Key : State_Value;
+				p++;
+			}
+			else if (c == (object ? '}' : ']'))
+			{
+				p = Close(c, at) ? p + 1 : NULL;
+			}
+			else
+			{
+				return Fail(object ? "Expected ',' or '}'" : "Expected ',' or ']'", at);
+			}
+			break;
+		}
+		case State_Done:
+			return Fail("Unexpected data after the root value", at);
+		}
+	}
+	if (p == NULL)
+	{
+		return false;
+	}
+	position += length;
+	return true;
+}
+
+/**
+ * Ends the document: finishes a number or literal that was waiting for a delimiter and checks that
+ * the root value is complete
+ *
+ * @access public
+ *
+ * @return bool Returns true if the stream held exactly one valid JSON value
+ */
+bool JsonStreamReader::Finish()
+{
+	if (error != NULL)
+	{
+		return false;
+	}
+	if (token == Token_String)
+	{
+		return Fail("Unterminated string", position);
+	}
+	if (token != Token_None && !EndScalar(partial.data(), partial.size()))
+	{
+		return false;
+	}
+	if (state == State_Done)
+	{
+		return true;
+	}
+	return Fail(depth > 0 ? "Unterminated array or object" : "Empty document", position);
+}
+
+/**
+ * Continues the open string up to its closing quote. Without escapes and within one piece the handler
+ * gets the bytes in place, otherwise they are gathered in 'partial' and unescaped there.
+ *
+ * @access private
+ *
+ * @return char* Returns the position after the string, the end of the piece if the string goes on,
+ *               or NULL on error
+ */
+const char* JsonStreamReader::ScanString(const char* p, const char* end)
+{
+	// The body starts after the quote, or at the piece if an earlier one opened the string
+	uint64_t body = token_offset + 1;
+	const char* begin = body > position ? base + (body - position) : base;
+
+	while (p < end)
+	{
+		if (escape)
+		{
+			escape = false;		// Checked by JsonUnescape
+			p++;
+			continue;
+		}
+		const uint8_t* q = (const uint8_t*)p;
+		while (q < (const uint8_t*)end && kStringClasses.table[*q] == 0)
+		{
+			q++;
+		}
+		p = (const char*)q;
+		if (p == end)
+		{
+			break;
+		}
+		switch (kStringClasses.table[*q])
+		{
+		case 1:
+			if (*p == '\\')
+			{
+				escape = escaped = true;
+				p++;
+				break;
+			}
+			if (partial.empty())
+			{
+				return EndString(begin, p - begin) ? p + 1 : NULL;
+			}
+			partial.append(begin, p - begin);
+			return EndString(partial.data(), partial.size()) ? p + 1 : NULL;
+		case 2:
+			Fail("Control character in string", position + (p - base));
+			return NULL;
+		default:
+			high = true;
+			p++;
+			break;
+		}
+	}
+	partial.append(begin, end - begin);
+	return end;
+}
+
+/**
+ * Continues the open number or literal up to the next delimiter
+ *
+ * @access private
+ *
+ * @return char* Returns the delimiter, the end of the piece if the token goes on, or NULL on error
+ */
+const char* JsonStreamReader::ScanScalar(const char* p, const char* end)
+{
+	const char* begin = token_offset > position ? base + (token_offset - position) : base;
+	while (p < end && !IsDelimiter(*p))
+	{
+		p++;
+	}
+	if (p == end)
+	{
+		partial.append(begin, end - begin);
+		return end;
+	}
+	if (partial.empty())
+	{
+		return EndScalar(begin, p - begin) ? p : NULL;
+	}
+	partial.append(begin, p - begin);
+	return EndScalar(partial.data(), partial.size()) ? p : NULL;
+}
+
+bool JsonStreamReader::EndString(const char* data, size_t size)
+{
+	token = Token_None;
+	if (high && !JsonValidateUtf8((const uint8_t*)data, size))
+	{
+		return Fail("Invalid UTF-8", token_offset);
+	}
+	if (escaped)
+	{
+		if (data != partial.data())
+		{
+			partial.assign(data, size);
+		}
+		size_t error_at;
+		char* out = JsonUnescape(partial.data(), size, &partial[0], error_at);
+		if (out == NULL)
+		{
+			return Fail("Invalid escape", token_offset + 1 + error_at);
+		}
+		data = partial.data();
+		size = out - partial.data();
+	}
+	bool ok = key ? handler->Key(data, size) : handler->String(data, size);
+	partial.clear();
+	if (!ok)
+	{
+		return Fail("Stopped by the handler", token_offset);
+	}
+	if (key)
+	{
+		state = State_Colon;
+		return true;
+	}
+	return EndValue();
+}
+
+bool JsonStreamReader::EndScalar(const char* data, size_t size)
+{
+	token = Token_None;
+	bool ok;
+	if (*data == '-' || (*data >= '0' && *data <= '9'))
+	{
+		JsonNode node;
+		memset(&node, 0, sizeof(node));
+		const char* stop;
+		if (!JsonParseNumber(data, data + size, stop, node) || stop != data + size)
+		{
+			return Fail("Invalid number", token_offset);
+		}
+		ok = node.integer ? handler->Integer(node.integer_value) : handler->Number(node.number);
+	}
+	else if (size == 4 && memcmp(data, "true", 4) == 0)
+	{
+		ok = handler->Bool(true);
+	}
+	else if (size == 5 && memcmp(data, "false", 5) == 0)
+	{
+		ok = handler->Bool(false);
+	}
+	else if (size == 4 && memcmp(data, "null", 4) == 0)
+	{
+		ok = handler->Null();
+	}
+	else
+	{
+		return Fail("Unexpected character", token_offset);
+	}
+	partial.clear();
+	if (!ok)
+	{
+		return Fail("Stopped by the handler", token_offset);
+	}
+	return EndValue();
+}
+
+bool JsonStreamReader::EndValue()
+{
+	state = depth == 0 ? State_Done : State_CommaOrEnd;
+	return true;
+}
+
+bool JsonStreamReader::Open(char c, uint64_t at)
+{
+	if (depth == JSON_MAX_DEPTH)
+	{
+		return Fail("Too deeply nested", at);
+	}
+	open[depth++] = c;
+	state = c == '{' ? State_KeyOrEnd : State_ValueOrEnd;
+	if (!(c == '{' ? handler->StartObject() : handler->StartArray()))
+	{
+		return Fail("Stopped by the handler", at);
+	}
+	return true;
+}
+
+bool JsonStreamReader::Close(char c, uint64_t at)
+{
+	depth--;
+	if (!(c == '}' ? handler->EndObject() : handler->EndArray()))
+	{
+		return Fail("Stopped by the handler", at);
+	}
+	return EndValue();
+}
+
+bool JsonStreamReader::Fail(const char* message, uint64_t offset)
+{
+	error = message;
+	error_offset = offset;
+	return false;
+}
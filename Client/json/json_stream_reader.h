@@ -0,0 +1,87 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "json_document.h"
+
+// Events of a JsonStreamReader, in document order. Strings and keys are unescaped UTF-8, not null
+// terminated and only valid during the call. Returning false from any event stops the reader.
+class JsonStreamHandler
+{
+public:
+	virtual ~JsonStreamHandler() {}
+	virtual bool Null() { return true; }
+	virtual bool Bool(bool value) { return true; }
+	virtual bool Integer(int64_t value) { return Number((double)value); }	// No fraction or exponent and fits in int64_t
+	virtual bool Number(double value) { return true; }
+	virtual bool String(const char* data, size_t length) { return true; }
+	virtual bool Key(const char* data, size_t length) { return true; }
+	virtual bool StartObject() { return true; }
+	virtual bool EndObject() { return true; }
+	virtual bool StartArray() { return true; }
+	virtual bool EndArray() { return true; }
+};
+
+// Push parser for JSON that arrives in pieces, such as a response body read from the network.
+// Nothing is kept of the values already reported: memory is the container stack plus the one
+// token split across two pieces, however large the document. Accepts the same grammar as
+// JsonDocument, including a leading byte order mark.
+class JsonStreamReader
+{
+public:
+	explicit JsonStreamReader(JsonStreamHandler* handler);
+	bool Feed(const char* data, size_t length);
+	bool Finish();
+	void Reset();
+
+	size_t GetDepth() const { return depth; }
+	const char* GetError() const { return error; }
+	uint64_t GetErrorOffset() const { return error_offset; }
+private:
+	JsonStreamReader(const JsonStreamReader&) = delete;
+	JsonStreamReader& operator=(const JsonStreamReader&) = delete;
+
+	enum State
+	{
+		State_Value,			// Any value
+		State_ValueOrEnd,		// First value of an array or ']'
+		State_Key,				// Key after ','
+		State_KeyOrEnd,			// First key of an object or '}'
+		State_Colon,
+		State_CommaOrEnd,
+		State_Done				// Root value complete, only whitespace may follow
+	};
+	enum Token
+	{
+		Token_None,
+		Token_String,
+		Token_Number,
+		Token_Literal			// true, false or null
+	};
+
+	const char* ScanString(const char* p, const char* end);
+	const char* ScanScalar(const char* p, const char* end);
+	bool EndString(const char* data, size_t size);
+	bool EndScalar(const char* data, size_t size);
+	bool EndValue();
+	bool Open(char c, uint64_t at);
+	bool Close(char c, uint64_t at);
+	bool Fail(const char* message, uint64_t offset);
+
+	JsonStreamHandler* handler;
+	State state;
+	Token token;
+	bool key;						// The open string is a key
+	bool escape;					// The last byte of the open string was an unescaping backslash
+	bool escaped;					// The open string has escapes
+	bool high;						// The open string has non-ASCII bytes
+	uint64_t token_offset;			// Stream offset of the open token
+	std::string partial;			// Bytes of the open token from earlier pieces
+	char open[JSON_MAX_DEPTH];		// '{' or '[' of each open container
+	size_t depth;
+	uint64_t position;				// Stream offset of the current piece
+	const char* base;				// Start of the current piece
+	uint32_t bom;					// Byte order mark bytes seen at the start
+	const char* error;
+	uint64_t error_offset;
+};
@@ -1,9 +1,15 @@
 #include "json_utility.h"
-#include "json/json_value.h"
+#include "json/json_document.h"
 #include "json/json_writer.h"
+#include "json/json_scalar.h"
 
 namespace UserOperations 
 {
+	static uint64_t FileTimeTicks(const FILETIME& time)
+	{
+		return ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime;
+	}
+
 	std::string JsonUtility::CreateJsonRegister(const UserInfo& info)
 	{
 		std::ostringstream os;
@@ -102,6 +108,27 @@ namespace UserOperations
 		return os.str();
 	}
 
+	std::string JsonUtility::CreateJsonBatch(const std::vector<BatchOperation>& operations)
+	{
+		std::ostringstream os;
+		JsonWriter* jw = new JsonWriter();
+		jw->SetWriter(&os);
+		jw->StartArray();
+		for (int i = 0; i < operations.size(); i++)
+		{
+			jw->StartObject();
+			jw->KeyValue("action", Helper::StringHelper::convertWideStringToString(operations[i].action));
+			jw->KeyValue("file_id", (uint64_t)operations[i].file_id);
+			if (!operations[i].new_name.empty())
+			{
+				jw->KeyValue("new_file_name", Helper::StringHelper::convertWideStringToString(operations[i].new_name));
+			}
+			jw->EndObject();
+		}
+		jw->EndArray();
+		return os.str();
+	}
+
 	std::string JsonUtility::CreateJsonFileUpload(const FileInfo& file)
 	{
 		std::ostringstream os;
@@ -137,99 +164,180 @@ namespace UserOperations
 		return os.str();
 	}
 
-	std::string JsonUtility::CreateJsonFolderTree(const FolderInfo& folder)
+	/**
+	 * Writes the folder tree for /files/compare, one object per file, straight from the FileInfo fields.
+	 * The folders are walked in place and the relative path is extended and cut back on the way,
+	 * instead of copying the tree with GetFilesRecursive and rebuilding each path from the parents.
+	 */
+	void JsonUtility::WriteJsonFolderTree(const FolderInfo& folder, JsonBufferWriter& writer)
 	{
-		std::ostringstream os;
-		JsonWriter* jw = new JsonWriter();
-		ResourceOperations::LIST_FILE files = folder.GetFilesRecursive();
+		std::wstring path = folder.GetRelativePath();
+		writer.StartArray();
+		WriteJsonFolderFiles(folder, path, writer);
+		writer.EndArray();
+	}
 
-		jw->SetWriter(&os);
-		jw->StartArray();
-		for (int i = 0; i < files.size(); i++)
+	void JsonUtility::WriteJsonFolderFiles(const FolderInfo& folder, std::wstring& path, JsonBufferWriter& writer)
+	{
+		for (const FileInfo& file : folder.GetFiles())
 		{
-			jw->StartObject();
-			jw->KeyValue("file_name", Helper::StringHelper::convertWideStringToString(files[i].GetFileName()));
-			jw->KeyValue("file_size", (uint64_t)files[i].GetFileSize());
-			jw->KeyValue("folder", Helper::StringHelper::convertWideStringToString(files[i].GetParentFolder()->GetRelativePath()));
-			jw->KeyValue("attribute", (uint64_t)files[i].GetFileAttribute());
-			jw->KeyValue("create_time", Helper::TimeHelper::convertFileTimeToString(files[i].GetCreateTime()));
-			jw->KeyValue("last_write_time", Helper::TimeHelper::convertFileTimeToString(files[i].GetLastWriteTime()));
-			jw->KeyValue("last_access_time", Helper::TimeHelper::convertFileTimeToString(files[i].GetLastAccessTime()));
-			jw->EndObject();
+			writer.StartObject();
+			writer.Key("file_name");
+			writer.String(file.GetFileName());
+			writer.Key("file_size");
+			writer.Unsigned(file.GetFileSize());
+			writer.Key("folder");
+			writer.String(path);
+			writer.Key("attribute");
+			writer.Unsigned(file.GetFileAttribute());
+			writer.Key("create_time");
+			writer.Timestamp(FileTimeTicks(file.GetCreateTime()));
+			writer.Key("last_write_time");
+			writer.Timestamp(FileTimeTicks(file.GetLastWriteTime()));
+			writer.Key("last_access_time");
+			writer.Timestamp(FileTimeTicks(file.GetLastAccessTime()));
+			writer.EndObject();
+		}
+		for (const FolderInfo& child : folder.GetChildrens())
+		{
+			size_t length = path.size();
+			path += L"\\";
+			path += child.GetFolderName();
+			WriteJsonFolderFiles(child, path, writer);
+			path.resize(length);
 		}
-		jw->EndArray();
-		return os.str();
 	}
 
 	void JsonUtility::ParserJsonRegisterResponse(const std::string& message, DWORD& user_id)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject() && jr->CountChildren() > 0)
+		JsonDocument document;
+		if (document.Parse(message) && document.Root().IsObject() && document.Root().CountChildren() > 0)
 		{
-			user_id = (DWORD)jr->Child(L"user_id")->AsNumber();
+			user_id = (DWORD)document.Root().Child("user_id").AsInteger();
 		}
-		if (jr) { delete jr; }
 	}
 
 	void JsonUtility::ParseJsonGetProfileResponse(const std::string& message, UserInfo& user_info)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject() && jr->CountChildren() > 0)
+		JsonDocument document;
+		JsonElement jr = document.Parse(message) ? document.Root() : JsonElement();
+		if (jr.IsObject() && jr.CountChildren() > 0)
 		{
-			user_info.first_name = jr->Child(L"first_name")->AsString();
-			user_info.last_name = jr->Child(L"last_name")->AsString();
-			user_info.user_name = jr->Child(L"user_name")->AsString();
-			user_info.password = jr->Child(L"password")->AsString();
-			user_info.birthday = jr->Child(L"birthday")->AsString();
-			user_info.email = jr->Child(L"email")->AsString();
+			user_info.first_name = jr.Child("first_name").AsWString();
+			user_info.last_name = jr.Child("last_name").AsWString();
+			user_info.user_name = jr.Child("user_name").AsWString();
+			user_info.password = jr.Child("password").AsWString();
+			user_info.birthday = jr.Child("birthday").AsWString();
+			user_info.email = jr.Child("email").AsWString();
 		}
-		if (jr) { delete jr; }
 	}
 
 	void JsonUtility::ParserJsonLoginResponse(const std::string& message, std::wstring& token_id)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject())
+		JsonDocument document;
+		if (document.Parse(message) && document.Root().IsObject())
 		{
-			token_id = jr->Child(L"token")->AsString();
+			token_id = document.Root().Child("token").AsWString();
 		}
-		if (jr) { delete jr; }
 	}
 
 	void JsonUtility::ParserJsonUploadFileResponse(const std::string& message, std::string& upload_id, DWORD& file_id)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject())
+		JsonDocument document;
+		if (document.Parse(message) && document.Root().IsObject())
 		{
-			file_id = (DWORD)jr->Child(L"file_id")->AsNumber();
-			upload_id = Helper::StringHelper::convertWideStringToString(jr->Child(L"upload_id")->AsString());
+			file_id = (DWORD)document.Root().Child("file_id").AsInteger();
+			upload_id = document.Root().Child("upload_id").AsString();
 		}
-		if (jr) { delete jr; }
 	}
 
 	void JsonUtility::ParserJsonUpdateFileResponse(const std::string& message, std::string& update_id, DWORD& file_id)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject())
+		JsonDocument document;
+		if (document.Parse(message) && document.Root().IsObject())
 		{
-			file_id = (DWORD)jr->Child(L"file_id")->AsNumber();
-			update_id = Helper::StringHelper::convertWideStringToString(jr->Child(L"update_id")->AsString());
+			file_id = (DWORD)document.Root().Child("file_id").AsInteger();
+			update_id = document.Root().Child("update_id").AsString();
 		}
-		if (jr) { delete jr; }
 	}
 	
-	void JsonUtility::ParserJsonFileMissResponse(const std::string& message, std::vector<FileMissing>& files)
+	void JsonUtility::ParserJsonBatchResponse(const std::string& message, std::vector<BatchResult>& results)
 	{
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsArray())
+		JsonDocument document;
+		if (document.Parse(message) && document.Root().IsArray())
 		{
-			JsonArray array = jr->AsArray();
-			for (int i = 0; i < array.size(); i++)
+			for (JsonElement obj = document.Root().FirstChild(); obj.IsValid(); obj = obj.NextSibling())
 			{
-				JsonObject obj = array[i]->AsObject();
-				files.push_back({obj[L"folder_path"]->AsString(),obj[L"file_name"]->AsString()});
+				results.push_back({ (DWORD)obj.Child("file_id").AsInteger(), (DWORD)obj.Child("status").AsInteger(), obj.Child("message").AsWString() });
 			}
 		}
-		if (jr) { delete jr; }
+	}
+
+	FileMissReader::FileMissReader(ThreadSafeQueue<FileMissing>& queue)
+		: queue(queue), reader(this), depth(0), field(0), count(0)
+	{
+	}
+
+	BOOL FileMissReader::ReadResponseData(const BYTE* data, DWORD length)
+	{
+		return reader.Feed((const char*)data, length) ? TRUE : FALSE;
+	}
+
+	// Checks that the whole response arrived and was valid JSON
+	BOOL FileMissReader::Finish()
+	{
+		return reader.Finish() ? TRUE : FALSE;
+	}
+
+	bool FileMissReader::StartObject()
+	{
+		if (++depth == 2)
+		{
+			entry.first.clear();
+			entry.second.clear();
+		}
+		return true;
+	}
+
+	bool FileMissReader::EndObject()
+	{
+		if (depth-- == 2)
+		{
+			count++;
+			return queue.push(entry);
+		}
+		return true;
+	}
+
+	bool FileMissReader::StartArray()
+	{
+		depth++;
+		return true;
+	}
+
+	bool FileMissReader::EndArray()
+	{
+		depth--;
+		return true;
+	}
+
+	bool FileMissReader::Key(const char* data, size_t length)
+	{
+		if (depth == 2)
+		{
+			field = (length == 11 && memcmp(data, "folder_path", 11) == 0) ? 1 :
+				(length == 9 && memcmp(data, "file_name", 9) == 0) ? 2 : 0;
+		}
+		return true;
+	}
+
+	bool FileMissReader::String(const char* data, size_t length)
+	{
+		// Keys and values of an entry alternate, so 'field' always belongs to the key just read
+		if (depth == 2 && field != 0)
+		{
+			(field == 1 ? entry.first : entry.second) = JsonDecodeWString(data, length);
+		}
+		return true;
 	}
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
 #pragma once
 #include "folder_info.h"
+#include "http_client.h"
+#include "thread_safe_queue.h"
+#include "json/json_stream_reader.h"
+#include "json/json_buffer_writer.h"
 
 using namespace ResourceOperations;
+using namespace NetworkOperations;
 
 namespace UserOperations 
 {
@@ -17,6 +22,21 @@ namespace UserOperations
 
     typedef std::pair<std::wstring, std::wstring> FileMissing;
 
+    struct BatchOperation
+    {
+        std::wstring action;        // "rename" or "remove"
+        DWORD file_id;
+        std::wstring file_path;     // Local path, only used to update the file cache
+        std::wstring new_name;
+    };
+
+    struct BatchResult
+    {
+        DWORD file_id;
+        DWORD status;
+        std::wstring message;
+    };
+
     class JsonUtility 
     {
     public:
@@ -24,17 +44,62 @@ namespace UserOperations
         static std::string CreateJsonUpdateProfile(const UserInfo& info);
         static std::string CreateJsonFileUpload(const FileInfo& file);
         static std::string CreateJsonFileUpdate(const FileInfo& file, DWORD file_id);
-        static std::string CreateJsonFolderTree(const FolderInfo& folder);
+        // The compare payload, written straight from the FileInfo fields while the folders are walked in place
+        static void WriteJsonFolderTree(const FolderInfo& folder, JsonBufferWriter& writer);
         static std::string CreateJsonLogin(const std::wstring& user_name, const std::wstring& password);
         static std::string CreateJsonChangePassword(const std::wstring& old_password, const std::wstring& new_password);
         static std::string CreateJsonFileRename(const std::wstring& old_file_name, const std::wstring& new_file_name);
         static std::string CreateJsonFolderRename(const std::wstring& old_folder_name, const std::wstring& new_folder_name);
+        static std::string CreateJsonBatch(const std::vector<BatchOperation>& operations);
     public:
         static void ParserJsonRegisterResponse(const std::string& message, DWORD& user_id);
         static void ParseJsonGetProfileResponse(const std::string& message, UserInfo& user_info);
         static void ParserJsonLoginResponse(const std::string& message, std::wstring& token_id);
         static void ParserJsonUploadFileResponse(const std::string& message, std::string& upload_id, DWORD& file_id);
         static void ParserJsonUpdateFileResponse(const std::string& message, std::string& update_id, DWORD& file_id);
-        static void ParserJsonFileMissResponse(const std::string& message, std::vector<FileMissing>& files);
+        static void ParserJsonBatchResponse(const std::string& message, std::vector<BatchResult>& results);
+    private:
+        // Files of 'folder' and its subfolders, 'path' is the relative path of 'folder' and is restored on return
+        static void WriteJsonFolderFiles(const FolderInfo& folder, std::wstring& path, JsonBufferWriter& writer);
+    };
+
+    // Sends the output of a JsonBufferWriter as the chunks of a request opened with HttpClient::OpenChunkedRequest
+    class ChunkedRequestSink : public JsonWriterSink
+    {
+    public:
+        ChunkedRequestSink(HttpClient* client, LPVOID request) : client(client), request(request) {}
+        bool WriteOutput(const char* data, size_t length) override
+        {
+            return client->WriteRequestChunk(request, data, length) ? true : false;
+        }
+    private:
+        HttpClient* client;
+        LPVOID request;
+    };
+
+    // Reads the /files/compare response, an array of { "folder_path", "file_name", ... } objects, while it
+    // downloads and pushes every entry to the queue as soon as its object closes. Stops when the queue is closed.
+    class FileMissReader : public IResponseReader, private JsonStreamHandler
+    {
+    public:
+        explicit FileMissReader(ThreadSafeQueue<FileMissing>& queue);
+        BOOL ReadResponseData(const BYTE* data, DWORD length) override;
+        BOOL Finish();
+        size_t GetCount() const { return count; }
+        const char* GetError() const { return reader.GetError(); }
+    private:
+        bool StartObject() override;
+        bool EndObject() override;
+        bool StartArray() override;
+        bool EndArray() override;
+        bool Key(const char* data, size_t length) override;
+        bool String(const char* data, size_t length) override;
+
+        ThreadSafeQueue<FileMissing>& queue;
+        JsonStreamReader reader;
+        size_t depth;
+        int field;              // 1 while the value of "folder_path" is due, 2 for "file_name"
+        FileMissing entry;
+        size_t count;
     };
 }
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "logger.h"
+#include "base64.h"
 #include "http_client.h"
 #include "user_handle.h"
-#include "json/json_value.h"
+#include "json/json_document.h"
 #include "json/json_writer.h"
 
 #include <Msi.h>
@@ -29,6 +30,7 @@ void Usage()
 	std::wcout << "  [14] Upload folder filter" << std::endl;
 	std::wcout << "  [15] Update folder filter" << std::endl;
 	std::wcout << "  [16] Watch folder" << std::endl;
+	std::wcout << "  [17] Download file" << std::endl;
 	std::wcout << "  [E]xit program" << std::endl;
 	std::wcout << "=> Action number: ";
 }
@@ -53,6 +55,7 @@ void cmd_user_upload_folder_filter(std::unique_ptr<UserHandle>& handler);
 void cmd_user_remove_file(std::unique_ptr<UserHandle>& handler);
 void cmd_user_rename_file(std::unique_ptr<UserHandle>& handler);
 void cmd_user_watch_folder(std::unique_ptr<UserHandle>& handler);
+void cmd_user_download_file(std::unique_ptr<UserHandle>& handler);
 
 
 void TEST()
@@ -98,27 +101,25 @@ void cmd_json_setup(const std::wstring& config_path, std::unique_ptr<UserHandle>
 	std::wstring cert_path;		// -cert_path	if not import from store -> import from file: ".../folder/client.pfx"
 	std::wstring cert_key;		// -cert_key	"qwerty"	
 	std::wstring file_cache;	// -cache		".../folder/file.txt"
+	std::string encryption_key;	// -encryption_key	base64 of an AES_KEY_SIZE byte key, empty to upload files unencrypted
 
 	BYTE* buffer = NULL;
 	DWORD buffer_size = 0;
 	if (FileHandle::ReadFileData(config_path, buffer, buffer_size))
 	{
-		std::string message = std::string((char*)buffer, buffer_size);
-		JsonValue* jr = JsonParser::Parse(message.c_str());
-		if (jr->IsObject() && jr->CountChildren() > 0)
+		JsonDocument document;
+		JsonElement jr = document.Parse((const char*)buffer, buffer_size) ? document.Root() : JsonElement();
+		if (jr.IsObject() && jr.CountChildren() > 0)
 		{
-			port = (int)jr->Child(L"port_number")->AsNumber();
-			host = jr->Child(L"host_name")->AsString();
-			protocol = jr->Child(L"protocol")->AsString();
-			cert_name = jr->Child(L"cert_name")->AsString();
-			cert_store = jr->Child(L"cert_store")->AsString();
-			cert_path = jr->Child(L"cert_path")->AsString();
-			cert_key = jr->Child(L"cert_key")->AsString();
-			file_cache = jr->Child(L"file_cache")->AsString();
-		}
-		if (jr)
-		{
-			delete jr;
+			port = (int)jr.Child("port_number").AsInteger();
+			host = jr.Child("host_name").AsWString();
+			protocol = jr.Child("protocol").AsWString();
+			cert_name = jr.Child("cert_name").AsWString();
+			cert_store = jr.Child("cert_store").AsWString();
+			cert_path = jr.Child("cert_path").AsWString();
+			cert_key = jr.Child("cert_key").AsWString();
+			file_cache = jr.Child("file_cache").AsWString();
+			encryption_key = jr.Child("encryption_key").AsString();
 		}
 		if (buffer)
 		{
@@ -146,6 +147,40 @@ void cmd_json_setup(const std::wstring& config_path, std::unique_ptr<UserHandle>
 	// Setup file cache
 	FileCache* cache = new FileCache(file_cache);
 	handler->SetupFileCache(cache);
+	// Setup client-side encryption, the same key restores the files on download
+	if (!encryption_key.empty())
+	{
+		std::string key;
+		try
+		{
+			key = Crypto::base64_decode(encryption_key);
+		}
+		catch (const std::exception&)
+		{
+			// Not base64, reported below like a key of the wrong size
+		}
+		if (key.size() == AES_KEY_SIZE)
+		{
+			handler->SetupEncryption(key);
+		}
+		else
+		{
+			std::wcout << L"The encryption key has to be " << AES_KEY_SIZE << L" bytes in base64, files are uploaded unencrypted!" << std::endl;
+		}
+	}
+	// Setup the last manifest the server acknowledged, kept next to the file cache
+	handler->SetupManifestState(file_cache + L".manifest");
+	// Setup the sync state, kept next to the file cache as well
+	MetadataStore* store = new MetadataStore();
+	if (store->Open(file_cache + L".db"))
+	{
+		handler->SetupMetadataStore(store);
+	}
+	else
+	{
+		std::wcout << L"Failed to open the sync state, every start compares the whole folder!" << std::endl;
+		delete store;
+	}
 }
 void cmd_user_setup(std::unique_ptr<UserHandle>& handler, std::unique_ptr<HttpClient>& net)
 {
@@ -281,6 +316,19 @@ void cmd_user_setup(std::unique_ptr<UserHandle>& handler, std::unique_ptr<HttpCl
 	// Setup file cache
 	FileCache* cache = new FileCache(file_cache);
 	handler->SetupFileCache(cache);
+	// Setup the last manifest the server acknowledged, kept next to the file cache
+	handler->SetupManifestState(file_cache + L".manifest");
+	// Setup the sync state, kept next to the file cache as well
+	MetadataStore* store = new MetadataStore();
+	if (store->Open(file_cache + L".db"))
+	{
+		handler->SetupMetadataStore(store);
+	}
+	else
+	{
+		std::wcout << L"Failed to open the sync state, every start compares the whole folder!" << std::endl;
+		delete store;
+	}
 }
 void cmd_user_action(std::unique_ptr<UserHandle>& handler, std::unique_ptr<HttpClient>& net)
 {
@@ -367,6 +415,10 @@ void cmd_user_action(std::unique_ptr<UserHandle>& handler, std::unique_ptr<HttpC
 				std::wcout << L"\n=============[ Watch folder sync ]==============" << std::endl;
 				cmd_user_watch_folder(handler);
 				break;
+			case 17:
+				std::wcout << L"\n================[ Download file ]===============" << std::endl;
+				cmd_user_download_file(handler);
+				break;
 			default:
 				std::wcout << L"=> Invalid input!" << std::endl;
 				break;
@@ -574,3 +626,14 @@ void cmd_user_watch_folder(std::unique_ptr<UserHandle>& handler)
 		return;
 	}
 }
+void cmd_user_download_file(std::unique_ptr<UserHandle>& handler)
+{
+	std::wstring file_path;
+	std::wcout << L"Enter file path: "; std::getline(std::wcin, file_path);
+	std::wstring save_path;
+	std::wcout << L"Enter path to save to: "; std::getline(std::wcin, save_path);
+	if (!handler->DownloadFile(file_path, save_path))
+	{
+		return;
+	}
+}
@@ -0,0 +1,687 @@
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <unordered_map>
+
+#include "utils.h"
+#include "sha256.h"
+#include "manifest.h"
+#include "file_handle.h"
+
+namespace
+{
+	const uint64_t kTicksPerSecond = 10000000;
+
+	inline char* WriteVarint(char* out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			*out++ = (char)(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = (char)value;
+		return out;
+	}
+
+	inline char* WriteSigned(char* out, int64_t value)
+	{
+		return WriteVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+	}
+
+	inline char* WriteBytes(char* out, const char* text, size_t length, unsigned shift, unsigned flag)
+	{
+		out = WriteVarint(out, ((uint64_t)length << shift) | flag);
+		memcpy(out, text, length);
+		return out + length;
+	}
+
+	bool ReadVarint(const char*& p, const char* end, uint64_t& value)
+	{
+		value = 0;
+		for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+		{
+			uint8_t b = (uint8_t)*p++;
+			value |= (uint64_t)(b & 0x7F) << shift;
+			if (b < 0x80)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline bool ReadSigned(const char*& p, const char* end, int64_t& value)
+	{
+		uint64_t raw;
+		if (!ReadVarint(p, end, raw))
+		{
+			return false;
+		}
+		value = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+		return true;
+	}
+
+	// A count of entries that take at least 'entry_size' bytes each, so a corrupt one cannot reserve too much
+	inline bool ReadCount(const char*& p, const char* end, size_t entry_size, uint64_t& count)
+	{
+		return ReadVarint(p, end, count) && count <= (uint64_t)(end - p) / entry_size;
+	}
+
+	inline bool ReadBytes(const char*& p, const char* end, size_t length)
+	{
+		if ((size_t)(end - p) < length)
+		{
+			return false;
+		}
+		p += length;
+		return true;
+	}
+
+	inline int64_t FileTimeSeconds(const FILETIME& time)
+	{
+		return (int64_t)((((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / kTicksPerSecond);
+	}
+
+	// UTF-16 to UTF-8, unpaired surrogates become U+FFFD. Needs 3 bytes of room per unit.
+	char* EncodeUtf8(char* out, const wchar_t* p, const wchar_t* end)
+	{
+		while (p < end)
+		{
+			uint32_t c = (uint32_t)*p++;
+			if (c < 0x80)
+			{
+				*out++ = (char)c;
+				continue;
+			}
+			if (c < 0x800)
+			{
+				*out++ = (char)(0xC0 | (c >> 6));
+				*out++ = (char)(0x80 | (c & 0x3F));
+				continue;
+			}
+			if (c >= 0xD800 && c <= 0xDFFF)
+			{
+				if (c <= 0xDBFF && p < end && (uint32_t)*p >= 0xDC00 && (uint32_t)*p <= 0xDFFF)
+				{
+					c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)*p++ - 0xDC00);
+				}
+				else
+				{
+					c = 0xFFFD;
+				}
+			}
+			else if (c > 0x10FFFF)
+			{
+				c = 0xFFFD;
+			}
+			if (c < 0x10000)
+			{
+				*out++ = (char)(0xE0 | (c >> 12));
+			}
+			else
+			{
+				*out++ = (char)(0xF0 | (c >> 18));
+				*out++ = (char)(0x80 | ((c >> 12) & 0x3F));
+			}
+			*out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (c & 0x3F));
+		}
+		return out;
+	}
+
+	uint64_t CountFolders(const ResourceOperations::FolderInfo& folder)
+	{
+		uint64_t count = 1;
+		for (const ResourceOperations::FolderInfo& child : folder.GetChildrens())
+		{
+			count += CountFolders(child);
+		}
+		return count;
+	}
+}
+
+namespace ResourceOperations
+{
+	ManifestWriter::ManifestWriter(size_t capacity)
+		: size(0), capacity(capacity > 0 ? capacity : 1), sink(NULL), failed(false), create_time(0)
+	{
+		data = (char*)malloc(this->capacity);
+		if (data == NULL)
+		{
+			this->capacity = 0;
+			failed = true;
+		}
+	}
+
+	ManifestWriter::~ManifestWriter()
+	{
+		free(data);
+	}
+
+	/**
+	 * Writes the whole manifest of 'folder': the header, the folder table and the files of every folder,
+	 * reading the tree in place without copying any FileInfo
+	 *
+	 * @access public
+	 *
+	 * @param FolderInfo folder The folder sent for comparison, its relative path becomes the root entry
+	 */
+	void ManifestWriter::WriteFolderTree(const FolderInfo& folder)
+	{
+		char* out = Reserve(5);
+		if (out == NULL)
+		{
+			return;
+		}
+		memcpy(out, MANIFEST_MAGIC, 4);
+		out[4] = MANIFEST_VERSION;
+		size += 5;
+
+		// The table needs its length first
+		out = Reserve(10);
+		if (out == NULL)
+		{
+			return;
+		}
+		size = WriteVarint(out, CountFolders(folder)) - data;
+
+		uint64_t index = 0;
+		std::wstring path = folder.GetRelativePath();
+		out = Reserve(10 + path.size() * 3);
+		if (out == NULL)
+		{
+			return;
+		}
+		out = WriteVarint(out, 0);
+		size = WriteString(out, path, 0, 0) - data;
+		for (const FolderInfo& child : folder.GetChildrens())
+		{
+			WriteFolders(child, 0, index);
+		}
+
+		create_time = 0;
+		WriteFiles(folder);
+	}
+
+	/**
+	 * Writes a delta: the files of 'content' listed in 'changed', under the table of the folders they are in.
+	 * The server applies it only if the manifest it acknowledged last is still 'base_version' and 'base_root'.
+	 *
+	 * @access public
+	 *
+	 * @param uint64_t base_version Version the server gave the base manifest
+	 * @param BYTE* base_root SHA-256 of the base manifest
+	 * @param BYTE* root SHA-256 of 'content', the manifest the server holds after the delta
+	 * @param vector changed Indexes in content.files, ascending, as ManifestReader::Diff returns them
+	 */
+	void ManifestWriter::WriteDelta(uint64_t base_version, const BYTE* base_root, const BYTE* root,
+		const ManifestContent& content, const std::vector<size_t>& changed)
+	{
+		char* out = Reserve(5 + 10 + 2 * MANIFEST_DIGEST_SIZE);
+		if (out == NULL)
+		{
+			return;
+		}
+		memcpy(out, MANIFEST_DELTA_MAGIC, 4);
+		out[4] = MANIFEST_VERSION;
+		out = WriteVarint(out + 5, base_version);
+		memcpy(out, base_root, MANIFEST_DIGEST_SIZE);
+		memcpy(out + MANIFEST_DIGEST_SIZE, root, MANIFEST_DIGEST_SIZE);
+		size = out + 2 * MANIFEST_DIGEST_SIZE - data;
+
+		// Files are grouped by folder, so the folders of the changes come in runs
+		std::vector<size_t> folders;
+		for (size_t index : changed)
+		{
+			size_t folder = content.files[index].folder;
+			if (folders.empty() || folders.back() != folder)
+			{
+				folders.push_back(folder);
+			}
+		}
+		out = Reserve(10);
+		if (out == NULL)
+		{
+			return;
+		}
+		size = WriteVarint(out, folders.size()) - data;
+		for (size_t folder : folders)
+		{
+			const std::string& path = content.folders[folder];
+			out = Reserve(20 + path.size());
+			if (out == NULL)
+			{
+				return;
+			}
+			out = WriteVarint(out, 0);
+			size = WriteBytes(out, path.data(), path.size(), 0, 0) - data;
+		}
+
+		create_time = 0;
+		size_t next = 0;
+		for (size_t folder : folders)
+		{
+			size_t end = next;
+			while (end < changed.size() && content.files[changed[end]].folder == folder)
+			{
+				end++;
+			}
+			out = Reserve(10);
+			if (out == NULL)
+			{
+				return;
+			}
+			size = WriteVarint(out, end - next) - data;
+			for (; next < end; next++)
+			{
+				const ManifestFile& file = content.files[changed[next]];
+				out = Reserve(10 + file.name_length + 20 + 30 + MANIFEST_DIGEST_SIZE);
+				if (out == NULL)
+				{
+					return;
+				}
+				out = WriteBytes(out, file.name, file.name_length, 1, file.digest != NULL ? 1 : 0);
+				out = WriteVarint(out, file.size);
+				out = WriteVarint(out, file.attribute);
+				out = WriteTimes(out, file.create_time, file.last_write_time, file.last_access_time);
+				if (file.digest != NULL)
+				{
+					memcpy(out, file.digest, MANIFEST_DIGEST_SIZE);
+					out += MANIFEST_DIGEST_SIZE;
+				}
+				size = out - data;
+			}
+		}
+	}
+
+	/**
+	 * Passes the buffered output to the sink. Without a sink the output stays in the buffer.
+	 *
+	 * @access public
+	 *
+	 * @return bool Returns false if the buffer could not grow or the sink refused the output
+	 */
+	bool ManifestWriter::Flush()
+	{
+		if (failed)
+		{
+			return false;
+		}
+		if (sink != NULL && size > 0)
+		{
+			if (!sink->WriteOutput(data, size))
+			{
+				failed = true;
+			}
+			size = 0;
+		}
+		return !failed;
+	}
+
+	/**
+	 * Appends the table entries of 'folder' and its subfolders in depth-first order
+	 *
+	 * @access private
+	 *
+	 * @param uint64_t parent Table index of the parent entry
+	 * @param uint64_t index Table index of the last entry written, advanced for every entry
+	 */
+	void ManifestWriter::WriteFolders(const FolderInfo& folder, uint64_t parent, uint64_t& index)
+	{
+		const std::wstring& name = folder.GetFolderName();
+		char* out = Reserve(20 + name.size() * 3);
+		if (out == NULL)
+		{
+			return;
+		}
+		out = WriteVarint(out, parent + 1);
+		size = WriteString(out, name, 0, 0) - data;
+		uint64_t self = ++index;
+		for (const FolderInfo& child : folder.GetChildrens())
+		{
+			WriteFolders(child, self, index);
+		}
+	}
+
+	void ManifestWriter::WriteFiles(const FolderInfo& folder)
+	{
+		const LIST_FILE& files = folder.GetFiles();
+		char* out = Reserve(10);
+		if (out == NULL)
+		{
+			return;
+		}
+		size = WriteVarint(out, files.size()) - data;
+		for (const FileInfo& file : files)
+		{
+			const std::wstring& name = file.GetFileName();
+			// Name and its length, four varints of up to 5 bytes for the DWORDs and three time deltas
+			out = Reserve(10 + name.size() * 3 + 10 + 30 + MANIFEST_DIGEST_SIZE);
+			if (out == NULL)
+			{
+				return;
+			}
+			const std::string& digest = file.GetHashFile();
+			bool has_digest = digest.size() == MANIFEST_DIGEST_SIZE;
+			out = WriteString(out, name, 1, has_digest ? 1 : 0);
+			out = WriteVarint(out, file.GetFileSize());
+			out = WriteVarint(out, file.GetFileAttribute());
+			out = WriteTimes(out, FileTimeSeconds(file.GetCreateTime()),
+				FileTimeSeconds(file.GetLastWriteTime()), FileTimeSeconds(file.GetLastAccessTime()));
+			if (has_digest)
+			{
+				memcpy(out, digest.data(), MANIFEST_DIGEST_SIZE);
+				out += MANIFEST_DIGEST_SIZE;
+			}
+			size = out - data;
+		}
+		for (const FolderInfo& child : folder.GetChildrens())
+		{
+			WriteFiles(child);
+		}
+	}
+
+	/**
+	 * Writes a UTF-8 string behind its byte length, shifted left by 'shift' bits that hold 'flag'
+	 *
+	 * @access private
+	 *
+	 * @param char* out Room for 10 + 3 bytes per unit of 'value'
+	 * @param unsigned shift 0 for a plain length, 1 to carry a flag bit
+	 *
+	 * @return char* Returns the end of the string
+	 */
+	char* ManifestWriter::WriteString(char* out, const std::wstring& value, unsigned shift, unsigned flag)
+	{
+		const wchar_t* begin = value.data();
+		const wchar_t* end = begin + value.size();
+		if (((value.size() * 3) << shift) < 0x80)
+		{
+			// The length fits one byte whatever the characters are
+			char* text_end = EncodeUtf8(out + 1, begin, end);
+			*out = (char)(((uint64_t)(text_end - out - 1) << shift) | flag);
+			return text_end;
+		}
+		char* text = out + 10;
+		char* text_end = EncodeUtf8(text, begin, end);
+		size_t length = text_end - text;
+		char* header_end = WriteVarint(out, ((uint64_t)length << shift) | flag);
+		memmove(header_end, text, length);
+		return header_end + length;
+	}
+
+	// The three times of a file as deltas, the create time against the previous file's
+	char* ManifestWriter::WriteTimes(char* out, int64_t create, int64_t last_write, int64_t last_access)
+	{
+		out = WriteSigned(out, create - create_time);
+		out = WriteSigned(out, last_write - create);
+		out = WriteSigned(out, last_access - last_write);
+		create_time = create;
+		return out;
+	}
+
+	/**
+	 * Makes room for 'count' more bytes, passing the buffer to the sink first when there is one
+	 *
+	 * @access private
+	 *
+	 * @return char* Returns the end of the output, or NULL once the writer failed
+	 */
+	char* ManifestWriter::Reserve(size_t count)
+	{
+		if (failed)
+		{
+			return NULL;
+		}
+		if (capacity - size >= count)
+		{
+			return data + size;
+		}
+		if (sink != NULL && !Flush())
+		{
+			return NULL;
+		}
+		if (capacity - size < count)
+		{
+			size_t grown = capacity * 2 > size + count ? capacity * 2 : size + count;
+			char* buffer = (char*)realloc(data, grown);
+			if (buffer == NULL)
+			{
+				failed = true;
+				return NULL;
+			}
+			data = buffer;
+			capacity = grown;
+		}
+		return data + size;
+	}
+
+	/**
+	 * Reads a whole manifest as written by ManifestWriter::WriteFolderTree
+	 *
+	 * @access public
+	 *
+	 * @param ManifestContent content Receives the folder paths and the files, which point into 'data'
+	 *
+	 * @return bool Returns false if 'data' is not a manifest or is cut short
+	 */
+	bool ManifestReader::Parse(const char* data, size_t size, ManifestContent& content)
+	{
+		const char* p = data;
+		const char* end = data + size;
+		content.folders.clear();
+		content.files.clear();
+		if (size < 5 || memcmp(p, MANIFEST_MAGIC, 4) != 0 || p[4] != MANIFEST_VERSION)
+		{
+			return false;
+		}
+		p += 5;
+
+		uint64_t count;
+		if (!ReadCount(p, end, 2, count))
+		{
+			return false;
+		}
+		content.folders.reserve((size_t)count);
+		for (uint64_t i = 0; i < count; i++)
+		{
+			uint64_t parent, length;
+			if (!ReadVarint(p, end, parent) || parent > i || !ReadVarint(p, end, length))
+			{
+				return false;
+			}
+			const char* name = p;
+			if (!ReadBytes(p, end, (size_t)length))
+			{
+				return false;
+			}
+			if (parent == 0)
+			{
+				content.folders.push_back(std::string(name, (size_t)length));
+			}
+			else
+			{
+				const std::string& path = content.folders[(size_t)parent - 1];
+				std::string folder;
+				folder.reserve(path.size() + 1 + (size_t)length);
+				folder.append(path).append(1, '\\').append(name, (size_t)length);
+				content.folders.push_back(std::move(folder));
+			}
+		}
+
+		int64_t create_time = 0;
+		for (size_t folder = 0; folder < content.folders.size(); folder++)
+		{
+			// Name, size, attribute and the three times take at least a byte each
+			if (!ReadCount(p, end, 6, count))
+			{
+				return false;
+			}
+			for (uint64_t i = 0; i < count; i++)
+			{
+				ManifestFile file;
+				uint64_t length;
+				int64_t create, write, access;
+				if (!ReadVarint(p, end, length))
+				{
+					return false;
+				}
+				file.folder = folder;
+				file.name = p;
+				file.name_length = (size_t)(length >> 1);
+				if (!ReadBytes(p, end, file.name_length) ||
+					!ReadVarint(p, end, file.size) || !ReadVarint(p, end, file.attribute) ||
+					!ReadSigned(p, end, create) || !ReadSigned(p, end, write) || !ReadSigned(p, end, access))
+				{
+					return false;
+				}
+				file.create_time = create_time + create;
+				file.last_write_time = file.create_time + write;
+				file.last_access_time = file.last_write_time + access;
+				create_time = file.create_time;
+				file.digest = NULL;
+				if (length & 1)
+				{
+					file.digest = p;
+					if (!ReadBytes(p, end, MANIFEST_DIGEST_SIZE))
+					{
+						return false;
+					}
+				}
+				content.files.push_back(file);
+			}
+		}
+		return p == end;
+	}
+
+	/**
+	 * Finds the files of 'current' that a server holding 'base' does not know about: new ones and ones
+	 * whose size, attribute, times or digest changed. Files only in 'base' are not reported.
+	 *
+	 * @access public
+	 *
+	 * @return vector Returns indexes in current.files in ascending order
+	 */
+	std::vector<size_t> ManifestReader::Diff(const ManifestContent& base, const ManifestContent& current)
+	{
+		std::unordered_map<std::string, const ManifestFile*> known;
+		known.reserve(base.files.size());
+		std::string key;
+		for (const ManifestFile& file : base.files)
+		{
+			const std::string& folder = base.folders[file.folder];
+			key.assign(folder).append(1, '\\').append(file.name, file.name_length);
+			known.emplace(key, &file);
+		}
+
+		std::vector<size_t> changed;
+		for (size_t i = 0; i < current.files.size(); i++)
+		{
+			const ManifestFile& file = current.files[i];
+			const std::string& folder = current.folders[file.folder];
+			key.assign(folder).append(1, '\\').append(file.name, file.name_length);
+			auto found = known.find(key);
+			if (found == known.end())
+			{
+				changed.push_back(i);
+				continue;
+			}
+			const ManifestFile& old = *found->second;
+			if (old.size != file.size || old.attribute != file.attribute ||
+				old.create_time != file.create_time || old.last_write_time != file.last_write_time ||
+				old.last_access_time != file.last_access_time || (old.digest == NULL) != (file.digest == NULL) ||
+				(file.digest != NULL && memcmp(old.digest, file.digest, MANIFEST_DIGEST_SIZE) != 0))
+			{
+				changed.push_back(i);
+			}
+		}
+		return changed;
+	}
+
+	/**
+	 * Reads the state saved by Save, checking the manifest against its root
+	 *
+	 * @access public
+	 *
+	 * @return BOOL Returns FALSE if there is no state or it is damaged
+	 */
+	BOOL ManifestState::Load(const std::wstring& path)
+	{
+		BYTE* buffer = NULL;
+		DWORD length = 0;
+		if (!FileHandle::ReadFileData(path, buffer, length))
+		{
+			return FALSE;
+		}
+		std::unique_ptr<BYTE[]> holder(buffer);
+		const char* p = (const char*)buffer;
+		const char* end = p + length;
+		uint64_t units;
+		if (length < 5 || memcmp(p, MANIFEST_STATE_MAGIC, 4) != 0 || p[4] != MANIFEST_VERSION)
+		{
+			return FALSE;
+		}
+		p += 5;
+		if (!ReadCount(p, end, sizeof(wchar_t), units))
+		{
+			return FALSE;
+		}
+		std::wstring name((size_t)units, L'\0');
+		memcpy(&name[0], p, (size_t)units * sizeof(wchar_t));
+		p += units * sizeof(wchar_t);
+		if ((size_t)(end - p) < sizeof(uint64_t) + MANIFEST_DIGEST_SIZE)
+		{
+			return FALSE;
+		}
+		uint64_t saved_version;
+		memcpy(&saved_version, p, sizeof(uint64_t));
+		p += sizeof(uint64_t);
+		BYTE saved_root[MANIFEST_DIGEST_SIZE];
+		memcpy(saved_root, p, MANIFEST_DIGEST_SIZE);
+		p += MANIFEST_DIGEST_SIZE;
+
+		BYTE digest[MANIFEST_DIGEST_SIZE];
+		if (!Crypto::SHA256_Hash((BYTE*)p, end - p, digest) || memcmp(digest, saved_root, MANIFEST_DIGEST_SIZE) != 0)
+		{
+			return FALSE;
+		}
+		user_name = std::move(name);
+		version = saved_version;
+		memcpy(root, saved_root, MANIFEST_DIGEST_SIZE);
+		manifest.assign(p, end);
+		return TRUE;
+	}
+
+	/**
+	 * Writes the state next to 'path' and moves it over the old one, so a crash leaves either state whole
+	 *
+	 * @access public
+	 *
+	 * @return BOOL Returns FALSE if the file could not be written or replaced
+	 */
+	BOOL ManifestState::Save(const std::wstring& path) const
+	{
+		std::string buffer;
+		buffer.reserve(5 + 10 + user_name.size() * sizeof(wchar_t) + sizeof(uint64_t) + MANIFEST_DIGEST_SIZE + manifest.size());
+		buffer.append(MANIFEST_STATE_MAGIC, 4).append(1, (char)MANIFEST_VERSION);
+		char count[10];
+		buffer.append(count, WriteVarint(count, user_name.size()) - count);
+		buffer.append((const char*)user_name.data(), user_name.size() * sizeof(wchar_t));
+		buffer.append((const char*)&version, sizeof(uint64_t));
+		buffer.append((const char*)root, MANIFEST_DIGEST_SIZE);
+		buffer.append(manifest);
+		if (buffer.size() > MAXDWORD)
+		{
+			return FALSE;
+		}
+
+		std::wstring temp = path + L".tmp";
+		if (!FileHandle::WriteFileData(temp, (const BYTE*)buffer.data(), (DWORD)buffer.size()))
+		{
+			return FALSE;
+		}
+		return MoveFileExW(Helper::PathHelper::getPathFromEnvironmentVariable(temp).c_str(),
+			Helper::PathHelper::getPathFromEnvironmentVariable(path).c_str(),
+			MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "folder_info.h"
+#include "json/json_buffer_writer.h"
+
+#define MANIFEST_CONTENT_TYPE   L"application/x-folder-manifest"
+#define MANIFEST_MAGIC          "FMAN"
+#define MANIFEST_DELTA_MAGIC    "FDLT"
+#define MANIFEST_STATE_MAGIC    "FMST"
+#define MANIFEST_VERSION        1
+#define MANIFEST_DIGEST_SIZE    32              // SHA-256, sent only for files that have one
+#define MANIFEST_BUFFER_SIZE    (64 * 1024)     // Initial capacity, and the size at which output goes to the sink
+
+namespace ResourceOperations
+{
+    // Binary form of the /files/compare payload, negotiated by its content type. All integers are
+    // LEB128 varints, signed ones zigzag encoded, strings are a byte length and UTF-8.
+    //
+    //   "FMAN" version:u8
+    //   folder count, then per folder in depth-first order: parent index + 1 (0 for the root), name
+    //   per folder in the same order: file count, then per file:
+    //     name length << 1 | has digest, name bytes, size, attribute,
+    //     create time - create time of the previous file, last write - create, last access - last write
+    //     32 digest bytes when flagged
+    //
+    // The root entry holds the relative path of the folder that was sent and every other folder is its
+    // parent's path, '\' and its name, the same strings as the JSON "folder". Times are whole seconds
+    // since 1601, the precision of the JSON timestamps.
+    //
+    // A delta lists only the files that are new or changed since a manifest the server acknowledged:
+    //
+    //   "FDLT" version:u8 base version, 32 byte base root, 32 byte root
+    //   folder table and files as above, every folder given by its whole path (parent index 0)
+    //
+    // A root is the SHA-256 of a whole manifest, the base one and the one the delta leads to.
+
+    // One file of a parsed manifest, name and digest point into the manifest bytes
+    struct ManifestFile
+    {
+        size_t folder;                  // Index in ManifestContent::folders
+        const char* name;
+        size_t name_length;
+        uint64_t size;
+        uint64_t attribute;
+        int64_t create_time;
+        int64_t last_write_time;
+        int64_t last_access_time;
+        const char* digest;             // MANIFEST_DIGEST_SIZE bytes, NULL when the file has none
+    };
+
+    struct ManifestContent
+    {
+        std::vector<std::string> folders;   // UTF-8 paths
+        std::vector<ManifestFile> files;    // In manifest order, so grouped by folder
+    };
+
+    class ManifestReader
+    {
+    public:
+        // Reads a whole manifest, false if it is malformed
+        static bool Parse(const char* data, size_t size, ManifestContent& content);
+        // Indexes in 'current' of the files that are not in 'base' or differ from it
+        static std::vector<size_t> Diff(const ManifestContent& base, const ManifestContent& current);
+    };
+
+    // The last manifest the server acknowledged, kept on disk so the next comparison can send a delta.
+    // A file that does not hash to its root, for example after a crash during Save, is not loaded.
+    struct ManifestState
+    {
+        std::wstring user_name;
+        uint64_t version;                   // Given by the server, 0 when not acknowledged
+        BYTE root[MANIFEST_DIGEST_SIZE];    // SHA-256 of 'manifest'
+        std::string manifest;
+
+        ManifestState() : version(0), root() {}
+        BOOL Load(const std::wstring& path);
+        BOOL Save(const std::wstring& path) const;
+    };
+
+    class ManifestWriter
+    {
+    public:
+        explicit ManifestWriter(size_t capacity = MANIFEST_BUFFER_SIZE);
+        ~ManifestWriter();
+        // Without a sink the buffer grows to hold the whole manifest
+        void SetSink(JsonWriterSink* sink) { this->sink = sink; }
+
+        void WriteFolderTree(const FolderInfo& folder);
+        // The files 'changed' of 'content', which is the manifest whose SHA-256 is 'root'
+        void WriteDelta(uint64_t base_version, const BYTE* base_root, const BYTE* root,
+            const ManifestContent& content, const std::vector<size_t>& changed);
+        bool Flush();
+        bool IsFailed() const { return failed; }
+
+        const char* GetData() const { return data; }
+        size_t GetSize() const { return size; }
+    private:
+        ManifestWriter(const ManifestWriter&) = delete;
+        ManifestWriter& operator=(const ManifestWriter&) = delete;
+
+        void WriteFolders(const FolderInfo& folder, uint64_t parent, uint64_t& index);
+        void WriteFiles(const FolderInfo& folder);
+        char* WriteString(char* out, const std::wstring& value, unsigned shift, unsigned flag);
+        char* WriteTimes(char* out, int64_t create, int64_t last_write, int64_t last_access);
+        char* Reserve(size_t count);
+
+        char* data;
+        size_t size;
+        size_t capacity;
+        JsonWriterSink* sink;
+        bool failed;
+        int64_t create_time;        // Create time of the previous file, in seconds
+    };
+}
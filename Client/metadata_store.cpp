@@ -0,0 +1,462 @@
+#include <unordered_map>
+#include "logger.h"
+#include "metadata_store.h"
+
+namespace
+{
+	const char* const kStatements[] =
+	{
+		"BEGIN IMMEDIATE",
+		"COMMIT",
+		"ROLLBACK",
+		"INSERT OR REPLACE INTO files (path, file_id, size, attribute, create_time, last_write_time, last_access_time, digest) "
+			"VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)",
+		"DELETE FROM files WHERE path = ?1",
+		"UPDATE OR REPLACE files SET path = ?2 WHERE path = ?1",
+		"SELECT digest FROM files WHERE path = ?1 AND size = ?2 AND last_write_time = ?3",
+		// Paths are UTF-8 and compared bytewise, so everything under 'folder\' sorts before 'folder]'
+		"SELECT path, file_id, size, last_write_time, digest FROM files WHERE path > ?1 AND path < ?2",
+		"SELECT 1 FROM files WHERE path > ?1 AND path < ?2 LIMIT 1",
+		"INSERT OR REPLACE INTO uploads (path, upload_id, parts, bytes) VALUES (?1, ?2, ?3, ?4)",
+		"DELETE FROM uploads WHERE path = ?1",
+		"SELECT path, upload_id, parts, bytes FROM uploads",
+		"DELETE FROM uploads",
+	};
+
+	const char kSchema[] =
+		"CREATE TABLE IF NOT EXISTS files ("
+		"path TEXT PRIMARY KEY NOT NULL, "
+		"file_id INTEGER NOT NULL, "
+		"size INTEGER NOT NULL, "
+		"attribute INTEGER NOT NULL, "
+		"create_time INTEGER NOT NULL, "
+		"last_write_time INTEGER NOT NULL, "
+		"last_access_time INTEGER NOT NULL, "
+		"digest BLOB) WITHOUT ROWID;"
+		"CREATE TABLE IF NOT EXISTS uploads ("
+		"path TEXT PRIMARY KEY NOT NULL, "
+		"upload_id TEXT NOT NULL, "
+		"parts INTEGER NOT NULL, "
+		"bytes INTEGER NOT NULL) WITHOUT ROWID;";
+
+	inline int64_t FromFileTime(const FILETIME& time)
+	{
+		return (int64_t)(((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime);
+	}
+
+	inline FILETIME ToFileTime(int64_t value)
+	{
+		FILETIME time;
+		time.dwLowDateTime = (DWORD)value;
+		time.dwHighDateTime = (DWORD)((uint64_t)value >> 32);
+		return time;
+	}
+
+	inline void BindPath(sqlite3_stmt* statement, int index, const std::wstring& path)
+	{
+		sqlite3_bind_text16(statement, index, path.c_str(), (int)(path.size() * sizeof(wchar_t)), SQLITE_STATIC);
+	}
+
+	inline std::wstring ColumnPath(sqlite3_stmt* statement, int column)
+	{
+		const wchar_t* path = (const wchar_t*)sqlite3_column_text16(statement, column);
+		return path ? std::wstring(path, sqlite3_column_bytes16(statement, column) / sizeof(wchar_t)) : std::wstring();
+	}
+
+	inline std::string ColumnBlob(sqlite3_stmt* statement, int column)
+	{
+		const char* data = (const char*)sqlite3_column_blob(statement, column);
+		return data ? std::string(data, sqlite3_column_bytes(statement, column)) : std::string();
+	}
+}
+
+namespace UserOperations
+{
+	MetadataStore::MetadataStore() : db(NULL), statements()
+	{
+	}
+
+	MetadataStore::~MetadataStore()
+	{
+		Close();
+	}
+
+	/**
+	 * Opens the database, creating it if needed, in WAL mode and prepares every statement
+	 *
+	 * @access public
+	 *
+	 * @param std::wstring path Database file, SQLite keeps its -wal and -shm files next to it
+	 *
+	 * @return BOOL Returns FALSE if the database can not be opened or was written by a newer schema
+	 */
+	BOOL MetadataStore::Open(const std::wstring& path)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		Close();
+		if (sqlite3_open16(path.c_str(), &db) != SQLITE_OK)
+		{
+			LOG_ERROR_W(L"[Store] Failed to open %s: %S", path.c_str(), db ? sqlite3_errmsg(db) : "out of memory");
+			Close();
+			return FALSE;
+		}
+		if (!CreateSchema())
+		{
+			LOG_ERROR_W(L"[Store] Failed to set up %s: %S", path.c_str(), sqlite3_errmsg(db));
+			Close();
+			return FALSE;
+		}
+		for (int i = 0; i < STMT_COUNT; i++)
+		{
+			if (sqlite3_prepare_v2(db, kStatements[i], -1, &statements[i], NULL) != SQLITE_OK)
+			{
+				LOG_ERROR_W(L"[Store] Failed to prepare a statement: %S", sqlite3_errmsg(db));
+				Close();
+				return FALSE;
+			}
+		}
+		return TRUE;
+	}
+
+	void MetadataStore::Close()
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		for (int i = 0; i < STMT_COUNT; i++)
+		{
+			sqlite3_finalize(statements[i]);
+			statements[i] = NULL;
+		}
+		if (db)
+		{
+			sqlite3_close(db);
+			db = NULL;
+		}
+	}
+
+	/**
+	 * Starts a batch. The caller holds the store until Commit or Rollback, and every write it makes
+	 * meanwhile goes to disk with one WAL sync.
+	 *
+	 * @access public
+	 *
+	 * @return BOOL Returns FALSE if the transaction could not start, the store is not held then
+	 */
+	BOOL MetadataStore::Begin()
+	{
+		store_mutex.lock();
+		if (!db || !Execute(STMT_BEGIN))
+		{
+			store_mutex.unlock();
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	BOOL MetadataStore::Commit()
+	{
+		BOOL result = Execute(STMT_COMMIT);
+		if (!result)
+		{
+			Execute(STMT_ROLLBACK);
+		}
+		store_mutex.unlock();
+		return result;
+	}
+
+	void MetadataStore::Rollback()
+	{
+		Execute(STMT_ROLLBACK);
+		store_mutex.unlock();
+	}
+
+	BOOL MetadataStore::PutFile(const FileInfo& file, DWORD file_id)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = statements[STMT_PUT_FILE];
+		std::wstring path = file.GetFilePath();
+		const std::string& digest = file.GetHashFile();
+		BindPath(statement, 1, path);
+		sqlite3_bind_int64(statement, 2, file_id);
+		sqlite3_bind_int64(statement, 3, file.GetFileSize());
+		sqlite3_bind_int64(statement, 4, file.GetFileAttribute());
+		sqlite3_bind_int64(statement, 5, FromFileTime(file.GetCreateTime()));
+		sqlite3_bind_int64(statement, 6, FromFileTime(file.GetLastWriteTime()));
+		sqlite3_bind_int64(statement, 7, FromFileTime(file.GetLastAccessTime()));
+		if (digest.empty())
+		{
+			sqlite3_bind_null(statement, 8);
+		}
+		else
+		{
+			sqlite3_bind_blob(statement, 8, digest.data(), (int)digest.size(), SQLITE_STATIC);
+		}
+		return Execute(STMT_PUT_FILE);
+	}
+
+	BOOL MetadataStore::RemoveFile(const std::wstring& path)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		BindPath(statements[STMT_REMOVE_FILE], 1, path);
+		return Execute(STMT_REMOVE_FILE);
+	}
+
+	BOOL MetadataStore::RenameFile(const std::wstring& path, const std::wstring& new_path)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		BindPath(statements[STMT_RENAME_FILE], 1, path);
+		BindPath(statements[STMT_RENAME_FILE], 2, new_path);
+		return Execute(STMT_RENAME_FILE);
+	}
+
+	/**
+	 * Gives the stored digest of a file whose size and last write time did not change since it was
+	 * sent, which is what a scan compares as well
+	 *
+	 * @access public
+	 *
+	 * @return BOOL Returns FALSE if the file has to be hashed
+	 */
+	BOOL MetadataStore::FindDigest(const std::wstring& path, DWORD size, const FILETIME& last_write_time, std::string& digest)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = statements[STMT_FIND_DIGEST];
+		BindPath(statement, 1, path);
+		sqlite3_bind_int64(statement, 2, size);
+		sqlite3_bind_int64(statement, 3, FromFileTime(last_write_time));
+		BOOL found = FALSE;
+		if (sqlite3_step(statement) == SQLITE_ROW)
+		{
+			digest = ColumnBlob(statement, 0);
+			found = !digest.empty();
+		}
+		sqlite3_reset(statement);
+		return found;
+	}
+
+	/**
+	 * Tells whether the store holds any file under a folder, without reading the rows
+	 *
+	 * @access public
+	 *
+	 * @param std::wstring folder_path Folder as the scan names it
+	 * @param BOOL found Receives TRUE if a file under it is stored
+	 *
+	 * @return BOOL Returns FALSE if the stored files could not be read
+	 */
+	BOOL MetadataStore::HasFolderTree(const std::wstring& folder_path, BOOL& found)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		found = FALSE;
+		if (!db)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = statements[STMT_ANY_IN_FOLDER];
+		std::wstring low = folder_path + L"\\";
+		std::wstring high = folder_path + L"]";
+		BindPath(statement, 1, low);
+		BindPath(statement, 2, high);
+		int status = sqlite3_step(statement);
+		sqlite3_reset(statement);
+		if (status != SQLITE_ROW && status != SQLITE_DONE)
+		{
+			LOG_ERROR_W(L"[Store] Failed to read the stored files: %S", sqlite3_errmsg(db));
+			return FALSE;
+		}
+		found = (status == SQLITE_ROW);
+		return TRUE;
+	}
+
+	/**
+	 * Compares a scan with the stored files under its folder. A file counts as modified when its
+	 * size, last write time or digest differs.
+	 *
+	 * @access public
+	 *
+	 * @param FolderInfo folder Scan of a folder, its paths are the stored ones
+	 * @param std::vector<FileInfo> added Receives the files of the scan that are not stored
+	 * @param std::vector<FileInfo> modified Receives the files of the scan that differ from the store
+	 * @param std::vector<StoredFile> removed Receives the stored files the scan does not have
+	 *
+	 * @return BOOL Returns FALSE if the stored files could not be read
+	 */
+	BOOL MetadataStore::DiffFolderTree(const FolderInfo& folder, std::vector<FileInfo>& added, std::vector<FileInfo>& modified,
+		std::vector<StoredFile>& removed)
+	{
+		std::vector<StoredFile> stored;
+		{
+			std::lock_guard<std::recursive_mutex> lock(store_mutex);
+			if (!db)
+			{
+				return FALSE;
+			}
+			sqlite3_stmt* statement = statements[STMT_LIST_FOLDER];
+			std::wstring low = folder.GetFolderPath() + L"\\";
+			std::wstring high = folder.GetFolderPath() + L"]";
+			BindPath(statement, 1, low);
+			BindPath(statement, 2, high);
+			int status;
+			while ((status = sqlite3_step(statement)) == SQLITE_ROW)
+			{
+				StoredFile file;
+				file.path = ColumnPath(statement, 0);
+				file.file_id = (DWORD)sqlite3_column_int64(statement, 1);
+				file.size = (uint64_t)sqlite3_column_int64(statement, 2);
+				file.last_write_time = ToFileTime(sqlite3_column_int64(statement, 3));
+				file.digest = ColumnBlob(statement, 4);
+				stored.push_back(std::move(file));
+			}
+			sqlite3_reset(statement);
+			if (status != SQLITE_DONE)
+			{
+				LOG_ERROR_W(L"[Store] Failed to read the stored files: %S", sqlite3_errmsg(db));
+				return FALSE;
+			}
+		}
+		DiffFiles(folder, stored, added, modified);
+		// What the scan matched was cleared on the way
+		for (auto& file : stored)
+		{
+			if (!file.path.empty())
+			{
+				removed.push_back(std::move(file));
+			}
+		}
+		return TRUE;
+	}
+
+	BOOL MetadataStore::RecordUploadPart(const std::wstring& path, const std::string& upload_id, DWORD parts, uint64_t bytes)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = statements[STMT_PUT_UPLOAD];
+		BindPath(statement, 1, path);
+		sqlite3_bind_text(statement, 2, upload_id.data(), (int)upload_id.size(), SQLITE_STATIC);
+		sqlite3_bind_int64(statement, 3, parts);
+		sqlite3_bind_int64(statement, 4, (sqlite3_int64)bytes);
+		return Execute(STMT_PUT_UPLOAD);
+	}
+
+	BOOL MetadataStore::FinishUpload(const std::wstring& path)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		BindPath(statements[STMT_REMOVE_UPLOAD], 1, path);
+		return Execute(STMT_REMOVE_UPLOAD);
+	}
+
+	BOOL MetadataStore::LoadUploads(std::vector<StoredUpload>& uploads)
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		if (!db)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = statements[STMT_LIST_UPLOADS];
+		int status;
+		while ((status = sqlite3_step(statement)) == SQLITE_ROW)
+		{
+			StoredUpload upload;
+			upload.path = ColumnPath(statement, 0);
+			upload.upload_id = ColumnBlob(statement, 1);
+			upload.parts = (DWORD)sqlite3_column_int64(statement, 2);
+			upload.bytes = (uint64_t)sqlite3_column_int64(statement, 3);
+			uploads.push_back(std::move(upload));
+		}
+		sqlite3_reset(statement);
+		return status == SQLITE_DONE;
+	}
+
+	BOOL MetadataStore::ClearUploads()
+	{
+		std::lock_guard<std::recursive_mutex> lock(store_mutex);
+		return db && Execute(STMT_CLEAR_UPLOADS);
+	}
+
+	//---- Private method
+	BOOL MetadataStore::CreateSchema()
+	{
+		// The encoding only applies to a new database, the path ranges of STMT_LIST_FOLDER rely on UTF-8.
+		// NORMAL is enough with WAL: a power cut may lose the last commits but never corrupts the store.
+		if (sqlite3_exec(db, "PRAGMA encoding = 'UTF-8'; PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;",
+			NULL, NULL, NULL) != SQLITE_OK)
+		{
+			return FALSE;
+		}
+		sqlite3_stmt* statement = NULL;
+		if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &statement, NULL) != SQLITE_OK)
+		{
+			return FALSE;
+		}
+		int version = sqlite3_step(statement) == SQLITE_ROW ? sqlite3_column_int(statement, 0) : -1;
+		sqlite3_finalize(statement);
+		if (version < 0 || version > METADATA_STORE_VERSION)
+		{
+			return FALSE;
+		}
+		std::string schema = std::string(kSchema) + "PRAGMA user_version = " + std::to_string(METADATA_STORE_VERSION) + ";";
+		return sqlite3_exec(db, schema.c_str(), NULL, NULL, NULL) == SQLITE_OK;
+	}
+
+	BOOL MetadataStore::Execute(Statement statement)
+	{
+		int status = sqlite3_step(statements[statement]);
+		sqlite3_reset(statements[statement]);
+		if (status != SQLITE_DONE)
+		{
+			LOG_ERROR_W(L"[Store] Statement %d failed: %S", statement, sqlite3_errmsg(db));
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	void MetadataStore::DiffFiles(const FolderInfo& folder, std::vector<StoredFile>& stored, std::vector<FileInfo>& added,
+		std::vector<FileInfo>& modified)
+	{
+		std::unordered_map<std::wstring, size_t> index;
+		index.reserve(stored.size());
+		for (size_t i = 0; i < stored.size(); i++)
+		{
+			index.emplace(stored[i].path, i);
+		}
+		for (const auto& file : folder.GetFilesRecursive())
+		{
+			auto it = index.find(file.GetFilePath());
+			if (it == index.end())
+			{
+				added.push_back(file);
+				continue;
+			}
+			StoredFile& known = stored[it->second];
+			FILETIME last_write_time = file.GetLastWriteTime();
+			if (known.size != file.GetFileSize() || CompareFileTime(&known.last_write_time, &last_write_time) != 0 ||
+				known.digest != file.GetHashFile())
+			{
+				modified.push_back(file);
+			}
+			known.path.clear();
+		}
+	}
+}
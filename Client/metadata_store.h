@@ -0,0 +1,107 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <Windows.h>
+#include <winsqlite/winsqlite3.h>
+#include "folder_info.h"
+#include "file_handle.h"
+
+#pragma comment(lib, "winsqlite3.lib")
+
+#define METADATA_STORE_VERSION		1			// PRAGMA user_version of the schema
+
+namespace UserOperations
+{
+	using ResourceOperations::FileInfo;
+	using ResourceOperations::FolderInfo;
+
+	// A file as the server last received it
+	struct StoredFile
+	{
+		std::wstring path;
+		DWORD file_id;
+		uint64_t size;
+		FILETIME last_write_time;
+		std::string digest;
+	};
+
+	// An upload cut off before it completed, 'parts' parts of 'bytes' bytes reached the server
+	struct StoredUpload
+	{
+		std::wstring path;
+		std::string upload_id;
+		DWORD parts;
+		uint64_t bytes;
+	};
+
+	// Sync state kept in one SQLite database (the winsqlite3 that ships with Windows) in WAL mode:
+	//
+	//   files    every file the server holds: path, server id, size, attribute, times and SHA-256
+	//   uploads  the part map of every upload in progress, removed when the upload completes
+	//
+	// What is pending after a restart is what a scan shows differently from 'files', so a scan is
+	// diffed against it instead of the server being asked again, and the digests it holds spare
+	// hashing the files that did not change. Every statement is prepared once when the store opens.
+	// Writes made between Begin and Commit are one transaction; other threads wait for the Commit.
+	class MetadataStore : public ResourceOperations::IDigestSource
+	{
+	public:
+		MetadataStore();
+		~MetadataStore();
+
+		BOOL Open(const std::wstring& path);
+		void Close();
+		BOOL IsOpen() const { return db != NULL; }
+
+		BOOL Begin();
+		BOOL Commit();
+		void Rollback();
+
+		BOOL PutFile(const FileInfo& file, DWORD file_id);
+		BOOL RemoveFile(const std::wstring& path);
+		BOOL RenameFile(const std::wstring& path, const std::wstring& new_path);
+		BOOL FindDigest(const std::wstring& path, DWORD size, const FILETIME& last_write_time, std::string& digest) override;
+		// Whether any file under 'folder_path' is stored, a folder that was never synced has none
+		BOOL HasFolderTree(const std::wstring& folder_path, BOOL& found);
+		// Files of 'folder' that are not stored or differ from it, and stored files under it that are gone
+		BOOL DiffFolderTree(const FolderInfo& folder, std::vector<FileInfo>& added, std::vector<FileInfo>& modified,
+			std::vector<StoredFile>& removed);
+
+		BOOL RecordUploadPart(const std::wstring& path, const std::string& upload_id, DWORD parts, uint64_t bytes);
+		BOOL FinishUpload(const std::wstring& path);
+		BOOL LoadUploads(std::vector<StoredUpload>& uploads);
+		BOOL ClearUploads();
+	private:
+		enum Statement
+		{
+			STMT_BEGIN,
+			STMT_COMMIT,
+			STMT_ROLLBACK,
+			STMT_PUT_FILE,
+			STMT_REMOVE_FILE,
+			STMT_RENAME_FILE,
+			STMT_FIND_DIGEST,
+			STMT_LIST_FOLDER,
+			STMT_ANY_IN_FOLDER,
+			STMT_PUT_UPLOAD,
+			STMT_REMOVE_UPLOAD,
+			STMT_LIST_UPLOADS,
+			STMT_CLEAR_UPLOADS,
+			STMT_COUNT
+		};
+
+		MetadataStore(const MetadataStore&) = delete;
+		MetadataStore& operator=(const MetadataStore&) = delete;
+
+		BOOL CreateSchema();
+		BOOL Execute(Statement statement);
+		void DiffFiles(const FolderInfo& folder, std::vector<StoredFile>& stored, std::vector<FileInfo>& added,
+			std::vector<FileInfo>& modified);
+
+		sqlite3* db;
+		sqlite3_stmt* statements[STMT_COUNT];
+		std::recursive_mutex store_mutex;		// Held from Begin to Commit or Rollback
+	};
+}
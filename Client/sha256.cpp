@@ -90,7 +90,9 @@ namespace Crypto {
 
 	void SHA256_Update(SHA256_CTX* ctx, uint8_t* data, uint32_t len)
 	{
-		for (uint32_t i = 0; i < len; ++i)
+		uint32_t i = 0;
+		// Top up a pending partial block, then hash whole blocks in place without copying
+		for (; ctx->index != 0 && i < len; ++i)
 		{
 			ctx->block[ctx->index] = data[i];
 			ctx->index++;
@@ -101,6 +103,15 @@ namespace Crypto {
 				ctx->index = 0;
 			}
 		}
+		for (; len - i >= SHA256_BLOCK_LENGTH; i += SHA256_BLOCK_LENGTH)
+		{
+			SHA256Transform(ctx, data + i);
+			DBL_INT_ADD(ctx->bitcount[0], ctx->bitcount[1], 512);
+		}
+		for (; i < len; ++i)
+		{
+			ctx->block[ctx->index++] = data[i];
+		}
 	}
 
 	void SHA256_Final(SHA256_CTX* ctx, uint8_t digest[SHA256_DIGEST_LENGTH])
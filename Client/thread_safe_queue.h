@@ -1,91 +1,76 @@
-//#pragma once
-//#include <list>
-//#include <thread>
-//#include <vector>
-//
-//template <typename C>
-//class ThreadSafeQueue : protected std::list<C> {
-//public:
-//    ThreadSafeQueue(int nMaxCount)
-//    {
-//        m_bOverflow = false;
-//
-//        m_hSemaphore = ::CreateSemaphore(
-//            NULL,		// no security attributes
-//            0,			// initial count
-//            nMaxCount,	// max count
-//            NULL);		// anonymous
-//    }
-//
-//    ~ThreadSafeQueue()
-//    {
-//        ::CloseHandle(m_hSemaphore);
-//        m_hSemaphore = NULL;
-//    }
-//
-//    void push(C& c)
-//    {
-//        CComCritSecLock<CComAutoCriticalSection> lock(m_Crit, true);
-//        this->push_back(c);
-//        lock.Unlock();
-//
-//        if (!::ReleaseSemaphore(m_hSemaphore, 1, NULL))
-//        {
-//            // If the semaphore is full, then take back the entry.
-//            lock.Lock();
-//            this->pop_back();
-//            if (GetLastError() == ERROR_TOO_MANY_POSTS)
-//            {
-//                m_bOverflow = true;
-//            }
-//        }
-//    }
-//
-//    bool pop(C& c)
-//    {
-//        CComCritSecLock<CComAutoCriticalSection> lock(m_Crit, true);
-//
-//        // If the user calls pop() more than once after the
-//        // semaphore is signaled, then the semaphore count will
-//        // get out of sync.  We fix that when the queue empties.
-//        if (this->empty())
-//        {
-//            while (::WaitForSingleObject(m_hSemaphore, 0) != WAIT_TIMEOUT)
-//                1;
-//            return false;
-//        }
-//
-//        c = this->front();
-//        this->pop_front();
-//
-//        return true;
-//    }
-//
-//    // If overflow, use this to clear the queue.
-//    void clear()
-//    {
-//        CComCritSecLock<CComAutoCriticalSection> lock(m_Crit, true);
-//
-//        for (DWORD i = 0; i < this->size(); i++)
-//        {
-//            // semaphore count decrease size, means reset semaphore count
-//            WaitForSingleObject(m_hSemaphore, 0);
-//        }
-//
-//        __super::clear();
-//
-//        m_bOverflow = false;
-//    }
-//
-//    bool overflow()
-//    {
-//        return m_bOverflow;
-//    }
-//
-//    HANDLE GetWaitHandle() { return m_hSemaphore; }
-//
-//protected:
-//    bool m_bOverflow;
-//    HANDLE m_hSemaphore;
-//    CComAutoCriticalSection m_Crit;
-//};
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Bounded queue between producer and consumer threads. push() blocks while the queue is full and
+// pop() while it is empty, so a fast producer cannot run ahead of the consumer by more than
+// nMaxCount items. After close() push() refuses new items and pop() drains the remaining ones.
+template <typename C>
+class ThreadSafeQueue {
+public:
+    explicit ThreadSafeQueue(size_t nMaxCount)
+        : m_nMaxCount(nMaxCount), m_bClosed(false)
+    {
+    }
+
+    bool push(C c)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_NotFull.wait(lock, [this]() { return m_bClosed || m_Items.size() < m_nMaxCount; });
+        if (m_bClosed)
+        {
+            return false;
+        }
+        m_Items.push_back(std::move(c));
+        lock.unlock();
+        m_NotEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(C& c)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_NotEmpty.wait(lock, [this]() { return m_bClosed || !m_Items.empty(); });
+        if (m_Items.empty())
+        {
+            return false;
+        }
+        c = std::move(m_Items.front());
+        m_Items.pop_front();
+        lock.unlock();
+        m_NotFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_bClosed = true;
+        m_NotEmpty.notify_all();
+        m_NotFull.notify_all();
+    }
+
+    // Drops the waiting items, for a consumer that gives up
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Items.clear();
+        m_NotFull.notify_all();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Items.size();
+    }
+
+protected:
+    std::deque<C> m_Items;
+    std::mutex m_Mutex;
+    std::condition_variable m_NotEmpty;
+    std::condition_variable m_NotFull;
+    size_t m_nMaxCount;
+    bool m_bClosed;
+};
@@ -1,14 +1,14 @@
 ﻿#include <queue>
 #include <atomic>
+#include <memory>
+#include <thread>
 #include <conio.h>
-#include <sstream>
 
 #include "utils.h"
 #include "logger.h"
 #include "base64.h"
+#include "sha256.h"
 #include "user_handle.h"
-#include "zlib/zstream/izstream.h"
-#include "zlib/zstream/ozstream.h"
 #include <unordered_map>
 
 std::atomic<BOOL> exitMonitorFlag(FALSE); // Shared variable to signal exit
@@ -215,6 +215,10 @@ namespace UserOperations
 			return FALSE;
 		}
 		cache_api->removeFile(file_path);
+		if (store_api)
+		{
+			store_api->RemoveFile(file_path);
+		}
 
 		LOG_SUCCESS_W(L"[Server]: Response \n%s \n%s", response.GetHeaderWString().c_str(), response.GetContentWString().c_str());
 		return TRUE;
@@ -248,11 +252,47 @@ namespace UserOperations
 		std::wstring new_file_path = Helper::PathHelper::combinePathComponent(old_folder_path, new_name);
 		cache_api->removeFile(file_path);
 		cache_api->insertFile(new_file_path, file_id);
+		if (store_api)
+		{
+			store_api->RenameFile(file_path, new_file_path);
+		}
 
 		LOG_SUCCESS_W(L"[Server]: Response \n%s \n%s", response.GetHeaderWString().c_str(), response.GetContentWString().c_str());
 		return TRUE;
 	}
 
+	BOOL UserHandle::DownloadFile(const std::wstring& file_path, const std::wstring& save_path)
+	{
+		HttpHeaders headers;
+		HttpResponse response;
+		if (!this->logged_in || this->token_id.empty() || this->user_name.empty())
+		{
+			LOG_ERROR_W(L"[Client]: You need to login to use this function!");
+			return FALSE;
+		}
+		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
+
+		// The stored file is fetched in parallel byte ranges next to the target, then restored into it
+		DWORD file_id = cache_api->getFileID(file_path);
+		std::wstring stored_path = save_path + L".download";
+		LOG_INFO_W(L"[Client][GET] Downloading file: %s", file_path.c_str());
+		response = net_api->DownloadFileRanged(this->user_name + L"/download/" + std::to_wstring(file_id), stored_path, headers);
+		if (response.GetStatusCode() != 200)
+		{
+			LOG_ERROR_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
+			return FALSE;
+		}
+		BOOL restored = RestoreDownloadedFile(stored_path, save_path);
+		DeleteFileW(stored_path.c_str());
+		if (!restored)
+		{
+			LOG_ERROR_W(L"[Client]: Downloaded file %s is damaged.", file_path.c_str());
+			return FALSE;
+		}
+		LOG_SUCCESS_W(L"[Client]: File %s downloaded to %s", file_path.c_str(), save_path.c_str());
+		return TRUE;
+	}
+
 	//---- Private method
 	HttpResponse UserHandle::UploadFileMultipart(const FileInfo& file, const std::string& upload_id)
 	{
@@ -275,12 +315,9 @@ namespace UserOperations
 		{
 			bufferSize = fileSize;
 		}
-		BYTE* buffer = new BYTE[bufferSize];
-		if (!buffer)
-		{
-			LOG_ERROR_W(L"Failed to allocate memory!");
-			return HttpResponse();
-		}
+		// Pooled, the next file reuses the buffers of this one
+		PooledBuffer readBuffer(bufferSize);
+		BYTE* buffer = readBuffer.data();
 		// Open file handle
 		HANDLE hFile = CreateFileW(file.GetFilePath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 		if (hFile == INVALID_HANDLE_VALUE)
@@ -288,32 +325,65 @@ namespace UserOperations
 			LOG_ERROR_W(L"Failed to opening file handle!");
 			return HttpResponse();
 		}
-		// Loop request POST file data
+		// Loop request POST file data, one compressor is reused for every part
+		std::unique_ptr<IDataTransform> compressor(CreateUploadCompressor(file));
+		std::unique_ptr<DataCryptor> cryptor;
+		std::string nonce(GCM_NONCE_LEN, '\0');
+		ULONGLONG chunkIndex = 0;
+		if (!this->encryption_key.empty())
+		{
+			// Client-side encryption, one random nonce per file and one AES-GCM tag per part
+			Helper::generateRandomBytes((uint8_t*)&nonce[0], nonce.size());
+			cryptor.reset(new DataCryptor(this->encryption_key, nonce));
+		}
+		// Compress, encrypt and hash in one pass over each part, straight into the part buffer
+		ChunkPipeline pipeline;
+		pipeline.AddStage(compressor.get());
+		if (cryptor)
+		{
+			pipeline.AddStage(cryptor.get());
+		}
+		// The body is framed in one pooled buffer: form fields, then the part written in place in the stored
+		// layout, which carries the nonce of an encrypted file, then the digest and the closing boundary
+		std::string parent_folder = Helper::StringHelper::convertWideStringToString(file.GetParentFolder()->GetRelativePath());
+		std::string file_name = Helper::StringHelper::convertWideStringToString(file.GetFileName());
+		std::string head;
+		/*---------[Folder]-----------------*/
+		head += "--" + boundary + "\r\n";
+		head += "Content-Disposition: form-data; name=\"folder\"\r\n";
+		head += "Content-Type: text/plain\r\n\r\n";
+		head += parent_folder + "\r\n";
+		/*---------[File Data]--------------*/
+		head += "--" + boundary + "\r\n";
+		head += "Content-Disposition: form-data; name=\"filedata\"; filename=\"" + file_name + "\"\r\n";
+		head += "Content-Type: application/octet-stream\r\n\r\n";
+		/*---------[Digest]-----------------*/
+		std::string digestHead = "--" + boundary + "\r\n";
+		digestHead += "Content-Disposition: form-data; name=\"sha256\"\r\n";
+		digestHead += "Content-Type: text/plain\r\n\r\n";
+		std::string closing = "--" + boundary + "--\r\n";
+		size_t partBound = StoredLayout::Bound(pipeline, bufferSize);
+		PooledBuffer body(head.size() + partBound + 2 + digestHead.size() + SHA256_DIGEST_LENGTH * 2 + 2 + closing.size());
+		memcpy(body.data(), head.data(), head.size());
+		size_t partSize = 0;
 		while (ReadFile(hFile, buffer, bufferSize, &bytesRead, NULL) && bytesRead > 0)
 		{
-			std::string parent_folder = Helper::StringHelper::convertWideStringToString(file.GetParentFolder()->GetRelativePath());
-			std::string file_name = Helper::StringHelper::convertWideStringToString(file.GetFileName());
-			std::stringstream body;
-			/*---------[Folder]-----------------*/
-			body << "--" << boundary << "\r\n";
-			body << "Content-Disposition: form-data; name=\"folder\"" << "\r\n";
-			body << "Content-Type: text/plain\r\n\r\n";
-			body << parent_folder << "\r\n";
-			/*---------[File Data]--------------*/
-			body << "--" << boundary << "\r\n";
-			body << "Content-Disposition: form-data; name=\"filedata\"; filename=\"" << file_name << "\"\r\n";
-			body << "Content-Type: application/octet-stream\r\n\r\n";
-			/*---------[Compress Data]----------*/
-			std::ostringstream compress;
+			BOOL lastChunk = (totalBytesUploaded + bytesRead >= fileSize);
+			/*---------[Compress Encrypt Data]--*/
+			if (!StoredLayout::WritePart(pipeline, cryptor ? nonce : "", chunkIndex++, lastChunk, buffer, bytesRead,
+				body.data() + head.size(), partBound, partSize))
+			{
+				CloseHandle(hFile);
+				return HttpResponse();
+			}
+			std::string tail = "\r\n";
+			if (lastChunk)
 			{
-				//TODO: Using zlib compress buffer
-				zstream::ozstream zipper(compress);
-				zipper << buffer;
+				tail += digestHead + pipeline.GetDigest() + "\r\n";
 			}
-			body << compress.str() << "\r\n";
-			/*-----------------------------------*/
-			body << "--" << boundary << "--\r\n";
-			response = net_api->Post(this->user_name + L"/files/upload/" + id, headers, body.str());
+			tail += closing;
+			memcpy(body.data() + head.size() + partSize, tail.data(), tail.size());
+			response = net_api->Post(this->user_name + L"/files/upload/" + id, headers, body.data(), head.size() + partSize + tail.size());
 			if (response.GetStatusCode() != 200)
 			{
 				return response;
@@ -323,7 +393,10 @@ namespace UserOperations
 			{
 				totalBytesUploaded = fileSize;
 			}
-			memset(buffer, 0, bufferSize);
+			if (store_api)
+			{
+				store_api->RecordUploadPart(file.GetFilePath(), upload_id, (DWORD)chunkIndex, totalBytesUploaded);
+			}
 
 			int percentUploaded = (int)(((double)(totalBytesUploaded) / fileSize) * 100);
 			printf("\r[Uploading %s: %d%%]", file_name.c_str(), percentUploaded);
@@ -335,7 +408,6 @@ namespace UserOperations
 		{
 			CloseHandle(hFile);
 		}
-		delete[] buffer;
 		return response;
 	}
 	//---- Private method
@@ -361,12 +433,9 @@ namespace UserOperations
 		{
 			bufferSize = fileSize;
 		}
-		BYTE* buffer = new BYTE[bufferSize];
-		if (!buffer)
-		{
-			LOG_ERROR_W(L"Failed to allocate memory!");
-			return HttpResponse();
-		}
+		// Pooled, the next file reuses the buffers of this one
+		PooledBuffer readBuffer(bufferSize);
+		BYTE* buffer = readBuffer.data();
 		// Open file handle
 		HANDLE hFile = CreateFileW(file.GetFilePath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 		if (hFile == INVALID_HANDLE_VALUE)
@@ -374,32 +443,65 @@ namespace UserOperations
 			LOG_ERROR_W(L"Failed to opening file handle!");
 			return HttpResponse();
 		}
-		// Loop request POST file data
+		// Loop request POST file data, one compressor is reused for every part
+		std::unique_ptr<IDataTransform> compressor(CreateUploadCompressor(file));
+		std::unique_ptr<DataCryptor> cryptor;
+		std::string nonce(GCM_NONCE_LEN, '\0');
+		ULONGLONG chunkIndex = 0;
+		if (!this->encryption_key.empty())
+		{
+			// Client-side encryption, one random nonce per file and one AES-GCM tag per part
+			Helper::generateRandomBytes((uint8_t*)&nonce[0], nonce.size());
+			cryptor.reset(new DataCryptor(this->encryption_key, nonce));
+		}
+		// Compress, encrypt and hash in one pass over each part, straight into the part buffer
+		ChunkPipeline pipeline;
+		pipeline.AddStage(compressor.get());
+		if (cryptor)
+		{
+			pipeline.AddStage(cryptor.get());
+		}
+		// The body is framed in one pooled buffer: form fields, then the part written in place in the stored
+		// layout, which carries the nonce of an encrypted file, then the digest and the closing boundary
+		std::string parent_folder = Helper::StringHelper::convertWideStringToString(file.GetParentFolder()->GetRelativePath());
+		std::string file_name = Helper::StringHelper::convertWideStringToString(file.GetFileName());
+		std::string head;
+		/*---------[Folder]-----------------*/
+		head += "--" + boundary + "\r\n";
+		head += "Content-Disposition: form-data; name=\"folder\"\r\n";
+		head += "Content-Type: text/plain\r\n\r\n";
+		head += parent_folder + "\r\n";
+		/*---------[File Data]--------------*/
+		head += "--" + boundary + "\r\n";
+		head += "Content-Disposition: form-data; name=\"filedata\"; filename=\"" + file_name + "\"\r\n";
+		head += "Content-Type: application/octet-stream\r\n\r\n";
+		/*---------[Digest]-----------------*/
+		std::string digestHead = "--" + boundary + "\r\n";
+		digestHead += "Content-Disposition: form-data; name=\"sha256\"\r\n";
+		digestHead += "Content-Type: text/plain\r\n\r\n";
+		std::string closing = "--" + boundary + "--\r\n";
+		size_t partBound = StoredLayout::Bound(pipeline, bufferSize);
+		PooledBuffer body(head.size() + partBound + 2 + digestHead.size() + SHA256_DIGEST_LENGTH * 2 + 2 + closing.size());
+		memcpy(body.data(), head.data(), head.size());
+		size_t partSize = 0;
 		while (ReadFile(hFile, buffer, bufferSize, &bytesRead, NULL) && bytesRead > 0)
 		{
-			std::string parent_folder = Helper::StringHelper::convertWideStringToString(file.GetParentFolder()->GetRelativePath());
-			std::string file_name = Helper::StringHelper::convertWideStringToString(file.GetFileName());
-			std::stringstream body;
-			/*---------[Folder]-----------------*/
-			body << "--" << boundary << "\r\n";
-			body << "Content-Disposition: form-data; name=\"folder\"" << "\r\n";
-			body << "Content-Type: text/plain\r\n\r\n";
-			body << parent_folder << "\r\n";
-			/*---------[File Data]--------------*/
-			body << "--" << boundary << "\r\n";
-			body << "Content-Disposition: form-data; name=\"filedata\"; filename=\"" << file_name << "\"\r\n";
-			body << "Content-Type: application/octet-stream\r\n\r\n";
-			/*---------[Compress Data]----------*/
-			std::ostringstream compress;
+			BOOL lastChunk = (totalBytesUpdated + bytesRead >= fileSize);
+			/*---------[Compress Encrypt Data]--*/
+			if (!StoredLayout::WritePart(pipeline, cryptor ? nonce : "", chunkIndex++, lastChunk, buffer, bytesRead,
+				body.data() + head.size(), partBound, partSize))
+			{
+				CloseHandle(hFile);
+				return HttpResponse();
+			}
+			std::string tail = "\r\n";
+			if (lastChunk)
 			{
-				//TODO: Using zlib compress buffer
-				zstream::ozstream zipper(compress);
-				zipper << buffer;
+				tail += digestHead + pipeline.GetDigest() + "\r\n";
 			}
-			body << compress.str() << "\r\n";
-			/*-----------------------------------*/
-			body << "--" << boundary << "--\r\n";
-			response = net_api->Put(this->user_name + L"/files/update/" + id, headers, body.str());
+			tail += closing;
+			memcpy(body.data() + head.size() + partSize, tail.data(), tail.size());
+			response = net_api->Put(this->user_name + L"/files/update/" + id, headers, body.data(), head.size() + partSize + tail.size());
 			if (response.GetStatusCode() != 200)
 			{
 				return response;
@@ -409,7 +511,10 @@ namespace UserOperations
 			{
 				totalBytesUpdated = fileSize;
 			}
-			memset(buffer, 0, bufferSize);
+			if (store_api)
+			{
+				store_api->RecordUploadPart(file.GetFilePath(), update_id, (DWORD)chunkIndex, totalBytesUpdated);
+			}
 
 			int percentUpdated = (int)(((double)(totalBytesUpdated) / fileSize) * 100);
 			printf("\r[Updating %s: %d%%]", file_name.c_str(), percentUpdated);
@@ -421,11 +526,64 @@ namespace UserOperations
 		{
 			CloseHandle(hFile);
 		}
-		delete[] buffer;
 		return response;
 	}
 
 
+	//---- Private method
+	IDataTransform* UserHandle::CreateUploadCompressor(const FileInfo& file)
+	{
+		// Deflate that skips incompressible chunks, split across the worker pool only when the parts are
+		// large enough for it to pay off
+		AdaptiveCompress* compressor = new AdaptiveCompress();
+		compressor->SetFileExtension(file.GetFileExtension());
+		if (file.GetFileSize() >= PARALLEL_MIN_SIZE)
+		{
+			compressor->SetThreadCount(WorkerPool::Instance().GetThreadCount() + 1);
+		}
+		return compressor;
+	}
+
+	//---- Private method
+	BOOL UserHandle::RestoreDownloadedFile(const std::wstring& stored_path, const std::wstring& save_path)
+	{
+		// The server keeps the parts as they were uploaded, StoredLayout reads it back: deflate streams
+		// checked by their Adler-32 trailers, decrypted first with the nonce of its header when encrypted
+		HANDLE hStored = CreateFileW(stored_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hStored == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR_W(L"Failed to opening file handle!");
+			return FALSE;
+		}
+		HANDLE hFile = CreateFileW(save_path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			LOG_ERROR_W(L"Failed to create file %s. Error code = %d", save_path.c_str(), GetLastError());
+			CloseHandle(hStored);
+			return FALSE;
+		}
+		BOOL success = StoredLayout::Restore(hStored, hFile, this->encryption_key);
+		CloseHandle(hStored);
+		CloseHandle(hFile);
+		if (!success)
+		{
+			DeleteFileW(save_path.c_str());
+		}
+		return success;
+	}
+
+	//---- Private method
+	void UserHandle::StoreSyncedFile(const FileInfo& file, DWORD file_id)
+	{
+		// The file and the end of its upload are one transaction
+		if (store_api && store_api->Begin())
+		{
+			store_api->PutFile(file, file_id);
+			store_api->FinishUpload(file.GetFilePath());
+			store_api->Commit();
+		}
+	}
+
 	BOOL UserHandle::UploadFile(const FileInfo& file)
 	{
 		HttpHeaders headers;
@@ -480,10 +638,99 @@ namespace UserOperations
 			LOG_ERROR_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
 			return FALSE;
 		}
+		StoreSyncedFile(file, file_id);
 		LOG_SUCCESS_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
 		return TRUE;
 	}
 
+	//---- Private method
+	BOOL UserHandle::UploadFileBundle(const std::vector<FileInfo>& files)
+	{
+		HttpHeaders headers;
+		HttpResponse response;
+		std::vector<BatchResult> results;
+		if (!this->logged_in || this->token_id.empty() || this->user_name.empty())
+		{
+			LOG_ERROR_W(L"[Client]: You need to login to use this function!");
+			return FALSE;
+		}
+		// Every file is read whole and sent as a single part, compressed and encrypted like the parts of a
+		// large upload, so one request replaces the init, part and complete requests of each file
+		MultipartBody body;
+		PooledBuffer readBuffer(BUNDLE_MAX_FILE_SIZE);
+		for (const FileInfo& file : files)
+		{
+			HANDLE hFile = CreateFileW(file.GetFilePath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (hFile == INVALID_HANDLE_VALUE)
+			{
+				LOG_ERROR_W(L"Failed to opening file handle: %s", file.GetFilePath().c_str());
+				return FALSE;
+			}
+			DWORD bytesRead = 0;
+			BOOL read = ReadFile(hFile, readBuffer.data(), BUNDLE_MAX_FILE_SIZE, &bytesRead, NULL);
+			CloseHandle(hFile);
+			if (!read)
+			{
+				LOG_ERROR_W(L"Failed to read file: %s", file.GetFilePath().c_str());
+				return FALSE;
+			}
+
+			std::unique_ptr<IDataTransform> compressor(CreateUploadCompressor(file));
+			std::unique_ptr<DataCryptor> cryptor;
+			std::string nonce(GCM_NONCE_LEN, '\0');
+			ChunkPipeline pipeline;
+			pipeline.AddStage(compressor.get());
+			if (!this->encryption_key.empty())
+			{
+				Helper::generateRandomBytes((uint8_t*)&nonce[0], nonce.size());
+				cryptor.reset(new DataCryptor(this->encryption_key, nonce));
+				pipeline.AddStage(cryptor.get());
+			}
+			std::vector<BYTE> part(StoredLayout::Bound(pipeline, bytesRead));
+			size_t partSize = 0;
+			if (!StoredLayout::WritePart(pipeline, cryptor ? nonce : "", 0, TRUE, readBuffer.data(), bytesRead, part.data(), part.size(), partSize))
+			{
+				return FALSE;
+			}
+			body.AddField("fileinfo", JsonUtility::CreateJsonFileUpload(file));
+			body.AddFile("filedata", Helper::StringHelper::convertWideStringToString(file.GetFileName()), part.data(), partSize);
+			body.AddField("sha256", pipeline.GetDigest());
+		}
+
+		headers.SetHeader(L"Accept-Encoding", L"gzip, deflate");
+		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
+		headers.SetHeader("Content-Type", body.GetContentType());
+		LOG_INFO_W(L"[Client][POST] Uploading a bundle of %d files", files.size());
+		response = net_api->Post(this->user_name + L"/files/bundle", headers, body.Finish());
+		if (response.GetStatusCode() != 200)
+		{
+			LOG_ERROR_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
+			return FALSE;
+		}
+		JsonUtility::ParserJsonBatchResponse(response.GetContentString(), results);
+		if (results.size() != files.size())
+		{
+			LOG_ERROR_W(L"[Server]: Bundle returned %d results for %d files", results.size(), files.size());
+			return FALSE;
+		}
+
+		// Results come back in request order, every stored file is synced on its own
+		BOOL result = TRUE;
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			if (results[i].status != 201)
+			{
+				LOG_ERROR_W(L"[Server][%ld]: %s: %s", results[i].status, files[i].GetFilePath().c_str(), results[i].message.c_str());
+				result = FALSE;
+				continue;
+			}
+			cache_api->insertFile(files[i].GetFilePath(), results[i].file_id);
+			StoreSyncedFile(files[i], results[i].file_id);
+		}
+		LOG_SUCCESS_W(L"[Server]: Bundle of %d files uploaded", files.size());
+		return result;
+	}
+
 	BOOL UserHandle::UpdateFile(const FileInfo& file)
 	{
 		HttpHeaders headers;
@@ -545,6 +792,7 @@ namespace UserOperations
 			LOG_ERROR_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
 			return FALSE;
 		}
+		StoreSyncedFile(file, file_id);
 		LOG_SUCCESS_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
 		return TRUE;
 	}
@@ -618,7 +866,7 @@ namespace UserOperations
 	BOOL UserHandle::UploadFolderWithFilter(const std::wstring& folder_path, const std::wstring& filter)
 	{
 		FolderInfo folder;
-		if (!FolderHandle::GetFolderFilter(folder_path, filter, folder))
+		if (!FolderHandle::GetFolderFilter(folder_path, filter, folder, store_api))
 		{
 			return FALSE;
 		}
@@ -628,7 +876,7 @@ namespace UserOperations
 	BOOL UserHandle::UpdateFolderWithFilter(const std::wstring& folder_path, const std::wstring& filter)
 	{
 		FolderInfo folder;
-		if (!FolderHandle::GetFolderFilter(folder_path, filter, folder))
+		if (!FolderHandle::GetFolderFilter(folder_path, filter, folder, store_api))
 		{
 			return FALSE;
 		}
@@ -658,7 +906,6 @@ namespace UserOperations
 
 	BOOL UserHandle::PrepareWatch(FolderInfo& folder)
 	{
-		HttpHeaders headers;
 		HttpResponse response;
 		cache_api->loadFileCache();
 
@@ -669,15 +916,64 @@ namespace UserOperations
 			return FALSE;
 		}
 
-		// Setup HTTP headers
-		headers.SetHeader(L"Accept-Encoding", L"gzip, deflate");
-		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
-		headers.SetHeader(L"Content-Type", L"application/json");
+		// Step 1: Upload the missing files on a worker thread as the server reports them
+		ThreadSafeQueue<FileMissing> files_missing(COMPARE_QUEUE_SIZE);
+		std::atomic<BOOL> upload_failed(FALSE);
+		size_t uploaded = 0;
+		std::thread uploader([&]()
+		{
+			// Small files wait for a bundle of BUNDLE_MAX_FILES, the rest are uploaded as they come
+			std::vector<FileInfo> bundle;
+			FileMissing file_miss;
+			while (!upload_failed && files_missing.pop(file_miss))
+			{
+				FileInfo file = folder.FindFileRecursive(file_miss.first, file_miss.second);
+				LOG_INFO_W(L"[Upload] Processing file %d: %s", uploaded + bundle.size() + 1, file.GetFilePath().c_str());
+				if (file.GetFileSize() > 0 && file.GetFileSize() <= BUNDLE_MAX_FILE_SIZE)
+				{
+					bundle.push_back(file);
+					if (bundle.size() == BUNDLE_MAX_FILES)
+					{
+						upload_failed = !UploadFileBundle(bundle);
+						uploaded += bundle.size();
+						bundle.clear();
+					}
+				}
+				else if (UploadFile(file))
+				{
+					uploaded++;
+				}
+				else
+				{
+					LOG_ERROR_W(L"[Upload] Failed to upload file: %s", file.GetFilePath().c_str());
+					upload_failed = TRUE;
+				}
+			}
+			if (!upload_failed && !bundle.empty())
+			{
+				upload_failed = !UploadFileBundle(bundle);
+				uploaded += bundle.size();
+			}
+			if (upload_failed)
+			{
+				// The response reader stops at its next entry
+				files_missing.close();
+				files_missing.clear();
+			}
+		});
 
-		// Step 1: Send folder tree to server for comparison
+		// Step 2: Send folder tree to server for comparison. It is sent while the tree is walked and
+		// the answer is parsed while it downloads
 		LOG_INFO_W(L"[Prepare Watch] Sending folder structure to server for comparison");
-		std::string json_folder_tree = JsonUtility::CreateJsonFolderTree(folder);
-		response = net_api->Post(this->user_name + L"/files/compare", headers, json_folder_tree);
+		FileMissReader reader(files_missing);
+		ManifestState sent;
+		response = CompareFolderTree(folder, &reader, sent);
+		// "No missing files found." comes as text and stops the reader at its first byte, a JSON answer
+		// has to be read to its end
+		BOOL complete = response.GetStatusCode() == 200 &&
+			(_strnicmp(response.GetResponseHeader("Content-Type").c_str(), "text/plain", 10) == 0 || reader.Finish());
+		files_missing.close();
+		uploader.join();
 
 		if (response.GetStatusCode() != 200)
 		{
@@ -686,38 +982,37 @@ namespace UserOperations
 				response.GetContentWString().c_str());
 			return FALSE;
 		}
-
-		// Step 2: Parse server response for missing files
-		LOG_INFO_W(L"[Prepare Watch] Analyzing server response for missing files");
-		std::vector<FileMissing> files_missing;
-		if (response.CheckContentIsJson())
+		if (upload_failed)
 		{
-			std::string json_response = response.GetContentString();
-			JsonUtility::ParserJsonFileMissResponse(json_response, files_missing);
+			return FALSE;
 		}
-
-		// Step 3: Upload missing files to server
-		if (!files_missing.empty())
+		if (!complete)
 		{
-			LOG_INFO_W(L"[Sync] Found %d files missing on server", files_missing.size());
-
-			for (size_t i = 0; i < files_missing.size(); i++)
+			LOG_ERROR_W(L"[Prepare Watch] Invalid comparison response: %S", reader.GetError());
+			return FALSE;
+		}
+		// Everything the server missed is uploaded, the next comparison only sends what changes from here
+		if (sent.version != 0 && !this->manifest_state_path.empty() && !sent.Save(this->manifest_state_path))
+		{
+			LOG_WARNING_W(L"[Prepare Watch] Failed to save manifest state: %s", this->manifest_state_path.c_str());
+		}
+		// The server holds the whole folder now, after a restart the next scan is compared with the store
+		if (store_api && store_api->Begin())
+		{
+			for (const auto& file : folder.GetFilesRecursive())
 			{
-				FileMissing file_miss = files_missing[i];
-				FileInfo file = folder.FindFileRecursive(file_miss.first, file_miss.second);
-
-				LOG_INFO_W(L"[Upload] Processing file %d/%d: %s",
-					i + 1,
-					files_missing.size(),
-					file.GetFilePath().c_str());
-
-				if (!UploadFile(file))
+				if (cache_api->isFileExist(file.GetFilePath()))
 				{
-					LOG_ERROR_W(L"[Upload] Failed to upload file: %s", file.GetFilePath().c_str());
-					return FALSE;
+					store_api->PutFile(file, cache_api->getFileID(file.GetFilePath()));
 				}
 			}
-			LOG_INFO_W(L"[Sync] Successfully uploaded all missing files");
+			store_api->Commit();
+		}
+
+		// Step 3: Report
+		if (uploaded > 0)
+		{
+			LOG_INFO_W(L"[Sync] Successfully uploaded all %d files missing on server", uploaded);
 		}
 		else
 		{
@@ -728,15 +1023,128 @@ namespace UserOperations
 		return TRUE;
 	}
 
+	/**
+	 * Sends the folder tree for comparison as a manifest. When the server acknowledged an earlier manifest
+	 * of this user, only the files that changed since are sent; a 409 means the server moved to another
+	 * version meanwhile and the whole manifest follows. Falls back to JSON if manifests are refused.
+	 *
+	 * @access private
+	 *
+	 * @param IResponseReader reader Receives the files the server is missing
+	 * @param ManifestState sent Receives the manifest sent and the version the server gave it, 0 if none
+	 *
+	 * @return HttpResponse Returns the response of the last request
+	 */
+	HttpResponse UserHandle::CompareFolderTree(const FolderInfo& folder, IResponseReader* reader, ManifestState& sent)
+	{
+		if (!this->manifest_accepted)
+		{
+			return SendFolderTree(folder, reader);
+		}
+		ManifestWriter writer;
+		writer.WriteFolderTree(folder);
+		if (writer.IsFailed())
+		{
+			return HttpResponse();
+		}
+		sent.user_name = this->user_name;
+		sent.version = 0;
+		sent.manifest.assign(writer.GetData(), writer.GetSize());
+		Crypto::SHA256_Hash((BYTE*)&sent.manifest[0], sent.manifest.size(), sent.root);
+
+		HttpHeaders headers;
+		headers.SetHeader(L"Accept-Encoding", L"gzip, deflate");
+		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
+		headers.SetHeader(L"Content-Type", MANIFEST_CONTENT_TYPE);
+		std::wstring path = this->user_name + L"/files/compare";
+
+		HttpResponse response;
+		BOOL delta_sent = FALSE;
+		ManifestState base;
+		if (!this->manifest_state_path.empty() && base.Load(this->manifest_state_path) && base.user_name == this->user_name)
+		{
+			ManifestContent base_content, content;
+			if (ManifestReader::Parse(base.manifest.data(), base.manifest.size(), base_content) &&
+				ManifestReader::Parse(sent.manifest.data(), sent.manifest.size(), content))
+			{
+				std::vector<size_t> changed = ManifestReader::Diff(base_content, content);
+				ManifestWriter delta;
+				delta.WriteDelta(base.version, base.root, sent.root, content, changed);
+				if (!delta.IsFailed())
+				{
+					LOG_INFO_W(L"[Prepare Watch] Sending %zu of %zu files changed since manifest version %llu",
+						changed.size(), content.files.size(), base.version);
+					response = net_api->Post(path, headers, std::string(delta.GetData(), delta.GetSize()), reader);
+					delta_sent = TRUE;
+				}
+			}
+		}
+		if (!delta_sent || response.GetStatusCode() == 409)
+		{
+			if (delta_sent)
+			{
+				LOG_WARNING_W(L"[Prepare Watch] Server manifest is no longer version %llu, sending the whole manifest", base.version);
+			}
+			response = net_api->Post(path, headers, sent.manifest, reader);
+		}
+		if (response.GetStatusCode() == 415)
+		{
+			// Nothing reached the reader, the same request goes again as JSON
+			LOG_WARNING_W(L"[Prepare Watch] Server does not accept the binary manifest, sending JSON");
+			this->manifest_accepted = FALSE;
+			return SendFolderTree(folder, reader);
+		}
+
+		// The version is kept only for the manifest the server says it hashed to the same root
+		std::string version = response.GetResponseHeader(std::string("Manifest-Version"));
+		std::string digest = response.GetResponseHeader(std::string("Manifest-Digest"));
+		if (response.GetStatusCode() == 200 && !version.empty() &&
+			digest == Helper::StringHelper::convertBytesHexString(sent.root, MANIFEST_DIGEST_SIZE))
+		{
+			sent.version = _strtoui64(version.c_str(), NULL, 10);
+		}
+		return response;
+	}
+
+	HttpResponse UserHandle::SendFolderTree(const FolderInfo& folder, IResponseReader* reader)
+	{
+		HttpHeaders headers;
+		headers.SetHeader(L"Accept-Encoding", L"gzip, deflate");
+		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
+		headers.SetHeader(L"Content-Type", L"application/json");
+
+		LPVOID hRequest = net_api->OpenChunkedRequest(L"POST", this->user_name + L"/files/compare", headers);
+		if (!hRequest)
+		{
+			return HttpResponse();
+		}
+		ChunkedRequestSink sink(net_api, hRequest);
+		JsonBufferWriter writer;
+		writer.SetSink(&sink);
+		JsonUtility::WriteJsonFolderTree(folder, writer);
+		if (!writer.Flush())
+		{
+			net_api->CloseRequest(hRequest);
+			return HttpResponse();
+		}
+		return net_api->EndChunkedRequest(hRequest, reader);
+	}
+
 	BOOL UserHandle::WatchFolderSync(const std::wstring& folder_path, const std::wstring& filter, DWORD waitMilliseconds)
 	{
 		//---- Step 1: Get initial snapshot
-		if (!FolderHandle::GetFolderFilter(folder_path, filter, current_snapshot))
+		if (!FolderHandle::GetFolderFilter(folder_path, filter, current_snapshot, store_api))
 		{
 			LOG_ERROR_W(L"[Snapshot] Failed to get initial folder tree for: %s", folder_path.c_str());
 			return FALSE;
 		}
 		LOG_INFO_W(L"[Snapshot] Successfully created folder tree for: %s", folder_path.c_str());
+		// What changed while the client was not running is synced with the first batch
+		ActionList actions;
+		if (!ResumeFromStore(current_snapshot, actions))
+		{
+			LOG_WARNING_W(L"[Resume] Failed to compare %s with the stored sync state", folder_path.c_str());
+		}
 
 		//---- Step 2: Prepare watch operation
 		//if (!PrepareWatch(current_snapshot_)) 
@@ -787,7 +1195,6 @@ namespace UserOperations
 		LOG_INFO_W(L"[Watch] Starting file system watch on: %s", folder_path.c_str());
 		LOG_INFO_W(L"[Watch] Press 'Q' to exit monitoring");
 
-		ActionList actions;	// List action
 		HANDLE handles[2] = { hKeyboard, overlapped.hEvent }; // Array of handles to wait on
 
 		while (!exitMonitorFlag)
@@ -828,7 +1235,7 @@ namespace UserOperations
 				}
 				// Changes detected, get a new snapshot and compare
 				FolderInfo new_snapshot;
-				if (!FolderHandle::GetFolderFilter(folder_path, filter, new_snapshot))
+				if (!FolderHandle::GetFolderFilter(folder_path, filter, new_snapshot, store_api))
 				{
 					LOG_ERROR_W(L"[Snapshot] Failed to get updated folder tree!");
 				}
@@ -1058,6 +1465,8 @@ namespace UserOperations
 		}
 
 		//LOG_INFO_W(L" ---> [Actions] number of action: %d", actions.size());
+		BOOL result = TRUE;
+		std::vector<BatchOperation> batch;
 		for (const auto& action : actions)
 		{
 			switch (action.type_)
@@ -1103,7 +1512,13 @@ namespace UserOperations
 				{
 					LOG_INFO_W(L" ---> [Delete] file on server: %s", action.object_old_.file_old_->GetFilePath().c_str());
 					FileInfo file_delete = *action.object_old_.file_old_;
-					//ProcessFileRemove(file_delete);
+					if (!cache_api->isFileExist(file_delete.GetFilePath()))
+					{
+						LOG_ERROR_W(L"[Client]: No server id for %s, it is not removed", file_delete.GetFilePath().c_str());
+						result = FALSE;
+						break;
+					}
+					batch.push_back({ L"remove", cache_api->getFileID(file_delete.GetFilePath()), file_delete.GetFilePath(), L"" });
 				}
 				break;
 
@@ -1120,11 +1535,186 @@ namespace UserOperations
 					LOG_INFO_W(L" ---> [Rename] file on server: %s -> %s", action.object_old_.file_old_->GetFilePath().c_str(), action.object_new_.file_new_->GetFilePath().c_str());
 					FileInfo old_file = *action.object_old_.file_old_;
 					FileInfo new_file = *action.object_new_.file_new_;
-					//ProcessFileRename(old_file, new_file);
+					if (!cache_api->isFileExist(old_file.GetFilePath()))
+					{
+						LOG_ERROR_W(L"[Client]: No server id for %s, it is not renamed", old_file.GetFilePath().c_str());
+						result = FALSE;
+						break;
+					}
+					batch.push_back({ L"rename", cache_api->getFileID(old_file.GetFilePath()), old_file.GetFilePath(), new_file.GetFileName() });
 				}
 				break;
 			}
+			// Metadata changes travel together, one round trip for up to BATCH_MAX_OPERATIONS files
+			if (batch.size() >= BATCH_MAX_OPERATIONS)
+			{
+				result &= ProcessBatch(batch);
+				batch.clear();
+			}
+		}
+		if (!batch.empty())
+		{
+			result &= ProcessBatch(batch);
+		}
+		return result;
+	}
+
+	BOOL UserHandle::ProcessBatch(const std::vector<BatchOperation>& operations)
+	{
+		HttpHeaders headers;
+		HttpResponse response;
+		std::vector<BatchResult> results;
+		if (!this->logged_in || this->token_id.empty() || this->user_name.empty())
+		{
+			LOG_ERROR_W(L"[Client]: You need to login to use this function!");
+			return FALSE;
+		}
+		headers.SetHeader(L"Accept-Encoding", L"gzip, deflate");
+		headers.SetHeader(L"Authorization", L"Bearer " + this->token_id);
+		headers.SetHeader(L"Content-Type", L"application/json");
+
+		std::string json_request = JsonUtility::CreateJsonBatch(operations);
+		response = net_api->Post(this->user_name + L"\\files\\batch", headers, json_request);
+		if (response.GetStatusCode() != 200)
+		{
+			LOG_ERROR_W(L"[Server][%ld]: %s", response.GetStatusCode(), response.GetContentWString().c_str());
+			return FALSE;
+		}
+		JsonUtility::ParserJsonBatchResponse(response.GetContentString(), results);
+		if (results.size() != operations.size())
+		{
+			LOG_ERROR_W(L"[Server]: Batch returned %d results for %d operations", results.size(), operations.size());
+			return FALSE;
+		}
+
+		// Results come back in request order, only the successful operations touch the cache and the store
+		BOOL result = TRUE;
+		BOOL stored = store_api && store_api->Begin();
+		for (size_t i = 0; i < operations.size(); i++)
+		{
+			const BatchOperation& operation = operations[i];
+			if (results[i].status != 200)
+			{
+				LOG_ERROR_W(L"[Server][%ld]: %s %s: %s", results[i].status, operation.action.c_str(), operation.file_path.c_str(), results[i].message.c_str());
+				result = FALSE;
+				continue;
+			}
+			cache_api->removeFile(operation.file_path);
+			if (operation.action == L"rename")
+			{
+				std::wstring folder_path = Helper::PathHelper::extractParentPathFromPath(operation.file_path);
+				std::wstring new_path = Helper::PathHelper::combinePathComponent(folder_path, operation.new_name);
+				cache_api->insertFile(new_path, operation.file_id);
+				if (stored)
+				{
+					store_api->RenameFile(operation.file_path, new_path);
+				}
+			}
+			else if (stored)
+			{
+				store_api->RemoveFile(operation.file_path);
+			}
+		}
+		if (stored)
+		{
+			store_api->Commit();
+		}
+		LOG_SUCCESS_W(L"[Server]: Batch of %d operations processed", operations.size());
+		return result;
+	}
+
+	/**
+	 * Turns what changed in a folder since the last sync into actions, from the stored sync state
+	 * instead of a comparison with the server. A stored file that is gone and a new file in the same
+	 * folder with its size and digest was renamed. A folder the store holds nothing of has no sync
+	 * state to resume from, the files the cache has server ids for become its state instead.
+	 *
+	 * @access private
+	 *
+	 * @param FolderInfo folder Scan of the folder
+	 * @param ActionList actions Receives the actions
+	 *
+	 * @return BOOL Returns FALSE if the stored state could not be read
+	 */
+	BOOL UserHandle::ResumeFromStore(const FolderInfo& folder, ActionList& actions)
+	{
+		if (!store_api)
+		{
+			return TRUE;
+		}
+		// The server can not continue an upload session, the files of the ones cut off are sent again
+		std::vector<StoredUpload> uploads;
+		if (store_api->LoadUploads(uploads) && !uploads.empty())
+		{
+			for (const auto& upload : uploads)
+			{
+				LOG_INFO_W(L"[Resume] Upload of %s stopped after %lu parts", upload.path.c_str(), upload.parts);
+			}
+			store_api->ClearUploads();
+		}
+
+		// Diffed against an empty store every file would be added, and the whole tree uploaded again
+		BOOL found = FALSE;
+		if (!store_api->HasFolderTree(folder.GetFolderPath(), found))
+		{
+			return FALSE;
+		}
+		if (!found)
+		{
+			DWORD seeded = 0;
+			if (store_api->Begin())
+			{
+				for (const auto& file : folder.GetFilesRecursive())
+				{
+					if (cache_api->isFileExist(file.GetFilePath()))
+					{
+						store_api->PutFile(file, cache_api->getFileID(file.GetFilePath()));
+						seeded++;
+					}
+				}
+				store_api->Commit();
+			}
+			LOG_INFO_W(L"[Resume] No stored sync state for %s, %lu cached files recorded as synced", folder.GetFolderPath().c_str(), seeded);
+			return TRUE;
+		}
+
+		std::vector<FileInfo> added, modified;
+		std::vector<StoredFile> removed;
+		if (!store_api->DiffFolderTree(folder, added, modified, removed))
+		{
+			return FALSE;
+		}
+		for (const auto& stored : removed)
+		{
+			FileInfo old_file(stored.path, (DWORD)stored.size, stored.digest, 0, {}, stored.last_write_time, {});
+			auto renamed = std::find_if(added.begin(), added.end(), [&](const FileInfo& file)
+			{
+				return !stored.digest.empty() && file.GetHashFile() == stored.digest && file.GetFileSize() == stored.size &&
+					Helper::PathHelper::extractParentPathFromPath(file.GetFilePath()) == Helper::PathHelper::extractParentPathFromPath(stored.path);
+			});
+			if (renamed != added.end())
+			{
+				actions.push_back({ ACTION_RENAME, new FileInfo(old_file), new FileInfo(*renamed) });
+				LOG_INFO_W(L"[FILE][RENAME] %s -> %s", stored.path.c_str(), renamed->GetFilePath().c_str());
+				added.erase(renamed);
+			}
+			else
+			{
+				actions.push_back({ ACTION_REMOVE, new FileInfo(old_file), NULL });
+				LOG_INFO_W(L"[FILE][REMOVE] %s", stored.path.c_str());
+			}
+		}
+		for (const auto& file : added)
+		{
+			actions.push_back({ ACTION_ADD, new FileInfo(file), NULL });
+			LOG_INFO_W(L"[FILE][ADD] %s", file.GetFilePath().c_str());
+		}
+		for (const auto& file : modified)
+		{
+			actions.push_back({ ACTION_MODIFIED, new FileInfo(file), NULL });
+			LOG_INFO_W(L"[FILE][MODIFIED] %s", file.GetFilePath().c_str());
 		}
+		LOG_INFO_W(L"[Resume] %d changes since the last sync of %s", actions.size(), folder.GetFolderPath().c_str());
 		return TRUE;
 	}
 
@@ -5,12 +5,19 @@
 #include "file_cache.h"
 #include "http_client.h"
 #include "json_utility.h"
+#include "manifest.h"
 #include "folder_handle.h"
+#include "metadata_store.h"
 
 
 using namespace NetworkOperations;
 using namespace ResourceOperations;
 
+#define BATCH_MAX_OPERATIONS    500     // Metadata operations sent in one batch request
+#define COMPARE_QUEUE_SIZE      (1 << 20) // Missing files the compare response may run ahead of the uploads
+#define BUNDLE_MAX_FILE_SIZE    (64 * KB) // Files up to this size are uploaded several to one request
+#define BUNDLE_MAX_FILES        64      // Files sent in one bundle request
+
 namespace UserOperations 
 {
     enum SyncActionType
@@ -59,17 +66,24 @@ namespace UserOperations
     private:
         std::wstring token_id;
         std::wstring user_name;
+        std::string encryption_key;
         BOOL logged_in = FALSE;
+        BOOL manifest_accepted = TRUE;      // Cleared once the server answers 415 to a binary manifest
+        std::wstring manifest_state_path;   // Last acknowledged manifest, empty to always send it whole
         HttpClient* net_api;
         FileCache* cache_api;
+        MetadataStore* store_api;           // Sync state kept across restarts, optional
 
         std::mutex snapshot_mutex;
         FolderInfo current_snapshot;
 
     public:
-        UserHandle() : net_api(NULL), cache_api(NULL) {}
+        UserHandle() : net_api(NULL), cache_api(NULL), store_api(NULL) {}
         void SetupNetwork(HttpClient* net) { net_api = net; }
         void SetupFileCache(FileCache* cache) { cache_api = cache; }
+        void SetupEncryption(const std::string& key) { encryption_key = key; }
+        void SetupManifestState(const std::wstring& path) { manifest_state_path = path; }
+        void SetupMetadataStore(MetadataStore* store) { store_api = store; }
 
         BOOL RegisterAccount(const UserInfo& info);
         BOOL LoginAccount(const std::wstring& user_name, const std::wstring& password);
@@ -83,6 +97,7 @@ namespace UserOperations
         BOOL RenameFile(const std::wstring& file_path, const std::wstring& new_name);
         BOOL UploadFile(const FileInfo& file);
         BOOL UpdateFile(const FileInfo& file);
+        BOOL DownloadFile(const std::wstring& file_path, const std::wstring& save_path);
 
         BOOL RemoveFolder(const std::wstring& folder_path);
         BOOL RenameFolder(const std::wstring& folder_path, const std::wstring& new_name);
@@ -96,12 +111,20 @@ namespace UserOperations
     private:
         HttpResponse UploadFileMultipart(const FileInfo& file, const std::string& upload_id);
         HttpResponse UpdateFileMultipart(const FileInfo& file, const std::string& upload_id);
+        BOOL UploadFileBundle(const std::vector<FileInfo>& files);
+        IDataTransform* CreateUploadCompressor(const FileInfo& file);
+        BOOL RestoreDownloadedFile(const std::wstring& stored_path, const std::wstring& save_path);
         
         //---- NEW ------
         BOOL PrepareWatch(FolderInfo& folder);
+        HttpResponse CompareFolderTree(const FolderInfo& folder, IResponseReader* reader, ManifestState& sent);
+        HttpResponse SendFolderTree(const FolderInfo& folder, IResponseReader* reader);
 		void DetectChangeForFile(const FolderInfo& old_snapshot, const FolderInfo& new_snapshot, ActionList& actions);
         void DetectChangeForFolder(const FolderInfo& old_snapshot, const FolderInfo& new_snapshot, ActionList& actions);
         BOOL ProcessSync(const ActionList& actions);
+        BOOL ProcessBatch(const std::vector<BatchOperation>& operations);
+        BOOL ResumeFromStore(const FolderInfo& folder, ActionList& actions);
+        void StoreSyncedFile(const FileInfo& file, DWORD file_id);
         //---- NEW ------
 
         BOOL ProcessFileAdd(const FileInfo& file);
@@ -5,6 +5,7 @@
 
 /* @(#) $Id$ */
 #include "zutil.h"
+#include "adler32_simd.h"
 
 #define BASE 65521U     /* largest prime smaller than 65536 */
 #define NMAX 5552
@@ -92,6 +93,19 @@ uLong ZEXPORT adler32_z(uLong adler, const Bytef *buf, z_size_t len) {
         return adler | (sum2 << 16);
     }
 
+#ifdef ADLER32_SIMD_SSSE3
+    /* sum the 32-byte blocks with SSSE3 when the CPU has it */
+    if (len >= Z_ADLER32_SSSE3_MINIMUM_LENGTH &&
+        (zlib_cpu_features() & Z_CPU_SSSE3)) {
+        z_size_t chunk = len & ~(z_size_t)Z_ADLER32_SSSE3_CHUNKSIZE_MASK;
+        adler = adler32_ssse3_(adler | (sum2 << 16), buf, chunk);
+        sum2 = adler >> 16;
+        adler &= 0xffff;
+        buf += chunk;
+        len -= chunk;
+    }
+#endif
+
     /* do length NMAX blocks -- requires just one modulo operation */
     while (len >= NMAX) {
         len -= NMAX;
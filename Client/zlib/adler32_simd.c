@@ -0,0 +1,83 @@
+/* adler32_simd.c -- Adler-32 with x86 SSSE3
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Each 32-byte block adds its bytes to s1 with psadbw, and the bytes weighted
+ * 32, 31, ..., 1 to s2 with pmaddubsw. The s1 of every earlier block is owed
+ * to s2 32 times, so it is collected in v_ps and added once per run of blocks.
+ * A run is at most NMAX bytes, the most that can be summed before the 32-bit
+ * lanes could overflow, and ends with one modulo of each sum.
+ */
+
+#include "adler32_simd.h"
+
+#ifdef ADLER32_SIMD_SSSE3
+
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#  define TARGET_SSSE3
+#else
+#  define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+#define BASE 65521U     /* largest prime smaller than 65536 */
+#define NMAX 5552
+#define BLOCK_SIZE 32
+
+/* ========================================================================= */
+TARGET_SSSE3
+uLong ZLIB_INTERNAL adler32_ssse3_(uLong adler, const Bytef *buf,
+                                   z_size_t len) {
+    unsigned s1 = (unsigned)(adler & 0xffff);
+    unsigned s2 = (unsigned)((adler >> 16) & 0xffff);
+    z_size_t blocks = len / BLOCK_SIZE;
+
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    while (blocks) {
+        unsigned n = NMAX / BLOCK_SIZE;
+        __m128i v_ps, v_s1, v_s2;
+        if (n > blocks)
+            n = (unsigned)blocks;
+        blocks -= n;
+
+        v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+        v_s2 = _mm_cvtsi32_si128((int)s2);
+        v_s1 = _mm_setzero_si128();
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            /* s1 of the earlier blocks is added 32 times at the end */
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2,
+                       _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2,
+                       _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += BLOCK_SIZE;
+        } while (--n);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* add the lanes together */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    return s1 | ((uLong)s2 << 16);
+}
+
+#endif /* ADLER32_SIMD_SSSE3 */
@@ -0,0 +1,30 @@
+/* adler32_simd.h -- Adler-32 with x86 SSSE3
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef ADLER32_SIMD_H
+#define ADLER32_SIMD_H
+
+#include "cpu_features.h"
+
+#ifdef Z_CPU_X86
+#  define ADLER32_SIMD_SSSE3
+#endif
+
+/* adler32_z() hands adler32_ssse3_() the multiple of 32 bytes in front of the
+   tail, once it has at least this many bytes */
+#define Z_ADLER32_SSSE3_MINIMUM_LENGTH 64
+#define Z_ADLER32_SSSE3_CHUNKSIZE_MASK 31
+
+#ifdef ADLER32_SIMD_SSSE3
+
+/*
+  Return the Adler-32 of len bytes at buf, len a multiple of 32, continuing
+  from adler. Both sums of the result are reduced modulo 65521.
+ */
+uLong ZLIB_INTERNAL adler32_ssse3_(uLong adler, const Bytef *buf,
+                                   z_size_t len);
+
+#endif
+
+#endif /* ADLER32_SIMD_H */
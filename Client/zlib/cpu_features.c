@@ -0,0 +1,37 @@
+/* cpu_features.c -- runtime detection of the x86 vector extensions
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#include "cpu_features.h"
+
+#ifdef Z_CPU_X86
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
+
+/* ========================================================================= */
+unsigned ZLIB_INTERNAL zlib_cpu_features(void) {
+#ifdef Z_CPU_X86
+    /* The value is the same for every thread, so a racing first call only
+       repeats the query. */
+    static volatile int known = 0;
+    static volatile unsigned ecx = 0;
+    if (!known) {
+#  ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        ecx = (unsigned)info[2];
+#  else
+        unsigned eax, ebx, c, edx;
+        ecx = __get_cpuid(1, &eax, &ebx, &c, &edx) ? c : 0;
+#  endif
+        known = 1;
+    }
+    return ecx;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,26 @@
+/* cpu_features.h -- runtime detection of the x86 vector extensions
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include "zutil.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define Z_CPU_X86
+#endif
+
+/* cpuid(1).ecx bits */
+#define Z_CPU_PCLMUL  (1U << 1)
+#define Z_CPU_SSSE3   (1U << 9)
+#define Z_CPU_SSE41   (1U << 19)
+#define Z_CPU_SSE42   (1U << 20)
+
+/*
+  Return the Z_CPU_* bits of the running CPU, or 0 if they are unknown or the
+  build is not for x86. The query is made once and cached.
+ */
+unsigned ZLIB_INTERNAL zlib_cpu_features(void);
+
+#endif /* CPU_FEATURES_H */
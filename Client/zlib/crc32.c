@@ -28,6 +28,7 @@
 #endif /* MAKECRCH */
 
 #include "zutil.h"      /* for Z_U4, Z_U8, z_crc_t, and FAR definitions */
+#include "crc32_simd.h" /* for the PCLMULQDQ folding on x86 */
 
  /*
   A CRC of a message is computed on N braids of words in the message, where
@@ -703,6 +704,17 @@ unsigned long ZEXPORT crc32_z(unsigned long crc, const unsigned char FAR *buf,
     /* Pre-condition the CRC */
     crc = (~crc) & 0xffffffff;
 
+#ifdef CRC32_SIMD_SSE42_PCLMUL
+    /* Fold the bulk with carry-less multiplies when the CPU has them, leaving
+       fewer than 16 bytes for the code below. */
+    if (len >= Z_CRC32_PCLMUL_MINIMUM_LENGTH && crc32_pclmul_supported()) {
+        z_size_t chunk = len & ~(z_size_t)Z_CRC32_PCLMUL_CHUNKSIZE_MASK;
+        crc = crc32_pclmul_((unsigned)crc, buf, chunk);
+        buf += chunk;
+        len -= chunk;
+    }
+#endif
+
 #ifdef W
 
     /* If provided enough bytes, do a braided CRC calculation. */
@@ -0,0 +1,62 @@
+/* crc32_simd.h -- CRC-32 and CRC-32C with x86 carry-less multiply and SSE4.2
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+#ifndef CRC32_SIMD_H
+#define CRC32_SIMD_H
+
+#include "zlib.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define CRC32_SIMD_SSE42_PCLMUL
+#endif
+
+/* crc32_pclmul_() folds 64 bytes per step; crc32_z() hands it the multiple of
+   16 bytes in front of the tail and finishes the tail with the braided tables */
+#define Z_CRC32_PCLMUL_MINIMUM_LENGTH 64
+#define Z_CRC32_PCLMUL_CHUNKSIZE_MASK 15
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CRC32_SIMD_SSE42_PCLMUL
+
+/*
+  Return non-zero if the CPU has PCLMULQDQ and SSE4.1 (for crc32_pclmul_()).
+  The result is determined once and cached.
+ */
+int crc32_pclmul_supported(void);
+
+/*
+  Return non-zero if the CPU has the SSE4.2 crc32 instruction (for crc32c()).
+ */
+int crc32c_sse42_supported(void);
+
+/*
+  Compute the CRC-32 of len bytes at buf, len >= 64 and a multiple of 16. crc
+  is pre-conditioned (inverted) and so is the returned value, as inside
+  crc32_z().
+ */
+unsigned crc32_pclmul_(unsigned crc, const unsigned char FAR *buf,
+                       z_size_t len);
+
+#endif
+
+/*
+  Update a running CRC-32C (Castagnoli, as used by iSCSI, ext4 and most
+  storage formats) with the bytes buf[0..len-1] and return the updated CRC.
+  Like crc32(), a Z_NULL buf returns the required initial value of zero, and
+  the pre- and post-conditioning is done here. Uses the SSE4.2 crc32
+  instruction when the CPU has it and a byte table otherwise. This is not
+  used by zlib itself; it is the checksum for the client's own chunk and log
+  records.
+ */
+unsigned long ZEXPORT crc32c(unsigned long crc, const unsigned char FAR *buf,
+                             z_size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32_SIMD_H */
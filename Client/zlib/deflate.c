@@ -51,6 +51,21 @@
 
 #include "deflate.h"
 
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define SLIDE_HASH_SSE2
+#endif
+
+#if (defined(_M_X64) || defined(__x86_64__) || defined(__aarch64__)) && \
+    !defined(UNALIGNED_OK)
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    pragma intrinsic(_BitScanForward64)
+#  endif
+#  define LONGEST_MATCH_WIDE
+#endif
+
 const char deflate_copyright[] =
    " deflate 1.3.0.1 Copyright 1995-2023 Jean-loup Gailly and Mark Adler ";
 /*
@@ -189,6 +204,31 @@ local void slide_hash(deflate_state *s) {
     Posf *p;
     uInt wsize = s->w_size;
 
+#ifdef SLIDE_HASH_SSE2
+    /* Eight entries at a time: the unsigned saturating subtract is the same
+     * as m >= wsize ? m - wsize : NIL. Both tables have a power of two
+     * entries, at least 256.
+     */
+    const __m128i w = _mm_set1_epi16((short)wsize);
+
+    n = s->hash_size;
+    p = s->head;
+    do {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        _mm_storeu_si128((__m128i *)p, _mm_subs_epu16(v, w));
+        p += 8;
+    } while (n -= 8);
+#ifndef FASTEST
+    n = wsize;
+    p = s->prev;
+    do {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        _mm_storeu_si128((__m128i *)p, _mm_subs_epu16(v, w));
+        p += 8;
+    } while (n -= 8);
+#endif
+    (void)m;
+#else
     n = s->hash_size;
     p = &s->head[n];
     do {
@@ -206,6 +246,7 @@ local void slide_hash(deflate_state *s) {
          */
     } while (--n);
 #endif
+#endif
 }
 
 /* ===========================================================================
@@ -1456,6 +1497,34 @@ local uInt longest_match(deflate_state *s, IPos cur_match) {
         scan += 2, match++;
         Assert(*scan == *match, "match[2]?");
 
+#ifdef LONGEST_MATCH_WIDE
+        /* Compare eight bytes at a time from strstart + 3; the first
+         * differing byte is found from the lowest set bit of the XOR. The
+         * 32nd word ends at strstart + 258, like the byte loop below, so the
+         * resulting length is the same.
+         */
+        scan++, match++;
+        do {
+            unsigned long long sw, mw;
+            zmemcpy(&sw, scan, sizeof(sw));
+            zmemcpy(&mw, match, sizeof(mw));
+            if (sw != mw) {
+                sw ^= mw;
+#ifdef _MSC_VER
+                {
+                    unsigned long bit;
+                    _BitScanForward64(&bit, sw);
+                    scan += bit >> 3;
+                }
+#else
+                scan += __builtin_ctzll(sw) >> 3;
+#endif
+                break;
+            }
+            scan += 8, match += 8;
+        } while (scan < strend);
+        if (scan > strend) scan = strend;
+#else
         /* We check for insufficient lookahead only every 8th comparison;
          * the 256th check will be made at strstart + 258.
          */
@@ -1465,6 +1534,7 @@ local uInt longest_match(deflate_state *s, IPos cur_match) {
                  *++scan == *++match && *++scan == *++match &&
                  *++scan == *++match && *++scan == *++match &&
                  scan < strend);
+#endif
 
         Assert(scan <= s->window + (unsigned)(s->window_size - 1),
                "wild scan");
@@ -12,6 +12,37 @@
 #  pragma message("Assembler code may have bugs -- use at your own risk")
 #else
 
+/*
+   Copy len bytes from from to out, first to last as the byte loops would, and
+   return the new out. Eight bytes are moved at a time when from is at least
+   eight bytes behind out, or anywhere ahead of it, since then no chunk reads a
+   byte the copy has yet to write. A distance of one is a run and becomes a
+   fill. Nothing is written past out + len.
+ */
+local unsigned char FAR *chunkcopy(unsigned char FAR *out,
+                                   z_const unsigned char FAR *from,
+                                   unsigned len) {
+    z_size_t dist = (z_size_t)out - (z_size_t)from;
+
+    if (dist == 1) {
+        unsigned char run = *from;
+        while (len--)
+            *out++ = run;
+        return out;
+    }
+    if (dist >= 8) {
+        while (len >= 8) {
+            zmemcpy(out, from, 8);
+            out += 8;
+            from += 8;
+            len -= 8;
+        }
+    }
+    while (len--)
+        *out++ = *from++;
+    return out;
+}
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -198,9 +229,7 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
                         from += wsize - op;
                         if (op < len) {         /* some from window */
                             len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
+                            out = chunkcopy(out, from, op);
                             from = out - dist;  /* rest from output */
                         }
                     }
@@ -209,16 +238,12 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
                         op -= wnext;
                         if (op < len) {         /* some from end of window */
                             len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
+                            out = chunkcopy(out, from, op);
                             from = window;
                             if (wnext < len) {  /* some from start of window */
                                 op = wnext;
                                 len -= op;
-                                do {
-                                    *out++ = *from++;
-                                } while (--op);
+                                out = chunkcopy(out, from, op);
                                 from = out - dist;      /* rest from output */
                             }
                         }
@@ -227,37 +252,15 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
                         from += wnext - op;
                         if (op < len) {         /* some from window */
                             len -= op;
-                            do {
-                                *out++ = *from++;
-                            } while (--op);
+                            out = chunkcopy(out, from, op);
                             from = out - dist;  /* rest from output */
                         }
                     }
-                    while (len > 2) {
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        len -= 3;
-                    }
-                    if (len) {
-                        *out++ = *from++;
-                        if (len > 1)
-                            *out++ = *from++;
-                    }
+                    out = chunkcopy(out, from, len);
                 }
                 else {
                     from = out - dist;          /* copy direct from output */
-                    do {                        /* minimum length is three */
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        *out++ = *from++;
-                        len -= 3;
-                    } while (len > 2);
-                    if (len) {
-                        *out++ = *from++;
-                        if (len > 1)
-                            *out++ = *from++;
-                    }
+                    out = chunkcopy(out, from, len);
                 }
             }
             else if ((op & 64) == 0) {          /* 2nd level distance code */
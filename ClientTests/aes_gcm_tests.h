@@ -0,0 +1,12 @@
+#pragma once
+
+// Test vectors of the GCM specification (AES-256, 96-bit nonce) with every backend the CPU has,
+// encrypted and decrypted in one call and in pieces of every size
+int RunGcmVectors();
+
+// MB/s of GCM encryption with the AES-NI backend and the portable code, one message and 16 KB pieces
+int RunGcmBenchmark(int megabytes);
+
+// Random keys, nonces, AAD and messages in random pieces through the portable code and the AES-NI
+// backend, ciphertexts and tags have to be identical and decrypt back with either
+int RunGcmEquality(int iterations);
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include "base64.h"
+#include "base64_simd.h"
+#include "base64_tests.h"
+#include "legacy/base64_legacy.h"
+
+namespace
+{
+	const size_t kSizes[] = { 16, 64, 256, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024 };
+	const size_t kBytesPerSize = 64 * 1024 * 1024;	// Each size runs until this much input is done
+
+	// Megabytes per second of input, the best of three runs over kBytesPerSize
+	template <typename Function>
+	double Measure(size_t input_size, Function function)
+	{
+		size_t rounds = (std::max)(kBytesPerSize / input_size, (size_t)1);
+		double best = 0;
+		size_t sink = 0;
+		for (int run = 0; run < 3; run++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (size_t round = 0; round < rounds; round++)
+			{
+				sink += function().size();
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			best = (std::max)(best, rounds * input_size / 1e6 / elapsed.count());
+		}
+		return sink ? best : 0;
+	}
+}
+
+int RunBase64Benchmark()
+{
+	static const char* levels[] = { "none", "SSSE3", "AVX2" };
+	std::mt19937 random(38);
+	std::string data(kSizes[sizeof(kSizes) / sizeof(kSizes[0]) - 1], '\0');
+	for (char& value : data)
+	{
+		value = (char)random();
+	}
+
+	printf("[Base64 bench] SIMD kernels: %s\n", levels[Crypto::Base64_SimdLevel()]);
+	printf("   size  encode MB/s  old MB/s   decode MB/s  old MB/s   url encode MB/s\n");
+	for (size_t size : kSizes)
+	{
+		const unsigned char* bytes = (const unsigned char*)data.data();
+		std::string encoded = Crypto::base64_encode(bytes, size);
+		std::string url_encoded = Crypto::base64_encode(bytes, size, true);
+		if (encoded != Legacy::base64_encode(bytes, size) || url_encoded != Legacy::base64_encode(bytes, size, true)
+			|| Crypto::base64_decode(encoded) != data.substr(0, size) || Crypto::base64_decode(url_encoded) != data.substr(0, size))
+		{
+			printf("FAIL %zu bytes: the results differ from the old base64\n", size);
+			return 1;
+		}
+		printf("%7zu %12.1f %9.1f %13.1f %9.1f %17.1f\n", size,
+			Measure(size, [&]() { return Crypto::base64_encode(bytes, size); }),
+			Measure(size, [&]() { return Legacy::base64_encode(bytes, size); }),
+			Measure(size, [&]() { return Crypto::base64_decode(encoded); }),
+			Measure(size, [&]() { return Legacy::base64_decode(encoded); }),
+			Measure(size, [&]() { return Crypto::base64_encode(bytes, size, true); }));
+	}
+	return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// MB/s of base64_encode and base64_decode against the character-at-a-time version they replaced,
+// from 16 bytes to 4 MB, after checking that both give the same results
+int RunBase64Benchmark();
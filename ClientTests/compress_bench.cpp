@@ -0,0 +1,76 @@
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "data_transform.h"
+#include "data_transform_tests.h"
+
+using NetworkOperations::DataCompress;
+
+namespace
+{
+	// Megabytes per second of input, the best of three runs
+	double Measure(DataCompress& compress, const std::vector<BYTE>& input, size_t& length)
+	{
+		double best = 0;
+		for (int run = 0; run < 3; run++)
+		{
+			BYTE* output = NULL;
+			DWORD length_out = 0;
+			auto start = std::chrono::steady_clock::now();
+			BOOL success = compress.TransformData(input.data(), (DWORD)input.size(), output, length_out);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			delete[] output;
+			if (!success)
+			{
+				return 0;
+			}
+			length = length_out;
+			best = (std::max)(best, input.size() / 1e6 / elapsed.count());
+		}
+		return best;
+	}
+}
+
+int RunCompressBenchmark(int megabytes)
+{
+	std::mt19937 random(31);
+	// Words from a small vocabulary, repetitive like source code or logs
+	static const char* words[] = { "file ", "folder ", "upload ", "size=", "0x1f ", "error ", "\r\n", "sync " };
+	size_t size = (size_t)megabytes * 1024 * 1024;
+	std::vector<BYTE> text, noise(size);
+	text.reserve(size + 8);
+	while (text.size() < size)
+	{
+		const char* word = words[random() % 8];
+		text.insert(text.end(), word, word + strlen(word));
+	}
+	text.resize(size);
+	for (BYTE& value : noise)
+	{
+		value = (BYTE)random();
+	}
+
+	unsigned threads = std::thread::hardware_concurrency();
+	printf("[Compress bench] %d MB per run, 1 and %u threads\n", megabytes, threads);
+	printf("level   text 1T MB/s  ratio   text %uT MB/s   random 1T MB/s\n", threads);
+	for (int level = 0; level <= 9; level++)
+	{
+		size_t text_length = 0, parallel_length = 0, noise_length = 0;
+		DataCompress single(level);
+		DataCompress parallel(level);
+		parallel.SetThreadCount(threads);
+		double text_speed = Measure(single, text, text_length);
+		double parallel_speed = Measure(parallel, text, parallel_length);
+		double noise_speed = Measure(single, noise, noise_length);
+		if (text_speed == 0 || parallel_speed == 0 || noise_speed == 0)
+		{
+			printf("level %d failed\n", level);
+			return 1;
+		}
+		printf("%5d %14.1f %6.2f %15.1f %16.1f\n", level, text_speed, (double)text.size() / text_length, parallel_speed, noise_speed);
+	}
+	return 0;
+}
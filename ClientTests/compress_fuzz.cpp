@@ -0,0 +1,136 @@
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "data_transform.h"
+#include "data_transform_tests.h"
+
+using NetworkOperations::DataCompress;
+
+namespace
+{
+	const int kWindowBits[] = { 9, 12, 15, -9, -15, 16 + 9, 16 + 15 };
+	const size_t kMaxInput = 3 * 1024 * 1024;	// Three times PARALLEL_MIN_SIZE, so the parallel path splits it
+
+	int failures = 0;
+
+#define FUZZ_CHECK(condition) \
+	do { if (!(condition) && failures++ < 10) printf("FAIL line %d: %s\n", __LINE__, #condition); } while (0)
+
+	// Text with repeats, random bytes, runs of one byte, or pieces of all three
+	std::vector<BYTE> MakeInput(std::mt19937& random)
+	{
+		size_t size;
+		switch (random() % 4)
+		{
+		case 0: size = random() % 64; break;
+		case 1: size = random() % (64 * 1024); break;
+		case 2: size = PARALLEL_BLOCK_SIZE - 2 + random() % 5; break;
+		default: size = random() % kMaxInput; break;
+		}
+		std::vector<BYTE> input(size);
+		int kind = random() % 4;
+		for (size_t i = 0; i < size; )
+		{
+			int piece_kind = kind == 3 ? random() % 3 : kind;
+			size_t piece = (std::min)(size - i, (size_t)(1 + random() % 20000));
+			for (size_t end = i + piece; i < end; i++)
+			{
+				input[i] = piece_kind == 0 ? "the quick brown fox, "[random() % 21]
+					: piece_kind == 1 ? (BYTE)random()
+					: (BYTE)(end & 0xFF);
+			}
+		}
+		return input;
+	}
+
+	bool Inflates(int window_bits, const BYTE* data, size_t length, const std::vector<BYTE>& expected)
+	{
+		DataCompress inflater(COMPRESS_LEVEL, window_bits);
+		BYTE* output = NULL;
+		DWORD length_out = 0;
+		if (!inflater.ReverseTransformData(data, (DWORD)length, output, length_out))
+		{
+			return false;
+		}
+		bool equal = length_out == expected.size() && (length_out == 0 || memcmp(output, expected.data(), length_out) == 0);
+		delete[] output;
+		return equal;
+	}
+
+	// One chunk through Process, input and output in random pieces
+	bool Stream(DataCompress& compress, const std::vector<BYTE>& input, std::vector<BYTE>& output, std::mt19937& random)
+	{
+		if (!compress.BeginChunk(0, TRUE))
+		{
+			return false;
+		}
+		output.clear();
+		std::vector<BYTE> piece_out(1 + random() % 100000);
+		size_t offset = 0;
+		BOOL done = FALSE;
+		while (!done)
+		{
+			size_t piece = (std::min)(input.size() - offset, (size_t)(random() % 300000));
+			BOOL final = offset + piece == input.size();
+			size_t room = 1 + random() % piece_out.size();
+			size_t consumed = 0, produced = 0;
+			if (!compress.Process(input.data() + offset, piece, consumed, piece_out.data(), room, produced, final, done))
+			{
+				return false;
+			}
+			if (consumed == 0 && produced == 0 && !done && piece > 0)
+			{
+				return false;
+			}
+			offset += consumed;
+			output.insert(output.end(), piece_out.data(), piece_out.data() + produced);
+		}
+		return offset == input.size();
+	}
+}
+
+int RunCompressFuzz(int iterations)
+{
+	std::mt19937 random(29);
+	size_t total = 0;
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		std::vector<BYTE> input = MakeInput(random);
+		int level = (int)(random() % 11) - 1;
+		int window_bits = kWindowBits[random() % (sizeof(kWindowBits) / sizeof(kWindowBits[0]))];
+		DataCompress compress(level, window_bits);
+		compress.SetThreadCount(1 + random() % 4);
+		total += input.size();
+
+		BYTE* output = NULL;
+		DWORD length_out = 0;
+		FUZZ_CHECK(compress.TransformData(input.data(), (DWORD)input.size(), output, length_out));
+		FUZZ_CHECK(length_out <= compress.Bound(input.size()));
+		FUZZ_CHECK(Inflates(window_bits, output, length_out, input));
+		delete[] output;
+
+		std::vector<BYTE> streamed;
+		FUZZ_CHECK(Stream(compress, input, streamed, random));
+		FUZZ_CHECK(streamed.size() <= compress.Bound(input.size()));
+		FUZZ_CHECK(Inflates(window_bits, streamed.data(), streamed.size(), input));
+
+		// In one call into exactly Bound() bytes
+		std::vector<BYTE> bounded(compress.Bound(input.size()));
+		size_t consumed = 0, produced = 0;
+		BOOL done = FALSE;
+		FUZZ_CHECK(compress.BeginChunk(1, TRUE));
+		FUZZ_CHECK(compress.Process(input.data(), input.size(), consumed, bounded.data(), bounded.size(), produced, TRUE, done));
+		FUZZ_CHECK(done && consumed == input.size());
+		FUZZ_CHECK(Inflates(window_bits, bounded.data(), produced, input));
+
+		// A damaged stream is rejected instead of read as something else
+		if (produced > 8)
+		{
+			bounded.resize(produced / 2);
+			FUZZ_CHECK(!Inflates(window_bits, bounded.data(), bounded.size(), input));
+		}
+	}
+	printf("[Compress fuzz] %d round trips of %.1f MB in total, %d failures\n", iterations, total / 1e6, failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Random inputs, levels, window bits and thread counts deflated whole and streamed in random pieces,
+// every result has to fit in Bound() and inflate back to the input
+int RunCompressFuzz(int iterations);
+
+// MB/s of every level on text-like and random data, whole buffers on one thread and in parallel blocks
+int RunCompressBenchmark(int megabytes);
+
+// MB/s of compress, encrypt and hash of upload parts, in separate passes and through ChunkPipeline, with the
+// bytes each moves through part-sized buffers. Fails unless both give the same output and digest
+int RunPipelineBenchmark(int megabytes);
+
+// Uploads written part by part in the stored layout, plain and encrypted, restored the way a download is.
+// A cut, changed or wrongly keyed file has to be rejected
+int RunStoredFileRoundTrip(int iterations);
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "http_client.h"
+#include "http_client_tests.h"
+#include "sha256.h"
+#include "utils.h"
+
+using NetworkOperations::HttpClient;
+using NetworkOperations::HttpHeaders;
+using NetworkOperations::HttpResponse;
+
+namespace
+{
+	const DWORD kConnections[] = { 1, 2, 4, 8 };
+
+	// Hex SHA-256 and size of a downloaded file, empty when it cannot be read
+	std::string HashFile(const std::wstring& path, ULONGLONG& size)
+	{
+		HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			return "";
+		}
+		Crypto::SHA256_CTX ctx;
+		Crypto::SHA256_Init(&ctx);
+		std::vector<BYTE> buffer(MB);
+		DWORD bytesRead = 0;
+		size = 0;
+		while (ReadFile(hFile, buffer.data(), (DWORD)buffer.size(), &bytesRead, NULL) && bytesRead > 0)
+		{
+			Crypto::SHA256_Update(&ctx, buffer.data(), bytesRead);
+			size += bytesRead;
+		}
+		CloseHandle(hFile);
+		BYTE digest[SHA256_DIGEST_LENGTH];
+		Crypto::SHA256_Final(&ctx, digest);
+		return Helper::StringHelper::convertBytesHexString(digest, SHA256_DIGEST_LENGTH);
+	}
+}
+
+int RunDownloadBenchmark(const char* host, int port, const char* path, const char* token)
+{
+	HttpClient client;
+	client.OptionKeepConnect(TRUE);
+	if (!client.Connect(Helper::StringHelper::convertStringToWideString(host), (WORD)port, FALSE))
+	{
+		printf("Cannot connect to %s:%d\n", host, port);
+		return 1;
+	}
+	HttpHeaders headers;
+	if (token[0] != '\0')
+	{
+		headers.SetHeader("Authorization", std::string("Bearer ") + token);
+	}
+	std::wstring remote = Helper::StringHelper::convertStringToWideString(path);
+	std::wstring local = L"download_bench.tmp";
+
+	printf("[Download bench] %s:%d/%s\n", host, port, path);
+	printf("connections     MB/s\n");
+	std::string digest;
+	ULONGLONG size = 0;
+	int failed = 0;
+	for (DWORD connections : kConnections)
+	{
+		auto start = std::chrono::steady_clock::now();
+		HttpResponse response = client.DownloadFileRanged(remote, local, headers, digest, connections);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (response.GetStatusCode() != 200)
+		{
+			printf("%11lu   failed, status %lu\n", connections, response.GetStatusCode());
+			failed = 1;
+			continue;
+		}
+		// The first download gives the digest the later ones are checked against
+		if (digest.empty())
+		{
+			digest = HashFile(local, size);
+		}
+		printf("%11lu %8.1f\n", connections, size / 1e6 / elapsed.count());
+	}
+	DeleteFileW(local.c_str());
+	if (size < RANGE_MIN_SIZE)
+	{
+		printf("Files under %d MB are fetched with one request whatever the connections\n", RANGE_MIN_SIZE / MB);
+	}
+	return failed;
+}
@@ -0,0 +1,93 @@
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include "file_cache.h"
+#include "file_cache_tests.h"
+
+using UserOperations::FileCache;
+
+namespace
+{
+	const int kStoredFiles = 100000;			// In the snapshot
+	const int kAddedFiles = 10000;				// Changes on top of it
+	const wchar_t kStorePath[] = L"file_cache_bench.bin";
+
+	std::wstring BenchPath(int key)
+	{
+		return L"C:\\sync\\dir" + std::to_wstring(key % 97) + L"\\file " + std::to_wstring(key) + L".txt";
+	}
+
+	// Nanoseconds per operation over all threads, each thread inserts paths of its own
+	double RunThreads(FileCache& cache, int threads, int write_percent, int operations)
+	{
+		std::vector<std::thread> workers;
+		std::atomic<long long> sink(0);
+		auto start = std::chrono::steady_clock::now();
+		for (int t = 0; t < threads; t++)
+		{
+			workers.emplace_back([&, t]()
+			{
+				std::mt19937 random(t + 7);
+				long long sum = 0;
+				for (int i = 0; i < operations / threads; i++)
+				{
+					int key = random() % (kStoredFiles + 2 * kAddedFiles);
+					if ((int)(random() % 100) < write_percent)
+					{
+						int own = 1000000 * (t + 1) + i;
+						cache.insertFile(BenchPath(own), own);
+					}
+					else if (cache.isFileExist(BenchPath(key)))
+					{
+						sum += cache.getFileID(BenchPath(key));
+					}
+				}
+				sink += sum;
+			});
+		}
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / operations;
+	}
+}
+
+int RunFileCacheBenchmark(int operations)
+{
+	unsigned cores = std::thread::hardware_concurrency();
+	printf("[FileCache bench] %d files, %d operations per run, %u cores\n", kStoredFiles + kAddedFiles, operations, cores);
+	for (int write_percent : { 0, 10 })
+	{
+		double single = 0;
+		for (int threads : { 1, 2, 4, 8, 16 })
+		{
+			// Rebuilt for every run, a snapshot with changes on top, so the inserts of one run do not slow the next
+			FileCache cache(kStorePath);
+			cache.deleteFileCache();
+			for (int key = 0; key < kStoredFiles; key++)
+			{
+				cache.insertFile(BenchPath(key), key + 1);
+			}
+			cache.saveFileCache();
+			cache.loadFileCache();
+			for (int key = kStoredFiles; key < kStoredFiles + kAddedFiles; key++)
+			{
+				cache.insertFile(BenchPath(key), key + 1);
+			}
+			double ns = RunThreads(cache, threads, write_percent, operations);
+			if (threads == 1)
+			{
+				single = ns;
+			}
+			printf("%2d%% writes, %2d threads: %7.0f ns/op, %5.2fx the single thread throughput\n",
+				write_percent, threads, ns, single / ns);
+			cache.deleteFileCache();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,180 @@
+#include <map>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdexcept>
+#include "file_cache.h"
+#include "file_cache_tests.h"
+
+using UserOperations::FileCache;
+
+namespace
+{
+	const int kKeys = 1500;						// Paths a writer changes, as many again are rename targets
+	const wchar_t kStorePath[] = L"file_cache_stress.bin";
+
+	std::atomic<int> failures(0);
+
+#define STRESS_CHECK(condition) \
+	do { if (!(condition) && failures++ < 10) printf("FAIL line %d: %s\n", __LINE__, #condition); } while (0)
+
+	std::wstring WriterPath(int writer, int key)
+	{
+		return L"C:\\sync\\w" + std::to_wstring(writer) + L"\\file " + std::to_wstring(key) + L".txt";
+	}
+
+	// 40% inserts, 15% removes, 7% renames, 1% saves, the rest lookups checked against the model
+	void RunWriter(FileCache& cache, int writer, int operations, std::map<std::wstring, DWORD>& model)
+	{
+		std::mt19937 random(writer + 1);
+		DWORD next_id = 1;
+		for (int step = 0; step < operations; step++)
+		{
+			int operation = random() % 100;
+			std::wstring path = WriterPath(writer, random() % kKeys);
+			if (operation < 40)
+			{
+				// The writer is in the top byte, so ids never collide between writers
+				DWORD id = ((DWORD)writer << 24) | next_id++;
+				model[path] = id;
+				cache.insertFile(path, id);
+			}
+			else if (operation < 55)
+			{
+				model.erase(path);
+				cache.removeFile(path);
+			}
+			else if (operation < 62)
+			{
+				auto it = model.find(path);
+				std::wstring new_path = WriterPath(writer, kKeys + random() % kKeys);
+				if (it != model.end() && !model.count(new_path))
+				{
+					DWORD id = it->second;
+					model.erase(it);
+					cache.removeFile(path);
+					cache.insertFile(new_path, id);
+					model[new_path] = id;
+				}
+			}
+			else if (operation < 63)
+			{
+				cache.saveFileCache();
+			}
+			else
+			{
+				auto it = model.find(path);
+				if (it == model.end())
+				{
+					STRESS_CHECK(!cache.isFileExist(path));
+					continue;
+				}
+				try
+				{
+					STRESS_CHECK(cache.getFileID(path) == it->second);
+				}
+				catch (const std::exception&)
+				{
+					STRESS_CHECK(!"inserted path is missing");
+				}
+			}
+		}
+	}
+
+	// Reads by index and by id while the writers run, and now and then reloads the store
+	void RunObserver(FileCache& cache, int writers, const std::atomic<bool>& done, long& rounds, long& reloads)
+	{
+		std::mt19937 random(99);
+		while (!done)
+		{
+			size_t count = cache.getCount();
+			STRESS_CHECK(count <= (size_t)writers * kKeys * 2);
+			if (count)
+			{
+				try
+				{
+					STRESS_CHECK(!cache.getFilePath((int)(random() % count)).empty());
+				}
+				catch (const std::out_of_range&)
+				{
+					// Removed since getCount
+				}
+			}
+			try
+			{
+				DWORD id = ((DWORD)(random() % writers) << 24) | (1 + random() % 1000);
+				STRESS_CHECK(cache.getFilePath(id).find(L"\\w" + std::to_wstring(id >> 24) + L"\\") != std::wstring::npos);
+			}
+			catch (const std::runtime_error&)
+			{
+				// No such id at the moment
+			}
+			if (random() % 500 == 0)
+			{
+				cache.loadFileCache();
+				reloads++;
+			}
+			rounds++;
+		}
+	}
+}
+
+int RunFileCacheStress(int writers, int operations)
+{
+	std::vector<std::map<std::wstring, DWORD>> models(writers);
+	std::map<std::wstring, DWORD> expected;
+	long rounds = 0, reloads = 0;
+	{
+		FileCache cache(kStorePath);
+		cache.deleteFileCache();
+		cache.loadFileCache();
+
+		std::atomic<bool> done(false);
+		std::vector<std::thread> threads;
+		for (int writer = 0; writer < writers; writer++)
+		{
+			threads.emplace_back(RunWriter, std::ref(cache), writer, operations, std::ref(models[writer]));
+		}
+		std::thread observer(RunObserver, std::ref(cache), writers, std::cref(done), std::ref(rounds), std::ref(reloads));
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		done = true;
+		observer.join();
+
+		// Every view of the cache matches the union of the models
+		for (const auto& model : models)
+		{
+			expected.insert(model.begin(), model.end());
+		}
+		STRESS_CHECK(cache.getCount() == expected.size());
+		std::map<std::wstring, DWORD> listed;
+		for (int i = 0; i < (int)cache.getCount(); i++)
+		{
+			listed[cache.getFilePath(i)] = cache.getFileID(i);
+		}
+		STRESS_CHECK(listed == expected);
+		for (const auto& file : expected)
+		{
+			STRESS_CHECK(cache.getFileID(file.first) == file.second);
+			STRESS_CHECK(cache.getFilePath(file.second) == file.first);
+		}
+		cache.saveFileCache();
+	}
+	{
+		FileCache reloaded(kStorePath);
+		reloaded.loadFileCache();
+		STRESS_CHECK(reloaded.getCount() == expected.size());
+		for (const auto& file : expected)
+		{
+			STRESS_CHECK(reloaded.isFileExist(file.first) && reloaded.getFileID(file.first) == file.second);
+		}
+		reloaded.deleteFileCache();
+	}
+	printf("[FileCache stress] %d writers x %d operations: %zu files, %ld observer rounds, %ld reloads, %d failures\n",
+		writers, operations, expected.size(), rounds, reloads, failures.load());
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Every writer thread changes its own paths while an observer reads and reloads the cache; the result
+// is checked against a model of each writer, before and after a save and a load
+int RunFileCacheStress(int writers, int operations);
+
+// Lookups and inserts per thread count on a cache of 110000 files, with 0% and 10% writes
+int RunFileCacheBenchmark(int operations);
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "aes_gcm.h"
+#include "aes_gcm_ni.h"
+#include "aes_gcm_tests.h"
+
+namespace
+{
+	int failures = 0;
+
+#define EQUALITY_CHECK(condition) \
+	do { if (!(condition) && failures++ < 10) printf("FAIL line %d: %s\n", __LINE__, #condition); } while (0)
+
+	struct Message
+	{
+		uint8_t key[AES_KEY_SIZE];
+		uint8_t nonce[GCM_NONCE_LEN];
+		std::vector<uint8_t> aad;
+		std::vector<uint8_t> text;
+	};
+
+	// Pieces of random size, so both backends see every alignment of the key stream and GHASH blocks
+	void Run(bool accelerated, bool encrypt, const Message& message, const std::vector<uint8_t>& input,
+		std::mt19937& random, std::vector<uint8_t>& output, uint8_t tag[TAG_SIZE])
+	{
+		Crypto::GCM_CTX ctx;
+		Crypto::GCM_Start(&ctx, message.key, message.nonce, message.aad.empty() ? NULL : message.aad.data(), message.aad.size());
+		ctx.accelerated = accelerated;
+		output.resize(input.size());
+		size_t offset = 0;
+		while (offset < input.size())
+		{
+			size_t length = (std::min)(input.size() - offset, (size_t)(random() % 3 == 0 ? random() % 17 : random() % 5000));
+			if (encrypt)
+			{
+				Crypto::GCM_EncryptUpdate(&ctx, input.data() + offset, length, output.data() + offset);
+			}
+			else
+			{
+				Crypto::GCM_DecryptUpdate(&ctx, input.data() + offset, length, output.data() + offset);
+			}
+			offset += length;
+		}
+		Crypto::GCM_Finish(&ctx, tag);
+	}
+}
+
+int RunGcmEquality(int iterations)
+{
+	if (!Crypto::AESNI_Supported())
+	{
+		printf("[GCM equality] skipped, the CPU has no AES-NI and PCLMULQDQ\n");
+		return 0;
+	}
+	std::mt19937 random(35);
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		Message message;
+		for (uint8_t& value : message.key) value = (uint8_t)random();
+		for (uint8_t& value : message.nonce) value = (uint8_t)random();
+		message.aad.resize(random() % 4 == 0 ? 0 : random() % 100);
+		message.text.resize(random() % 4 == 0 ? random() % 64 : random() % 100000);
+		for (uint8_t& value : message.aad) value = (uint8_t)random();
+		for (uint8_t& value : message.text) value = (uint8_t)random();
+
+		std::vector<uint8_t> portable, accelerated, decrypted;
+		uint8_t portable_tag[TAG_SIZE], accelerated_tag[TAG_SIZE], tag[TAG_SIZE];
+		Run(false, true, message, message.text, random, portable, portable_tag);
+		Run(true, true, message, message.text, random, accelerated, accelerated_tag);
+		EQUALITY_CHECK(portable == accelerated);
+		EQUALITY_CHECK(memcmp(portable_tag, accelerated_tag, TAG_SIZE) == 0);
+
+		Run(true, false, message, portable, random, decrypted, tag);
+		EQUALITY_CHECK(decrypted == message.text && memcmp(tag, portable_tag, TAG_SIZE) == 0);
+		Run(false, false, message, accelerated, random, decrypted, tag);
+		EQUALITY_CHECK(decrypted == message.text && memcmp(tag, accelerated_tag, TAG_SIZE) == 0);
+	}
+	printf("[GCM equality] %d messages, portable and AES-NI, %d failures\n", iterations, failures);
+	return failures == 0 ? 0 : 1;
+}
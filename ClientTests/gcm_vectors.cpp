@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "aes_gcm.h"
+#include "aes_gcm_ni.h"
+#include "aes_gcm_tests.h"
+
+namespace
+{
+	struct GcmVector
+	{
+		const char* name;
+		const char* key;
+		const char* nonce;
+		const char* aad;
+		const char* plaintext;
+		const char* ciphertext;
+		const char* tag;
+	};
+
+	// Test cases 13 to 16 of "The Galois/Counter Mode of Operation", the AES-256 ones with a 96-bit nonce,
+	// and the first empty message of the NIST CAVP gcmEncryptExtIV256 file
+	const GcmVector kVectors[] =
+	{
+		{ "case 13",
+			"0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+			"", "", "530f8afbc74536b9a963b4f1c4cb738b" },
+		{ "case 14",
+			"0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+			"00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18", "d0d1c8a799996bf0265b98b5d48ab919" },
+		{ "case 15",
+			"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+			"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+			"1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+			"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+			"8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad",
+			"b094dac5d93471bdec1a502270e3cc6c" },
+		{ "case 16",
+			"feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+			"feedfacedeadbeeffeedfacedeadbeefabaddad2",
+			"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+			"1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+			"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+			"8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+			"76fc6ece0f4e1768cddf8853bb2d551b" },
+		{ "CAVP 256/96/0/0 count 0",
+			"b52c505a37d78eda5dd34f20c22540ea1b58963cf8e5bf8ffa85f9f2492505b4", "516c33929df5a3284ff463d7", "",
+			"", "", "bdc1ac884d332457a1d2664f168c76f0" },
+	};
+
+	int failures = 0;
+
+	std::vector<uint8_t> FromHex(const char* hex)
+	{
+		std::vector<uint8_t> bytes;
+		for (; hex[0] && hex[1]; hex += 2)
+		{
+			bytes.push_back((uint8_t)std::stoi(std::string(hex, 2), NULL, 16));
+		}
+		return bytes;
+	}
+
+	// One message through GCM_Start/Update/Finish in pieces of the given size, on the portable code
+	// unless accelerated is set
+	void Run(bool accelerated, bool encrypt, const GcmVector& vector, const std::vector<uint8_t>& input,
+		size_t piece, std::vector<uint8_t>& output, uint8_t tag[TAG_SIZE])
+	{
+		std::vector<uint8_t> key = FromHex(vector.key), nonce = FromHex(vector.nonce), aad = FromHex(vector.aad);
+		Crypto::GCM_CTX ctx;
+		Crypto::GCM_Start(&ctx, key.data(), nonce.data(), aad.empty() ? NULL : aad.data(), aad.size());
+		ctx.accelerated = accelerated;
+		output.resize(input.size());
+		for (size_t offset = 0; offset < input.size(); offset += piece)
+		{
+			size_t length = (std::min)(piece, input.size() - offset);
+			if (encrypt)
+			{
+				Crypto::GCM_EncryptUpdate(&ctx, input.data() + offset, length, output.data() + offset);
+			}
+			else
+			{
+				Crypto::GCM_DecryptUpdate(&ctx, input.data() + offset, length, output.data() + offset);
+			}
+		}
+		Crypto::GCM_Finish(&ctx, tag);
+	}
+}
+
+int RunGcmVectors()
+{
+	int backends = Crypto::AESNI_Supported() ? 2 : 1;
+	for (const GcmVector& vector : kVectors)
+	{
+		std::vector<uint8_t> plaintext = FromHex(vector.plaintext), ciphertext = FromHex(vector.ciphertext);
+		std::vector<uint8_t> expected_tag = FromHex(vector.tag);
+		for (int backend = 0; backend < backends; backend++)
+		{
+			for (size_t piece = 1; piece <= (std::max)(plaintext.size(), (size_t)1); piece++)
+			{
+				std::vector<uint8_t> output;
+				uint8_t tag[TAG_SIZE];
+				Run(backend == 1, true, vector, plaintext, piece, output, tag);
+				bool encrypted = output == ciphertext && memcmp(tag, expected_tag.data(), TAG_SIZE) == 0;
+				Run(backend == 1, false, vector, ciphertext, piece, output, tag);
+				bool decrypted = output == plaintext && memcmp(tag, expected_tag.data(), TAG_SIZE) == 0;
+				if ((!encrypted || !decrypted) && failures++ < 10)
+				{
+					printf("FAIL %s, %s backend, pieces of %zu: %s\n", vector.name, backend ? "AES-NI" : "portable",
+						piece, encrypted ? "decryption" : "encryption");
+				}
+			}
+		}
+	}
+	printf("[GCM vectors] %zu vectors, %s, %d failures\n", sizeof(kVectors) / sizeof(kVectors[0]),
+		backends == 2 ? "portable and AES-NI" : "portable only, the CPU has no AES-NI", failures);
+	return failures == 0 ? 0 : 1;
+}
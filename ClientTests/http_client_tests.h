@@ -0,0 +1,11 @@
+#pragma once
+
+// MB/s of DownloadFileRanged with 1, 2, 4 and 8 connections against a running server, every download
+// checked against the digest of the first. path is the download route of a stored file and token the
+// bearer token of its logged-in owner
+int RunDownloadBenchmark(const char* host, int port, const char* path, const char* token);
+
+// Files per second of syncing many tiny files to a running server, first every file in its own upload of
+// init, part and complete requests, then the files in bundles of BUNDLE_MAX_FILES to a request. user is
+// the name and token the bearer token of a logged-in user
+int RunSyncBenchmark(const char* host, int port, const char* user, const char* token, int files);
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "json/json_document.h"
+#include "json_tests.h"
+#include "legacy/json_parser.h"
+
+namespace
+{
+	// The files a /files/compare request reports missing
+	std::string MissingFilesResponse(int entries)
+	{
+		std::string json = "[";
+		for (int i = 0; i < entries; i++)
+		{
+			json += i ? "," : "";
+			json += "{\"folder_path\":\"C:\\\\Users\\\\someone\\\\Documents\\\\project_" + std::to_string(i % 97)
+				+ "\\\\src\",\"file_name\":\"source_file_" + std::to_string(i) + ".cpp\"}";
+		}
+		return json + "]";
+	}
+
+	// The metadata of the files of a folder tree
+	std::string FileInfoResponse(int entries)
+	{
+		std::string json = "[";
+		for (int i = 0; i < entries; i++)
+		{
+			json += i ? "," : "";
+			json += "{\"file_id\":" + std::to_string(100000 + i) + ",\"file_name\":\"report " + std::to_string(i)
+				+ ".xlsx\",\"file_size\":" + std::to_string(i * 7919LL) + ",\"folder\":\"Shared/Finance/2024\",\"attribute\":32,"
+				"\"create_time\":\"2024-03-01 10:22:33\",\"last_write_time\":\"2024-03-02 11:00:00\","
+				"\"last_access_time\":\"2024-03-03 12:00:00\","
+				"\"sha256\":\"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\",\"ratio\":0.4375}";
+		}
+		return json + "]";
+	}
+
+	// Every entry has the same name and number in both trees, number_key may be NULL
+	bool SameValues(JsonValue* old_root, const JsonElement& root, const char* name_key, const char* number_key)
+	{
+		if (old_root == NULL || !old_root->IsArray() || !root.IsArray() || old_root->CountChildren() != root.CountChildren())
+		{
+			return false;
+		}
+		std::wstring old_name_key(name_key, name_key + strlen(name_key));
+		std::wstring old_number_key = number_key ? std::wstring(number_key, number_key + strlen(number_key)) : L"";
+		const JsonArray& entries = old_root->AsArray();
+		JsonElement entry = root.FirstChild();
+		for (size_t i = 0; i < entries.size(); i++, entry = entry.NextSibling())
+		{
+			if (entries[i]->Child(old_name_key.c_str())->AsString() != entry.Child(name_key).AsWString())
+			{
+				return false;
+			}
+			if (number_key && entries[i]->Child(old_number_key.c_str())->AsNumber() != entry.Child(number_key).AsNumber())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	double Milliseconds(std::chrono::steady_clock::time_point start, int rounds)
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / rounds;
+	}
+}
+
+int RunJsonBenchmark(int entries)
+{
+	struct Payload
+	{
+		const char* name;
+		std::string json;
+		const char* name_key;
+		const char* number_key;
+	} payloads[] =
+	{
+		{ "missing files", MissingFilesResponse(entries), "file_name", NULL },
+		{ "file metadata", FileInfoResponse(entries), "file_name", "file_size" },
+	};
+
+	printf("[JSON bench] %d entries per response\n", entries);
+	for (const Payload& payload : payloads)
+	{
+		JsonDocument document;
+		JsonValue* old_root = JsonParser::Parse(payload.json.c_str());
+		bool same = document.Parse(payload.json) && SameValues(old_root, document.Root(), payload.name_key, payload.number_key);
+		delete old_root;
+		if (!same)
+		{
+			printf("FAIL %s: the parsers read different values\n", payload.name);
+			return 1;
+		}
+
+		const int old_rounds = 5, new_rounds = 20;
+		size_t sink = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < old_rounds; round++)
+		{
+			JsonValue* value = JsonParser::Parse(payload.json.c_str());
+			sink += value->CountChildren();
+			delete value;
+		}
+		double old_ms = Milliseconds(start, old_rounds);
+		start = std::chrono::steady_clock::now();
+		for (int round = 0; round < new_rounds; round++)
+		{
+			document.Parse(payload.json);
+			sink += document.Root().CountChildren();
+		}
+		double new_ms = Milliseconds(start, new_rounds);
+		double megabytes = payload.json.size() / 1e6;
+		printf("%s, %.1f MB: JsonParser %.1f ms (%.0f MB/s), JsonDocument %.1f ms (%.0f MB/s), %.1fx\n", payload.name, megabytes,
+			old_ms, megabytes * 1000 / old_ms, new_ms, megabytes * 1000 / new_ms, old_ms / new_ms);
+		if (sink != (size_t)entries * (old_rounds + new_rounds))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Parse time of JsonDocument against the wchar_t JsonParser it replaced, on a /files/compare
+// response and a file metadata listing of the given number of entries, after checking both read
+// the same values
+int RunJsonBenchmark(int entries);
@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+
+// Reference implementations for the benchmarks, as the client had them before the rewrite
+namespace Legacy
+{
+	std::string base64_encode(unsigned char const* bytes_to_encode, size_t in_len, bool url = false);
+	std::string base64_decode(std::string const& s, bool remove_linebreaks = false);
+}
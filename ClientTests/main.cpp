@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_cache_tests.h"
+#include "data_transform_tests.h"
+#include "aes_gcm_tests.h"
+#include "base64_tests.h"
+#include "json_tests.h"
+#include "http_client_tests.h"
+
+// ClientTests                                   Every check below with its default size
+// ClientTests stress [writers] [operations]     FileCache writers against an observer
+// ClientTests bench [operations]                Throughput of the FileCache by thread count
+// ClientTests compress [iterations]             Deflate round trips of random inputs and settings
+// ClientTests compress-bench [megabytes]        Deflate MB/s per level
+// ClientTests pipeline-bench [megabytes]        Upload parts through ChunkPipeline against separate passes
+// ClientTests stored [iterations]               Uploads in the stored layout restored, plain and encrypted
+// ClientTests gcm                               AES-GCM test vectors on every backend
+// ClientTests gcm-equality [iterations]         AES-NI and portable AES-GCM give the same results
+// ClientTests gcm-bench [megabytes]             AES-GCM MB/s of the AES-NI and the portable backend
+// ClientTests base64-bench                      base64 MB/s by size, new and old
+// ClientTests json-bench [entries]              JsonDocument against the old JsonParser
+// ClientTests download-bench host port path [token]  Ranged download MB/s from a running server
+// ClientTests sync-bench host port user token [files]  Tiny file uploads per second to a running server
+// Exit code 0 when every check passed
+int main(int argc, char* argv[])
+{
+	const char* mode = argc > 1 ? argv[1] : "";
+	if (strcmp(mode, "") == 0)
+	{
+		int failed = RunFileCacheStress(8, 40000);
+		failed |= RunCompressFuzz(200);
+		failed |= RunStoredFileRoundTrip(100);
+		failed |= RunGcmVectors();
+		failed |= RunGcmEquality(2000);
+		return failed;
+	}
+	if (strcmp(mode, "stress") == 0)
+	{
+		int writers = argc > 2 ? atoi(argv[2]) : 8;
+		int operations = argc > 3 ? atoi(argv[3]) : 40000;
+		return RunFileCacheStress(writers, operations);
+	}
+	if (strcmp(mode, "bench") == 0)
+	{
+		return RunFileCacheBenchmark(argc > 2 ? atoi(argv[2]) : 400000);
+	}
+	if (strcmp(mode, "compress") == 0)
+	{
+		return RunCompressFuzz(argc > 2 ? atoi(argv[2]) : 200);
+	}
+	if (strcmp(mode, "compress-bench") == 0)
+	{
+		return RunCompressBenchmark(argc > 2 ? atoi(argv[2]) : 16);
+	}
+	if (strcmp(mode, "pipeline-bench") == 0)
+	{
+		return RunPipelineBenchmark(argc > 2 ? atoi(argv[2]) : 64);
+	}
+	if (strcmp(mode, "stored") == 0)
+	{
+		return RunStoredFileRoundTrip(argc > 2 ? atoi(argv[2]) : 100);
+	}
+	if (strcmp(mode, "gcm") == 0)
+	{
+		return RunGcmVectors();
+	}
+	if (strcmp(mode, "gcm-equality") == 0)
+	{
+		return RunGcmEquality(argc > 2 ? atoi(argv[2]) : 2000);
+	}
+	if (strcmp(mode, "gcm-bench") == 0)
+	{
+		return RunGcmBenchmark(argc > 2 ? atoi(argv[2]) : 64);
+	}
+	if (strcmp(mode, "base64-bench") == 0)
+	{
+		return RunBase64Benchmark();
+	}
+	if (strcmp(mode, "json-bench") == 0)
+	{
+		return RunJsonBenchmark(argc > 2 ? atoi(argv[2]) : 40000);
+	}
+	if (strcmp(mode, "download-bench") == 0 && argc > 4)
+	{
+		return RunDownloadBenchmark(argv[2], atoi(argv[3]), argv[4], argc > 5 ? argv[5] : "");
+	}
+	if (strcmp(mode, "sync-bench") == 0 && argc > 5)
+	{
+		return RunSyncBenchmark(argv[2], atoi(argv[3]), argv[4], argv[5], argc > 6 ? atoi(argv[6]) : 10000);
+	}
+	printf("Usage: ClientTests [stress [writers] [operations] | bench [operations]\n"
+		"                   | compress [iterations] | compress-bench [megabytes]\n"
+		"                   | pipeline-bench [megabytes] | stored [iterations]\n"
+		"                   | gcm | gcm-equality [iterations] | gcm-bench [megabytes]\n"
+		"                   | base64-bench | json-bench [entries]\n"
+		"                   | download-bench host port path [token]\n"
+		"                   | sync-bench host port user token [files]]\n");
+	return 2;
+}
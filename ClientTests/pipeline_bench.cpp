@@ -0,0 +1,127 @@
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "data_transform.h"
+#include "data_transform_tests.h"
+#include "sha256.h"
+#include "utils.h"
+
+using NetworkOperations::ChunkPipeline;
+using NetworkOperations::DataCompress;
+using NetworkOperations::DataCryptor;
+
+namespace
+{
+	const size_t kPartSize = 10 * 1024 * 1024;	// The part size of UploadFileMultipart
+
+	struct Result
+	{
+		double speed = 0;
+		size_t buffered = 0;	// Bytes written to or read from part-sized buffers
+		std::vector<BYTE> output;
+		std::string digest;
+	};
+
+	// Every part compressed into a buffer of its own, then encrypted into another, then hashed, the way
+	// uploads ran before ChunkPipeline
+	Result RunSeparate(const std::vector<BYTE>& input, const std::string& key, const std::string& nonce)
+	{
+		Result result;
+		DataCompress compress;
+		DataCryptor cryptor(key, nonce);
+		Crypto::SHA256_CTX digest;
+		Crypto::SHA256_Init(&digest);
+		auto start = std::chrono::steady_clock::now();
+		ULONGLONG index = 0;
+		for (size_t offset = 0; offset < input.size(); offset += kPartSize, index++)
+		{
+			DWORD part = (DWORD)(std::min)(kPartSize, input.size() - offset);
+			BYTE* compressed = NULL;
+			BYTE* encrypted = NULL;
+			DWORD compressed_size = 0, encrypted_size = 0;
+			if (!compress.TransformData(input.data() + offset, part, compressed, compressed_size)
+				|| !cryptor.TransformChunk(index, offset + part == input.size(), compressed, compressed_size, encrypted, encrypted_size))
+			{
+				delete[] compressed;
+				return Result();
+			}
+			Crypto::SHA256_Update(&digest, encrypted, encrypted_size);
+			result.output.insert(result.output.end(), encrypted, encrypted + encrypted_size);
+			// Input read, compressed part written and read back, encrypted part written and read back
+			result.buffered += part + 2 * (size_t)compressed_size + 2 * (size_t)encrypted_size;
+			delete[] compressed;
+			delete[] encrypted;
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		BYTE hash[SHA256_DIGEST_LENGTH];
+		Crypto::SHA256_Final(&digest, hash);
+		result.digest = Helper::StringHelper::convertBytesHexString(hash, SHA256_DIGEST_LENGTH);
+		result.speed = input.size() / 1e6 / elapsed.count();
+		return result;
+	}
+
+	// Every part through ChunkPipeline, tile by tile into one reused part buffer
+	Result RunPipeline(const std::vector<BYTE>& input, const std::string& key, const std::string& nonce)
+	{
+		Result result;
+		DataCompress compress;
+		DataCryptor cryptor(key, nonce);
+		ChunkPipeline pipeline;
+		pipeline.AddStage(&compress);
+		pipeline.AddStage(&cryptor);
+		std::vector<BYTE> part_out(pipeline.Bound(kPartSize));
+		auto start = std::chrono::steady_clock::now();
+		ULONGLONG index = 0;
+		for (size_t offset = 0; offset < input.size(); offset += kPartSize, index++)
+		{
+			size_t part = (std::min)(kPartSize, input.size() - offset);
+			size_t part_size = 0;
+			if (!pipeline.ProcessChunk(index, offset + part == input.size(), input.data() + offset, part, part_out.data(), part_out.size(), part_size))
+			{
+				return Result();
+			}
+			result.output.insert(result.output.end(), part_out.data(), part_out.data() + part_size);
+			// Input read and encrypted part written, the stages between work on tiles in cache
+			result.buffered += part + part_size;
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		result.digest = pipeline.GetDigest();
+		result.speed = input.size() / 1e6 / elapsed.count();
+		return result;
+	}
+}
+
+int RunPipelineBenchmark(int megabytes)
+{
+	std::mt19937 random(36);
+	// Text with repeats, so the compressed part is still a sizable fraction of the input
+	std::vector<BYTE> input((size_t)megabytes * 1024 * 1024);
+	for (size_t i = 0; i < input.size(); i++)
+	{
+		input[i] = (i / 4096) % 3 == 0 ? (BYTE)random() : "the quick brown fox, "[random() % 21];
+	}
+	std::string key(AES_KEY_SIZE, '\x36'), nonce(GCM_NONCE_LEN, '\x24');
+
+	printf("[Pipeline bench] %d MB in %zu MB parts, deflate then AES-GCM then SHA-256\n", megabytes, kPartSize / (1024 * 1024));
+	Result separate = RunSeparate(input, key, nonce);
+	Result pipeline = RunPipeline(input, key, nonce);
+	if (separate.speed == 0 || pipeline.speed == 0)
+	{
+		printf("A transform failed\n");
+		return 1;
+	}
+	if (separate.output != pipeline.output || separate.digest != pipeline.digest)
+	{
+		printf("FAIL the pipeline output or digest differs from the separate passes\n");
+		return 1;
+	}
+	printf("path             MB/s   MB through part-sized buffers\n");
+	printf("separate %12.1f %16.1f\n", separate.speed, separate.buffered / 1e6);
+	printf("pipeline %12.1f %16.1f\n", pipeline.speed, pipeline.buffered / 1e6);
+	printf("The pipeline moves %.0f%% of the bytes through part-sized buffers\n", 100.0 * pipeline.buffered / separate.buffered);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data_transform.h"
+#include "data_transform_tests.h"
+#include "sha256.h"
+#include "utils.h"
+
+using NetworkOperations::ChunkPipeline;
+using NetworkOperations::DataCompress;
+using NetworkOperations::DataCryptor;
+using NetworkOperations::StoredLayout;
+
+namespace
+{
+	const wchar_t* kStoredPath = L"stored_file_roundtrip.stored";
+	const wchar_t* kOutputPath = L"stored_file_roundtrip.out";
+
+	int failures = 0;
+
+#define ROUNDTRIP_CHECK(condition) \
+	do { if (!(condition) && failures++ < 10) printf("FAIL line %d: %s\n", __LINE__, #condition); } while (0)
+
+	// Text with repeats or random bytes, from empty up to a few parts of a megabyte
+	std::vector<BYTE> MakeInput(std::mt19937& random)
+	{
+		std::vector<BYTE> input(random() % 2 ? random() % 4096 : random() % (3 * 1024 * 1024));
+		bool text = random() % 2 == 0;
+		for (BYTE& value : input)
+		{
+			value = text ? "the quick brown fox, "[random() % 21] : (BYTE)random();
+		}
+		return input;
+	}
+
+	// The parts of an upload in the stored layout, one after the other the way the server appends them
+	bool Store(const std::vector<BYTE>& input, size_t part_size, const std::string& key, std::vector<BYTE>& stored, std::string& digest)
+	{
+		DataCompress compress;
+		std::string nonce;
+		std::unique_ptr<DataCryptor> cryptor;
+		ChunkPipeline pipeline;
+		pipeline.AddStage(&compress);
+		if (!key.empty())
+		{
+			nonce.assign(GCM_NONCE_LEN, '\0');
+			Helper::generateRandomBytes((uint8_t*)&nonce[0], nonce.size());
+			cryptor.reset(new DataCryptor(key, nonce));
+			pipeline.AddStage(cryptor.get());
+		}
+		stored.clear();
+		std::vector<BYTE> part(StoredLayout::Bound(pipeline, part_size));
+		ULONGLONG index = 0;
+		size_t offset = 0;
+		do
+		{
+			size_t length = (std::min)(part_size, input.size() - offset);
+			size_t written = 0;
+			if (!StoredLayout::WritePart(pipeline, nonce, index++, offset + length == input.size(),
+				input.data() + offset, length, part.data(), part.size(), written))
+			{
+				return false;
+			}
+			stored.insert(stored.end(), part.data(), part.data() + written);
+			offset += length;
+		} while (offset < input.size());
+		digest = pipeline.GetDigest();
+		return true;
+	}
+
+	std::string Hash(const std::vector<BYTE>& data)
+	{
+		BYTE hash[SHA256_DIGEST_LENGTH];
+		Crypto::SHA256_CTX ctx;
+		Crypto::SHA256_Init(&ctx);
+		Crypto::SHA256_Update(&ctx, (BYTE*)data.data(), (uint32_t)data.size());
+		Crypto::SHA256_Final(&ctx, hash);
+		return Helper::StringHelper::convertBytesHexString(hash, SHA256_DIGEST_LENGTH);
+	}
+
+	// The stored bytes written to a file and restored from it, the way a download is
+	bool Restores(const std::vector<BYTE>& stored, const std::string& key, const std::vector<BYTE>& expected)
+	{
+		HANDLE hStored = CreateFileW(kStoredPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		HANDLE hFile = CreateFileW(kOutputPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hStored == INVALID_HANDLE_VALUE || hFile == INVALID_HANDLE_VALUE)
+		{
+			printf("Cannot create the test files\n");
+			exit(1);
+		}
+		DWORD bytesWrite = 0, bytesRead = 0;
+		bool restored = (stored.empty() || WriteFile(hStored, stored.data(), (DWORD)stored.size(), &bytesWrite, NULL))
+			&& StoredLayout::Restore(hStored, hFile, key);
+		std::vector<BYTE> output(expected.size() + 1);
+		LARGE_INTEGER start;
+		start.QuadPart = 0;
+		restored = restored && SetFilePointerEx(hFile, start, NULL, FILE_BEGIN)
+			&& ReadFile(hFile, output.data(), (DWORD)output.size(), &bytesRead, NULL)
+			&& bytesRead == expected.size() && memcmp(output.data(), expected.data(), expected.size()) == 0;
+		CloseHandle(hStored);
+		CloseHandle(hFile);
+		return restored;
+	}
+}
+
+int RunStoredFileRoundTrip(int iterations)
+{
+	std::mt19937 random(33);
+	std::string key(AES_KEY_SIZE, '\0'), other_key(AES_KEY_SIZE, '\0');
+	Helper::generateRandomBytes((uint8_t*)&key[0], key.size());
+	Helper::generateRandomBytes((uint8_t*)&other_key[0], other_key.size());
+	int encrypted = 0;
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		std::vector<BYTE> input = MakeInput(random);
+		size_t part_size = 1024 + random() % (1024 * 1024);
+		bool encrypt = random() % 2 == 0;
+		encrypted += encrypt;
+		std::vector<BYTE> stored;
+		std::string digest;
+		ROUNDTRIP_CHECK(Store(input, part_size, encrypt ? key : "", stored, digest));
+		// The digest sent with the last part is the one the server computes over what it stored
+		ROUNDTRIP_CHECK(digest == Hash(stored));
+		ROUNDTRIP_CHECK(Restores(stored, encrypt ? key : "", input));
+
+		// A cut file is rejected instead of restored as something else
+		std::vector<BYTE> damaged = stored;
+		damaged.resize(stored.size() - 1 - random() % (stored.size() / 2));
+		ROUNDTRIP_CHECK(!Restores(damaged, encrypt ? key : "", input));
+		if (encrypt)
+		{
+			// So is any changed byte, the padding bits of a deflate stream included, and the wrong key
+			damaged = stored;
+			damaged[random() % damaged.size()] ^= (BYTE)(1 + random() % 255);
+			ROUNDTRIP_CHECK(!Restores(damaged, key, input));
+			ROUNDTRIP_CHECK(!Restores(stored, other_key, input));
+			ROUNDTRIP_CHECK(!Restores(stored, "", input));
+		}
+	}
+	DeleteFileW(kStoredPath);
+	DeleteFileW(kOutputPath);
+	printf("[Stored file] %d uploads restored, %d of them encrypted, %d failures\n", iterations, encrypted, failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "http_client.h"
+#include "http_client_tests.h"
+#include "json/json_document.h"
+#include "sha256.h"
+#include "utils.h"
+
+using NetworkOperations::HttpClient;
+using NetworkOperations::HttpHeaders;
+using NetworkOperations::HttpResponse;
+using NetworkOperations::MultipartBody;
+
+namespace
+{
+	const size_t kBundleFiles = 64;	// BUNDLE_MAX_FILES of user_handle.h
+
+	struct TinyFile
+	{
+		std::string name;
+		std::string data;
+		std::string info;	// The fileinfo JSON of JsonUtility::CreateJsonFileUpload
+		std::string digest;
+	};
+
+	std::vector<TinyFile> MakeFiles(int count, const std::string& folder)
+	{
+		std::mt19937 random(27);
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		std::string time = Helper::TimeHelper::convertFileTimeToString(now);
+		std::vector<TinyFile> files(count);
+		for (int i = 0; i < count; i++)
+		{
+			TinyFile& file = files[i];
+			file.name = "tiny_" + std::to_string(i) + ".txt";
+			file.data.resize(64 + random() % 960);
+			for (char& value : file.data)
+			{
+				value = "sync the tiny files, "[random() % 21];
+			}
+			file.info = "{\"file_name\":\"" + file.name + "\",\"file_size\":" + std::to_string(file.data.size()) +
+				",\"folder\":\"" + folder + "\",\"attribute\":32,\"create_time\":\"" + time +
+				"\",\"last_write_time\":\"" + time + "\",\"last_access_time\":\"" + time + "\"}";
+			BYTE hash[SHA256_DIGEST_LENGTH];
+			Crypto::SHA256_CTX ctx;
+			Crypto::SHA256_Init(&ctx);
+			Crypto::SHA256_Update(&ctx, (BYTE*)&file.data[0], (uint32_t)file.data.size());
+			Crypto::SHA256_Final(&ctx, hash);
+			file.digest = Helper::StringHelper::convertBytesHexString(hash, SHA256_DIGEST_LENGTH);
+		}
+		return files;
+	}
+
+	// Every file in its own upload, the init, part and complete requests of UserHandle::UploadFile
+	bool UploadEach(HttpClient& client, const HttpHeaders& auth, const std::wstring& user, const std::vector<TinyFile>& files,
+		const std::string& folder, size_t& requests)
+	{
+		HttpHeaders json = auth;
+		json.SetHeader("Content-Type", "application/json");
+		for (const TinyFile& file : files)
+		{
+			HttpResponse response = client.Post(user + L"/files/upload/init", json, file.info);
+			requests++;
+			// The document points into the content, which has to outlive it
+			std::string content = response.GetContentString();
+			JsonDocument document;
+			if (response.GetStatusCode() != 201 || !document.Parse(content) || !document.Root().IsObject())
+			{
+				printf("init of %s failed, status %lu\n", file.name.c_str(), response.GetStatusCode());
+				return false;
+			}
+			std::string upload_id = document.Root().Child("upload_id").AsString();
+
+			MultipartBody body;
+			body.AddField("folder", folder);
+			body.AddFile("filedata", file.name, file.data.data(), file.data.size());
+			body.AddField("sha256", file.digest);
+			HttpHeaders multipart = auth;
+			multipart.SetHeader("Content-Type", body.GetContentType());
+			response = client.Post(user + L"/files/upload/" + Helper::StringHelper::convertStringToWideString(upload_id), multipart, body.Finish());
+			requests++;
+			if (response.GetStatusCode() != 200)
+			{
+				printf("part of %s failed, status %lu\n", file.name.c_str(), response.GetStatusCode());
+				return false;
+			}
+
+			response = client.Post(user + L"/files/upload/complete", json, "{\n\t upload_id: " + upload_id + " \n}");
+			requests++;
+			if (response.GetStatusCode() != 200)
+			{
+				printf("complete of %s failed, status %lu\n", file.name.c_str(), response.GetStatusCode());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// kBundleFiles files to a request, the bundles of UserHandle::UploadFileBundle
+	bool UploadBundles(HttpClient& client, const HttpHeaders& auth, const std::wstring& user, const std::vector<TinyFile>& files,
+		size_t& requests)
+	{
+		for (size_t first = 0; first < files.size(); first += kBundleFiles)
+		{
+			size_t last = (std::min)(first + kBundleFiles, files.size());
+			MultipartBody body;
+			for (size_t i = first; i < last; i++)
+			{
+				body.AddField("fileinfo", files[i].info);
+				body.AddFile("filedata", files[i].name, files[i].data.data(), files[i].data.size());
+				body.AddField("sha256", files[i].digest);
+			}
+			HttpHeaders multipart = auth;
+			multipart.SetHeader("Content-Type", body.GetContentType());
+			HttpResponse response = client.Post(user + L"/files/bundle", multipart, body.Finish());
+			requests++;
+			std::string content = response.GetContentString();
+			JsonDocument document;
+			if (response.GetStatusCode() != 200 || !document.Parse(content) || !document.Root().IsArray())
+			{
+				printf("bundle of %s failed, status %lu\n", files[first].name.c_str(), response.GetStatusCode());
+				return false;
+			}
+			size_t stored = 0;
+			for (JsonElement result = document.Root().FirstChild(); result.IsValid(); result = result.NextSibling())
+			{
+				if (result.Child("status").AsInteger() != 201)
+				{
+					printf("%s\n", result.Child("message").AsString().c_str());
+					return false;
+				}
+				stored++;
+			}
+			if (stored != last - first)
+			{
+				printf("bundle of %s returned %zu results for %zu files\n", files[first].name.c_str(), stored, last - first);
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int RunSyncBenchmark(const char* host, int port, const char* user, const char* token, int count)
+{
+	HttpClient client;
+	client.OptionKeepConnect(TRUE);
+	if (!client.Connect(Helper::StringHelper::convertStringToWideString(host), (WORD)port, FALSE))
+	{
+		printf("Cannot connect to %s:%d\n", host, port);
+		return 1;
+	}
+	HttpHeaders auth;
+	auth.SetHeader("Authorization", std::string("Bearer ") + token);
+	std::wstring remote_user = Helper::StringHelper::convertStringToWideString(user);
+	// A folder of its own per run and per path, the server keeps what is uploaded
+	std::string run = std::to_string(GetTickCount64());
+	std::vector<TinyFile> each = MakeFiles(count, "sync_bench_" + run + "_each");
+	std::vector<TinyFile> bundled = MakeFiles(count, "sync_bench_" + run + "_bundle");
+
+	printf("[Sync bench] %d files of 64 to 1023 bytes to %s:%d as %s, over one keep-alive connection\n", count, host, port, user);
+	printf("path         requests   files/s\n");
+	size_t requests = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (!UploadEach(client, auth, remote_user, each, "sync_bench_" + run + "_each", requests))
+	{
+		return 1;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	double each_speed = count / elapsed.count();
+	printf("each     %12zu %9.1f\n", requests, each_speed);
+
+	requests = 0;
+	start = std::chrono::steady_clock::now();
+	if (!UploadBundles(client, auth, remote_user, bundled, requests))
+	{
+		return 1;
+	}
+	elapsed = std::chrono::steady_clock::now() - start;
+	double bundle_speed = count / elapsed.count();
+	printf("bundle   %12zu %9.1f\n", requests, bundle_speed);
+	printf("Bundles of %zu files sync %.1fx the files per second\n", kBundleFiles, bundle_speed / each_speed);
+	return 0;
+}
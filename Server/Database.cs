@@ -167,6 +167,40 @@ namespace CloudServer
             }
         }
 
+        public async Task<bool> CreateManifestStateTable()
+        {
+            if (_con is null)
+            {
+                Console.WriteLine("Database connection is not available.");
+                return false;
+            }
+
+            // The last folder manifest acknowledged for each user, what a delta manifest applies to.
+            // Created at startup when missing, so databases from before manifests get it too
+            string queryManifestState = @"IF OBJECT_ID(N'ManifestState', N'U') IS NULL
+            CREATE TABLE ManifestState 
+            (
+                user_id INT PRIMARY KEY,
+                version BIGINT NOT NULL,
+                root_digest BINARY(32) NOT NULL,
+                update_at DATETIME DEFAULT GETDATE()
+            );";
+
+            try
+            {
+                using (SqlCommand command = new SqlCommand(queryManifestState, _con))
+                {
+                    await command.ExecuteNonQueryAsync();
+                }
+                return true; // Tables created successfully
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"An error occurred: {ex.Message}");
+                return false;
+            }
+        }
+
         public async Task<bool> UserExistAsync(int user_id)
         {
             if (_con is null)
@@ -619,7 +653,12 @@ namespace CloudServer
                 }
             }
         }
-        public async Task<string> RenameFileAsync(int user_id, int file_id, string new_filename)
+        /// <summary>
+        /// Rename a file of the user
+        /// </summary>
+        /// <param name="apply">Runs with the storage path before the commit, the rename is rolled back if it throws</param>
+        /// <returns>The storage path of the file, or null if it was not found or not renamed</returns>
+        public async Task<string> RenameFileAsync(int user_id, int file_id, string new_filename, Action<string> apply = null)
         {
             if (_con is null)
             {
@@ -657,6 +696,7 @@ namespace CloudServer
                         // Commit the transaction if the file name was updated
                         if (rowsAffected > 0)
                         {
+                            apply?.Invoke(storage_path);
                             transaction.Commit();   // File renamed successfully 
                             return storage_path;
                         }
@@ -671,7 +711,39 @@ namespace CloudServer
             }
             return null; // File not renamed
         }
-        public async Task<string> RemoveFileAsync(int user_id, int file_id)
+        /// <summary>
+        /// Remove a file of the user
+        /// </summary>
+        /// <param name="apply">Runs with the storage path before the commit, the removal is rolled back if it throws</param>
+        /// <returns>The storage path of the file, or null if it was not found or not removed</returns>
+        /// <summary>
+        /// Find where a file of the user is stored
+        /// </summary>
+        /// <returns>The storage path, or null if the user has no such file</returns>
+        public async Task<string> GetStoragePathAsync(int user_id, int file_id)
+        {
+            if (_con is null)
+            {
+                Console.WriteLine("Database connection is not available.");
+                return null;
+            }
+            try
+            {
+                string query = "SELECT storage_on FROM [FileInfo] WHERE user_id = @userId AND file_id = @fileId";
+                using (var command = new SqlCommand(query, _con))
+                {
+                    command.Parameters.AddWithValue("@userId", user_id);
+                    command.Parameters.AddWithValue("@fileId", file_id);
+                    return await command.ExecuteScalarAsync() as string;
+                }
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"An error occurred: {ex.Message}");
+                return null;
+            }
+        }
+        public async Task<string> RemoveFileAsync(int user_id, int file_id, Action<string> apply = null)
         {
             if (_con is null)
             {
@@ -708,6 +780,7 @@ namespace CloudServer
                         // Commit the transaction if the file was deleted
                         if (rowsAffected > 0)
                         {
+                            apply?.Invoke(storage_path);
                             transaction.Commit();   // File deleted successfully
                             return storage_path;
                         }
@@ -722,6 +795,73 @@ namespace CloudServer
             }
             return null; // File not deleted
         }
+        /// <summary>
+        /// Record a whole manifest sent by the user as the base of its next delta
+        /// </summary>
+        /// <param name="root">SHA-256 of the manifest</param>
+        /// <returns>The new manifest version, or null on error</returns>
+        public async Task<long?> AcknowledgeManifestAsync(int user_id, byte[] root)
+        {
+            if (_con is null)
+            {
+                Console.WriteLine("Database connection is not available.");
+                return null;
+            }
+            string query = @"MERGE [ManifestState] WITH (HOLDLOCK) AS target
+                            USING (SELECT @userId AS user_id) AS source ON target.user_id = source.user_id
+                            WHEN MATCHED THEN UPDATE SET version = target.version + 1, root_digest = @root, update_at = GETDATE()
+                            WHEN NOT MATCHED THEN INSERT (user_id, version, root_digest) VALUES (@userId, 1, @root)
+                            OUTPUT INSERTED.version;";
+            try
+            {
+                using (var _cmd = new SqlCommand(query, _con))
+                {
+                    _cmd.Parameters.AddWithValue("@userId", user_id);
+                    _cmd.Parameters.Add("@root", SqlDbType.Binary, Manifest.DigestSize).Value = root;
+                    var result = await _cmd.ExecuteScalarAsync();
+                    return result == null ? (long?)null : (long)result;
+                }
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"An error occurred: {ex.Message}");
+                return null;
+            }
+        }
+
+        /// <summary>
+        /// Move the user's manifest state over a delta, only from the version and root the delta was made against
+        /// </summary>
+        /// <returns>The new manifest version, or null if the state diverged from the delta's base or on error</returns>
+        public async Task<long?> AcknowledgeDeltaAsync(int user_id, long base_version, byte[] base_root, byte[] root)
+        {
+            if (_con is null)
+            {
+                Console.WriteLine("Database connection is not available.");
+                return null;
+            }
+            string query = @"UPDATE [ManifestState] SET version = version + 1, root_digest = @root, update_at = GETDATE()
+                            OUTPUT INSERTED.version
+                            WHERE user_id = @userId AND version = @baseVersion AND root_digest = @baseRoot";
+            try
+            {
+                using (var _cmd = new SqlCommand(query, _con))
+                {
+                    _cmd.Parameters.AddWithValue("@userId", user_id);
+                    _cmd.Parameters.Add("@baseVersion", SqlDbType.BigInt).Value = base_version;
+                    _cmd.Parameters.Add("@baseRoot", SqlDbType.Binary, Manifest.DigestSize).Value = base_root;
+                    _cmd.Parameters.Add("@root", SqlDbType.Binary, Manifest.DigestSize).Value = root;
+                    var result = await _cmd.ExecuteScalarAsync();
+                    return result == null ? (long?)null : (long)result;
+                }
+            }
+            catch (Exception ex)
+            {
+                Console.WriteLine($"An error occurred: {ex.Message}");
+                return null;
+            }
+        }
+
         public async Task<List<FileInfo>> RetrieveUploadAsync(int user_id, List<FileInfo> files)
         {
             if (_con is null)
@@ -161,8 +161,7 @@ namespace CloudServer
             switch (request.Method)
             {
                 case "HEAD":
-                    Console.WriteLine(request);
-                    SendResponse(response.MakeHeadResponse());
+                    OnHeadMethod(request);
                     break;
                 case "GET":
                     OnGetMethod(this.request);
@@ -194,6 +193,28 @@ namespace CloudServer
         #endregion
 
         #region Request handlers
+        private async void OnHeadMethod(Request request)
+        {
+            // Decode the URL and remove leading/trailing 
+            string url_path = Uri.UnescapeDataString(request.Url.Trim('/'));
+            Console.WriteLine(request);
+
+            /* HEAD /                           : server check */
+            /* HEAD /account/download/file_id   : /teddy/download/123, size and range support */
+            string[] segments = url_path.Split('/');
+            if (string.IsNullOrEmpty(url_path))
+            {
+                SendResponse(response.MakeHeadResponse());
+            }
+            else if (segments.Length == 3 && segments[1].ToLower() == "download")
+            {
+                await UserOperations.ProcessDownloadFile(this, request, response, segments[0], Convert.ToInt32(segments[2]));
+            }
+            else
+            {
+                SendResponse(response.MakeErrorResponse((int)HttpStatusCode.NotFound, ""));
+            }
+        }
         private async void OnGetMethod(Request request)
         {
             // Decode the URL and remove leading/trailing 
@@ -215,6 +236,11 @@ namespace CloudServer
 
             switch (action.ToLower())
             {
+                case "download":
+                    Console.WriteLine("\n=================[ Download file ]==============");
+                    Console.WriteLine(request);
+                    await UserOperations.ProcessDownloadFile(this, request, response, user_name, Convert.ToInt32(segments[2]));
+                    break;
                 case "profile":
                     Console.WriteLine("\n=================[ Get profile ]================");
                     Console.WriteLine(request);
@@ -239,6 +265,7 @@ namespace CloudServer
             /* POST /action                          : /register or /login */
             /* POST /user_name/files/action          : /teddy/files/upload */
             /* POST /user_name/files/action/endpoint : /teddy/files/upload/init */
+            /* POST /user_name/files/bundle          : several small files in one request */
             string action, account;
             string[] segments = url_path.Split('/');
             {
@@ -297,6 +324,18 @@ namespace CloudServer
                                     await UserOperations.ProcessUploadFile(this, Id, request, response, account);
                                 }
                             }
+                            else if (file_action == "bundle")
+                            {
+                                // The body is binary file data, only the banner is printed
+                                Console.WriteLine("\n=================[ Upload bundle ]================");
+                                await UserOperations.ProcessUploadBundle(this, request, response, account);
+                            }
+                            else if (file_action == "batch")
+                            {
+                                Console.WriteLine("\n=================[ Batch files ]================");
+                                Console.WriteLine(request);
+                                await UserOperations.ProcessBatch(this, request, response, account);
+                            }
                         }
                     }
                     break;
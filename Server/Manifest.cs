@@ -0,0 +1,169 @@
+﻿using System;
+using System.Text;
+using System.Collections.Generic;
+
+namespace CloudServer
+{
+    /// <summary>
+    /// Binary folder manifest, the compact alternative to the JSON array of files sent to /files/compare
+    /// </summary>
+    /// <remarks>
+    /// Integers are LEB128 varints, signed ones zigzag encoded, strings are a byte length and UTF-8:
+    /// "FMAN", version byte, the folder table (count, then parent index + 1 and name per folder) and
+    /// per table entry its file count and files. A file is its name length shifted left by one with
+    /// the digest flag in the low bit, the name, size, attribute, the create time relative to the
+    /// previous file, last write relative to create, last access relative to last write (seconds
+    /// since 1601) and the 32 byte digest when flagged. The writer is ManifestWriter in the client.
+    ///
+    /// A delta starts with "FDLT" and the version byte, then the version and root of the manifest it
+    /// applies to and the root it leads to, and carries only the new or changed files, every folder
+    /// by its whole path. A root is the SHA-256 of a whole manifest.
+    /// </remarks>
+    public static class Manifest
+    {
+        public const string ContentType = "application/x-folder-manifest";
+        public const int Version = 1;
+        public const int DigestSize = 32;
+        private static readonly long EpochTicks = new DateTime(1601, 1, 1).Ticks;
+
+        /// <summary>
+        /// Decode a manifest or a delta into the files it lists, with the same values the JSON payload gives
+        /// </summary>
+        /// <param name="data">Request body</param>
+        /// <param name="delta">The base and new root of a delta, null for a whole manifest</param>
+        /// <returns>Files in manifest order</returns>
+        /// <exception cref="FormatException">The manifest is malformed, truncated or of another version</exception>
+        public static List<FileInfo> Decode(byte[] data, out ManifestDelta delta)
+        {
+            delta = null;
+            if ((data.Length < 5) || (data[0] != 'F'))
+                throw new FormatException("Not a folder manifest");
+            bool isDelta = (data[1] == 'D') && (data[2] == 'L') && (data[3] == 'T');
+            if (!isDelta && ((data[1] != 'M') || (data[2] != 'A') || (data[3] != 'N')))
+                throw new FormatException("Not a folder manifest");
+            if (data[4] != Version)
+                throw new FormatException($"Unsupported manifest version {data[4]}");
+            int position = 5;
+
+            if (isDelta)
+            {
+                ulong baseVersion = ReadVarint(data, ref position);
+                if ((baseVersion > long.MaxValue) || (data.Length - position < 2 * DigestSize))
+                    throw new FormatException("Truncated manifest");
+                delta = new ManifestDelta
+                {
+                    BaseVersion = (long)baseVersion,
+                    BaseRoot = new byte[DigestSize],
+                    Root = new byte[DigestSize]
+                };
+                System.Buffer.BlockCopy(data, position, delta.BaseRoot, 0, DigestSize);
+                System.Buffer.BlockCopy(data, position + DigestSize, delta.Root, 0, DigestSize);
+                position += 2 * DigestSize;
+            }
+
+            // Folder table, every entry after the root is its parent's path and its own name
+            int folderCount = ReadCount(data, ref position);
+            string[] folders = new string[folderCount];
+            for (int i = 0; i < folderCount; i++)
+            {
+                ulong parent = ReadVarint(data, ref position);
+                string name = ReadString(data, ref position, ReadCount(data, ref position));
+                if (parent == 0)
+                    folders[i] = name;
+                else if (parent <= (ulong)i)
+                    folders[i] = folders[(int)parent - 1] + "\\" + name;
+                else
+                    throw new FormatException("Invalid parent folder");
+            }
+
+            var files = new List<FileInfo>();
+            long createTime = 0;
+            for (int i = 0; i < folderCount; i++)
+            {
+                int fileCount = ReadCount(data, ref position);
+                for (int j = 0; j < fileCount; j++)
+                {
+                    ulong header = ReadVarint(data, ref position);
+                    if ((header >> 1) > (ulong)(data.Length - position))
+                        throw new FormatException("Truncated manifest");
+                    var file = new FileInfo();
+                    file.file_name = ReadString(data, ref position, (int)(header >> 1));
+                    file.folder = folders[i];
+                    file.file_size = (long)ReadVarint(data, ref position);
+                    file.attribute = (int)(uint)ReadVarint(data, ref position);
+                    createTime += ReadSigned(data, ref position);
+                    long lastWriteTime = createTime + ReadSigned(data, ref position);
+                    long lastAccessTime = lastWriteTime + ReadSigned(data, ref position);
+                    file.create_time = ToDateTime(createTime);
+                    file.last_write_time = ToDateTime(lastWriteTime);
+                    file.last_access_time = ToDateTime(lastAccessTime);
+                    // The digest is not stored yet, the comparison uses the metadata only
+                    if ((header & 1) != 0)
+                    {
+                        if (data.Length - position < DigestSize)
+                            throw new FormatException("Truncated manifest");
+                        position += DigestSize;
+                    }
+                    files.Add(file);
+                }
+            }
+            if (position != data.Length)
+                throw new FormatException("Unexpected data after the manifest");
+            return files;
+        }
+
+        private static ulong ReadVarint(byte[] data, ref int position)
+        {
+            ulong value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (position >= data.Length)
+                    throw new FormatException("Truncated manifest");
+                byte b = data[position++];
+                value |= (ulong)(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                    return value;
+            }
+            throw new FormatException("Invalid varint");
+        }
+
+        private static long ReadSigned(byte[] data, ref int position)
+        {
+            ulong value = ReadVarint(data, ref position);
+            return (long)(value >> 1) ^ -(long)(value & 1);
+        }
+
+        // A count or length can not exceed the bytes left, which also bounds the allocations
+        private static int ReadCount(byte[] data, ref int position)
+        {
+            ulong value = ReadVarint(data, ref position);
+            if (value > (ulong)(data.Length - position))
+                throw new FormatException("Truncated manifest");
+            return (int)value;
+        }
+
+        private static string ReadString(byte[] data, ref int position, int length)
+        {
+            string value = Encoding.UTF8.GetString(data, position, length);
+            position += length;
+            return value;
+        }
+
+        private static DateTime ToDateTime(long seconds)
+        {
+            if ((seconds < 0) || (seconds > (DateTime.MaxValue.Ticks - EpochTicks) / TimeSpan.TicksPerSecond))
+                throw new FormatException("Time out of range");
+            return new DateTime(EpochTicks + seconds * TimeSpan.TicksPerSecond);
+        }
+    }
+
+    /// <summary>
+    /// What a delta applies to: the manifest the server acknowledged as BaseVersion, and the one it leads to
+    /// </summary>
+    public class ManifestDelta
+    {
+        public long BaseVersion { get; set; }
+        public byte[] BaseRoot { get; set; }
+        public byte[] Root { get; set; }
+    }
+}
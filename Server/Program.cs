@@ -125,6 +125,13 @@ namespace CloudServer
                 } while (true);
             }
 
+            // Tables added after the first release are created on databases that do not have them yet
+            if (!SqlDatabase.Instance.CreateManifestStateTable().Result)
+            {
+                Console.WriteLine("Failed to create the ManifestState table.");
+                return;
+            }
+
             // Start the appropriate server based on the protocol
             if (protocol.ToLower() == "http")
             {
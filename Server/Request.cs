@@ -152,6 +152,10 @@ namespace CloudServer
             _bodySize = 0;
             _bodyLength = 0;
             _bodyLengthProvided = false;
+            _bodyChunked = false;
+            _chunkState = ChunkState.Size;
+            _chunkIndex = 0;
+            _chunkRemaining = 0;
 
             _cache.Clear();
             _cacheSize = 0;
@@ -333,6 +337,13 @@ namespace CloudServer
         private int _bodyLength;
         private bool _bodyLengthProvided;
 
+        // HTTP chunked request body
+        private enum ChunkState { Size, Data, DataEnd, Trailer }
+        private bool _bodyChunked;
+        private ChunkState _chunkState;
+        private int _chunkIndex;
+        private int _chunkRemaining;
+
         // HTTP request cache
         private Buffer _cache = new Buffer();
         private int _cacheSize;
@@ -483,6 +494,13 @@ namespace CloudServer
                             }
                         }
 
+                        // Try to find the chunked transfer coding, it takes precedence over Content-Length
+                        if (string.Compare(headerName, "Transfer-Encoding", StringComparison.OrdinalIgnoreCase) == 0)
+                        {
+                            if (headerValue.IndexOf("chunked", StringComparison.OrdinalIgnoreCase) >= 0)
+                                _bodyChunked = true;
+                        }
+
                         // Try to find Cookies
                         if (string.Compare(headerName, "Cookie", StringComparison.OrdinalIgnoreCase) == 0)
                         {
@@ -626,6 +644,10 @@ namespace CloudServer
             // Update the parsed cache size
             _cacheSize = (int)_cache.Size;
 
+            // Chunked body is decoded as it arrives
+            if (_bodyChunked)
+                return ReceiveChunkedBody();
+
             // Update body size
             _bodySize += size;
 
@@ -663,6 +685,95 @@ namespace CloudServer
                 }
             }
 
+            // Body was received partially...
+            return false;
+        }
+        private bool ReceiveChunkedBody()
+        {
+            // The decoded body is kept at _bodyIndex, chunk data is moved down over the chunk
+            // size lines and the bytes not decoded yet start at _chunkIndex
+            if (_chunkIndex == 0)
+            {
+                _chunkIndex = _bodyIndex;
+                _bodySize = 0;
+            }
+
+            int size = (int)_cache.Size;
+            while (_chunkIndex < size)
+            {
+                if (_chunkState == ChunkState.Data)
+                {
+                    int count = Math.Min(_chunkRemaining, size - _chunkIndex);
+                    Array.Copy(_cache.Data, _chunkIndex, _cache.Data, _bodyIndex + _bodySize, count);
+                    _bodySize += count;
+                    _chunkIndex += count;
+                    _chunkRemaining -= count;
+                    if (_chunkRemaining == 0)
+                        _chunkState = ChunkState.DataEnd;
+                    continue;
+                }
+
+                // Everything else is a CRLF terminated line
+                int line = _chunkIndex;
+                while (((line + 1) < size) && ((_cache[line] != '\r') || (_cache[line + 1] != '\n')))
+                    line++;
+                if ((line + 1) >= size)
+                    break;
+
+                if (_chunkState == ChunkState.DataEnd)
+                {
+                    // Chunk data must be followed by an empty line
+                    if (line != _chunkIndex)
+                    {
+                        IsErrorSet = true;
+                        return false;
+                    }
+                    _chunkState = ChunkState.Size;
+                }
+                else if (_chunkState == ChunkState.Trailer)
+                {
+                    // Trailer fields are ignored, an empty line ends the body
+                    if (line == _chunkIndex)
+                    {
+                        _chunkIndex = line + 2;
+                        _cache.Remove(_bodyIndex + _bodySize, _chunkIndex - _bodyIndex - _bodySize);
+                        _cacheSize = (int)_cache.Size;
+                        _bodyLength = _bodySize;
+                        return true;
+                    }
+                }
+                else
+                {
+                    // Chunk size in hex, optionally followed by extensions after ';'
+                    int length = 0;
+                    int digits = 0;
+                    for (int j = _chunkIndex; (j < line) && (_cache[j] != ';'); j++, digits++)
+                    {
+                        int c = _cache[j];
+                        int digit = ((c >= '0') && (c <= '9')) ? (c - '0') : ((c >= 'a') && (c <= 'f')) ? (c - 'a' + 10) : ((c >= 'A') && (c <= 'F')) ? (c - 'A' + 10) : -1;
+                        if ((digit < 0) || (digits == 7))
+                        {
+                            IsErrorSet = true;
+                            return false;
+                        }
+                        length = length * 16 + digit;
+                    }
+                    if (digits == 0)
+                    {
+                        IsErrorSet = true;
+                        return false;
+                    }
+                    _chunkRemaining = length;
+                    _chunkState = (length > 0) ? ChunkState.Data : ChunkState.Trailer;
+                }
+                _chunkIndex = line + 2;
+            }
+
+            // Drop the decoded chunk framing, so the cache holds the body and an incomplete line
+            _cache.Remove(_bodyIndex + _bodySize, _chunkIndex - _bodyIndex - _bodySize);
+            _chunkIndex = _bodyIndex + _bodySize;
+            _cacheSize = (int)_cache.Size;
+
             // Body was received partially...
             return false;
         }
@@ -471,7 +471,7 @@ namespace CloudServer
         /// Set the HTTP response body length
         /// </summary>
         /// <param name="length">Body length</param>
-        public Response SetBodyLength(int length)
+        public Response SetBodyLength(long length)
         {
             // Append content length header
             SetHeader("Content-Length", length.ToString());
@@ -650,7 +650,7 @@ namespace CloudServer
         // HTTP response body
         private int _bodyIndex;
         private int _bodySize;
-        private int _bodyLength;
+        private long _bodyLength;
         private bool _bodyLengthProvided;
 
         // HTTP response cache
@@ -857,7 +857,7 @@ namespace CloudServer
                 // Was the body fully received?
                 if (_bodySize >= _bodyLength)
                 {
-                    _bodySize = _bodyLength;
+                    _bodySize = (int)_bodyLength;
                     return true;
                 }
             }
@@ -3,6 +3,7 @@ using System.IO;
 using System.Linq;
 using System.Net;
 using System.Text;
+using System.Security.Cryptography;
 using Newtonsoft.Json;
 using Newtonsoft.Json.Linq;
 using System.Threading.Tasks;
@@ -413,8 +414,119 @@ namespace CloudServer
             SendResponseAsync(session, response.MakeOkResponse($"File ID = {file_id} deleted successfully!"));
             return true;
         }
+        static public async Task<bool> ProcessDownloadFile(Object session, Request request, Response response, string user_name, int file_id)
+        {
+            // A HEAD answer has no body, so its errors only carry the status
+            bool head = request.Method == "HEAD";
+            var authorizationHeader = request.Header("Authorization");
+            if (string.IsNullOrEmpty(authorizationHeader))
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.Unauthorized, head ? "" : "Authorization header is missing."));
+                return false;
+            }
+            var token_id = authorizationHeader.StartsWith("Bearer ")
+                           ? authorizationHeader.Substring("Bearer ".Length)
+                           : authorizationHeader; // Fallback to the full header if it doesn't start with "Bearer "
 
-        static public async Task<bool> ProcessUploadFileMiss(Object session, Request request, Response response, string user_name)
+            var user_id = UserManager.Instance.GetUserID(token_id);
+            if (user_id is null)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.NotFound, head ? "" : $"User {user_name} does not exist."));
+                return false;
+            }
+            var user_status = UserManager.Instance.GetUserStatus((int)user_id);
+            if (user_status == STATES.LOGGED_OUT || user_status == STATES.DISCONNECTED)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.InternalServerError, head ? "" : $"User {user_name} not logged in."));
+                return false;
+            }
+
+            string storage_path = await SqlDatabase.Instance.GetStoragePathAsync((int)user_id, file_id);
+            if (storage_path is null || !File.Exists(storage_path))
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.NotFound, head ? "" : "File not found!"));
+                return false;
+            }
+
+            // The file is sent as stored, a Range header selects one byte range of it
+            using (var fileStream = new FileStream(storage_path, FileMode.Open, FileAccess.Read, FileShare.Read))
+            {
+                long file_size = fileStream.Length;
+                long first = 0, last = file_size - 1;
+                string range = request.Header("Range");
+                bool partial = !string.IsNullOrEmpty(range);
+                if (partial && !ParseRange(range, file_size, out first, out last))
+                {
+                    response.Clear();
+                    response.SetBegin(416);
+                    response.SetHeader("Content-Range", $"bytes */{file_size}");
+                    response.SetBody();
+                    SendResponseAsync(session, response);
+                    return false;
+                }
+                long length = last - first + 1;
+                response.Clear();
+                response.SetBegin(partial ? 206 : 200);
+                response.SetHeader("Content-Type", "application/octet-stream");
+                response.SetHeader("Accept-Ranges", "bytes");
+                if (partial)
+                {
+                    response.SetHeader("Content-Range", $"bytes {first}-{last}/{file_size}");
+                }
+                response.SetBodyLength(length);
+                // Sent synchronously, the body has to follow the header
+                SendResponse(session, response);
+                if (head)
+                {
+                    return true;
+                }
+
+                // Stream the range instead of loading the whole file into memory
+                byte[] buffer = new byte[64 * 1024];
+                fileStream.Seek(first, SeekOrigin.Begin);
+                while (length > 0)
+                {
+                    int read = fileStream.Read(buffer, 0, (int)Math.Min(buffer.Length, length));
+                    if (read <= 0 || SendResponseBody(session, buffer, 0, read) != read)
+                    {
+                        return false;
+                    }
+                    length -= read;
+                }
+            }
+            return true;
+        }
+
+        // One range of a "bytes=first-last", "bytes=first-" or "bytes=-suffix" header, false if it cannot be served
+        static private bool ParseRange(string range, long file_size, out long first, out long last)
+        {
+            first = 0;
+            last = file_size - 1;
+            if (!range.StartsWith("bytes=", StringComparison.OrdinalIgnoreCase))
+                return false;
+            string[] bounds = range.Substring("bytes=".Length).Trim().Split('-');
+            if (bounds.Length != 2)
+                return false;
+            if (bounds[0].Length == 0)
+            {
+                long suffix;
+                if (!long.TryParse(bounds[1], out suffix) || suffix <= 0 || file_size == 0)
+                    return false;
+                first = Math.Max(0, file_size - suffix);
+                return true;
+            }
+            if (!long.TryParse(bounds[0], out first) || first < 0 || first >= file_size)
+                return false;
+            if (bounds[1].Length > 0)
+            {
+                if (!long.TryParse(bounds[1], out last) || last < first)
+                    return false;
+                last = Math.Min(last, file_size - 1);
+            }
+            return true;
+        }
+
+        static public async Task<bool> ProcessBatch(Object session, Request request, Response response, string user_name)
         {
             string requestBody = request.Body;
             var authorizationHeader = request.Header("Authorization");
@@ -439,13 +551,182 @@ namespace CloudServer
                 SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.InternalServerError, $"User {user_name} not logged in."));
                 return false;
             }
-            //Parse json request
-            var files = JsonConvert.DeserializeObject<List<FileInfo>>(requestBody);
+
+            //Parse json request, operations are applied in order and each one gets its own result. The
+            //file is moved or deleted inside the database transaction, so an operation that fails leaves
+            //both as they were and the ones after it still run
+            JArray operations = JArray.Parse(requestBody);
+            JArray results = new JArray();
+            foreach (JToken operation in operations)
+            {
+                int file_id = 0;
+                int status = (int)HttpStatusCode.OK;
+                string message;
+                string error = null;
+                try
+                {
+                    string action = ((string)operation.SelectToken("action"))?.ToLower();
+                    file_id = (int)operation.SelectToken("file_id");
+
+                    if (action == "rename")
+                    {
+                        string new_fileName = (string)operation.SelectToken("new_file_name");
+                        string storage_path = await SqlDatabase.Instance.RenameFileAsync((int)user_id, file_id, new_fileName, path =>
+                        {
+                            try
+                            {
+                                File.Move(path, Path.Combine(Path.GetDirectoryName(path), new_fileName));
+                            }
+                            catch (Exception ex)
+                            {
+                                error = ex.Message;
+                                throw;
+                            }
+                        });
+                        if (error != null)
+                        {
+                            status = (int)HttpStatusCode.InternalServerError;
+                            message = $"Failed to rename file: {error}";
+                        }
+                        else if (storage_path is null)
+                        {
+                            status = (int)HttpStatusCode.NotFound;
+                            message = "File not found!";
+                        }
+                        else
+                        {
+                            message = $"File ID = {file_id} renamed successfully!";
+                        }
+                    }
+                    else if (action == "remove")
+                    {
+                        string storage_path = await SqlDatabase.Instance.RemoveFileAsync((int)user_id, file_id, path =>
+                        {
+                            try
+                            {
+                                File.Delete(path);
+                            }
+                            catch (Exception ex)
+                            {
+                                error = ex.Message;
+                                throw;
+                            }
+                        });
+                        if (error != null)
+                        {
+                            status = (int)HttpStatusCode.InternalServerError;
+                            message = $"Failed to delete file: {error}";
+                        }
+                        else if (storage_path is null)
+                        {
+                            status = (int)HttpStatusCode.NotFound;
+                            message = "File not found!";
+                        }
+                        else
+                        {
+                            message = $"File ID = {file_id} deleted successfully!";
+                        }
+                    }
+                    else
+                    {
+                        status = (int)HttpStatusCode.BadRequest;
+                        message = $"Unknown action: {action}";
+                    }
+                }
+                catch (Exception ex)
+                {
+                    // A malformed operation, nothing was changed for it
+                    status = (int)HttpStatusCode.BadRequest;
+                    message = $"Invalid operation: {ex.Message}";
+                }
+                results.Add(new JObject
+                {
+                    { "file_id", file_id },
+                    { "status", status },
+                    { "message", message }
+                });
+            }
+
+            string jsonResult = JsonConvert.SerializeObject(results, Formatting.Indented);
+            SendResponseAsync(session, response.MakeOkResponse(jsonResult, "application/json"));
+            return true;
+        }
+
+        static public async Task<bool> ProcessUploadFileMiss(Object session, Request request, Response response, string user_name)
+        {
+            var authorizationHeader = request.Header("Authorization");
+            if (string.IsNullOrEmpty(authorizationHeader))
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.Unauthorized, "Authorization header is missing."));
+                return false;
+            }
+            var token_id = authorizationHeader.StartsWith("Bearer ")
+                           ? authorizationHeader.Substring("Bearer ".Length)
+                           : authorizationHeader; // Fallback to the full header if it doesn't start with "Bearer "
+
+            var user_id = UserManager.Instance.GetUserID(token_id);
+            if (user_id is null)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.NotFound, $"User {user_name} does not exist."));
+                return false;
+            }
+            var user_status = UserManager.Instance.GetUserStatus((int)user_id);
+            if (user_status == STATES.LOGGED_OUT || user_status == STATES.DISCONNECTED)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.InternalServerError, $"User {user_name} not logged in."));
+                return false;
+            }
+            //Parse the folder tree, a binary manifest or the JSON array of files
+            List<FileInfo> files;
+            long? manifest_version = null;
+            byte[] manifest_root = null;
+            var contentType = request.Header("Content-Type") ?? "";
+            if (contentType.StartsWith(Manifest.ContentType, StringComparison.OrdinalIgnoreCase))
+            {
+                ManifestDelta delta;
+                try
+                {
+                    files = Manifest.Decode(request.BodyBytes, out delta);
+                }
+                catch (FormatException ex)
+                {
+                    SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.BadRequest, $"Invalid manifest: {ex.Message}"));
+                    return false;
+                }
+                // A delta only holds the files changed since the manifest acknowledged last, it must be made against that one
+                if (delta != null)
+                {
+                    manifest_root = delta.Root;
+                    manifest_version = await SqlDatabase.Instance.AcknowledgeDeltaAsync((int)user_id, delta.BaseVersion, delta.BaseRoot, delta.Root);
+                    if (manifest_version is null)
+                    {
+                        SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.Conflict, "Manifest version diverged, send the whole manifest."));
+                        return false;
+                    }
+                }
+                else
+                {
+                    using (var sha256 = SHA256.Create())
+                    {
+                        manifest_root = sha256.ComputeHash(request.BodyBytes);
+                    }
+                    manifest_version = await SqlDatabase.Instance.AcknowledgeManifestAsync((int)user_id, manifest_root);
+                }
+            }
+            else if ((contentType.Length == 0) || contentType.StartsWith("application/json", StringComparison.OrdinalIgnoreCase))
+            {
+                files = JsonConvert.DeserializeObject<List<FileInfo>>(request.Body);
+            }
+            else
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.UnsupportedMediaType, $"Unsupported content type {contentType}."));
+                return false;
+            }
             var files_miss = await SqlDatabase.Instance.RetrieveUploadAsync((int)user_id, files);
 
             if (files_miss == null || files_miss.Count == 0)
             {
-                SendResponseAsync(session, response.MakeOkResponse("No missing files found."));
+                SendResponseAsync(session, MakeCompareResponse(response, "No missing files found.", "text/plain; charset=UTF-8", manifest_version, manifest_root));
             }
             else
             {
@@ -465,11 +746,36 @@ namespace CloudServer
 
                 // Serialize JArray to JSON
                 string jsonResult = JsonConvert.SerializeObject(array, Formatting.Indented);
-                SendResponseAsync(session, response.MakeOkResponse(jsonResult, "application/json"));
+                SendResponseAsync(session, MakeCompareResponse(response, jsonResult, "application/json", manifest_version, manifest_root));
             }
             return true;
         }
 
+        // The compare answer, telling a manifest sender which version its manifest is now known as
+        static private Response MakeCompareResponse(Response response, string content, string contentType, long? manifest_version, byte[] manifest_root)
+        {
+            if (manifest_version is null)
+                return response.MakeOkResponse(content, contentType);
+            response.Clear();
+            response.SetBegin(200);
+            response.SetHeader("Content-Type", contentType);
+            response.SetHeader("Manifest-Version", manifest_version.Value.ToString());
+            response.SetHeader("Manifest-Digest", BitConverter.ToString(manifest_root).Replace("-", "").ToLowerInvariant());
+            response.SetBody(content);
+            return response;
+        }
+
+        // The last part of a large upload carries the SHA-256 of every part as sent, which is what the file holds now
+        static private bool MatchesStoredDigest(string storage_path, string digest)
+        {
+            using (var sha256 = SHA256.Create())
+            using (var fileStream = new FileStream(storage_path, FileMode.Open, FileAccess.Read))
+            {
+                string stored = BitConverter.ToString(sha256.ComputeHash(fileStream)).Replace("-", "");
+                return string.Equals(stored, digest, StringComparison.OrdinalIgnoreCase);
+            }
+        }
+
         static public async Task<bool> ProcessUploadFile(Object session, Guid session_id, Request request, Response response, string user_name)
         {
             var authorizationHeader = request.Header("Authorization");
@@ -543,6 +849,113 @@ namespace CloudServer
             }
             return true;
         }
+        static public async Task<bool> ProcessUploadBundle(Object session, Request request, Response response, string user_name)
+        {
+            var authorizationHeader = request.Header("Authorization");
+            if (string.IsNullOrEmpty(authorizationHeader))
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.Unauthorized, "Authorization header is missing."));
+                return false;
+            }
+            var token_id = authorizationHeader.StartsWith("Bearer ")
+                           ? authorizationHeader.Substring("Bearer ".Length)
+                           : authorizationHeader; // Fallback to the full header if it doesn't start with "Bearer "
+
+            var user_id = UserManager.Instance.GetUserID(token_id);
+            if (user_id is null)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.NotFound, $"User {user_name} does not exist."));
+                return false;
+            }
+            var user_status = UserManager.Instance.GetUserStatus((int)user_id);
+            if (user_status == STATES.LOGGED_OUT || user_status == STATES.DISCONNECTED)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.InternalServerError, $"User {user_name} not logged in."));
+                return false;
+            }
+
+            //Small files are sent together, the n-th "fileinfo" and "sha256" fields belong to the n-th file.
+            //They are stored one after another and each one gets its own result, a file that fails does not
+            //stop the ones after it
+            MultipartFormDataParser parser = MultipartFormDataParser.Parse(new MemoryStream(request.BodyBytes));
+            List<string> file_infos = parser.GetParameterValues("fileinfo").ToList();
+            List<string> digests = parser.GetParameterValues("sha256").ToList();
+            if (file_infos.Count != parser.Files.Count || digests.Count != parser.Files.Count)
+            {
+                SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.BadRequest, "Every file of a bundle needs its fileinfo and sha256."));
+                return false;
+            }
+            JArray results = new JArray();
+            for (int i = 0; i < parser.Files.Count; i++)
+            {
+                int file_id = 0;
+                int status = (int)HttpStatusCode.Created;
+                string message;
+                try
+                {
+                    JObject obj = JObject.Parse(file_infos[i]);
+                    string folder = (string)obj.SelectToken("folder");
+                    string file_name = (string)obj.SelectToken("file_name");
+                    string storage_dir = Path.Combine(LocalDatabase.Instance.GetStorageDirectory(), user_name, folder);
+                    string storage_path = Path.Combine(storage_dir, file_name);
+                    byte[] file_data;
+                    using (var memory = new MemoryStream())
+                    {
+                        parser.Files[i].Data.CopyTo(memory);
+                        file_data = memory.ToArray();
+                    }
+                    string stored;
+                    using (var sha256 = SHA256.Create())
+                    {
+                        stored = BitConverter.ToString(sha256.ComputeHash(file_data)).Replace("-", "");
+                    }
+                    if (!string.Equals(stored, digests[i], StringComparison.OrdinalIgnoreCase))
+                    {
+                        status = (int)HttpStatusCode.BadRequest;
+                        message = $"File {file_name} does not match its SHA-256, upload it again.";
+                    }
+                    else
+                    {
+                        // Add column SqlDatabase.StoragePath
+                        if (!obj.ContainsKey("storage_on"))
+                        {
+                            obj.Add("storage_on", storage_path);
+                        }
+                        FileInfo info = await SqlDatabase.Instance.UploadFileInfoAsync((int)user_id, obj.ToObject<FileInfo>());
+                        if (info is null)
+                        {
+                            status = (int)HttpStatusCode.InternalServerError;
+                            message = "Unable to INSERT file information into the database.";
+                        }
+                        else
+                        {
+                            file_id = (int)info.file_id;
+                            Directory.CreateDirectory(storage_dir);
+                            File.WriteAllBytes(storage_path, file_data);
+                            message = $"File {file_name} uploaded successfully.";
+                        }
+                    }
+                }
+                catch (Exception ex)
+                {
+                    // Malformed file information, or the file could not be written after it was inserted
+                    status = file_id == 0 ? (int)HttpStatusCode.BadRequest : (int)HttpStatusCode.InternalServerError;
+                    message = file_id == 0 ? $"Invalid file: {ex.Message}" : $"Failed to store file: {ex.Message}";
+                }
+                results.Add(new JObject
+                {
+                    { "file_id", file_id },
+                    { "status", status },
+                    { "message", message }
+                });
+            }
+            Console.WriteLine($"[{user_name}]: {parser.Files.Count} files of a bundle have been processed.");
+
+            string jsonResult = JsonConvert.SerializeObject(results, Formatting.Indented);
+            SendResponseAsync(session, response.MakeOkResponse(jsonResult, "application/json"));
+            return true;
+        }
+
         static public async Task<bool> ProcessUploadFileLarge(Object session, Guid session_id, Request request, Response response, string user_name, string endpoint)
         {
             var authorizationHeader = request.Header("Authorization");
@@ -620,6 +1033,12 @@ namespace CloudServer
                 {
                     file_data.CopyTo(fileStream);
                 }
+                string digest = parser.GetParameterValue("sha256");
+                if (digest != null && !MatchesStoredDigest(storage_path, digest))
+                {
+                    SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.BadRequest, $"File {file_name} does not match its SHA-256, upload it again."));
+                    return false;
+                }
                 SendResponseAsync(session, response.MakeOkResponse($"File part has been uploaded {file_data.Length} bytes."));
 
                 // Move the cursor to the beginning of the line
@@ -770,6 +1189,12 @@ namespace CloudServer
                 {
                     file_data.CopyTo(fileStream);
                 }
+                string digest = parser.GetParameterValue("sha256");
+                if (digest != null && !MatchesStoredDigest(storage_path, digest))
+                {
+                    SendResponseAsync(session, response.MakeErrorResponse((int)HttpStatusCode.BadRequest, $"File {file_name} does not match its SHA-256, update it again."));
+                    return false;
+                }
                 SendResponseAsync(session, response.MakeOkResponse($"File part has been updated {file_data.Length} bytes."));
 
                 // Move the cursor to the beginning of the line